@@ -22,6 +22,7 @@ public:
 
 	// model specific
 	virtual bool	Interpolate( float currentTime );
+	virtual bool	PrepareThreadedInterpolation() { return false; }
 	virtual	void	StandardBlendingRules( CStudioHdr *pStudioHdr, Vector pos[], Quaternion q[], float currentTime, int boneMask );
 
 	float				m_recanimtime[3];
@@ -814,6 +814,7 @@ C_BaseAnimating::C_BaseAnimating() :
 
 	m_iMostRecentModelBoneCounter = 0xFFFFFFFF;
 	m_iMostRecentBoneSetupRequest = g_iPreviousBoneCounter - 1;
+	m_iMostRecentThreadedBoneSetup = g_iPreviousBoneCounter - 1;
 	m_flLastBoneSetupTime = -FLT_MAX;
 
 	m_vecPreRagdollMins = vec3_origin;
@@ -827,6 +828,7 @@ C_BaseAnimating::C_BaseAnimating() :
 	m_nEventSequence = -1;
 
 	m_pIk = NULL;
+	m_pDeferredIKPose = NULL;
 
 	// Assume false.  Derived classes might fill in a receive table entry
 	// and in that case this would show up as true
@@ -1653,7 +1655,6 @@ void C_BaseAnimating::BuildTransformations( CStudioHdr *hdr, Vector *pos, Quater
 	if ( !hdr )
 		return;
 
-	matrix3x4_t bonematrix;
 	bool boneSimulated[MAXSTUDIOBONES];
 
 	// no bones have been simulated
@@ -1702,6 +1703,20 @@ void C_BaseAnimating::BuildTransformations( CStudioHdr *hdr, Vector *pos, Quater
 		}
 	}
 
+	// Build the local matrices in one batch; the hierarchy walk below only concatenates.
+	// Simulated, merged and IK computed bones never read theirs.
+	CBoneBitList skipBones;
+	for ( int i = 0; i < hdr->numbones(); i++ )
+	{
+		if ( boneSimulated[i] || boneComputed.IsBoneMarked( i ) || ( m_pBoneMergeCache && m_pBoneMergeCache->IsBoneMerged( i ) ) )
+		{
+			skipBones.MarkBone( i );
+		}
+	}
+
+	matrix3x4_t *pLocalMatrices = (matrix3x4_t *)stackalloc( hdr->numbones() * sizeof(matrix3x4_t) );
+	Studio_CalcLocalMatrices( hdr, pos, q, boneMask, pLocalMatrices, &skipBones );
+
 	for (int i = 0; i < hdr->numbones(); i++) 
 	{
 		// Only update bones reference by the bone mask.
@@ -1726,7 +1741,7 @@ void C_BaseAnimating::BuildTransformations( CStudioHdr *hdr, Vector *pos, Quater
 		}
 		else
 		{
-			QuaternionMatrix( q[i], pos[i], bonematrix );
+			const matrix3x4_t &bonematrix = pLocalMatrices[i];
 
 			Assert( fabs( pos[i].x ) < 100000 );
 			Assert( fabs( pos[i].y ) < 100000 );
@@ -2922,7 +2937,11 @@ CMouthInfo *C_BaseAnimating::GetMouth( void )
 #ifdef DEBUG_BONE_SETUP_THREADING
 ConVar cl_warn_thread_contested_bone_setup("cl_warn_thread_contested_bone_setup", "0" );
 #endif
-ConVar cl_threaded_bone_setup("cl_threaded_bone_setup", "0", 0, "Enable parallel processing of C_BaseAnimating::SetupBones()" );
+ConVar cl_threaded_bone_setup("cl_threaded_bone_setup", "0", 0, "Set up the bones of everything that was drawn last frame in parallel, before rendering" );
+ConVar cl_threaded_bone_setup_debug("cl_threaded_bone_setup_debug", "0", 0, "Show how many entities each level of the threaded bone setup handled" );
+
+// Move parent chains deeper than this are left to set themselves up on demand
+#define MAX_BONE_SETUP_LEVELS	8
 
 //-----------------------------------------------------------------------------
 // Purpose: Do the default sequence blending rules as done in HL1
@@ -2930,8 +2949,7 @@ ConVar cl_threaded_bone_setup("cl_threaded_bone_setup", "0", 0, "Enable parallel
 
 static void SetupBonesOnBaseAnimating( C_BaseAnimating *&pBaseAnimating )
 {
-	if ( !pBaseAnimating->GetMoveParent() )
-		pBaseAnimating->SetupBones( NULL, -1, -1, gpGlobals->curtime );
+	pBaseAnimating->SetupBones( NULL, -1, -1, gpGlobals->curtime );
 }
 
 static void PreThreadedBoneSetup()
@@ -2947,6 +2965,62 @@ static void PostThreadedBoneSetup()
 static bool g_bInThreadedBoneSetup;
 static bool g_bDoThreadedBoneSetup;
 
+//-----------------------------------------------------------------------------
+// A pose blended on a worker thread, waiting for its IK pass
+//-----------------------------------------------------------------------------
+struct C_BaseAnimating::DeferredIKPose_t
+{
+	Vector		pos[MAXSTUDIOBONES];
+	Quaternion	q[MAXSTUDIOBONES];
+	matrix3x4_t	parentTransform;
+	int			boneMask;
+	int			oldReadableBones;
+	float		currentTime;
+	bool		bPending;
+};
+
+//-----------------------------------------------------------------------------
+// Ragdolls read their physics objects, so they and anything parented to them
+// are left to set up on demand. IK traces the world and touches other
+// entities, so it is deferred to the main thread rather than excluded.
+//-----------------------------------------------------------------------------
+bool C_BaseAnimating::CanSetupBonesThreaded()
+{
+	return !IsRagdoll();
+}
+
+//-----------------------------------------------------------------------------
+// Runs the IK pass and builds the transforms of a pose blended on a worker
+// thread. Main thread only.
+//-----------------------------------------------------------------------------
+void C_BaseAnimating::FinishDeferredIKPose()
+{
+	DeferredIKPose_t *pDeferred = m_pDeferredIKPose;
+	m_pDeferredIKPose = NULL;
+	if ( !pDeferred || !pDeferred->bPending )
+		return;
+
+	AUTO_LOCK( m_BoneSetupLock );
+	MDLCACHE_CRITICAL_SECTION();
+
+	CStudioHdr *hdr = GetModelPtr();
+	if ( !hdr || !hdr->SequencesAvailable() )
+	{
+		RemoveFlag( EFL_SETTING_UP_BONES );
+		return;
+	}
+
+	m_BoneAccessor.SetWritableBones( pDeferred->boneMask );
+	m_BoneAccessor.SetReadableBones( pDeferred->boneMask );
+
+	SetupBones_FinishPose( hdr, pDeferred->pos, pDeferred->q, pDeferred->parentTransform, pDeferred->boneMask, pDeferred->currentTime );
+
+	if ( !( pDeferred->oldReadableBones & BONE_USED_BY_ATTACHMENT ) && ( pDeferred->boneMask & BONE_USED_BY_ATTACHMENT ) )
+	{
+		SetupBones_AttachmentHelper( hdr );
+	}
+}
+
 void C_BaseAnimating::InitBoneSetupThreadPool()
 {
 }				 
@@ -2955,20 +3029,130 @@ void C_BaseAnimating::ShutdownBoneSetupThreadPool()
 {
 }
 
+//-----------------------------------------------------------------------------
+// Sets up everything that asked for bones last frame, so the SetupBones calls
+// made while rendering are cache hits. Children read their move parent's
+// bones through attachments and bone merging (weapons, viewmodel hands, hats),
+// so entities are bucketed by the depth of their move parent chain and each
+// level runs in parallel only once the one above it is done. Entities with
+// IK blend in parallel too, then get their IK pass serially before the next
+// level starts.
+//-----------------------------------------------------------------------------
 void C_BaseAnimating::ThreadedBoneSetup()
 {
 	g_bDoThreadedBoneSetup = cl_threaded_bone_setup.GetBool();
-	if ( g_bDoThreadedBoneSetup )
+	if ( g_bDoThreadedBoneSetup && g_PreviousBoneSetups.Count() > 1 )
 	{
-		int nCount = g_PreviousBoneSetups.Count();
-		if ( nCount > 1 )
+		VPROF_BUDGET( "C_BaseAnimating::ThreadedBoneSetup", VPROF_BUDGETGROUP_CLIENT_ANIMATION );
+
+		CUtlVector< C_BaseAnimating * > levels[MAX_BONE_SETUP_LEVELS];
+		static CUtlVector< DeferredIKPose_t > s_DeferredIKPoses;
+
+		// Animating parents that weren't drawn themselves are added as they're
+		// found, so the list can grow while it's walked
+		for ( int i = 0; i < g_PreviousBoneSetups.Count(); i++ )
 		{
-			g_bInThreadedBoneSetup = true;
+			C_BaseAnimating *pAnimating = g_PreviousBoneSetups[i];
+			if ( pAnimating->IsDormant() )
+				continue;
 
-			ParallelProcess( "C_BaseAnimating::ThreadedBoneSetup", g_PreviousBoneSetups.Base(), nCount, &SetupBonesOnBaseAnimating, &PreThreadedBoneSetup, &PostThreadedBoneSetup );
+			bool bThreaded = pAnimating->CanSetupBonesThreaded();
+
+			int nLevel = 0;
+			for ( C_BaseEntity *pParent = pAnimating->GetMoveParent(); pParent; pParent = pParent->GetMoveParent() )
+			{
+				nLevel++;
+
+				C_BaseAnimating *pParentAnimating = pParent->GetBaseAnimating();
+				if ( !pParentAnimating )
+					continue;
+
+				if ( !pParentAnimating->CanSetupBonesThreaded() )
+				{
+					bThreaded = false;
+				}
+				else if ( pParentAnimating->m_iMostRecentBoneSetupRequest != g_iPreviousBoneCounter )
+				{
+					pParentAnimating->m_iMostRecentBoneSetupRequest = g_iPreviousBoneCounter;
+					g_PreviousBoneSetups.AddToTail( pParentAnimating );
+				}
+			}
 
-			g_bInThreadedBoneSetup = false;
+			if ( bThreaded && nLevel < MAX_BONE_SETUP_LEVELS )
+			{
+				levels[nLevel].AddToTail( pAnimating );
+			}
 		}
+
+		g_bInThreadedBoneSetup = true;
+
+		for ( int nLevel = 0; nLevel < MAX_BONE_SETUP_LEVELS; nLevel++ )
+		{
+			CUtlVector< C_BaseAnimating * > &level = levels[nLevel];
+			if ( level.Count() == 0 )
+				continue;
+
+			if ( nLevel > 0 )
+			{
+				// The parents' bones are done, so work out the children's abs
+				// transforms here; siblings would otherwise race to recompute
+				// a shared parent's
+				for ( int i = 0; i < level.Count(); i++ )
+				{
+					level[i]->GetAbsOrigin();
+					level[i]->GetAbsAngles();
+				}
+			}
+
+			// Entities that can use IK get somewhere to leave their blended pose
+			int nIK = 0;
+			for ( int i = 0; i < level.Count(); i++ )
+			{
+				CStudioHdr *pStudioHdr = level[i]->GetModelPtr();
+				if ( pStudioHdr && pStudioHdr->numikchains() > 0 )
+				{
+					nIK++;
+				}
+			}
+
+			s_DeferredIKPoses.EnsureCount( nIK );
+			for ( int i = 0, iPose = 0; i < level.Count(); i++ )
+			{
+				CStudioHdr *pStudioHdr = level[i]->GetModelPtr();
+				if ( pStudioHdr && pStudioHdr->numikchains() > 0 )
+				{
+					s_DeferredIKPoses[iPose].bPending = false;
+					level[i]->m_pDeferredIKPose = &s_DeferredIKPoses[iPose++];
+				}
+			}
+
+			if ( level.Count() > 1 )
+			{
+				ParallelProcess( "C_BaseAnimating::ThreadedBoneSetup", level.Base(), level.Count(), &SetupBonesOnBaseAnimating, &PreThreadedBoneSetup, &PostThreadedBoneSetup );
+			}
+			else
+			{
+				SetupBonesOnBaseAnimating( level[0] );
+			}
+
+			// The IK pass, in the same order the entities asked for bones
+			for ( int i = 0; i < level.Count() && nIK; i++ )
+			{
+				level[i]->FinishDeferredIKPose();
+			}
+
+			for ( int i = 0; i < level.Count(); i++ )
+			{
+				level[i]->m_iMostRecentThreadedBoneSetup = g_iPreviousBoneCounter;
+			}
+
+			if ( cl_threaded_bone_setup_debug.GetBool() )
+			{
+				engine->Con_NPrintf( nLevel, "Bone setup level %d: %d entities, %d with IK", nLevel, level.Count(), nIK );
+			}
+		}
+
+		g_bInThreadedBoneSetup = false;
 	}
 	g_iPreviousBoneCounter++;
 	g_PreviousBoneSetups.RemoveAll();
@@ -3023,7 +3207,10 @@ bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, i
 		boneMask |= BONE_USED_BY_ANYTHING;
 	}
 
-	if ( g_bInThreadedBoneSetup )
+	// Entities from a finished level are only being read by their children, so
+	// those wait for the lock; anything else that's contended gives up as before
+	bool bTryLock = g_bInThreadedBoneSetup && m_iMostRecentThreadedBoneSetup != g_iPreviousBoneCounter;
+	if ( bTryLock )
 	{
 		if ( !m_BoneSetupLock.TryLock() )
 		{
@@ -3047,7 +3234,7 @@ bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, i
 
 	AUTO_LOCK( m_BoneSetupLock );
 
-	if ( g_bInThreadedBoneSetup )
+	if ( bTryLock )
 	{
 		m_BoneSetupLock.Unlock();
 	}
@@ -3075,7 +3262,7 @@ bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, i
 	}
 
 	int nBoneCount = m_CachedBoneData.Count();
-	if ( g_bDoThreadedBoneSetup && !g_bInThreadedBoneSetup && ( nBoneCount >= 16 ) && !GetMoveParent() && m_iMostRecentBoneSetupRequest != g_iPreviousBoneCounter )
+	if ( g_bDoThreadedBoneSetup && !g_bInThreadedBoneSetup && ( nBoneCount >= 16 ) && m_iMostRecentBoneSetupRequest != g_iPreviousBoneCounter )
 	{
 		m_iMostRecentBoneSetupRequest = g_iPreviousBoneCounter;
 		Assert( g_PreviousBoneSetups.Find( this ) == -1 );
@@ -3167,22 +3354,25 @@ bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, i
 
 			StandardBlendingRules( hdr, pos, q, currentTime, bonesMaskNeedRecalc );
 
-			CBoneBitList boneComputed;
-			// don't calculate IK on ragdolls
-			if ( m_pIk && !IsRagdoll() )
+			// The threaded bone setup leaves IK to the main thread. Until it's
+			// done nothing may read the bones, and EFL_SETTING_UP_BONES stays on.
+			if ( m_pDeferredIKPose && m_pIk && !IsRagdoll() )
 			{
-				UpdateIKLocks( currentTime );
-
-				m_pIk->UpdateTargets( pos, q, m_BoneAccessor.GetBoneArrayForWrite(), boneComputed );
-
-				CalculateIKLocks( currentTime );
-				m_pIk->SolveDependencies( pos, q, m_BoneAccessor.GetBoneArrayForWrite(), boneComputed );
+				DeferredIKPose_t &deferred = *m_pDeferredIKPose;
+				memcpy( deferred.pos, pos, hdr->numbones() * sizeof( Vector ) );
+				memcpy( deferred.q, q, hdr->numbones() * sizeof( Quaternion ) );
+				MatrixCopy( parentTransform, deferred.parentTransform );
+				deferred.boneMask = bonesMaskNeedRecalc;
+				deferred.oldReadableBones = oldReadableBones;
+				deferred.currentTime = currentTime;
+				deferred.bPending = true;
+
+				m_BoneAccessor.SetReadableBones( oldReadableBones );
+				m_BoneAccessor.SetWritableBones( oldReadableBones );
+				return ( pBoneToWorldOut == NULL );
 			}
 
-			BuildTransformations( hdr, pos, q, parentTransform, bonesMaskNeedRecalc, boneComputed );
-			
-			RemoveFlag( EFL_SETTING_UP_BONES );
-			ControlMouth( hdr );
+			SetupBones_FinishPose( hdr, pos, q, parentTransform, bonesMaskNeedRecalc, currentTime );
 		}
 		
 		if( !( oldReadableBones & BONE_USED_BY_ATTACHMENT ) && ( boneMask & BONE_USED_BY_ATTACHMENT ) )
@@ -3210,6 +3400,29 @@ bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, i
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: IK, then the bone transforms, from a blended pose
+//-----------------------------------------------------------------------------
+void C_BaseAnimating::SetupBones_FinishPose( CStudioHdr *hdr, Vector pos[], Quaternion q[], const matrix3x4_t &parentTransform, int boneMask, float currentTime )
+{
+	CBoneBitList boneComputed;
+	// don't calculate IK on ragdolls
+	if ( m_pIk && !IsRagdoll() )
+	{
+		UpdateIKLocks( currentTime );
+
+		m_pIk->UpdateTargets( pos, q, m_BoneAccessor.GetBoneArrayForWrite(), boneComputed );
+
+		CalculateIKLocks( currentTime );
+		m_pIk->SolveDependencies( pos, q, m_BoneAccessor.GetBoneArrayForWrite(), boneComputed );
+	}
+
+	BuildTransformations( hdr, pos, q, parentTransform, boneMask, boneComputed );
+
+	RemoveFlag( EFL_SETTING_UP_BONES );
+	ControlMouth( hdr );
+}
+
 C_BaseAnimating* C_BaseAnimating::FindFollowedEntity()
 {
 	C_BaseEntity *follow = GetFollowedEntity();
@@ -4745,6 +4958,34 @@ bool C_BaseAnimating::Interpolate( float flCurrentTime )
 	return true;
 }
 
+//-----------------------------------------------------------------------------
+// Opts in to threaded interpolation: InterpolateVars() below does what
+// Interpolate() does to this entity's own vars, and FinishInterpolateVars() the rest
+//-----------------------------------------------------------------------------
+bool C_BaseAnimating::PrepareThreadedInterpolation()
+{
+	// ragdolls don't need interpolation
+	if ( m_pRagdoll || !CanInterpolateThreaded() )
+		return false;
+
+	// Sequence lookups can page in model data, so they stay on the main thread
+	if ( !m_bClientSideAnimation )
+		m_iv_flCycle.SetLooping( IsSequenceLooping( GetSequence() ) );
+
+	return true;
+}
+
+void C_BaseAnimating::InterpolateVars( ThreadedInterpolation_t &interp )
+{
+	float flOldCycle = GetCycle();
+
+	BaseClass::InterpolateVars( interp );
+
+	// Did cycle change?
+	if ( GetCycle() != flOldCycle )
+		interp.m_nChangeFlags |= ANIMATION_CHANGED;
+}
+
 
 //-----------------------------------------------------------------------------
 // returns true if we're currently being ragdolled
@@ -112,6 +112,8 @@ public:
 	bool UsesPowerOfTwoFrameBufferTexture( void );
 
 	virtual bool	Interpolate( float currentTime );
+	virtual bool	PrepareThreadedInterpolation();
+	virtual void	InterpolateVars( ThreadedInterpolation_t &interp );
 	virtual void	Simulate();	
 	virtual void	Release();	
 
@@ -418,6 +420,7 @@ public:
 	static void						ThreadedBoneSetup();
 	static void						InitBoneSetupThreadPool();
 	static void						ShutdownBoneSetupThreadPool();
+	bool							CanSetupBonesThreaded();
 
 	// Invalidate bone caches so all SetupBones() calls force bone transforms to be regenerated.
 	static void						InvalidateBoneCaches();
@@ -565,6 +568,7 @@ protected:
 	// bone transformation matrix
 	unsigned long					m_iMostRecentModelBoneCounter;
 	unsigned long					m_iMostRecentBoneSetupRequest;
+	unsigned long					m_iMostRecentThreadedBoneSetup;
 	int								m_iPrevBoneMask;
 	int								m_iAccumulatedBoneMask;
 
@@ -662,6 +666,13 @@ private:
 
 	void							SetupBones_AttachmentHelper( CStudioHdr *pStudioHdr );
 
+	// IK and the transforms that follow blending. The threaded bone setup
+	// blends IK entities on the worker threads and finishes them serially.
+	struct DeferredIKPose_t;
+	void							SetupBones_FinishPose( CStudioHdr *pStudioHdr, Vector pos[], Quaternion q[], const matrix3x4_t &parentTransform, int boneMask, float currentTime );
+	void							FinishDeferredIKPose();
+	DeferredIKPose_t				*m_pDeferredIKPose;
+
 	EHANDLE							m_hLightingOrigin;
 	EHANDLE							m_hLightingOriginRelative;
 
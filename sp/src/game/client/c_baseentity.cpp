@@ -40,6 +40,7 @@
 #include "cdll_bounded_cvars.h"
 #include "inetchannelinfo.h"
 #include "proto_version.h"
+#include "vstdlib/jobthread.h"
 #ifdef MAPBASE
 #include "viewrender.h"
 #endif
@@ -84,6 +85,7 @@ void cc_cl_interp_all_changed( IConVar *pConVar, const char *pOldString, float f
 static ConVar  cl_extrapolate( "cl_extrapolate", "1", FCVAR_CHEAT, "Enable/disable extrapolation if interpolation history runs out." );
 static ConVar  cl_interp_npcs( "cl_interp_npcs", "0.0", FCVAR_USERINFO, "Interpolate NPC positions starting this many seconds in past (or cl_interp, if greater)" );  
 static ConVar  cl_interp_all( "cl_interp_all", "0", 0, "Disable interpolation list optimizations.", 0, 0, 0, 0, cc_cl_interp_all_changed );
+static ConVar  cl_threaded_interpolation( "cl_threaded_interpolation", "0", 0, "Blend the interpolated vars of entities that opt in on the job threads" );
 ConVar  r_drawmodeldecals( "r_drawmodeldecals", "1" );
 extern ConVar	cl_showerror;
 int C_BaseEntity::m_nPredictionRandomSeed = -1;
@@ -101,6 +103,7 @@ static unsigned short g_iAbsRecomputationStackPos = 0;
 
 // All the entities that want Interpolate() called on them.
 static CUtlLinkedList<C_BaseEntity*, unsigned short> g_InterpolationList;
+static CUtlVector<ThreadedInterpolation_t> g_ThreadedInterpolation;
 static CUtlLinkedList<C_BaseEntity*, unsigned short> g_TeleportList;
 
 #if !defined( NO_ENTITY_PREDICTION )
@@ -3089,6 +3092,32 @@ bool C_BaseEntity::Interpolate( float currentTime )
 	return true;
 }
 
+//-----------------------------------------------------------------------------
+// Threaded Interpolate(), see ProcessInterpolatedListThreaded
+//-----------------------------------------------------------------------------
+bool C_BaseEntity::CanInterpolateThreaded()
+{
+	// These snap to their last received position through SetLocalOrigin, which walks the hierarchy
+	return !IsFollowingEntity() && IsInterpolationEnabled();
+}
+
+void C_BaseEntity::InterpolateVars( ThreadedInterpolation_t &interp )
+{
+	interp.m_nChangeFlags = 0;
+	int retVal = BaseInterpolatePart1( interp.m_flCurrentTime, interp.m_vecOldOrigin, interp.m_angOldAngles, interp.m_vecOldVelocity, interp.m_bNoMoreChanges );
+	Assert( retVal == INTERPOLATE_CONTINUE );
+	NOTE_UNUSED( retVal );
+}
+
+void C_BaseEntity::FinishInterpolateVars( ThreadedInterpolation_t &interp )
+{
+	if ( interp.m_bNoMoreChanges )
+		RemoveFromInterpolationList();
+
+	BaseInterpolatePart2( interp.m_vecOldOrigin, interp.m_angOldAngles, interp.m_vecOldVelocity, interp.m_nChangeFlags );
+	m_bReadyToDraw = true;
+}
+
 CStudioHdr *C_BaseEntity::OnNewModel()
 {
 #ifdef TF_CLIENT_DLL
@@ -3277,6 +3306,12 @@ void C_BaseEntity::ProcessInterpolatedList()
 {
 	CheckInterpolatedVarParanoidMeasurement();
 
+	if ( cl_threaded_interpolation.GetBool() && g_InterpolationList.Count() > 1 )
+	{
+		ProcessInterpolatedListThreaded();
+		return;
+	}
+
 	// Interpolate the minimal set of entities that need it.
 	int iNext;
 	for ( int iCur=g_InterpolationList.Head(); iCur != g_InterpolationList.InvalidIndex(); iCur=iNext )
@@ -3289,6 +3324,50 @@ void C_BaseEntity::ProcessInterpolatedList()
 }
 
 
+static void InterpolateVarsJob( ThreadedInterpolation_t &interp )
+{
+	if ( interp.m_bThreaded )
+	{
+		interp.m_pEntity->InterpolateVars( interp );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Blends every entity's interpolated vars on the job threads, then does the
+// hierarchy / leaf system side of Interpolate() on the main thread in list order.
+//-----------------------------------------------------------------------------
+void C_BaseEntity::ProcessInterpolatedListThreaded()
+{
+	g_ThreadedInterpolation.RemoveAll();
+	g_ThreadedInterpolation.EnsureCapacity( g_InterpolationList.Count() );
+
+	for ( int iCur=g_InterpolationList.Head(); iCur != g_InterpolationList.InvalidIndex(); iCur=g_InterpolationList.Next( iCur ) )
+	{
+		ThreadedInterpolation_t &interp = g_ThreadedInterpolation[ g_ThreadedInterpolation.AddToTail() ];
+		interp.m_pEntity = g_InterpolationList[iCur];
+		interp.m_bThreaded = interp.m_pEntity->PrepareThreadedInterpolation();
+		interp.m_flCurrentTime = gpGlobals->curtime;
+	}
+
+	ParallelProcess( "C_BaseEntity::InterpolateVars", g_ThreadedInterpolation.Base(), g_ThreadedInterpolation.Count(), &InterpolateVarsJob );
+
+	// Entities may leave the interpolation list from here on
+	int nCount = g_ThreadedInterpolation.Count();
+	for ( int i = 0; i < nCount; ++i )
+	{
+		ThreadedInterpolation_t &interp = g_ThreadedInterpolation[i];
+		if ( interp.m_bThreaded )
+		{
+			interp.m_pEntity->FinishInterpolateVars( interp );
+		}
+		else
+		{
+			interp.m_pEntity->m_bReadyToDraw = interp.m_pEntity->Interpolate( gpGlobals->curtime );
+		}
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Add entity to visibile entities list
 //-----------------------------------------------------------------------------
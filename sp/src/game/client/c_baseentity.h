@@ -102,6 +102,21 @@ struct VarMapping_t
 	float						m_lastInterpolationTime;
 };
 
+//-----------------------------------------------------------------------------
+// State carried between the two halves of a threaded Interpolate()
+//-----------------------------------------------------------------------------
+struct ThreadedInterpolation_t
+{
+	C_BaseEntity	*m_pEntity;
+	bool			m_bThreaded;		// false: interpolated serially with Interpolate()
+	float			m_flCurrentTime;
+	Vector			m_vecOldOrigin;
+	QAngle			m_angOldAngles;
+	Vector			m_vecOldVelocity;
+	int				m_nChangeFlags;
+	int				m_bNoMoreChanges;
+};
+
 																	
 
 #define DECLARE_INTERPOLATION()
@@ -424,6 +439,14 @@ public:
 	// Called whenever you registered for a think message (with SetNextClientThink).
 	virtual void					ClientThink();
 
+	// Entities returning true here run ClientThink() on the job threads, alongside the other
+	// entities that opted in. ClientThinkPrepare() and ClientThinkFinish() bracket it on the
+	// main thread. Anything that reaches the leaf system, other entities or the hierarchy
+	// belongs in those two.
+	virtual bool					IsClientThinkThreadSafe() const { return false; }
+	virtual void					ClientThinkPrepare() {}
+	virtual void					ClientThinkFinish() {}
+
 	virtual ClientThinkHandle_t		GetThinkHandle();
 	virtual void					SetThinkHandle( ClientThinkHandle_t hThink );
 
@@ -769,6 +792,19 @@ public:
 	// Interpolate the position for rendering
 	virtual bool					Interpolate( float currentTime );
 
+	// Threaded interpolation splits Interpolate() in two. InterpolateVars() runs on the job
+	// threads and may only touch this entity's own interpolated vars; FinishInterpolateVars()
+	// runs on the main thread afterwards. PrepareThreadedInterpolation() is called on the main
+	// thread first and returns false, which uses Interpolate(), unless a class has been checked
+	// and opts in. Opting in is inherited, so classes below that override Interpolate() must
+	// opt out again.
+	virtual bool					PrepareThreadedInterpolation() { return false; }
+	virtual void					InterpolateVars( ThreadedInterpolation_t &interp );
+	void							FinishInterpolateVars( ThreadedInterpolation_t &interp );
+
+	// What every class that opts in to threaded interpolation needs on top of its own checks
+	bool							CanInterpolateThreaded();
+
 	// Did the object move so far that it shouldn't interpolate?
 	bool							Teleported( void );
 	// Is this a submodel of the world ( *1 etc. in name ) ( brush models only )
@@ -1569,6 +1605,7 @@ private:
 	// Figure out the smoothly interpolated origin for all server entities. Happens right before
 	// letting all entities simulate.
 	static void InterpolateServerEntities();
+	static void ProcessInterpolatedListThreaded();
 	
 	// Check which entities want to be drawn and add them to the leaf system.
 	static void	AddVisibleEntities();
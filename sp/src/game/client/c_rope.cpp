@@ -1367,7 +1367,7 @@ void C_RopeKeyframe::CPhysicsDelegate::ApplyConstraints( CSimplePhysics::CNode *
 #ifdef MAPBASE
 		CTraceFilterWorldOnly traceFilter;
 #else
-		CTimeAdder adder( &g_RopeCollideTicks );
+		CTimeAdder adder( m_pKeyframe->m_bThinkingThreaded ? NULL : &g_RopeCollideTicks );
 #endif
 
 		for( int i=0; i < nNodes; i++ )
@@ -1458,6 +1458,8 @@ C_RopeKeyframe::C_RopeKeyframe()
 	m_PhysicsDelegate.m_pKeyframe = this;
 	m_pMaterial = NULL;
 	m_bPhysicsInitted = false;
+	m_bThinkingThreaded = false;
+	m_bBBoxDirty = false;
 	m_RopeFlags = 0;
 	m_TextureHeight = 1;
 	m_hStartPoint = m_hEndPoint = NULL;
@@ -1860,8 +1862,12 @@ void C_RopeKeyframe::ConstrainNodesBetweenEndpoints( void )
 void C_RopeKeyframe::ClientThink()
 {
 	// Only recalculate the endpoint attachments once per frame.
-	m_bEndPointAttachmentPositionsDirty = true;
-	m_bEndPointAttachmentAnglesDirty = true;
+	// Threaded thinks had that done in ClientThinkPrepare.
+	if ( !m_bThinkingThreaded )
+	{
+		m_bEndPointAttachmentPositionsDirty = true;
+		m_bEndPointAttachmentAnglesDirty = true;
+	}
 	
 	if( !r_drawropes.GetBool() )
 		return;
@@ -1885,12 +1891,12 @@ void C_RopeKeyframe::ClientThink()
 #endif
 		// Update the simulation.
 #ifndef MAPBASE
-		CTimeAdder adder( &g_RopeSimulateTicks );
+		CTimeAdder adder( m_bThinkingThreaded ? NULL : &g_RopeSimulateTicks );
 #endif
 		
 		RunRopeSimulation( gpGlobals->frametime );
 
-		g_nRopePointsSimulated += m_RopePhysics.NumNodes();
+		ThreadInterlockedExchangeAdd( &g_nRopePointsSimulated, m_RopePhysics.NumNodes() );
 
 		m_bNewDataThisFrame = false;
 
@@ -1918,11 +1924,53 @@ void C_RopeKeyframe::ClientThink()
 
 #ifdef MAPBASE
 	}
-	UpdateBBox();
+	m_bBBoxDirty = true;
 #else
-		UpdateBBox();
+		m_bBBoxDirty = true;
 	}
 #endif
+
+	// Setting the collision bounds reaches the leaf system, so threaded thinks leave it to ClientThinkFinish
+	if ( !m_bThinkingThreaded && m_bBBoxDirty )
+	{
+		m_bBBoxDirty = false;
+		UpdateBBox();
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Threaded think support. InitRopePhysics sets bounds and picks random numbers,
+// so a rope only thinks threaded once its physics are set up.
+//-----------------------------------------------------------------------------
+bool C_RopeKeyframe::IsClientThinkThreadSafe() const
+{
+	return m_bPhysicsInitted;
+}
+
+void C_RopeKeyframe::ClientThinkPrepare()
+{
+	// Endpoint attachments may set up other entities' bones, so fill the cache
+	// here; the simulation then only reads it.
+	m_bEndPointAttachmentPositionsDirty = true;
+	m_bEndPointAttachmentAnglesDirty = true;
+
+	Vector vecPos;
+	QAngle angles;
+	GetEndPointAttachment( 0, vecPos, angles );
+
+	m_bThinkingThreaded = true;
+}
+
+void C_RopeKeyframe::ClientThinkFinish()
+{
+	m_bThinkingThreaded = false;
+
+	if ( m_bBBoxDirty )
+	{
+		m_bBBoxDirty = false;
+		UpdateBBox();
+	}
 }
 
 
@@ -135,6 +135,9 @@ public:
 
 	virtual void	OnDataChanged( DataUpdateType_t updateType );
 	virtual void	ClientThink();
+	virtual bool	IsClientThinkThreadSafe() const;
+	virtual void	ClientThinkPrepare();
+	virtual void	ClientThinkFinish();
 	virtual int		DrawModel( int flags );
 	virtual bool	ShouldDraw();
 	virtual const Vector& WorldSpaceCenter() const;
@@ -259,6 +262,8 @@ private:
 	bool			m_bNewDataThisFrame : 1;			// Set to true in OnDataChanged so that we simulate that frame
 	bool			m_bPhysicsInitted : 1;				// It waits until all required entities are 
 	// present to start simulating and rendering.
+	bool			m_bThinkingThreaded : 1;			// Between ClientThinkPrepare and ClientThinkFinish
+	bool			m_bBBoxDirty : 1;					// UpdateBBox deferred to ClientThinkFinish
 
 	friend class CRopeManager;
 };
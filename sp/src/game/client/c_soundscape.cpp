@@ -282,6 +282,9 @@ void Soundscape_AddFile( const char *szFile )
 void C_SoundscapeSystem::AddSoundScapeFile( const char *filename )
 {
 	KeyValues *script = new KeyValues( filename );
+
+	// The scripts are only read, and only freed all at once at shutdown
+	script->UseArena( true );
 #ifndef _XBOX
 	if ( script->LoadFromFile( filesystem, filename ) )
 #else
@@ -7,12 +7,15 @@
 #include "cbase.h"
 
 #include "tier0/vprof.h"
+#include "vstdlib/jobthread.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
 CClientThinkList g_ClientThinkList;
 
+static ConVar cl_threaded_client_think( "cl_threaded_client_think", "0", 0, "Run consecutive client thinks of entities that allow it together on the job threads" );
+
 
 CClientThinkList::CClientThinkList()
 {
@@ -76,6 +79,7 @@ void CClientThinkList::SetNextClientThink( ClientThinkHandle_t hThink, float flN
 	if ( m_bInThinkLoop )
 	{
 		// Queue up all changes
+		AUTO_LOCK( m_ChangeListMutex );
 		int i = m_aChangeList.AddToTail();
 		m_aChangeList[i].m_hEnt = INVALID_CLIENTENTITY_HANDLE;
 		m_aChangeList[i].m_hThink = hThink;
@@ -110,6 +114,7 @@ void CClientThinkList::SetNextClientThink( ClientEntityHandle_t hEnt, float flNe
 	if ( m_bInThinkLoop )
 	{
 		// Queue up all changes
+		AUTO_LOCK( m_ChangeListMutex );
 		int i = m_aChangeList.AddToTail();
 		m_aChangeList[i].m_hEnt = hEnt;
 		m_aChangeList[i].m_hThink = hThink;
@@ -145,6 +150,7 @@ void CClientThinkList::RemoveThinkable( ClientThinkHandle_t hThink )
 	if ( m_bInThinkLoop )
 	{
 		// Queue up all changes
+		AUTO_LOCK( m_ChangeListMutex );
 		int i = m_aChangeList.AddToTail();
 		m_aChangeList[i].m_hEnt = INVALID_CLIENTENTITY_HANDLE;
 		m_aChangeList[i].m_hThink = hThink;
@@ -220,6 +226,65 @@ void CClientThinkList::PerformThinkFunction( ThinkEntry_t *pEntry, float flCurti
 }
 
 
+//-----------------------------------------------------------------------------
+// Can this entry think on a job thread?
+//-----------------------------------------------------------------------------
+bool CClientThinkList::CanThinkThreaded( ThinkEntry_t *pEntry )
+{
+	// Entries that are only going to be removed stay on the main thread
+	if ( pEntry->m_flNextClientThink == FLT_MAX )
+		return false;
+
+	C_BaseEntity *pEntity = ClientEntityList().GetBaseEntityFromHandle( pEntry->m_hEnt );
+	if ( !pEntity || !pEntity->IsClientThinkThreadSafe() )
+		return false;
+
+	// Parents think before their children, so children of thinking parents stay in order on the main thread
+	C_BaseEntity *pParent = pEntity->GetMoveParent();
+	return !pParent || ( pParent->GetThinkHandle() == INVALID_THINK_HANDLE );
+}
+
+void CClientThinkList::PerformThreadedThinkFunction( ThinkEntry_t *&pEntry )
+{
+	PerformThinkFunction( pEntry, gpGlobals->curtime );
+}
+
+
+//-----------------------------------------------------------------------------
+// Runs the run of thread-safe thinks at the head of the list together on the
+// job threads. Thinks behind them in the list still run after them, so the
+// order relative to the serial thinks is the same as without threading.
+// Returns how many entries were run; a run of one is left to the caller.
+//-----------------------------------------------------------------------------
+int CClientThinkList::PerformThreadedThinkFunctions( int nThinkCount, ThinkEntry_t **ppThinkEntryList )
+{
+	m_ThreadedThinks.RemoveAll();
+
+	for ( int i = 0; i < nThinkCount && CanThinkThreaded( ppThinkEntryList[i] ); ++i )
+	{
+		m_ThreadedThinks.AddToTail( ppThinkEntryList[i] );
+	}
+
+	int nThreadedCount = m_ThreadedThinks.Count();
+	if ( nThreadedCount < 2 )
+		return 0;
+
+	for ( int i = 0; i < nThreadedCount; ++i )
+	{
+		ClientEntityList().GetBaseEntityFromHandle( m_ThreadedThinks[i]->m_hEnt )->ClientThinkPrepare();
+	}
+
+	ParallelProcess( "CClientThinkList::PerformThreadedThinkFunction", m_ThreadedThinks.Base(), nThreadedCount, this, &CClientThinkList::PerformThreadedThinkFunction );
+
+	for ( int i = 0; i < nThreadedCount; ++i )
+	{
+		ClientEntityList().GetBaseEntityFromHandle( m_ThreadedThinks[i]->m_hEnt )->ClientThinkFinish();
+	}
+
+	return nThreadedCount;
+}
+
+
 //-----------------------------------------------------------------------------
 // Add entity to frame think list
 //-----------------------------------------------------------------------------
@@ -287,11 +352,24 @@ void CClientThinkList::PerformThinkFunctions()
 	// While we're in the loop, no changes to the think list are allowed
 	m_bInThinkLoop = true;
 
-	// Perform thinks on all entities that need it
-	int i;
-	for ( i = 0; i < nThinkCount; ++i )
+	// Perform thinks on all entities that need it. Consecutive entities that
+	// allow it think together on the job threads.
+	bool bThreaded = cl_threaded_client_think.GetBool();
+	int i = 0;
+	while ( i < nThinkCount )
 	{
-		PerformThinkFunction( ppThinkEntryList[i], gpGlobals->curtime );		
+		if ( bThreaded )
+		{
+			int nThreadedCount = PerformThreadedThinkFunctions( nThinkCount - i, &ppThinkEntryList[i] );
+			if ( nThreadedCount )
+			{
+				i += nThreadedCount;
+				continue;
+			}
+		}
+
+		PerformThinkFunction( ppThinkEntryList[i], gpGlobals->curtime );
+		++i;
 	}
 
 	m_bInThinkLoop = false;
@@ -91,6 +91,11 @@ private:
 	void			SetNextClientThink( ClientThinkHandle_t hThink, float nextTime );
 	void			RemoveThinkable( ClientThinkHandle_t hThink );
 	void			PerformThinkFunction( ThinkEntry_t *pEntry, float curtime );
+
+	// Runs the thread-safe thinks at the head of the list on the job threads and returns how many ran
+	int				PerformThreadedThinkFunctions( int nThinkCount, ThinkEntry_t **ppThinkEntryList );
+	bool			CanThinkThreaded( ThinkEntry_t *pEntry );
+	void			PerformThreadedThinkFunction( ThinkEntry_t *&pEntry );
 	ThinkEntry_t*	GetThinkEntry( ClientThinkHandle_t hThink );
 	void			CleanUpDeleteList();
 
@@ -102,6 +107,9 @@ private:
 
 	CUtlVector<ClientEntityHandle_t>	m_aDeleteList;
 	CUtlVector<ThinkListChanges_t>		m_aChangeList;
+	CThreadFastMutex					m_ChangeListMutex;	// Threaded thinks queue changes too
+
+	CUtlVector<ThinkEntry_t*>			m_ThreadedThinks;
 
 	// Makes sure the entries are thinked once per frame in the face of hierarchy
 	int m_nIterEnum;
@@ -23,6 +23,8 @@
 #include "datacache/imdlcache.h"
 #include "view.h"
 #include "viewrender.h"
+#include "mathlib/ssemath.h"
+#include "devtest.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -33,6 +35,7 @@ static ConVar cl_drawleaf("cl_drawleaf", "-1", FCVAR_CHEAT );
 static ConVar r_PortalTestEnts( "r_PortalTestEnts", "1", FCVAR_CHEAT, "Clip entities against portal frustums." );
 static ConVar r_portalsopenall( "r_portalsopenall", "0", FCVAR_CHEAT, "Open all portals" );
 static ConVar cl_threaded_client_leaf_system("cl_threaded_client_leaf_system", "0"  );
+static ConVar cl_leafsystem_batched( "cl_leafsystem_batched", "1", 0, "Gather the renderables in all visible leaves first, cull them against the view frustum four at a time and radix sort translucents." );
 
 
 DEFINE_FIXEDSIZE_ALLOCATOR( CClientRenderablesList, 1, CUtlMemoryPool::GROW_SLOW );
@@ -56,6 +59,224 @@ static void CallComputeFXBlend( IClientRenderable *&pRenderable )
 	pRenderable->ComputeFxBlend();
 }
 
+//-----------------------------------------------------------------------------
+// Renderables gathered for one BuildRenderablesList, with their world bounds
+// stored as separate min/max component arrays so four can be culled at once
+//-----------------------------------------------------------------------------
+enum
+{
+	CULL_MINS_X = 0, CULL_MINS_Y, CULL_MINS_Z,
+	CULL_MAXS_X, CULL_MAXS_Y, CULL_MAXS_Z,
+	CULL_BOUNDS_COUNT
+};
+
+class CRenderableCullList
+{
+public:
+	void RemoveAll()
+	{
+		m_Handles.RemoveAll();
+		m_Alpha.RemoveAll();
+		for ( int i = 0; i < CULL_BOUNDS_COUNT; i++ )
+		{
+			m_Bounds[i].RemoveAll();
+		}
+	}
+
+	void AddToTail( ClientRenderHandle_t handle, unsigned char nAlpha, const Vector &absMins, const Vector &absMaxs )
+	{
+		m_Handles.AddToTail( handle );
+		m_Alpha.AddToTail( nAlpha );
+		m_Bounds[CULL_MINS_X].AddToTail( absMins.x );
+		m_Bounds[CULL_MINS_Y].AddToTail( absMins.y );
+		m_Bounds[CULL_MINS_Z].AddToTail( absMins.z );
+		m_Bounds[CULL_MAXS_X].AddToTail( absMaxs.x );
+		m_Bounds[CULL_MAXS_Y].AddToTail( absMaxs.y );
+		m_Bounds[CULL_MAXS_Z].AddToTail( absMaxs.z );
+	}
+
+	int Count() const { return m_Handles.Count(); }
+
+	void GetBounds( int i, Vector &absMins, Vector &absMaxs ) const
+	{
+		absMins.Init( m_Bounds[CULL_MINS_X][i], m_Bounds[CULL_MINS_Y][i], m_Bounds[CULL_MINS_Z][i] );
+		absMaxs.Init( m_Bounds[CULL_MAXS_X][i], m_Bounds[CULL_MAXS_Y][i], m_Bounds[CULL_MAXS_Z][i] );
+	}
+
+	// Pads the bounds out to a multiple of four for CullBoxesToFrustumSides
+	void GetPaddedBounds( const float *pBounds[CULL_BOUNDS_COUNT] )
+	{
+		int nPadded = ( Count() + 3 ) & ~3;
+		for ( int i = 0; i < CULL_BOUNDS_COUNT; i++ )
+		{
+			m_Bounds[i].EnsureCount( nPadded );
+			pBounds[i] = m_Bounds[i].Base();
+		}
+	}
+
+	CUtlVector< ClientRenderHandle_t > m_Handles;
+	CUtlVector< unsigned char > m_Alpha;
+	CUtlVector< byte > m_Culled;
+	CUtlVector< float > m_Bounds[CULL_BOUNDS_COUNT];
+};
+
+//-----------------------------------------------------------------------------
+// Marks the boxes that are entirely behind one of the side planes of the
+// frustum, the same test R_CullBox makes for those planes. nCount must be a
+// multiple of four. The near and far planes are left to the engine.
+//-----------------------------------------------------------------------------
+static void CullBoxesToFrustumSides( const Frustum_t &frustum, const float * const pBounds[CULL_BOUNDS_COUNT], int nCount, byte *pCulled )
+{
+	fltx4 planeNormal[FRUSTUM_NEARZ][3];
+	fltx4 planeDist[FRUSTUM_NEARZ];
+	for ( int i = 0; i < FRUSTUM_NEARZ; i++ )
+	{
+		const cplane_t *pPlane = frustum.GetPlane( i );
+		planeNormal[i][0] = ReplicateX4( pPlane->normal.x );
+		planeNormal[i][1] = ReplicateX4( pPlane->normal.y );
+		planeNormal[i][2] = ReplicateX4( pPlane->normal.z );
+		planeDist[i] = ReplicateX4( pPlane->dist );
+	}
+
+	for ( int j = 0; j < nCount; j += 4 )
+	{
+		fltx4 mins[3], maxs[3];
+		for ( int k = 0; k < 3; k++ )
+		{
+			mins[k] = LoadUnalignedSIMD( pBounds[CULL_MINS_X + k] + j );
+			maxs[k] = LoadUnalignedSIMD( pBounds[CULL_MAXS_X + k] + j );
+		}
+
+		fltx4 culled = Four_Zeros;
+		for ( int i = 0; i < FRUSTUM_NEARZ; i++ )
+		{
+			// Distance of the corner furthest along the plane normal
+			fltx4 dist = MaxSIMD( MulSIMD( planeNormal[i][0], mins[0] ), MulSIMD( planeNormal[i][0], maxs[0] ) );
+			dist = AddSIMD( dist, MaxSIMD( MulSIMD( planeNormal[i][1], mins[1] ), MulSIMD( planeNormal[i][1], maxs[1] ) ) );
+			dist = AddSIMD( dist, MaxSIMD( MulSIMD( planeNormal[i][2], mins[2] ), MulSIMD( planeNormal[i][2], maxs[2] ) ) );
+			culled = OrSIMD( culled, CmpLtSIMD( dist, planeDist[i] ) );
+		}
+
+		int nMask = TestSignSIMD( culled );
+		pCulled[j] = ( nMask & 1 ) != 0;
+		pCulled[j+1] = ( nMask & 2 ) != 0;
+		pCulled[j+2] = ( nMask & 4 ) != 0;
+		pCulled[j+3] = ( nMask & 8 ) != 0;
+	}
+}
+
+// Scalar version of the above, for comparison
+static bool CullBoxToFrustumSides( const Frustum_t &frustum, const Vector &absMins, const Vector &absMaxs )
+{
+	for ( int i = 0; i < FRUSTUM_NEARZ; i++ )
+	{
+		if ( BoxOnPlaneSide( absMins, absMaxs, frustum.GetPlane( i ) ) == 2 )
+			return true;
+	}
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Translucent sorting helpers
+//-----------------------------------------------------------------------------
+
+// Maps floats onto unsigned ints that sort in the same order
+static inline uint32 FloatSortKey( float flValue )
+{
+	uint32 nBits = *(uint32 *)&flValue;
+	return ( nBits & 0x80000000 ) ? ~nBits : ( nBits | 0x80000000 );
+}
+
+// Fills pOrder with the indices of pKeys in ascending, stable order. pScratch
+// holds nCount keys and indices and pKeys is overwritten.
+static void RadixSortKeys( uint32 *pKeys, unsigned short *pOrder, uint32 *pScratchKeys, unsigned short *pScratchOrder, int nCount )
+{
+	for ( int i = 0; i < nCount; i++ )
+	{
+		pOrder[i] = i;
+	}
+
+	if ( nCount < 2 )
+		return;
+
+	for ( int nShift = 0; nShift < 32; nShift += 8 )
+	{
+		int nHistogram[256];
+		memset( nHistogram, 0, sizeof( nHistogram ) );
+		for ( int i = 0; i < nCount; i++ )
+		{
+			nHistogram[ ( pKeys[i] >> nShift ) & 0xff ]++;
+		}
+
+		// Skip digits every key shares
+		if ( nHistogram[ ( pKeys[0] >> nShift ) & 0xff ] == nCount )
+			continue;
+
+		int nOffset = 0;
+		for ( int i = 0; i < 256; i++ )
+		{
+			int nBucket = nHistogram[i];
+			nHistogram[i] = nOffset;
+			nOffset += nBucket;
+		}
+
+		for ( int i = 0; i < nCount; i++ )
+		{
+			int nDest = nHistogram[ ( pKeys[i] >> nShift ) & 0xff ]++;
+			pScratchKeys[nDest] = pKeys[i];
+			pScratchOrder[nDest] = pOrder[i];
+		}
+		memcpy( pKeys, pScratchKeys, nCount * sizeof( uint32 ) );
+		memcpy( pOrder, pScratchOrder, nCount * sizeof( unsigned short ) );
+	}
+}
+
+// A view and the renderables in it, captured by cl_leafsystem_record
+struct RecordedCullFrame_t
+{
+	Frustum_t m_Frustum;
+	CUtlVector< Vector > m_Mins;				// Bounds of each distinct renderable
+	CUtlVector< Vector > m_Maxs;
+	CUtlVector< float > m_TranslucentDists;
+	CUtlVector< ClientRenderHandle_t > m_LeafHandles;	// Every leaf's renderables, duplicates included
+	CUtlVector< int > m_LeafStart;
+	int m_nHandleLimit;
+};
+
+static int s_nRecordIterations = 0;
+static RecordedCullFrame_t s_RecordedCullFrame;
+
+// The original translucent sort, used with cl_leafsystem_batched 0
+static void HSortEntities( CClientRenderablesList::CEntry *pEntities, float *dists, int nEntities )
+{
+	int i;
+	int stepSize = 4;
+	while( stepSize )
+	{
+		int end = nEntities - stepSize;
+		for( i=0; i < end; i += stepSize )
+		{
+			if( dists[i] > dists[i+stepSize] )
+			{
+				::V_swap( pEntities[i], pEntities[i+stepSize] );
+				::V_swap( dists[i], dists[i+stepSize] );
+
+				if( i == 0 )
+				{
+					i = -stepSize;
+				}
+				else
+				{
+					i -= stepSize << 1;
+				}
+			}
+		}
+
+		stepSize >>= 1;
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // The client leaf system
 //-----------------------------------------------------------------------------
@@ -112,6 +333,8 @@ public:
 	virtual void CollateViewModelRenderables( CUtlVector< IClientRenderable * >& opaque, CUtlVector< IClientRenderable * >& translucent );
 	virtual void BuildRenderablesList( const SetupRenderInfo_t &info );
 			void CollateRenderablesInLeaf( int leaf, int worldListLeafIndex, const SetupRenderInfo_t &info );
+			void BuildRenderablesListBatched( const SetupRenderInfo_t &info );
+			void BuildRenderablesListLegacy( const SetupRenderInfo_t &info );
 	virtual void DrawStaticProps( bool enable );
 	virtual void DrawSmallEntities( bool enable );
 	virtual void EnableAlternateSorting( ClientRenderHandle_t handle, bool bEnable );
@@ -124,6 +347,7 @@ public:
 	virtual void RemoveShadow( ClientLeafShadowHandle_t h );
 
 	virtual void ProjectShadow( ClientLeafShadowHandle_t handle, int nLeafCount, const int *pLeafList );
+	virtual int ProjectShadows( int nShadows, const ClientLeafShadowHandle_t *pHandles, const int *pLeafCounts, const int *pLeafList );
 	virtual void ProjectFlashlight( ClientLeafShadowHandle_t handle, int nLeafCount, const int *pLeafList );
 
 	// Find all shadow casters in a set of leaves
@@ -154,7 +378,7 @@ private:
 	// Adds a renderable to the list of renderables
 	void AddRenderableToLeaf( int leaf, ClientRenderHandle_t handle );
 
-	void SortEntities(  const Vector &vecRenderOrigin, const Vector &vecRenderForward, CClientRenderablesList::CEntry *pEntities, int nEntities );
+	void SortEntities(  const Vector &vecRenderOrigin, const Vector &vecRenderForward, CClientRenderablesList::CEntry *pEntities, int nEntities, bool bRadixSort );
 
 	// Returns -1 if the renderable spans more than one area. If it's totally in one area, then this returns the leaf.
 	short GetRenderableArea( ClientRenderHandle_t handle );
@@ -188,6 +412,15 @@ private:
 	// Adds a shadow to a leaf/removes shadow from leaf
 	void RemoveShadowFromLeaves( ClientLeafShadowHandle_t handle );
 
+	// Adds a shadow to every renderable in a leaf, once per m_ShadowEnum
+	void AddShadowToRenderablesInLeaf( int leaf, ClientLeafShadowHandle_t shadow );
+
+	// Is the shadow already in exactly this set of leaves?
+	bool IsShadowInLeaves( ClientLeafShadowHandle_t handle, int nLeafCount, const int *pLeafList );
+
+	// Re-projects a shadow, keeping its leaf membership if the leaves didn't change
+	bool ReprojectShadow( ClientLeafShadowHandle_t handle, int nLeafCount, const int *pLeafList );
+
 	// Methods associated with the various bi-directional sets
 	static unsigned short& FirstRenderableInLeaf( int leaf ) 
 	{ 
@@ -266,6 +499,7 @@ private:
 		unsigned short	m_FirstDetailProp;
 		unsigned short	m_DetailPropCount;
 		int				m_DetailPropRenderFrame;
+		int				m_ShadowLeafMark;
 		CClientLeafSubSystemData *m_pSubSystemData[N_CLSUBSYSTEMS];
 
 	};
@@ -292,6 +526,17 @@ private:
 		ClientRenderHandle_t handle;
 	};
 
+	// Pieces of CollateRenderablesInLeaf shared with the batched path
+	bool CullRenderable( const SetupRenderInfo_t &info, const RenderableInfo_t &renderable, const Vector &absMins, const Vector &absMaxs, bool bPortalTestEnts );
+	void AddVisibleRenderable( const SetupRenderInfo_t &info, ClientRenderHandle_t handle, const RenderableInfo_t &renderable, unsigned char nAlpha, int worldListLeafIndex, const Vector &absMins, const Vector &absMaxs );
+	void CollateDetailObjectsInLeaf( int leaf, int worldListLeafIndex, const SetupRenderInfo_t &info );
+
+	// Saves the view and renderables for cl_leafsystem_bench
+	void RecordCullFrame( const SetupRenderInfo_t &info );
+
+	// Builds the view with both paths and checks they made the same lists
+	void CompareRenderablesLists( const SetupRenderInfo_t &info, int nIterations );
+
 	// Stores data associated with each leaf.
 	CUtlVector< ClientLeaf_t >	m_Leaf;
 
@@ -323,7 +568,18 @@ private:
 	// A little enumerator to help us when adding shadows to renderables
 	int	m_ShadowEnum;
 
+	// Stamped into leaves when comparing a shadow's old and new leaf lists
+	int m_ShadowLeafMark;
+
 	CTSList<EnumResultList_t> m_DeferredInserts;
+
+	// Scratch for BuildRenderablesListBatched and SortEntities; only used by the render thread
+	CRenderableCullList m_CullList;
+	CUtlVector< int > m_CullListLeafStart;
+	CUtlVector< uint32 > m_RenderablesSeen;
+	CUtlVector< uint32 > m_SortKeys;
+	CUtlVector< unsigned short > m_SortOrder;
+	CUtlVector< CClientRenderablesList::CEntry > m_SortEntries;
 };
 
 
@@ -485,6 +741,8 @@ void CClientLeafSystem::LevelInitPreEntity()
 	newLeaf.m_FirstDetailProp = 0;
 	newLeaf.m_DetailPropCount = 0;
 	newLeaf.m_DetailPropRenderFrame = -1;
+	newLeaf.m_ShadowLeafMark = 0;
+	m_ShadowLeafMark = 0;
 	while ( --leafCount >= 0 )
 	{
 		m_Leaf.AddToTail( newLeaf );
@@ -984,7 +1242,11 @@ void CClientLeafSystem::RemoveShadowFromRenderables( ClientLeafShadowHandle_t ha
 void CClientLeafSystem::AddShadowToLeaf( int leaf, ClientLeafShadowHandle_t shadow )
 {
 	m_ShadowsInLeaf.AddElementToBucket( leaf, shadow ); 
+	AddShadowToRenderablesInLeaf( leaf, shadow );
+}
 
+void CClientLeafSystem::AddShadowToRenderablesInLeaf( int leaf, ClientLeafShadowHandle_t shadow )
+{
 	// Add the shadow exactly once to all renderables in the leaf
 	unsigned short i = m_RenderablesInLeaf.FirstElement( leaf );
 	while ( i != m_RenderablesInLeaf.InvalidIndex() )
@@ -1016,19 +1278,87 @@ void CClientLeafSystem::RemoveShadowFromLeaves( ClientLeafShadowHandle_t handle
 //-----------------------------------------------------------------------------
 void CClientLeafSystem::ProjectShadow( ClientLeafShadowHandle_t handle, int nLeafCount, const int *pLeafList )
 {
-	// Remove the shadow from any leaves it current exists in
-	RemoveShadowFromLeaves( handle );
-	RemoveShadowFromRenderables( handle );
+	ReprojectShadow( handle, nLeafCount, pLeafList );
+}
+
+int CClientLeafSystem::ProjectShadows( int nShadows, const ClientLeafShadowHandle_t *pHandles, const int *pLeafCounts, const int *pLeafList )
+{
+	VPROF_BUDGET( "CClientLeafSystem::ProjectShadows", VPROF_BUDGETGROUP_SHADOW_RENDERING );
+
+	int nReused = 0;
+	for ( int i = 0; i < nShadows; ++i )
+	{
+		if ( ReprojectShadow( pHandles[i], pLeafCounts[i], pLeafList ) )
+		{
+			++nReused;
+		}
+		pLeafList += pLeafCounts[i];
+	}
+	return nReused;
+}
+
+
+//-----------------------------------------------------------------------------
+// Is the shadow already in exactly this set of leaves?
+//-----------------------------------------------------------------------------
+bool CClientLeafSystem::IsShadowInLeaves( ClientLeafShadowHandle_t handle, int nLeafCount, const int *pLeafList )
+{
+	++m_ShadowLeafMark;
+
+	int nCurrentCount = 0;
+	for ( unsigned short i = m_ShadowsInLeaf.FirstBucket( handle ); i != m_ShadowsInLeaf.InvalidIndex(); i = m_ShadowsInLeaf.NextBucket( i ) )
+	{
+		m_Leaf[ m_ShadowsInLeaf.Bucket( i ) ].m_ShadowLeafMark = m_ShadowLeafMark;
+		++nCurrentCount;
+	}
+
+	// Leaf lists from the engine never repeat a leaf, so equal counts + all marked means equal sets
+	if ( nCurrentCount != nLeafCount )
+		return false;
 
+	for ( int i = 0; i < nLeafCount; ++i )
+	{
+		if ( m_Leaf[ pLeafList[i] ].m_ShadowLeafMark != m_ShadowLeafMark )
+			return false;
+	}
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Re-projects a shadow. Small caster motion usually leaves the shadow volume in
+// the same leaves, in which case the leaf buckets are kept and only the receivers
+// are rebuilt (the engine's ProjectShadow has already cleared them).
+// Returns true if the leaf list was reused.
+//-----------------------------------------------------------------------------
+bool CClientLeafSystem::ReprojectShadow( ClientLeafShadowHandle_t handle, int nLeafCount, const int *pLeafList )
+{
 	Assert( ( m_Shadows[handle].m_Flags & SHADOW_FLAGS_PROJECTED_TEXTURE_TYPE_MASK ) == SHADOW_FLAGS_SHADOW );
 
+	bool bSameLeaves = IsShadowInLeaves( handle, nLeafCount, pLeafList );
+
+	// Remove the shadow from any leaves it current exists in
+	if ( !bSameLeaves )
+	{
+		RemoveShadowFromLeaves( handle );
+	}
+	RemoveShadowFromRenderables( handle );
+
 	// This will help us to avoid adding the shadow multiple times to a renderable
 	++m_ShadowEnum;
 
 	for ( int i = 0; i < nLeafCount; ++i )
 	{
-		AddShadowToLeaf( pLeafList[i], handle );
+		if ( bSameLeaves )
+		{
+			AddShadowToRenderablesInLeaf( pLeafList[i], handle );
+		}
+		else
+		{
+			AddShadowToLeaf( pLeafList[i], handle );
+		}
 	}
+	return bSameLeaves;
 }
 
 void CClientLeafSystem::ProjectFlashlight( ClientLeafShadowHandle_t handle, int nLeafCount, const int *pLeafList )
@@ -1505,6 +1835,101 @@ static RenderGroup_t DetectBucketedRenderGroup( RenderGroup_t group, float fDime
 	return bucketedGroup;
 }
 
+//-----------------------------------------------------------------------------
+// Returns true if the renderable is outside the view or occluded
+//-----------------------------------------------------------------------------
+bool CClientLeafSystem::CullRenderable( const SetupRenderInfo_t &info, const RenderableInfo_t &renderable, const Vector &absMins, const Vector &absMaxs, bool bPortalTestEnts )
+{
+	// If the renderable is inside an area, cull it using the frustum for that area.
+	if ( bPortalTestEnts && renderable.m_Area != -1 )
+	{
+		VPROF( "r_PortalTestEnts" );
+		if ( !engine->DoesBoxTouchAreaFrustum( absMins, absMaxs, renderable.m_Area ) )
+			return true;
+	}
+	else
+	{
+		// cull with main frustum
+		if ( engine->CullBox( absMins, absMaxs ) )
+			return true;
+	}
+
+	// UNDONE: Investigate speed tradeoffs of occlusion culling brush models too?
+	if ( renderable.m_Flags & RENDER_FLAGS_STUDIO_MODEL )
+	{
+		// test to see if this renderable is occluded by the engine's occlusion system
+		if ( engine->IsOccluded( absMins, absMaxs ) )
+			return true;
+	}
+
+#ifdef INVASION_CLIENT_DLL
+	if (info.m_flRenderDistSq != 0.0f)
+	{
+		Vector mins, maxs;
+		renderable.m_pRenderable->GetRenderBounds( mins, maxs );
+
+		if ((maxs.z - mins.z) < 100)
+		{
+			Vector vCenter;
+			VectorLerp( mins, maxs, 0.5f, vCenter );
+			vCenter += renderable.m_pRenderable->GetRenderOrigin();
+
+			float flDistSq = info.m_vecRenderOrigin.DistToSqr( vCenter );
+			if (info.m_flRenderDistSq <= flDistSq)
+				return true;
+		}
+	}
+#endif
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Adds a renderable that passed culling to the right render groups
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::AddVisibleRenderable( const SetupRenderInfo_t &info, ClientRenderHandle_t handle, const RenderableInfo_t &renderable, 
+	unsigned char nAlpha, int worldListLeafIndex, const Vector &absMins, const Vector &absMaxs )
+{
+	if( renderable.m_RenderGroup != RENDER_GROUP_TRANSLUCENT_ENTITY )
+	{
+		RenderGroup_t group = (RenderGroup_t)renderable.m_RenderGroup;
+
+		// Determine object group offset
+		if ( RENDER_GROUP_CFG_NUM_OPAQUE_ENT_BUCKETS > 1 &&
+			 group >= RENDER_GROUP_OPAQUE_STATIC &&
+			 group <= RENDER_GROUP_OPAQUE_ENTITY )
+		{
+			Vector dims;
+			VectorSubtract( absMaxs, absMins, dims );
+
+			float const fDimension = MAX( MAX( fabs(dims.x), fabs(dims.y) ), fabs(dims.z) );
+			group = DetectBucketedRenderGroup( group, fDimension );
+			
+			Assert( group >= RENDER_GROUP_OPAQUE_STATIC_HUGE && group <= RENDER_GROUP_OPAQUE_ENTITY );
+		}
+
+		AddRenderableToRenderList( *info.m_pRenderList, renderable.m_pRenderable, 
+			worldListLeafIndex, group, handle);
+	}
+	else
+	{
+		bool bTwoPass = ((renderable.m_Flags & RENDER_FLAGS_TWOPASS) != 0) && ( nAlpha == 255 );	// Two pass?
+
+		// Add to appropriate list if drawing translucent objects (shadow depth mapping will skip this)
+		if ( info.m_bDrawTranslucentObjects ) 
+		{
+			AddRenderableToRenderList( *info.m_pRenderList, renderable.m_pRenderable, 
+				worldListLeafIndex, (RenderGroup_t)renderable.m_RenderGroup, handle, bTwoPass );
+		}
+		
+		if ( bTwoPass )	// Also add to opaque list if it's a two-pass model... 
+		{
+			AddRenderableToRenderList( *info.m_pRenderList, renderable.m_pRenderable, 
+				worldListLeafIndex, RENDER_GROUP_OPAQUE_ENTITY, handle, bTwoPass );
+		}
+	}
+}
+
 void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafIndex,	const SetupRenderInfo_t &info )
 {
 	bool portalTestEnts = r_PortalTestEnts.GetBool() && !r_portalsopenall.GetBool();
@@ -1568,92 +1993,22 @@ void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafInd
 
 		Vector absMins, absMaxs;
 		CalcRenderableWorldSpaceAABB( renderable.m_pRenderable, absMins, absMaxs );
-		// If the renderable is inside an area, cull it using the frustum for that area.
-		if ( portalTestEnts && renderable.m_Area != -1 )
-		{
-			VPROF( "r_PortalTestEnts" );
-			if ( !engine->DoesBoxTouchAreaFrustum( absMins, absMaxs, renderable.m_Area ) )
-				continue;
-		}
-		else
-		{
-			// cull with main frustum
-			if ( engine->CullBox( absMins, absMaxs ) )
-				continue;
-		}
-
-		// UNDONE: Investigate speed tradeoffs of occlusion culling brush models too?
-		if ( renderable.m_Flags & RENDER_FLAGS_STUDIO_MODEL )
-		{
-			// test to see if this renderable is occluded by the engine's occlusion system
-			if ( engine->IsOccluded( absMins, absMaxs ) )
-				continue;
-		}
-
-#ifdef INVASION_CLIENT_DLL
-		if (info.m_flRenderDistSq != 0.0f)
-		{
-			Vector mins, maxs;
-			renderable.m_pRenderable->GetRenderBounds( mins, maxs );
-
-			if ((maxs.z - mins.z) < 100)
-			{
-				Vector vCenter;
-				VectorLerp( mins, maxs, 0.5f, vCenter );
-				vCenter += renderable.m_pRenderable->GetRenderOrigin();
-
-				float flDistSq = info.m_vecRenderOrigin.DistToSqr( vCenter );
-				if (info.m_flRenderDistSq <= flDistSq)
-					continue;
-			}
-		}
-#endif
-
-		if( renderable.m_RenderGroup != RENDER_GROUP_TRANSLUCENT_ENTITY )
-		{
-			RenderGroup_t group = (RenderGroup_t)renderable.m_RenderGroup;
-
-			// Determine object group offset
-			if ( RENDER_GROUP_CFG_NUM_OPAQUE_ENT_BUCKETS > 1 &&
-				 group >= RENDER_GROUP_OPAQUE_STATIC &&
-				 group <= RENDER_GROUP_OPAQUE_ENTITY )
-			{
-				Vector dims;
-				VectorSubtract( absMaxs, absMins, dims );
-
-				float const fDimension = MAX( MAX( fabs(dims.x), fabs(dims.y) ), fabs(dims.z) );
-				group = DetectBucketedRenderGroup( group, fDimension );
-				
-				Assert( group >= RENDER_GROUP_OPAQUE_STATIC_HUGE && group <= RENDER_GROUP_OPAQUE_ENTITY );
-			}
-
-			AddRenderableToRenderList( *info.m_pRenderList, renderable.m_pRenderable, 
-				worldListLeafIndex, group, handle);
-		}
-		else
-		{
-			bool bTwoPass = ((renderable.m_Flags & RENDER_FLAGS_TWOPASS) != 0) && ( nAlpha == 255 );	// Two pass?
+		if ( CullRenderable( info, renderable, absMins, absMaxs, portalTestEnts ) )
+			continue;
 
-			// Add to appropriate list if drawing translucent objects (shadow depth mapping will skip this)
-			if ( info.m_bDrawTranslucentObjects ) 
-			{
-				AddRenderableToRenderList( *info.m_pRenderList, renderable.m_pRenderable, 
-					worldListLeafIndex, (RenderGroup_t)renderable.m_RenderGroup, handle, bTwoPass );
-			}
-			
-			if ( bTwoPass )	// Also add to opaque list if it's a two-pass model... 
-			{
-				AddRenderableToRenderList( *info.m_pRenderList, renderable.m_pRenderable, 
-					worldListLeafIndex, RENDER_GROUP_OPAQUE_ENTITY, handle, bTwoPass );
-			}
-		}
+		AddVisibleRenderable( info, handle, renderable, nAlpha, worldListLeafIndex, absMins, absMaxs );
 	}
 
+	CollateDetailObjectsInLeaf( leaf, worldListLeafIndex, info );
+}
+
+void CClientLeafSystem::CollateDetailObjectsInLeaf( int leaf, int worldListLeafIndex, const SetupRenderInfo_t &info )
+{
 	// Do detail objects.
 	// These don't have render handles!
 	if ( info.m_bDrawDetailObjects && ShouldDrawDetailObjectsInLeaf( leaf, info.m_nDetailBuildFrame ) )
 	{
-		idx = m_Leaf[leaf].m_FirstDetailProp;
+		unsigned short idx = m_Leaf[leaf].m_FirstDetailProp;
 		int count = m_Leaf[leaf].m_DetailPropCount;
 		while( --count >= 0 )
 		{
@@ -1686,10 +2041,28 @@ void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafInd
 }
 
 
+//-----------------------------------------------------------------------------
+// Distance along the view direction that translucents are sorted by
+//-----------------------------------------------------------------------------
+static float RenderableSortDist( IClientRenderable *pRenderable, const Vector &vecRenderOrigin, const Vector &vecRenderForward )
+{
+	// Compute the center of the object (needed for translucent brush models)
+	Vector boxcenter;
+	Vector mins,maxs;
+	pRenderable->GetRenderBounds( mins, maxs );
+	VectorAdd( mins, maxs, boxcenter );
+	VectorMA( pRenderable->GetRenderOrigin(), 0.5f, boxcenter, boxcenter );
+
+	// Compute distance...
+	Vector delta;
+	VectorSubtract( boxcenter, vecRenderOrigin, delta );
+	return DotProduct( delta, vecRenderForward );
+}
+
 //-----------------------------------------------------------------------------
 // Sort entities in a back-to-front ordering
 //-----------------------------------------------------------------------------
-void CClientLeafSystem::SortEntities( const Vector &vecRenderOrigin, const Vector &vecRenderForward, CClientRenderablesList::CEntry *pEntities, int nEntities )
+void CClientLeafSystem::SortEntities( const Vector &vecRenderOrigin, const Vector &vecRenderForward, CClientRenderablesList::CEntry *pEntities, int nEntities, bool bRadixSort )
 {
 	// Don't sort if we only have 1 entity
 	if ( nEntities <= 1 )
@@ -1701,52 +2074,155 @@ void CClientLeafSystem::SortEntities( const Vector &vecRenderOrigin, const Vecto
 	int i;
 	for( i=0; i < nEntities; i++ )
 	{
-		IClientRenderable *pRenderable = pEntities[i].m_pRenderable;
+		dists[i] = RenderableSortDist( pEntities[i].m_pRenderable, vecRenderOrigin, vecRenderForward );
+	}
 
-		// Compute the center of the object (needed for translucent brush models)
-		Vector boxcenter;
-		Vector mins,maxs;
-		pRenderable->GetRenderBounds( mins, maxs );
-		VectorAdd( mins, maxs, boxcenter );
-		VectorMA( pRenderable->GetRenderOrigin(), 0.5f, boxcenter, boxcenter );
+	if ( !bRadixSort )
+	{
+		HSortEntities( pEntities, dists, nEntities );
+		return;
+	}
 
-		// Compute distance...
-		Vector delta;
-		VectorSubtract( boxcenter, vecRenderOrigin, delta );
-		dists[i] = DotProduct( delta, vecRenderForward );
+	// Radix sort on the distances, then move the entries into place
+	m_SortKeys.EnsureCount( nEntities * 2 );
+	m_SortOrder.EnsureCount( nEntities * 2 );
+	m_SortEntries.CopyArray( pEntities, nEntities );
+	for( i=0; i < nEntities; i++ )
+	{
+		m_SortKeys[i] = FloatSortKey( dists[i] );
 	}
 
-	// H-sort.
-	int stepSize = 4;
-	while( stepSize )
+	RadixSortKeys( m_SortKeys.Base(), m_SortOrder.Base(), m_SortKeys.Base() + nEntities, m_SortOrder.Base() + nEntities, nEntities );
+
+	for( i=0; i < nEntities; i++ )
 	{
-		int end = nEntities - stepSize;
-		for( i=0; i < end; i += stepSize )
+		pEntities[i] = m_SortEntries[ m_SortOrder[i] ];
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Same output as calling CollateRenderablesInLeaf on each leaf, but the
+// renderables of every leaf are gathered and frustum culled in one pass first
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::BuildRenderablesListBatched( const SetupRenderInfo_t &info )
+{
+	int leafCount = info.m_pWorldListInfo->m_LeafCount;
+	bool portalTestEnts = r_PortalTestEnts.GetBool() && !r_portalsopenall.GetBool();
+
+	// Renderables already gathered from an earlier leaf
+	m_RenderablesSeen.SetCount( ( m_Renderables.MaxElementIndex() + 31 ) >> 5 );
+	memset( m_RenderablesSeen.Base(), 0, m_RenderablesSeen.Count() * sizeof( uint32 ) );
+
+	m_CullList.RemoveAll();
+	m_CullListLeafStart.SetCount( leafCount + 1 );
+
+	{
+		VPROF( "BuildRenderablesListBatched - Gather" );
+		for ( int i = 0; i < leafCount; i++ )
 		{
-			if( dists[i] > dists[i+stepSize] )
+			m_CullListLeafStart[i] = m_CullList.Count();
+
+			int leaf = info.m_pWorldListInfo->m_pLeafList[i];
+			unsigned short idx = m_RenderablesInLeaf.FirstElement(leaf);
+			for ( ;idx != m_RenderablesInLeaf.InvalidIndex(); idx = m_RenderablesInLeaf.NextElement(idx) )
 			{
-				::V_swap( pEntities[i], pEntities[i+stepSize] );
-				::V_swap( dists[i], dists[i+stepSize] );
+				ClientRenderHandle_t handle = m_RenderablesInLeaf.Element(idx);
+				RenderableInfo_t& renderable = m_Renderables[handle];
 
-				if( i == 0 )
+				// Early out on static props if we don't want to render them
+				if ((!m_DrawStaticProps) && (renderable.m_Flags & RENDER_FLAGS_STATIC_PROP))
+					continue;
+
+				// Don't hit the same ent in multiple leaves twice; translucents only draw in their render leaf
+				if ( renderable.m_RenderGroup != RENDER_GROUP_TRANSLUCENT_ENTITY )
 				{
-					i = -stepSize;
+					uint32 nBit = 1U << ( handle & 31 );
+					uint32 &nSeen = m_RenderablesSeen[ handle >> 5 ];
+					if ( nSeen & nBit )
+						continue;
+
+					nSeen |= nBit;
 				}
-				else
+				else if ( renderable.m_RenderLeaf != leaf )
 				{
-					i -= stepSize << 1;
+					continue;
+				}
+
+				unsigned char nAlpha = 255;
+				if ( info.m_bDrawTranslucentObjects ) 
+				{
+					// NOTE: OPAQUE objects can have alpha == 0. 
+					nAlpha = renderable.m_pRenderable->GetFxBlend();
+					if ( nAlpha == 0 )
+						continue;
 				}
+
+				Vector absMins, absMaxs;
+				CalcRenderableWorldSpaceAABB( renderable.m_pRenderable, absMins, absMaxs );
+				m_CullList.AddToTail( handle, nAlpha, absMins, absMaxs );
 			}
 		}
+		m_CullListLeafStart[leafCount] = m_CullList.Count();
+	}
 
-		stepSize >>= 1;
+	// Reject whatever is outside the view before going to the engine for the exact tests
+	int nPadded = ( m_CullList.Count() + 3 ) & ~3;
+	m_CullList.m_Culled.EnsureCount( nPadded );
+	if ( info.m_pFrustum )
+	{
+		VPROF( "BuildRenderablesListBatched - Cull" );
+		const float *pBounds[CULL_BOUNDS_COUNT];
+		m_CullList.GetPaddedBounds( pBounds );
+		CullBoxesToFrustumSides( *info.m_pFrustum, pBounds, nPadded, m_CullList.m_Culled.Base() );
+	}
+	else
+	{
+		memset( m_CullList.m_Culled.Base(), 0, nPadded );
 	}
-}
 
+	CClientRenderablesList::CEntry *pTranslucentEntries = info.m_pRenderList->m_RenderGroups[RENDER_GROUP_TRANSLUCENT_ENTITY];
+	int &nTranslucentEntries = info.m_pRenderList->m_RenderGroupCounts[RENDER_GROUP_TRANSLUCENT_ENTITY];
+	for ( int i = 0; i < leafCount; i++ )
+	{
+		int nTranslucent = nTranslucentEntries;
 
-void CClientLeafSystem::BuildRenderablesList( const SetupRenderInfo_t &info )
+		// Place a fake entity for static/opaque ents in this leaf
+		AddRenderableToRenderList( *info.m_pRenderList, NULL, i, RENDER_GROUP_OPAQUE_STATIC, NULL );
+		AddRenderableToRenderList( *info.m_pRenderList, NULL, i, RENDER_GROUP_OPAQUE_ENTITY, NULL );
+
+		for ( int j = m_CullListLeafStart[i]; j < m_CullListLeafStart[i+1]; j++ )
+		{
+			if ( m_CullList.m_Culled[j] )
+				continue;
+
+			ClientRenderHandle_t handle = m_CullList.m_Handles[j];
+			const RenderableInfo_t &renderable = m_Renderables[handle];
+
+			Vector absMins, absMaxs;
+			m_CullList.GetBounds( j, absMins, absMaxs );
+			if ( CullRenderable( info, renderable, absMins, absMaxs, portalTestEnts ) )
+				continue;
+
+			AddVisibleRenderable( info, handle, renderable, m_CullList.m_Alpha[j], i, absMins, absMaxs );
+		}
+
+		CollateDetailObjectsInLeaf( info.m_pWorldListInfo->m_pLeafList[i], i, info );
+
+		int nNewTranslucent = nTranslucentEntries - nTranslucent;
+		if( (nNewTranslucent != 0 ) && info.m_bDrawTranslucentObjects )
+		{
+			// Sort the new translucent entities.
+			SortEntities( info.m_vecRenderOrigin, info.m_vecRenderForward, &pTranslucentEntries[nTranslucent], nNewTranslucent, true );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// The original build, one leaf at a time, used with cl_leafsystem_batched 0
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::BuildRenderablesListLegacy( const SetupRenderInfo_t &info )
 {
-	VPROF_BUDGET( "BuildRenderablesList", "BuildRenderablesList" );
 	int leafCount = info.m_pWorldListInfo->m_LeafCount;
 	const Vector &vecRenderOrigin = info.m_vecRenderOrigin;
 	const Vector &vecRenderForward = info.m_vecRenderForward;
@@ -1764,7 +2240,403 @@ void CClientLeafSystem::BuildRenderablesList( const SetupRenderInfo_t &info )
 		if( (nNewTranslucent != 0 ) && info.m_bDrawTranslucentObjects )
 		{
 			// Sort the new translucent entities.
-			SortEntities( vecRenderOrigin, vecRenderForward, &pTranslucentEntries[nTranslucent], nNewTranslucent );
+			SortEntities( vecRenderOrigin, vecRenderForward, &pTranslucentEntries[nTranslucent], nNewTranslucent, false );
 		}
 	}
 }
+
+void CClientLeafSystem::BuildRenderablesList( const SetupRenderInfo_t &info )
+{
+	VPROF_BUDGET( "BuildRenderablesList", "BuildRenderablesList" );
+
+	if ( s_nRecordIterations && info.m_pFrustum )
+	{
+		RecordCullFrame( info );
+		CompareRenderablesLists( info, s_nRecordIterations );
+		s_nRecordIterations = 0;
+	}
+
+	if ( cl_leafsystem_batched.GetBool() )
+	{
+		BuildRenderablesListBatched( info );
+	}
+	else
+	{
+		BuildRenderablesListLegacy( info );
+	}
+}
+
+// Frames stamped into m_RenderFrame2 by the legacy builds made for comparison;
+// the real frames count up from zero and renderables start out at -1
+static int s_nCompareRenderFrame = -2;
+
+void CClientLeafSystem::RecordCullFrame( const SetupRenderInfo_t &info )
+{
+	RecordedCullFrame_t &frame = s_RecordedCullFrame;
+	frame.m_Frustum = *info.m_pFrustum;
+	frame.m_Mins.RemoveAll();
+	frame.m_Maxs.RemoveAll();
+	frame.m_TranslucentDists.RemoveAll();
+	frame.m_LeafHandles.RemoveAll();
+	frame.m_LeafStart.RemoveAll();
+	frame.m_nHandleLimit = m_Renderables.MaxElementIndex();
+
+	CUtlVector< uint32 > seen;
+	seen.SetCount( ( frame.m_nHandleLimit + 31 ) >> 5 );
+	memset( seen.Base(), 0, seen.Count() * sizeof( uint32 ) );
+
+	for ( int i = 0; i < info.m_pWorldListInfo->m_LeafCount; i++ )
+	{
+		frame.m_LeafStart.AddToTail( frame.m_LeafHandles.Count() );
+
+		int leaf = info.m_pWorldListInfo->m_pLeafList[i];
+		unsigned short idx = m_RenderablesInLeaf.FirstElement(leaf);
+		for ( ;idx != m_RenderablesInLeaf.InvalidIndex(); idx = m_RenderablesInLeaf.NextElement(idx) )
+		{
+			ClientRenderHandle_t handle = m_RenderablesInLeaf.Element(idx);
+			frame.m_LeafHandles.AddToTail( handle );
+
+			if ( seen[ handle >> 5 ] & ( 1U << ( handle & 31 ) ) )
+				continue;
+			seen[ handle >> 5 ] |= 1U << ( handle & 31 );
+
+			IClientRenderable *pRenderable = m_Renderables[handle].m_pRenderable;
+			Vector absMins, absMaxs;
+			CalcRenderableWorldSpaceAABB( pRenderable, absMins, absMaxs );
+			frame.m_Mins.AddToTail( absMins );
+			frame.m_Maxs.AddToTail( absMaxs );
+
+			if ( m_Renderables[handle].m_RenderGroup == RENDER_GROUP_TRANSLUCENT_ENTITY )
+			{
+				frame.m_TranslucentDists.AddToTail( RenderableSortDist( pRenderable, info.m_vecRenderOrigin, info.m_vecRenderForward ) );
+			}
+		}
+	}
+	frame.m_LeafStart.AddToTail( frame.m_LeafHandles.Count() );
+
+	Msg( "Recorded %d renderables, %d translucent, in %d leaves\n", frame.m_Mins.Count(), frame.m_TranslucentDists.Count(), info.m_pWorldListInfo->m_LeafCount );
+}
+
+void CClientLeafSystem::CompareRenderablesLists( const SetupRenderInfo_t &info, int nIterations )
+{
+	CDevTestReport report( "cl_leafsystem_record" );
+
+	// Build into scratch lists so the view's own list is left alone
+	CClientRenderablesList *pBatchedList = new CClientRenderablesList;
+	CClientRenderablesList *pLegacyList = new CClientRenderablesList;
+
+	SetupRenderInfo_t batchedInfo = info;
+	batchedInfo.m_pRenderList = pBatchedList;
+	SetupRenderInfo_t legacyInfo = info;
+	legacyInfo.m_pRenderList = pLegacyList;
+
+	CFastTimer timer;
+	timer.Start();
+	for ( int j = 0; j < nIterations; j++ )
+	{
+		memset( pBatchedList->m_RenderGroupCounts, 0, sizeof( pBatchedList->m_RenderGroupCounts ) );
+		BuildRenderablesListBatched( batchedInfo );
+	}
+	timer.End();
+	report.Time( "batched build", timer, nIterations );
+
+	timer.Start();
+	for ( int j = 0; j < nIterations; j++ )
+	{
+		memset( pLegacyList->m_RenderGroupCounts, 0, sizeof( pLegacyList->m_RenderGroupCounts ) );
+		legacyInfo.m_nRenderFrame = s_nCompareRenderFrame--;
+		BuildRenderablesListLegacy( legacyInfo );
+	}
+	timer.End();
+	report.Time( "legacy build", timer, nIterations );
+
+	for ( int group = 0; group < RENDER_GROUP_COUNT; group++ )
+	{
+		int nCount = pBatchedList->m_RenderGroupCounts[group];
+		if ( !report.Check( nCount == pLegacyList->m_RenderGroupCounts[group], "group %d has %d entries batched, %d legacy", group, nCount, pLegacyList->m_RenderGroupCounts[group] ) )
+			continue;
+
+		for ( int i = 0; i < nCount; i++ )
+		{
+			const CClientRenderablesList::CEntry &batched = pBatchedList->m_RenderGroups[group][i];
+			const CClientRenderablesList::CEntry &legacy = pLegacyList->m_RenderGroups[group][i];
+			bool bSame = ( batched.m_pRenderable == legacy.m_pRenderable ) && ( batched.m_iWorldListInfoLeaf == legacy.m_iWorldListInfoLeaf ) &&
+				( batched.m_TwoPass == legacy.m_TwoPass ) && ( batched.m_RenderHandle == legacy.m_RenderHandle );
+
+			// The h-sort isn't stable, so translucents in a leaf at the same distance may trade places
+			if ( !bSame && group == RENDER_GROUP_TRANSLUCENT_ENTITY && batched.m_iWorldListInfoLeaf == legacy.m_iWorldListInfoLeaf )
+			{
+				bSame = RenderableSortDist( batched.m_pRenderable, info.m_vecRenderOrigin, info.m_vecRenderForward ) ==
+					RenderableSortDist( legacy.m_pRenderable, info.m_vecRenderOrigin, info.m_vecRenderForward );
+			}
+
+			report.Check( bSame, "group %d entry %d is handle %d batched, %d legacy", group, i, (int)batched.m_RenderHandle, (int)legacy.m_RenderHandle );
+		}
+	}
+
+	pBatchedList->Release();
+	pLegacyList->Release();
+
+	report.Finish();
+}
+
+
+//-----------------------------------------------------------------------------
+// Culling and sorting benchmark. Replays the frame captured with
+// cl_leafsystem_record, or a random one if nothing was recorded.
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( cl_leafsystem_record, "Builds the next view's renderables with both the batched and the legacy code, checks the lists match and captures the view for cl_leafsystem_bench. Usage: cl_leafsystem_record [iterations]", DEVTEST_COMMAND_FLAGS )
+{
+	s_nRecordIterations = args.ArgC() > 1 ? MAX( atoi( args[1] ), 1 ) : 1;
+}
+
+static void GenerateRandomCullFrame( RecordedCullFrame_t &frame )
+{
+	GeneratePerspectiveFrustum( vec3_origin, vec3_angle, 4.0f, 16384.0f, 90.0f, 16.0f / 9.0f, frame.m_Frustum );
+
+	for ( int i = 0; i < 2048; i++ )
+	{
+		Vector vecCenter( RandomFloat( -4096.0f, 4096.0f ), RandomFloat( -4096.0f, 4096.0f ), RandomFloat( -1024.0f, 1024.0f ) );
+		Vector vecExtents( RandomFloat( 4.0f, 128.0f ), RandomFloat( 4.0f, 128.0f ), RandomFloat( 4.0f, 128.0f ) );
+		frame.m_Mins.AddToTail( vecCenter - vecExtents );
+		frame.m_Maxs.AddToTail( vecCenter + vecExtents );
+		if ( ( i & 3 ) == 0 )
+		{
+			// Coarse distances, so the sorts see ties
+			frame.m_TranslucentDists.AddToTail( RandomInt( -64, 64 ) * 64.0f );
+		}
+	}
+
+	// Leaves share a lot of renderables, as they do in the world
+	frame.m_nHandleLimit = 4096;
+	for ( int i = 0; i < 512; i++ )
+	{
+		frame.m_LeafStart.AddToTail( frame.m_LeafHandles.Count() );
+		int nInLeaf = RandomInt( 0, 16 );
+		for ( int j = 0; j < nInLeaf; j++ )
+		{
+			frame.m_LeafHandles.AddToTail( RandomInt( 0, frame.m_nHandleLimit - 1 ) );
+		}
+	}
+	frame.m_LeafStart.AddToTail( frame.m_LeafHandles.Count() );
+}
+
+static void TestCullReplay( CDevTestReport &report, const RecordedCullFrame_t &frame, int nIterations )
+{
+	int nCount = frame.m_Mins.Count();
+
+	CUtlVector< byte > scalarCulled;
+	scalarCulled.SetCount( nCount );
+	CFastTimer timer;
+	timer.Start();
+	for ( int j = 0; j < nIterations; j++ )
+	{
+		for ( int i = 0; i < nCount; i++ )
+		{
+			scalarCulled[i] = CullBoxToFrustumSides( frame.m_Frustum, frame.m_Mins[i], frame.m_Maxs[i] );
+		}
+	}
+	timer.End();
+	report.Time( "scalar cull", timer, nIterations );
+
+	// Includes building the list, as BuildRenderablesListBatched has to
+	CRenderableCullList cullList;
+	timer.Start();
+	for ( int j = 0; j < nIterations; j++ )
+	{
+		cullList.RemoveAll();
+		for ( int i = 0; i < nCount; i++ )
+		{
+			cullList.AddToTail( i, 255, frame.m_Mins[i], frame.m_Maxs[i] );
+		}
+
+		int nPadded = ( nCount + 3 ) & ~3;
+		cullList.m_Culled.EnsureCount( nPadded );
+		const float *pBounds[CULL_BOUNDS_COUNT];
+		cullList.GetPaddedBounds( pBounds );
+		CullBoxesToFrustumSides( frame.m_Frustum, pBounds, nPadded, cullList.m_Culled.Base() );
+	}
+	timer.End();
+	report.Time( "SIMD cull", timer, nIterations );
+
+	int nCulled = 0;
+	for ( int i = 0; i < nCount; i++ )
+	{
+		nCulled += scalarCulled[i];
+		report.Check( scalarCulled[i] == cullList.m_Culled[i], "box %d culled %d by the scalar test, %d by the SIMD one", i, scalarCulled[i], cullList.m_Culled[i] );
+	}
+
+	Msg( "cl_leafsystem_bench: %d renderables, %d culled by the side planes\n", nCount, nCulled );
+}
+
+static void TestDedupeReplay( CDevTestReport &report, const RecordedCullFrame_t &frame, int nIterations )
+{
+	int nHandles = frame.m_LeafHandles.Count();
+
+	// The legacy code stamps the frame into each renderable
+	CUtlVector< ClientRenderHandle_t > stampOut;
+	CUtlVector< int > stamps;
+	stamps.SetCount( frame.m_nHandleLimit );
+	for ( int i = 0; i < stamps.Count(); i++ )
+	{
+		stamps[i] = -1;
+	}
+
+	CFastTimer timer;
+	timer.Start();
+	for ( int j = 0; j < nIterations; j++ )
+	{
+		stampOut.RemoveAll();
+		for ( int i = 0; i < nHandles; i++ )
+		{
+			ClientRenderHandle_t handle = frame.m_LeafHandles[i];
+			if ( stamps[handle] == j )
+				continue;
+
+			stamps[handle] = j;
+			stampOut.AddToTail( handle );
+		}
+	}
+	timer.End();
+	report.Time( "frame stamp dedupe", timer, nIterations );
+
+	CUtlVector< ClientRenderHandle_t > bitsetOut;
+	CUtlVector< uint32 > seen;
+	timer.Start();
+	for ( int j = 0; j < nIterations; j++ )
+	{
+		bitsetOut.RemoveAll();
+		seen.SetCount( ( frame.m_nHandleLimit + 31 ) >> 5 );
+		memset( seen.Base(), 0, seen.Count() * sizeof( uint32 ) );
+		for ( int i = 0; i < nHandles; i++ )
+		{
+			ClientRenderHandle_t handle = frame.m_LeafHandles[i];
+			uint32 nBit = 1U << ( handle & 31 );
+			uint32 &nSeen = seen[ handle >> 5 ];
+			if ( nSeen & nBit )
+				continue;
+
+			nSeen |= nBit;
+			bitsetOut.AddToTail( handle );
+		}
+	}
+	timer.End();
+	report.Time( "bitset dedupe", timer, nIterations );
+
+	if ( report.Check( stampOut.Count() == bitsetOut.Count(), "%d renderables left by the frame stamps, %d by the bitset", stampOut.Count(), bitsetOut.Count() ) )
+	{
+		for ( int i = 0; i < stampOut.Count(); i++ )
+		{
+			report.Check( stampOut[i] == bitsetOut[i], "renderable %d is handle %d with frame stamps, %d with the bitset", i, (int)stampOut[i], (int)bitsetOut[i] );
+		}
+	}
+
+	Msg( "cl_leafsystem_bench: %d leaf entries, %d distinct renderables\n", nHandles, bitsetOut.Count() );
+}
+
+static void TestSortReplay( CDevTestReport &report, const RecordedCullFrame_t &frame, int nIterations )
+{
+	const CUtlVector< float > &frameDists = frame.m_TranslucentDists;
+	int nSort = MIN( frameDists.Count(), (int)CClientRenderablesList::MAX_GROUP_ENTITIES );
+
+	CUtlVector< CClientRenderablesList::CEntry > entries, hsorted, radixSorted;
+	CUtlVector< float > dists;
+	CUtlVector< uint32 > keys;
+	CUtlVector< unsigned short > order;
+	entries.SetCount( nSort );
+	radixSorted.SetCount( nSort );
+	keys.SetCount( nSort * 2 );
+	order.SetCount( nSort * 2 );
+	for ( int i = 0; i < nSort; i++ )
+	{
+		entries[i].m_pRenderable = NULL;
+		entries[i].m_iWorldListInfoLeaf = i;
+		entries[i].m_TwoPass = false;
+		entries[i].m_RenderHandle = INVALID_CLIENT_RENDER_HANDLE;
+	}
+
+	CFastTimer timer;
+	timer.Start();
+	for ( int j = 0; j < nIterations; j++ )
+	{
+		hsorted.CopyArray( entries.Base(), nSort );
+		dists.CopyArray( frameDists.Base(), nSort );
+		HSortEntities( hsorted.Base(), dists.Base(), nSort );
+	}
+	timer.End();
+	report.Time( "h-sort", timer, nIterations );
+
+	timer.Start();
+	for ( int j = 0; j < nIterations; j++ )
+	{
+		for ( int i = 0; i < nSort; i++ )
+		{
+			keys[i] = FloatSortKey( frameDists[i] );
+		}
+		RadixSortKeys( keys.Base(), order.Base(), keys.Base() + nSort, order.Base() + nSort, nSort );
+		for ( int i = 0; i < nSort; i++ )
+		{
+			radixSorted[i] = entries[ order[i] ];
+		}
+	}
+	timer.End();
+	report.Time( "radix sort", timer, nIterations );
+
+	for ( int i = 0; i < nSort; i++ )
+	{
+		int nRadix = radixSorted[i].m_iWorldListInfoLeaf;
+		int nHSort = hsorted[i].m_iWorldListInfoLeaf;
+		report.Check( frameDists[nRadix] == frameDists[nHSort], "entry %d is %g after the radix sort, %g after the h-sort", i, frameDists[nRadix], frameDists[nHSort] );
+
+		if ( i == 0 )
+			continue;
+
+		// The radix sort is also stable
+		int nPrev = radixSorted[i-1].m_iWorldListInfoLeaf;
+		report.Check( frameDists[nPrev] < frameDists[nRadix] || ( frameDists[nPrev] == frameDists[nRadix] && nPrev < nRadix ),
+			"radix sort entry %d (%g) is out of order after %g", i, frameDists[nRadix], frameDists[nPrev] );
+	}
+}
+
+static void TestFloatSortKeys( CDevTestReport &report )
+{
+	// In order, both zeros and the denormals included
+	static const float s_flOrdered[] =
+	{
+		-FLT_MAX, -1.0e10f, -1.0f, -FLT_MIN, -1.0e-40f, -0.0f, 0.0f, 1.0e-40f, FLT_MIN, 1.0f, 1.0e10f, FLT_MAX
+	};
+	for ( int i = 1; i < ARRAYSIZE( s_flOrdered ); i++ )
+	{
+		report.Check( FloatSortKey( s_flOrdered[i-1] ) < FloatSortKey( s_flOrdered[i] ), "key of %g isn't below the key of %g", s_flOrdered[i-1], s_flOrdered[i] );
+	}
+
+	for ( int i = 0; i < 4096; i++ )
+	{
+		float flA = RandomFloat( -1.0f, 1.0f ) * powf( 10.0f, (float)RandomInt( -30, 30 ) );
+		float flB = RandomFloat( -1.0f, 1.0f ) * powf( 10.0f, (float)RandomInt( -30, 30 ) );
+		uint32 nKeyA = FloatSortKey( flA );
+		uint32 nKeyB = FloatSortKey( flB );
+		report.Check( ( flA < flB ) == ( nKeyA < nKeyB ) && ( flA > flB ) == ( nKeyA > nKeyB ), "keys of %g and %g are out of order", flA, flB );
+	}
+}
+
+CON_COMMAND_F( cl_leafsystem_bench, "Replays the view captured with cl_leafsystem_record through the batched culling, dedupe and radix sort and checks them against the legacy code. Usage: cl_leafsystem_bench [iterations]", DEVTEST_COMMAND_FLAGS )
+{
+	int nIterations = args.ArgC() > 1 ? MAX( atoi( args[1] ), 1 ) : 100;
+
+	RecordedCullFrame_t randomFrame;
+	const RecordedCullFrame_t *pFrame = &s_RecordedCullFrame;
+	if ( !pFrame->m_LeafStart.Count() )
+	{
+		Msg( "Nothing recorded, using a random frame\n" );
+		GenerateRandomCullFrame( randomFrame );
+		pFrame = &randomFrame;
+	}
+
+	CDevTestReport report( "cl_leafsystem_bench" );
+	TestCullReplay( report, *pFrame, nIterations );
+	TestDedupeReplay( report, *pFrame, nIterations );
+	TestSortReplay( report, *pFrame, nIterations );
+	TestFloatSortKeys( report );
+	report.Finish();
+}
@@ -85,11 +85,13 @@ struct SetupRenderInfo_t
 	int m_nRenderFrame;
 	int m_nDetailBuildFrame;	// The "render frame" for detail objects
 	float m_flRenderDistSq;
+	const Frustum_t *m_pFrustum;	// If set, renderables outside its side planes are rejected before the engine tests
 	bool m_bDrawDetailObjects : 1;
 	bool m_bDrawTranslucentObjects : 1;
 
 	SetupRenderInfo_t()
 	{
+		m_pFrustum = NULL;
 		m_bDrawDetailObjects = true;
 		m_bDrawTranslucentObjects = true;
 	}
@@ -188,6 +190,10 @@ public:
 	// Project a shadow
 	virtual void ProjectShadow( ClientLeafShadowHandle_t handle, int nLeafCount, const int *pLeafList ) = 0;
 
+	// Project a batch of shadows; pLeafList holds each shadow's pLeafCounts[i] leaves back to back.
+	// Returns how many of the shadows landed in exactly the leaves they were already in.
+	virtual int ProjectShadows( int nShadows, const ClientLeafShadowHandle_t *pHandles, const int *pLeafCounts, const int *pLeafList ) = 0;
+
 	// Project a projected texture spotlight
 	virtual void ProjectFlashlight( ClientLeafShadowHandle_t handle, int nLeafCount, const int *pLeafList ) = 0;
 
@@ -106,6 +106,9 @@ static ConVar r_shadow_shortenfactor( "r_shadow_shortenfactor", "2" , 0, "Makes
 static ConVar r_shadow_mincastintensity( "r_shadow_mincastintensity", "0.3", FCVAR_CHEAT, "Minimum brightness of a light to be classed as shadow casting", true, 0, false, 0 );
 #endif
 static ConVar r_flashlight_version2( "r_flashlight_version2", "0", FCVAR_CHEAT | FCVAR_DEVELOPMENTONLY );
+static ConVar r_shadow_reproject_tolerance( "r_shadow_reproject_tolerance", "0.25", 0, "Distance a shadow caster must move before its shadow is re-projected", true, 0, false, 0 );
+static ConVar r_shadow_reproject_angle_tolerance( "r_shadow_reproject_angle_tolerance", "0.5", 0, "Degrees a shadow caster (or its light direction) must turn before its shadow is re-projected", true, 0, false, 0 );
+static ConVar r_shadow_batch_leaf_projection( "r_shadow_batch_leaf_projection", "1", 0, "Project dirty shadows into the client leaf system in one batch per frame" );
 
 ConVar r_flashlightdepthtexture( "r_flashlightdepthtexture", "1" );
 
@@ -834,6 +837,9 @@ public:
 	bool IsShadowingFromWorldLights() const { return m_bShadowFromWorldLights && !m_bSuppressShadowFromWorldLights; }
 #endif
 
+	// Prints (and resets) the re-projection counters
+	void PrintReprojectionStats();
+
 private:
 	enum
 	{
@@ -857,6 +863,7 @@ private:
 		Vector					m_LastOrigin;
 		QAngle					m_LastAngles;
 #ifdef DYNAMIC_RTT_SHADOWS
+		Vector					m_LastShadowDir;	// Shadow direction at the last projection
 		Vector					m_CurrentLightPos;	// When shadowing from local lights, stores the position of the currently shadowing light
 		Vector					m_TargetLightPos;	// When shadowing from local lights, stores the position of the new shadowing light
 		float					m_LightPosLerp;		// Lerp progress when going from current to target light
@@ -873,6 +880,14 @@ private:
 	void UpdateBrushShadow( IClientRenderable *pRenderable, ClientShadowHandle_t handle );
 	void UpdateShadow( ClientShadowHandle_t handle, bool force );
 
+	// Has the caster moved or turned far enough since its last projection?
+	bool ShouldReprojectShadow( const ClientShadow_t &shadow, const Vector &origin, const QAngle &angles ) const;
+
+	// Adds a shadow to the client leaf system, or queues it while the dirty list is being updated
+	void ProjectShadowIntoLeaves( ClientShadowHandle_t handle, int nLeafCount, const int *pLeafList );
+	void FlushDeferredLeafProjections();
+	void CancelDeferredLeafProjection( ClientLeafShadowHandle_t handle );
+
 #ifdef DYNAMIC_RTT_SHADOWS
 	// Updates shadow cast direction when shadowing from world lights
 	void UpdateShadowDirectionFromLocalLightSource( ClientShadowHandle_t shadowHandle );
@@ -1037,6 +1052,18 @@ private:
 	CUtlRBTree< ClientShadowHandle_t, unsigned short >	m_DirtyShadows;
 	CUtlVector< ClientShadowHandle_t > m_TransparentShadows;
 
+	// Leaf projections queued up by PreRender; m_DeferredLeafList holds each shadow's leaves back to back
+	bool m_bDeferLeafProjection;
+	CUtlVector< ClientLeafShadowHandle_t > m_DeferredLeafShadows;
+	CUtlVector< int > m_DeferredLeafCounts;
+	CUtlVector< int > m_DeferredLeafList;
+
+	// Re-projection counters for r_shadow_reproject_stats
+	int m_nShadowUpdates;
+	int m_nShadowReprojections;
+	int m_nLeafProjections;
+	int m_nLeafProjectionsReused;
+
 #ifdef ASW_PROJECTED_TEXTURES
 	int m_nPrevFrameCount;
 #endif
@@ -1272,6 +1299,11 @@ CClientShadowMgr::CClientShadowMgr() :
 {
 	m_nDepthTextureResolution = r_flashlightdepthres.GetInt();
 	m_bThreaded = false;
+	m_bDeferLeafProjection = false;
+	m_nShadowUpdates = 0;
+	m_nShadowReprojections = 0;
+	m_nLeafProjections = 0;
+	m_nLeafProjectionsReused = 0;
 }
 
 
@@ -1297,6 +1329,11 @@ CON_COMMAND_F( r_shadowdir, "Set shadow direction", FCVAR_CHEAT )
 	}
 }
 
+CON_COMMAND( r_shadow_reproject_stats, "Prints how many shadow updates re-projected their shadow since the last call" )
+{
+	s_ClientShadowMgr.PrintReprojectionStats();
+}
+
 CON_COMMAND_F( r_shadowangles, "Set shadow angles", FCVAR_CHEAT )
 {
 	Vector dir;
@@ -1658,6 +1695,10 @@ void CClientShadowMgr::GetShadowColor( unsigned char *r, unsigned char *g, unsig
 void CClientShadowMgr::LevelInitPreEntity()
 {
 	m_bUpdatingDirtyShadows = false;
+	m_bDeferLeafProjection = false;
+	m_DeferredLeafShadows.RemoveAll();
+	m_DeferredLeafCounts.RemoveAll();
+	m_DeferredLeafList.RemoveAll();
 
 #ifdef DYNAMIC_RTT_SHADOWS
 	// Default setting for this, can be overridden by shadow control entities
@@ -2123,6 +2164,7 @@ ClientShadowHandle_t CClientShadowMgr::CreateProjectedTexture( ClientEntityHandl
 	shadow.m_nRenderFrame = -1;
 #ifdef DYNAMIC_RTT_SHADOWS
 	shadow.m_ShadowDir = GetShadowDirection();
+	shadow.m_LastShadowDir = shadow.m_ShadowDir;
 	shadow.m_CurrentLightPos.Init( FLT_MAX, FLT_MAX, FLT_MAX );
 	shadow.m_TargetLightPos.Init( FLT_MAX, FLT_MAX, FLT_MAX );
 	shadow.m_LightPosLerp = FLT_MAX;
@@ -2279,6 +2321,7 @@ void CClientShadowMgr::DestroyShadow( ClientShadowHandle_t handle )
 {
 	Assert( m_Shadows.IsValidIndex(handle) );
 	RemoveShadowFromDirtyList( handle );
+	CancelDeferredLeafProjection( m_Shadows[handle].m_ClientLeafShadowHandle );
 	shadowmgr->DestroyShadow( m_Shadows[handle].m_ShadowHandle );
 	ClientLeafSystem()->RemoveShadow( m_Shadows[handle].m_ClientLeafShadowHandle );
 	CleanUpRenderToTextureShadow( handle );
@@ -2759,7 +2802,7 @@ void CClientShadowMgr::BuildOrthoShadow( IClientRenderable* pRenderable,
 
 	// Add the shadow to the client leaf system so it correctly marks 
 	// leafs as being affected by a particular shadow
-	ClientLeafSystem()->ProjectShadow( m_Shadows[handle].m_ClientLeafShadowHandle, nCount, pLeafList );
+	ProjectShadowIntoLeaves( handle, nCount, pLeafList );
 }
 
 
@@ -2942,7 +2985,7 @@ void CClientShadowMgr::BuildRenderToTextureShadow( IClientRenderable* pRenderabl
 
 	// Add the shadow to the client leaf system so it correctly marks 
 	// leafs as being affected by a particular shadow
-	ClientLeafSystem()->ProjectShadow( m_Shadows[handle].m_ClientLeafShadowHandle, nCount, pLeafList );
+	ProjectShadowIntoLeaves( handle, nCount, pLeafList );
 }
 
 static void LineDrawHelper( const Vector &startShadowSpace, const Vector &endShadowSpace, 
@@ -3321,6 +3364,7 @@ void CClientShadowMgr::PreRender()
 	}
 
 	m_bUpdatingDirtyShadows = true;
+	m_bDeferLeafProjection = r_shadow_batch_leaf_projection.GetBool();
 
 	unsigned short i = m_DirtyShadows.FirstInorder();
 	while ( i != m_DirtyShadows.InvalidIndex() )
@@ -3337,6 +3381,8 @@ void CClientShadowMgr::PreRender()
 	}
 	m_DirtyShadows.RemoveAll();
 
+	FlushDeferredLeafProjections();
+
 	// Transparent shadows must remain dirty, since they were not re-projected
 	int nCount = m_TransparentShadows.Count();
 	for ( int i = 0; i < nCount; ++i )
@@ -3478,6 +3524,116 @@ void CClientShadowMgr::MarkRenderToTextureShadowDirty( ClientShadowHandle_t hand
 }
 
 
+//-----------------------------------------------------------------------------
+// Has the caster moved or turned far enough since its last projection to be
+// worth re-projecting? Sub-tolerance motion leaves the old projection in place;
+// it's re-projected once the accumulated motion crosses the tolerance.
+//-----------------------------------------------------------------------------
+bool CClientShadowMgr::ShouldReprojectShadow( const ClientShadow_t &shadow, const Vector &origin, const QAngle &angles ) const
+{
+	// New shadows and forced updates (see AddToDirtyShadowList) have FLT_MAX in here
+	if ( shadow.m_LastOrigin.x == FLT_MAX || shadow.m_LastAngles.x == FLT_MAX )
+		return true;
+
+	float flTolerance = r_shadow_reproject_tolerance.GetFloat();
+	if ( origin.DistToSqr( shadow.m_LastOrigin ) > flTolerance * flTolerance )
+		return true;
+
+	float flAngleTolerance = r_shadow_reproject_angle_tolerance.GetFloat();
+	for ( int i = 0; i < 3; ++i )
+	{
+		if ( fabs( AngleDiff( angles[i], shadow.m_LastAngles[i] ) ) > flAngleTolerance )
+			return true;
+	}
+
+#ifdef DYNAMIC_RTT_SHADOWS
+	// The shadow swings while lerping between world lights
+	if ( shadow.m_LightPosLerp < 1.0f )
+	{
+		if ( flAngleTolerance <= 0.0f )
+			return true;
+
+		float flCosTolerance = cos( DEG2RAD( flAngleTolerance ) );
+		if ( DotProduct( shadow.m_ShadowDir, shadow.m_LastShadowDir ) < flCosTolerance )
+			return true;
+	}
+#endif
+
+	return false;
+}
+
+
+//-----------------------------------------------------------------------------
+// Adds a shadow to the client leaf system. While PreRender is walking the dirty
+// list the leaf projections are queued and handed over in one batch.
+//-----------------------------------------------------------------------------
+void CClientShadowMgr::ProjectShadowIntoLeaves( ClientShadowHandle_t handle, int nLeafCount, const int *pLeafList )
+{
+	ClientLeafShadowHandle_t leafHandle = m_Shadows[handle].m_ClientLeafShadowHandle;
+	if ( !m_bDeferLeafProjection )
+	{
+		ClientLeafSystem()->ProjectShadow( leafHandle, nLeafCount, pLeafList );
+		return;
+	}
+
+	// The dirty list is a set, so each shadow is only queued once per batch
+	Assert( m_DeferredLeafShadows.Find( leafHandle ) == m_DeferredLeafShadows.InvalidIndex() );
+	m_DeferredLeafShadows.AddToTail( leafHandle );
+	m_DeferredLeafCounts.AddToTail( nLeafCount );
+	m_DeferredLeafList.AddMultipleToTail( nLeafCount, pLeafList );
+}
+
+void CClientShadowMgr::FlushDeferredLeafProjections()
+{
+	m_bDeferLeafProjection = false;
+
+	int nShadows = m_DeferredLeafShadows.Count();
+	if ( nShadows == 0 )
+		return;
+
+	m_nLeafProjections += nShadows;
+	m_nLeafProjectionsReused += ClientLeafSystem()->ProjectShadows( nShadows, m_DeferredLeafShadows.Base(),
+		m_DeferredLeafCounts.Base(), m_DeferredLeafList.Base() );
+
+	m_DeferredLeafShadows.RemoveAll();
+	m_DeferredLeafCounts.RemoveAll();
+	m_DeferredLeafList.RemoveAll();
+}
+
+void CClientShadowMgr::CancelDeferredLeafProjection( ClientLeafShadowHandle_t handle )
+{
+	int nStart = 0;
+	for ( int i = 0; i < m_DeferredLeafShadows.Count(); ++i )
+	{
+		int nLeafCount = m_DeferredLeafCounts[i];
+		if ( m_DeferredLeafShadows[i] == handle )
+		{
+			m_DeferredLeafList.RemoveMultiple( nStart, nLeafCount );
+			m_DeferredLeafCounts.Remove( i );
+			m_DeferredLeafShadows.Remove( i );
+			return;
+		}
+		nStart += nLeafCount;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Prints (and resets) the re-projection counters
+//-----------------------------------------------------------------------------
+void CClientShadowMgr::PrintReprojectionStats()
+{
+	Msg( "Shadow updates: %d, re-projected: %d (%.1f%%)\n", m_nShadowUpdates, m_nShadowReprojections,
+		m_nShadowUpdates ? 100.0f * m_nShadowReprojections / m_nShadowUpdates : 0.0f );
+	Msg( "Batched leaf projections: %d, leaf lists reused: %d\n", m_nLeafProjections, m_nLeafProjectionsReused );
+
+	m_nShadowUpdates = 0;
+	m_nShadowReprojections = 0;
+	m_nLeafProjections = 0;
+	m_nLeafProjectionsReused = 0;
+}
+
+
 //-----------------------------------------------------------------------------
 // Update a shadow
 //-----------------------------------------------------------------------------
@@ -3536,15 +3692,17 @@ void CClientShadowMgr::UpdateShadow( ClientShadowHandle_t handle, bool force )
 	const Vector& origin = pRenderable->GetRenderOrigin();
 	const QAngle& angles = pRenderable->GetRenderAngles();
 
-#ifdef DYNAMIC_RTT_SHADOWS
-	if (force || (origin != shadow.m_LastOrigin) || (angles != shadow.m_LastAngles) || shadow.m_LightPosLerp < 1.0f)
-#else
-	if (force || (origin != shadow.m_LastOrigin) || (angles != shadow.m_LastAngles))
-#endif
+	++m_nShadowUpdates;
+	if ( force || ShouldReprojectShadow( shadow, origin, angles ) )
 	{
+		++m_nShadowReprojections;
+
 		// Store off the new pos/orientation
 		VectorCopy( origin, shadow.m_LastOrigin );
 		VectorCopy( angles, shadow.m_LastAngles );
+#ifdef DYNAMIC_RTT_SHADOWS
+		VectorCopy( shadow.m_ShadowDir, shadow.m_LastShadowDir );
+#endif
 
 		CMatRenderContextPtr pRenderContext( materials );
 		const model_t *pModel = pRenderable->GetModel();
@@ -21,6 +21,7 @@
 #include "env_detail_controller.h"
 #include "tier0/icommandline.h"
 #include "c_world.h"
+#include "vstdlib/jobthread.h"
 
 #include "tier0/valve_minmax_off.h"
 #include <algorithm>
@@ -36,6 +37,8 @@
 #endif
 
 #include "materialsystem/imaterialsystemhardwareconfig.h"
+#include "devtest.h"
+#include "tier1/fmtstr.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -50,6 +53,7 @@ struct model_t;
 
 ConVar cl_detaildist( "cl_detaildist", "1200", 0, "Distance at which detail props are no longer visible" );
 ConVar cl_detailfade( "cl_detailfade", "400", 0, "Distance across which detail props fade in" );
+ConVar cl_detail_threaded_buildout( "cl_detail_threaded_buildout", "1", 0, "Build the detail sprite quads of each leaf in parallel before drawing them" );
 #if defined( USE_DETAIL_SHAPES ) 
 ConVar cl_detail_max_sway( "cl_detail_max_sway", "0", FCVAR_ARCHIVE, "Amplitude of the detail prop sway" );
 ConVar cl_detail_avoid_radius( "cl_detail_avoid_radius", "0", FCVAR_ARCHIVE, "radius around detail sprite to avoid players" );
@@ -326,6 +330,15 @@ struct FastSpriteQuadBuildoutBufferNonSIMDView_t
 };
 
 
+// A finished detail sprite vertex, ready to be copied into the mesh
+struct DetailSpriteVertex_t
+{
+	float m_Pos[3];
+	uint8 m_Color[4];
+	float m_TexCoord[2];
+};
+
+
 class CFastDetailLeafSpriteList : public CClientLeafSubSystemData
 {
 	friend class CDetailObjectSystem;
@@ -410,6 +423,10 @@ public:
 	DetailPropLightstylesLump_t& DetailLighting( int i ) { return m_DetailLighting[i]; }
 	DetailPropSpriteDict_t& DetailSpriteDict( int i ) { return m_DetailSpriteDict[i]; }
 
+	// Checks the serial and threaded sprite builds and the back to front
+	// sorts against scalar references on synthetic leaves
+	void TestFastSpriteBuildout( int nSprites, int nLeaves, int nIterations );
+
 private:
 	struct DetailModelDict_t
 	{
@@ -428,11 +445,41 @@ private:
 		float m_flDistance;
 	};
 
+	// Sprites of one leaf built out by RenderFastSprites. The sort info holds twice
+	// the leaf's sprite count, the second half being scratch for the sort.
+	struct FastSpriteLeafJob_t
+	{
+		CFastDetailLeafSpriteList *m_pData;
+		SortInfo_t *m_pSortInfo;
+		FastSpriteQuadBuildoutBufferX4_t *m_pBuildout;
+		DetailSpriteVertex_t *m_pVerts;
+		int m_nCount;
+	};
+
+	struct FastSpriteView_t
+	{
+		Vector m_vecOrigin;
+		Vector m_vecForward;
+		Vector m_vecRight;
+		Vector m_vecUp;
+		const VPlane *m_pFrustum;
+	};
+
 	int BuildOutSortedSprites( CFastDetailLeafSpriteList *pData,
 							   Vector const &viewOrigin,
 							   Vector const &viewForward,
 							   Vector const &viewRight,
-							   Vector const &viewUp );
+							   Vector const &viewUp,
+							   SortInfo_t *pSortOut,
+							   FastSpriteQuadBuildoutBufferX4_t *pBuildout,
+							   const VPlane *pFrustum );
+
+	// Writes four vertices per sorted sprite
+	static void BuildSortedSpriteVerts( const SortInfo_t *pDraw, int nCount, const FastSpriteQuadBuildoutBufferX4_t *pBuildout, DetailSpriteVertex_t *pVerts );
+
+	void BuildFastSpriteLeaf( FastSpriteLeafJob_t &job );
+	void EnsureFastSpriteJobBuffers( int nSprites );
+	int BuildFastSpriteJobs( bool bThreaded );
 
 	void RenderFastSprites( const Vector &viewOrigin, const Vector &viewForward, const Vector &viewRight, const Vector &viewUp, int nLeafCount, LeafIndex_t const * pLeafList );
 
@@ -461,6 +508,10 @@ private:
 
 	// Sorts sprites in back-to-front order
 	static bool SortLessFunc( const SortInfo_t &left, const SortInfo_t &right );
+	static void SortBackToFront( SortInfo_t *pSortInfo, SortInfo_t *pScratch, int nCount );
+	static void InsertionSortBackToFront( SortInfo_t *pSortInfo, int nCount );
+	static void RadixSortBackToFront( SortInfo_t *pSortInfo, SortInfo_t *pScratch, int nCount );
+	static void TestSortBackToFront( CDevTestReport &report, int nIterations );
 	int SortSpritesBackToFront( int nLeaf, const Vector &viewOrigin, const Vector &viewForward, SortInfo_t *pSortInfo );
 
 	// For fast detail object insertion
@@ -486,6 +537,14 @@ private:
 	SortInfo_t *m_pFastSortInfo;
 	FastSpriteQuadBuildoutBufferX4_t *m_pBuildoutBuffer;
 
+	// Per leaf buffers for RenderFastSprites, sized for m_nFastSpriteJobCapacity sprites
+	CUtlVector< FastSpriteLeafJob_t > m_FastSpriteJobs;
+	FastSpriteView_t m_FastSpriteView;
+	SortInfo_t *m_pJobSortInfo;
+	FastSpriteQuadBuildoutBufferX4_t *m_pJobBuildout;
+	DetailSpriteVertex_t *m_pJobVerts;
+	int m_nFastSpriteJobCapacity;
+
 	float m_flDefaultFadeStart;
 	float m_flDefaultFadeEnd;
 
@@ -1402,6 +1461,10 @@ CDetailObjectSystem::CDetailObjectSystem() : m_DetailSpriteDict( 0, 32 ), m_Deta
 	m_pSortInfo = NULL;
 	m_pFastSortInfo = NULL;
 	m_pBuildoutBuffer = NULL;
+	m_pJobSortInfo = NULL;
+	m_pJobBuildout = NULL;
+	m_pJobVerts = NULL;
+	m_nFastSpriteJobCapacity = 0;
 }
 
 void CDetailObjectSystem::FreeSortBuffers( void )
@@ -1421,6 +1484,16 @@ void CDetailObjectSystem::FreeSortBuffers( void )
 		MemAlloc_FreeAligned(  m_pBuildoutBuffer );
 		m_pBuildoutBuffer = NULL;
 	}
+	if ( m_pJobSortInfo )
+	{
+		MemAlloc_FreeAligned( m_pJobSortInfo );
+		MemAlloc_FreeAligned( m_pJobBuildout );
+		MemAlloc_FreeAligned( m_pJobVerts );
+		m_pJobSortInfo = NULL;
+		m_pJobBuildout = NULL;
+		m_pJobVerts = NULL;
+	}
+	m_nFastSpriteJobCapacity = 0;
 }
 
 CDetailObjectSystem::~CDetailObjectSystem()
@@ -1766,13 +1839,14 @@ void CDetailObjectSystem::UnserializeModels( CUtlBuffer& buf )
 
 	if ( nMaxOldInLeaf )
 	{
+		// The second half is scratch for SortBackToFront
 		m_pSortInfo = reinterpret_cast<SortInfo_t *> (
-			MemAlloc_AllocAligned( (3 + nMaxOldInLeaf ) * sizeof( SortInfo_t ), sizeof( fltx4 ) ) );
+			MemAlloc_AllocAligned( 2 * (3 + nMaxOldInLeaf ) * sizeof( SortInfo_t ), sizeof( fltx4 ) ) );
 	}
 	if ( nMaxFastInLeaf )
 	{
 		m_pFastSortInfo = reinterpret_cast<SortInfo_t *> (
-			MemAlloc_AllocAligned( (3 + nMaxFastInLeaf ) * sizeof( SortInfo_t ), sizeof( fltx4 ) ) );
+			MemAlloc_AllocAligned( 2 * (3 + nMaxFastInLeaf ) * sizeof( SortInfo_t ), sizeof( fltx4 ) ) );
 
 		m_pBuildoutBuffer = reinterpret_cast<FastSpriteQuadBuildoutBufferX4_t *> (
 			MemAlloc_AllocAligned( 
@@ -2139,14 +2213,83 @@ int CDetailObjectSystem::SortSpritesBackToFront( int nLeaf, const Vector &viewOr
 	if ( nCount )
 	{
 		VPROF( "CDetailObjectSystem::SortSpritesBackToFront -- Sort" );
-		std::make_heap( pSortInfo, pSortInfo + nCount, SortLessFunc ); 
-		std::sort_heap( pSortInfo, pSortInfo + nCount, SortLessFunc ); 
+		SortBackToFront( pSortInfo, pSortInfo + ( nDetailObjectCount - nFirstDetailObject ), nCount );
 	}
 
 	return nCount;
 }
 
 
+//-----------------------------------------------------------------------------
+// Stable sort by decreasing distance. Distances are squared, so never
+// negative, and their bits order the same way as their values; the radix
+// sort runs on the complemented bits to put the furthest first.
+//-----------------------------------------------------------------------------
+void CDetailObjectSystem::SortBackToFront( SortInfo_t *pSortInfo, SortInfo_t *pScratch, int nCount )
+{
+	if ( nCount < 16 )
+	{
+		InsertionSortBackToFront( pSortInfo, nCount );
+	}
+	else
+	{
+		RadixSortBackToFront( pSortInfo, pScratch, nCount );
+	}
+}
+
+void CDetailObjectSystem::InsertionSortBackToFront( SortInfo_t *pSortInfo, int nCount )
+{
+	for ( int i = 1; i < nCount; i++ )
+	{
+		SortInfo_t info = pSortInfo[i];
+		int j = i;
+		for ( ; j > 0 && TREATASINT( pSortInfo[j-1].m_flDistance ) < TREATASINT( info.m_flDistance ); j-- )
+		{
+			pSortInfo[j] = pSortInfo[j-1];
+		}
+		pSortInfo[j] = info;
+	}
+}
+
+void CDetailObjectSystem::RadixSortBackToFront( SortInfo_t *pSortInfo, SortInfo_t *pScratch, int nCount )
+{
+	SortInfo_t *pSrc = pSortInfo;
+	SortInfo_t *pDest = pScratch;
+	for ( int nShift = 0; nShift < 32; nShift += 8 )
+	{
+		int nHistogram[256];
+		memset( nHistogram, 0, sizeof( nHistogram ) );
+		for ( int i = 0; i < nCount; i++ )
+		{
+			nHistogram[ ( ~TREATASINT( pSrc[i].m_flDistance ) >> nShift ) & 0xff ]++;
+		}
+
+		// Skip digits every distance shares
+		if ( nHistogram[ ( ~TREATASINT( pSrc[0].m_flDistance ) >> nShift ) & 0xff ] == nCount )
+			continue;
+
+		int nOffset = 0;
+		for ( int i = 0; i < 256; i++ )
+		{
+			int nBucket = nHistogram[i];
+			nHistogram[i] = nOffset;
+			nOffset += nBucket;
+		}
+
+		for ( int i = 0; i < nCount; i++ )
+		{
+			pDest[ nHistogram[ ( ~TREATASINT( pSrc[i].m_flDistance ) >> nShift ) & 0xff ]++ ] = pSrc[i];
+		}
+		V_swap( pSrc, pDest );
+	}
+
+	if ( pSrc != pSortInfo )
+	{
+		memcpy( pSortInfo, pSrc, nCount * sizeof( SortInfo_t ) );
+	}
+}
+
+
 #define MAGIC_NUMBER (1<<23)
 #ifdef VALVE_BIG_ENDIAN
 #define MANTISSA_LSB_OFFSET 3
@@ -2163,15 +2306,20 @@ int CDetailObjectSystem::BuildOutSortedSprites( CFastDetailLeafSpriteList *pData
 												Vector const &viewOrigin,
 												Vector const &viewForward,
 												Vector const &viewRight,
-												Vector const &viewUp )
+												Vector const &viewUp,
+												SortInfo_t *pSortOut,
+												FastSpriteQuadBuildoutBufferX4_t *pBuildout,
+												const VPlane *pFrustum )
 {
 	// part 1 - do all vertex math, fading, etc into a buffer, using as much simd as we can
 	int nSIMDSprites = pData->m_nNumSIMDSprites;
 	FastSpriteX4_t const *pSprites = pData->m_pSprites;
-	SortInfo_t *pOut = m_pFastSortInfo;
-	FastSpriteQuadBuildoutBufferX4_t *pQuadBufferOut = m_pBuildoutBuffer;
+	SortInfo_t *pOut = pSortOut;
+	FastSpriteQuadBuildoutBufferX4_t *pQuadBufferOut = pBuildout;
 	int curidx = 0;
-	int nLastBfMask = 0;
+
+	// the lanes of the last group past m_nNumSprites are copies of its first sprite
+	int nLastGroupMask = ( 1 << ( pData->m_nNumSprites - 4 * ( nSIMDSprites - 1 ) ) ) - 1;
 
 	FourVectors vecViewPos;
 	vecViewPos.DuplicateVector( viewOrigin );
@@ -2185,6 +2333,18 @@ int CDetailObjectSystem::BuildOutSortedSprites( CFastDetailLeafSpriteList *pData
 	FourVectors vecFwd;
 	vecFwd.DuplicateVector( viewForward );
 
+	// side planes of the view frustum, culled against a sphere around each quad
+	FourVectors vecPlaneNormal[4];
+	fltx4 planeDist[4];
+	if ( pFrustum )
+	{
+		for ( int i = 0; i < 4; i++ )
+		{
+			vecPlaneNormal[i].DuplicateVector( pFrustum[i].m_Normal );
+			planeDist[i] = ReplicateX4( pFrustum[i].m_Dist );
+		}
+	}
+
 	do
 	{
 		// calculate alpha
@@ -2192,77 +2352,232 @@ int CDetailObjectSystem::BuildOutSortedSprites( CFastDetailLeafSpriteList *pData
 		ofs -= vecViewPos;
 		fltx4 ofsDotFwd = ofs * vecFwd;
 		fltx4 distanceSquared = ofs * ofs;
-		nLastBfMask = TestSignSIMD( OrSIMD( ofsDotFwd, CmpGtSIMD( distanceSquared, maxsqdist ) ) );		//  cull
-		if ( nLastBfMask != 0xf )
+		int nBfMask = TestSignSIMD( OrSIMD( ofsDotFwd, CmpGtSIMD( distanceSquared, maxsqdist ) ) );		//  cull
+		if ( nBfMask != 0xf )
 		{
-			FourVectors dx1;
-			dx1.x = fnegate( ofs.y );
-			dx1.y = ( ofs.x );
-			dx1.z = Four_Zeros;
-			dx1.VectorNormalizeFast();
-				
-			FourVectors vecDx = dx1;
-			FourVectors vecDy = vecUp;
-
-			FourVectors vecPos0 = pSprites->m_Pos;
-
-			vecDx *= pSprites->m_HalfWidth;
-			vecDy *= pSprites->m_Height;
-			fltx4 alpha = MulSIMD( falloffFactor, SubSIMD( distanceSquared, startFade ) );
-			alpha = SubSIMD( Four_Ones, MinSIMD( MaxSIMD( alpha, Four_Zeros), Four_Ones ) );
-
-			pQuadBufferOut->m_Alpha = AddSIMD( Four_MagicNumbers, 
-											   MulSIMD( Four_255s,alpha ) );
-
-			vecPos0 += vecDx;
-			pQuadBufferOut->m_Coords[0] = vecPos0;
-			vecPos0 -= vecDy;
-			pQuadBufferOut->m_Coords[1] = vecPos0;
-			vecPos0 -= vecDx;
-			vecPos0 -= vecDx;
-			pQuadBufferOut->m_Coords[2] = vecPos0;
-			vecPos0 += vecDy;
-			pQuadBufferOut->m_Coords[3] = vecPos0;
-
-			fltx4 fetch4 = *( ( fltx4 *) ( &pSprites->m_pSpriteDefs[0] ) );
-			*( (fltx4 *) ( & ( pQuadBufferOut->m_pSpriteDefs[0] ) ) ) = fetch4;
-
-			fetch4 = *( ( fltx4 *) ( &pSprites->m_RGBColor[0][0] ) );
-			*( (fltx4 *) ( & ( pQuadBufferOut->m_RGBColor[0][0] ) ) ) = fetch4;
-
-			//!! bug!! store distance
-			// !! speed!! simd?
-			pOut[0].m_nIndex = curidx;
-			pOut[0].m_flDistance = SubFloat( distanceSquared, 0 );
-			pOut[1].m_nIndex = curidx+1;
-			pOut[1].m_flDistance = SubFloat( distanceSquared, 1 );
-			pOut[2].m_nIndex = curidx+2;
-			pOut[2].m_flDistance = SubFloat( distanceSquared, 2 );
-			pOut[3].m_nIndex = curidx+3;
-			pOut[3].m_flDistance = SubFloat( distanceSquared, 3 );
-			curidx += 4;
-			pOut += 4;
-			pQuadBufferOut++;
+			// then per sprite: too far to have any alpha, or outside the frustum
+			fltx4 culled = CmpGtSIMD( distanceSquared, maxsqdist );
+			if ( pFrustum )
+			{
+				// the quad hangs from m_Pos by m_Height, which is negative for upright sprites
+				fltx4 halfHeight = MulSIMD( pSprites->m_Height, Four_PointFives );
+				fltx4 radius = AddSIMD( MaxSIMD( pSprites->m_HalfWidth, fnegate( pSprites->m_HalfWidth ) ),
+										MaxSIMD( halfHeight, fnegate( halfHeight ) ) );
+				FourVectors center = pSprites->m_Pos;
+				center.z = SubSIMD( center.z, halfHeight );
+				for ( int i = 0; i < 4; i++ )
+				{
+					fltx4 planeDistToSphere = AddSIMD( SubSIMD( center * vecPlaneNormal[i], planeDist[i] ), radius );
+					culled = OrSIMD( culled, CmpLtSIMD( planeDistToSphere, Four_Zeros ) );
+				}
+			}
+
+			int nVisibleMask = ~TestSignSIMD( culled ) & 0xf;
+			if ( nSIMDSprites == 1 )
+			{
+				nVisibleMask &= nLastGroupMask;
+			}
+
+			if ( nVisibleMask )
+			{
+				FourVectors dx1;
+				dx1.x = fnegate( ofs.y );
+				dx1.y = ( ofs.x );
+				dx1.z = Four_Zeros;
+				dx1.VectorNormalizeFast();
+
+				FourVectors vecDx = dx1;
+				FourVectors vecDy = vecUp;
+
+				FourVectors vecPos0 = pSprites->m_Pos;
+
+				vecDx *= pSprites->m_HalfWidth;
+				vecDy *= pSprites->m_Height;
+				fltx4 alpha = MulSIMD( falloffFactor, SubSIMD( distanceSquared, startFade ) );
+				alpha = SubSIMD( Four_Ones, MinSIMD( MaxSIMD( alpha, Four_Zeros), Four_Ones ) );
+
+				pQuadBufferOut->m_Alpha = AddSIMD( Four_MagicNumbers,
+												   MulSIMD( Four_255s,alpha ) );
+
+				vecPos0 += vecDx;
+				pQuadBufferOut->m_Coords[0] = vecPos0;
+				vecPos0 -= vecDy;
+				pQuadBufferOut->m_Coords[1] = vecPos0;
+				vecPos0 -= vecDx;
+				vecPos0 -= vecDx;
+				pQuadBufferOut->m_Coords[2] = vecPos0;
+				vecPos0 += vecDy;
+				pQuadBufferOut->m_Coords[3] = vecPos0;
+
+				fltx4 fetch4 = *( ( fltx4 *) ( &pSprites->m_pSpriteDefs[0] ) );
+				*( (fltx4 *) ( & ( pQuadBufferOut->m_pSpriteDefs[0] ) ) ) = fetch4;
+
+				fetch4 = *( ( fltx4 *) ( &pSprites->m_RGBColor[0][0] ) );
+				*( (fltx4 *) ( & ( pQuadBufferOut->m_RGBColor[0][0] ) ) ) = fetch4;
+
+				for ( int nLane = 0; nLane < 4; nLane++ )
+				{
+					if ( nVisibleMask & ( 1 << nLane ) )
+					{
+						pOut->m_nIndex = curidx + nLane;
+						pOut->m_flDistance = SubFloat( distanceSquared, nLane );
+						pOut++;
+					}
+				}
+				curidx += 4;
+				pQuadBufferOut++;
+			}
 		}
 		pSprites++;
 	} while( --nSIMDSprites );
 
-	// adjust count for tail
-	int nCount = pOut - m_pFastSortInfo;
-	if ( nLastBfMask != 0xf )						// if last not skipped
-		nCount -= ( 0 - pData->m_nNumSprites ) & 3;
-
-	// part 2 - sort
+	// part 2 - sort, using the space after the padded sprite count as scratch
+	int nCount = pOut - pSortOut;
 	if ( nCount )
 	{
 		VPROF( "CDetailObjectSystem::SortSpritesBackToFront -- Sort" );
-		std::make_heap( m_pFastSortInfo, m_pFastSortInfo + nCount, SortLessFunc ); 
-		std::sort_heap( m_pFastSortInfo, m_pFastSortInfo + nCount, SortLessFunc ); 
+		SortBackToFront( pSortOut, pSortOut + 4 * pData->m_nNumSIMDSprites, nCount );
 	}
 	return nCount;
 }
 
 
+//-----------------------------------------------------------------------------
+// part 3 - turns the sorted sprites into finished quad vertices
+//-----------------------------------------------------------------------------
+static inline void SetDetailSpriteVertex( DetailSpriteVertex_t &vert, float x, float y, float z, uint8 const *pColor, float s, float t )
+{
+	vert.m_Pos[0] = x;
+	vert.m_Pos[1] = y;
+	vert.m_Pos[2] = z;
+	vert.m_Color[0] = pColor[0];
+	vert.m_Color[1] = pColor[1];
+	vert.m_Color[2] = pColor[2];
+	vert.m_Color[3] = pColor[3];
+	vert.m_TexCoord[0] = s;
+	vert.m_TexCoord[1] = t;
+}
+
+void CDetailObjectSystem::BuildSortedSpriteVerts( const SortInfo_t *pDraw, int nCount, const FastSpriteQuadBuildoutBufferX4_t *pBuildout, DetailSpriteVertex_t *pVerts )
+{
+	FastSpriteQuadBuildoutBufferNonSIMDView_t const *pQuadBuffer =
+		( FastSpriteQuadBuildoutBufferNonSIMDView_t const *) pBuildout;
+
+	COMPILE_TIME_ASSERT( sizeof( FastSpriteQuadBuildoutBufferNonSIMDView_t ) ==
+						 sizeof( FastSpriteQuadBuildoutBufferX4_t ) );
+
+	for ( ; nCount > 0; --nCount, ++pDraw, pVerts += 4 )
+	{
+		int nSIMDIdx = pDraw->m_nIndex >> 2;
+		int nSubIdx = pDraw->m_nIndex & 3;
+
+		FastSpriteQuadBuildoutBufferNonSIMDView_t const *pquad = pQuadBuffer+nSIMDIdx;
+
+		// voodoo - since everything is in 4s, offset structure pointer by a couple of floats to handle sub-index
+		pquad = (FastSpriteQuadBuildoutBufferNonSIMDView_t const *) ( ( (intp) ( pquad ) )+ ( nSubIdx << 2 ) );
+		uint8 const *pColorsCasted = reinterpret_cast<uint8 const *> ( pquad->m_Alpha );
+
+		uint8 color[4];
+		color[0] = pquad->m_RGBColor[0][0];
+		color[1] = pquad->m_RGBColor[0][1];
+		color[2] = pquad->m_RGBColor[0][2];
+		color[3] = pColorsCasted[MANTISSA_LSB_OFFSET];
+
+		DetailPropSpriteDict_t *pDict = pquad->m_pSpriteDefs[0];
+
+		SetDetailSpriteVertex( pVerts[0], pquad->m_flX0[0], pquad->m_flY0[0], pquad->m_flZ0[0], color, pDict->m_TexLR.x, pDict->m_TexLR.y );
+		SetDetailSpriteVertex( pVerts[1], pquad->m_flX1[0], pquad->m_flY1[0], pquad->m_flZ1[0], color, pDict->m_TexLR.x, pDict->m_TexUL.y );
+		SetDetailSpriteVertex( pVerts[2], pquad->m_flX2[0], pquad->m_flY2[0], pquad->m_flZ2[0], color, pDict->m_TexUL.x, pDict->m_TexUL.y );
+		SetDetailSpriteVertex( pVerts[3], pquad->m_flX3[0], pquad->m_flY3[0], pquad->m_flZ3[0], color, pDict->m_TexUL.x, pDict->m_TexLR.y );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Builds out, sorts and generates the vertices of one leaf's sprites. Leaves
+// only share read-only data, so this runs on the job threads.
+//-----------------------------------------------------------------------------
+void CDetailObjectSystem::BuildFastSpriteLeaf( FastSpriteLeafJob_t &job )
+{
+	const FastSpriteView_t &viewInfo = m_FastSpriteView;
+	job.m_nCount = BuildOutSortedSprites( job.m_pData, viewInfo.m_vecOrigin, viewInfo.m_vecForward, viewInfo.m_vecRight, viewInfo.m_vecUp,
+		job.m_pSortInfo, job.m_pBuildout, viewInfo.m_pFrustum );
+	BuildSortedSpriteVerts( job.m_pSortInfo, job.m_nCount, job.m_pBuildout, job.m_pVerts );
+}
+
+
+//-----------------------------------------------------------------------------
+// Makes room in the per leaf buffers for this many groups of four sprites
+//-----------------------------------------------------------------------------
+void CDetailObjectSystem::EnsureFastSpriteJobBuffers( int nSIMDSprites )
+{
+	if ( nSIMDSprites <= m_nFastSpriteJobCapacity )
+		return;
+
+	if ( m_pJobSortInfo )
+	{
+		MemAlloc_FreeAligned( m_pJobSortInfo );
+		MemAlloc_FreeAligned( m_pJobBuildout );
+		MemAlloc_FreeAligned( m_pJobVerts );
+	}
+
+	// Grow geometrically so walking into denser areas doesn't reallocate every frame
+	m_nFastSpriteJobCapacity = MAX( nSIMDSprites, 2 * m_nFastSpriteJobCapacity );
+	m_pJobSortInfo = reinterpret_cast<SortInfo_t *> (
+		MemAlloc_AllocAligned( 2 * 4 * m_nFastSpriteJobCapacity * sizeof( SortInfo_t ), sizeof( fltx4 ) ) );
+	m_pJobBuildout = reinterpret_cast<FastSpriteQuadBuildoutBufferX4_t *> (
+		MemAlloc_AllocAligned( m_nFastSpriteJobCapacity * sizeof( FastSpriteQuadBuildoutBufferX4_t ), sizeof( fltx4 ) ) );
+	m_pJobVerts = reinterpret_cast<DetailSpriteVertex_t *> (
+		MemAlloc_AllocAligned( 4 * 4 * m_nFastSpriteJobCapacity * sizeof( DetailSpriteVertex_t ), sizeof( fltx4 ) ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// Gives each leaf in m_FastSpriteJobs its slice of the per leaf buffers and
+// builds them for m_FastSpriteView. Returns the number of visible sprites.
+//-----------------------------------------------------------------------------
+int CDetailObjectSystem::BuildFastSpriteJobs( bool bThreaded )
+{
+	int nSIMDSprites = 0;
+	for ( int i = 0; i < m_FastSpriteJobs.Count(); ++i )
+	{
+		nSIMDSprites += m_FastSpriteJobs[i].m_pData->m_nNumSIMDSprites;
+	}
+
+	EnsureFastSpriteJobBuffers( nSIMDSprites );
+
+	int nOffset = 0;
+	for ( int i = 0; i < m_FastSpriteJobs.Count(); ++i )
+	{
+		FastSpriteLeafJob_t &job = m_FastSpriteJobs[i];
+		job.m_pSortInfo = m_pJobSortInfo + 2 * 4 * nOffset;
+		job.m_pBuildout = m_pJobBuildout + nOffset;
+		job.m_pVerts = m_pJobVerts + 4 * 4 * nOffset;
+		job.m_nCount = 0;
+		nOffset += job.m_pData->m_nNumSIMDSprites;
+	}
+
+	if ( bThreaded && m_FastSpriteJobs.Count() > 1 )
+	{
+		ParallelProcess( "CDetailObjectSystem::BuildFastSpriteLeaf", m_FastSpriteJobs.Base(), m_FastSpriteJobs.Count(), this, &CDetailObjectSystem::BuildFastSpriteLeaf );
+	}
+	else
+	{
+		for ( int i = 0; i < m_FastSpriteJobs.Count(); ++i )
+		{
+			BuildFastSpriteLeaf( m_FastSpriteJobs[i] );
+		}
+	}
+
+	int nQuadCount = 0;
+	for ( int i = 0; i < m_FastSpriteJobs.Count(); ++i )
+	{
+		nQuadCount += m_FastSpriteJobs[i].m_nCount;
+	}
+	return nQuadCount;
+}
+
+
 void CDetailObjectSystem::RenderFastSprites( const Vector &viewOrigin, const Vector &viewForward, const Vector &viewRight, const Vector &viewUp, int nLeafCount, LeafIndex_t const * pLeafList )
 {
 	// Here, we must draw all detail objects back-to-front
@@ -2277,6 +2592,35 @@ void CDetailObjectSystem::RenderFastSprites( const Vector &viewOrigin, const Vec
 	if  ( r_DrawDetailProps.GetInt() == 0 )
 		return;
 
+	// Build out and sort every leaf up front, each into its own slice of the
+	// per leaf buffers, so the leaves can be built in parallel
+	{
+		VPROF( "CDetailObjectSystem::RenderFastSprites -- Build" );
+
+		m_FastSpriteJobs.RemoveAll();
+		for ( int i = 0; i < nLeafCount; ++i )
+		{
+			CFastDetailLeafSpriteList *pData = reinterpret_cast<CFastDetailLeafSpriteList *> (
+				ClientLeafSystem()->GetSubSystemDataInLeaf( pLeafList[i], CLSUBSYSTEM_DETAILOBJECTS ) );
+			if ( pData )
+			{
+				Assert( pData->m_nNumSprites );					// ptr with no sprites?
+				FastSpriteLeafJob_t &job = m_FastSpriteJobs[ m_FastSpriteJobs.AddToTail() ];
+				job.m_pData = pData;
+				job.m_nCount = 0;
+			}
+		}
+
+		m_FastSpriteView.m_vecOrigin = viewOrigin;
+		m_FastSpriteView.m_vecForward = viewForward;
+		m_FastSpriteView.m_vecRight = viewRight;
+		m_FastSpriteView.m_vecUp = viewUp;
+		m_FastSpriteView.m_pFrustum = view->GetFrustum();
+
+		nQuadCount = BuildFastSpriteJobs( cl_detail_threaded_buildout.GetBool() );
+		if ( nQuadCount == 0 )
+			return;
+	}
 
 	CMatRenderContextPtr pRenderContext( materials );
 	pRenderContext->MatrixMode( MATERIAL_MODEL );
@@ -2295,7 +2639,7 @@ void CDetailObjectSystem::RenderFastSprites( const Vector &viewOrigin, const Vec
 	int nMaxVerts, nMaxIndices;
 	pRenderContext->GetMaxToRender( pMesh, false, &nMaxVerts, &nMaxIndices );
 	int nMaxQuadsToDraw = nMaxIndices / 6;
-	if ( nMaxQuadsToDraw > nMaxVerts / 4 ) 
+	if ( nMaxQuadsToDraw > nMaxVerts / 4 )
 	{
 		nMaxQuadsToDraw = nMaxVerts / 4;
 	}
@@ -2308,89 +2652,342 @@ void CDetailObjectSystem::RenderFastSprites( const Vector &viewOrigin, const Vec
 
 	meshBuilder.Begin( pMesh, MATERIAL_QUADS, nQuadsToDraw );
 
+	// Stuff the sorted sprites of each leaf into the vb
+	for ( int i = 0; i < m_FastSpriteJobs.Count(); ++i )
+	{
+		DetailSpriteVertex_t const *pVert = m_FastSpriteJobs[i].m_pVerts;
+		int nCount = m_FastSpriteJobs[i].m_nCount;
 
+		while( nCount )
+		{
+			if ( ! nQuadsRemaining )					// no room left?
+			{
+				meshBuilder.End();
+				pMesh->Draw();
+				nQuadsRemaining = nQuadsToDraw;
+				meshBuilder.Begin( pMesh, MATERIAL_QUADS, nQuadsToDraw );
+			}
+			int nToDraw = MIN( nCount, nQuadsRemaining );
+			nCount -= nToDraw;
+			nQuadsRemaining -= nToDraw;
+			for ( int nVert = 4 * nToDraw; nVert > 0; --nVert, ++pVert )
+			{
+				meshBuilder.Position3fv( pVert->m_Pos );
+				meshBuilder.Color4ubv( pVert->m_Color );
+				meshBuilder.TexCoord2fv( 0, pVert->m_TexCoord );
+				meshBuilder.AdvanceVertex();
+			}
+		}
+	}
+	meshBuilder.End();
+	pMesh->Draw();
+	pRenderContext->PopMatrix();
+}
 
-	// Sort detail sprites in each leaf independently; then render them
-	for ( int i = 0; i < nLeafCount; ++i )
+//-----------------------------------------------------------------------------
+// Checks the fast sprite build against a straightforward per sprite version
+// on synthetic leaves, the threaded build against the serial one, and both
+// halves of SortBackToFront against std::stable_sort.
+//-----------------------------------------------------------------------------
+static bool DetailSpriteVertsMatch( const DetailSpriteVertex_t &left, const DetailSpriteVertex_t &right, float flPosTolerance, int nAlphaTolerance )
+{
+	for ( int i = 0; i < 3; i++ )
 	{
-		int nLeaf = pLeafList[i];
+		if ( fabs( left.m_Pos[i] - right.m_Pos[i] ) > flPosTolerance )
+			return false;
+		if ( left.m_Color[i] != right.m_Color[i] )
+			return false;
+	}
+	return abs( (int)left.m_Color[3] - (int)right.m_Color[3] ) <= nAlphaTolerance &&
+		left.m_TexCoord[0] == right.m_TexCoord[0] && left.m_TexCoord[1] == right.m_TexCoord[1];
+}
 
-		CFastDetailLeafSpriteList *pData = reinterpret_cast<CFastDetailLeafSpriteList *> (
-			ClientLeafSystem()->GetSubSystemDataInLeaf( nLeaf, CLSUBSYSTEM_DETAILOBJECTS ) );
+void CDetailObjectSystem::TestSortBackToFront( CDevTestReport &report, int nIterations )
+{
+	static const int s_nCounts[] = { 1, 2, 3, 15, 16, 17, 64, 256, 1024 };
 
-		if ( pData )
+	CUtlVector< SortInfo_t > input, reference, sorted, scratch;
+	for ( int c = 0; c < ARRAYSIZE( s_nCounts ); c++ )
+	{
+		int nCount = s_nCounts[c];
+		input.SetCount( nCount );
+		scratch.SetCount( nCount );
+		for ( int i = 0; i < nCount; i++ )
+		{
+			// Every fourth distance is coarse so the stability gets checked
+			input[i].m_nIndex = i;
+			input[i].m_flDistance = ( i & 3 ) ? random->RandomFloat( 0, 1500 * 1500 ) : random->RandomInt( 0, 8 ) * 65536.0f;
+		}
+
+		reference.CopyArray( input.Base(), nCount );
+		std::stable_sort( reference.Base(), reference.Base() + nCount, SortLessFunc );
+
+		for ( int nSort = 0; nSort < 2; nSort++ )
+		{
+			const char *pszSort = nSort ? "radix" : "insertion";
+			CFastTimer timer;
+			timer.Start();
+			for ( int j = 0; j < nIterations; j++ )
+			{
+				sorted.CopyArray( input.Base(), nCount );
+				if ( nSort )
+				{
+					RadixSortBackToFront( sorted.Base(), scratch.Base(), nCount );
+				}
+				else
+				{
+					InsertionSortBackToFront( sorted.Base(), nCount );
+				}
+			}
+			timer.End();
+			if ( nCount >= 16 )
+			{
+				report.Time( CFmtStr( "%s sort, %d sprites", pszSort, nCount ), timer, nIterations );
+			}
+
+			for ( int i = 0; i < nCount; i++ )
+			{
+				report.Check( sorted[i].m_nIndex == reference[i].m_nIndex, "%s sort of %d: entry %d is sprite %d, stable_sort has %d",
+					pszSort, nCount, i, sorted[i].m_nIndex, reference[i].m_nIndex );
+			}
+		}
+	}
+}
+
+void CDetailObjectSystem::TestFastSpriteBuildout( int nSprites, int nLeaves, int nIterations )
+{
+	CDevTestReport report( "cl_detail_buildout_test" );
+
+	// Random sprites around a camera at the origin looking down +x, split into leaves
+	DetailPropSpriteDict_t dicts[4];
+	for ( int i = 0; i < ARRAYSIZE( dicts ); i++ )
+	{
+		dicts[i].m_UL.Init( -random->RandomFloat( 4, 16 ), random->RandomFloat( 8, 32 ) );
+		dicts[i].m_LR.Init( -dicts[i].m_UL.x, 0 );
+		dicts[i].m_TexUL.Init( random->RandomFloat( 0, 0.5f ), random->RandomFloat( 0, 0.5f ) );
+		dicts[i].m_TexLR.Init( random->RandomFloat( 0.5f, 1 ), random->RandomFloat( 0.5f, 1 ) );
+	}
+
+	nLeaves = MIN( nLeaves, nSprites );
+	CFastDetailLeafSpriteList *leaves = new CFastDetailLeafSpriteList[nLeaves];
+	int nSIMDSprites = 0;
+	for ( int i = 0; i < nLeaves; i++ )
+	{
+		leaves[i].m_nNumSprites = ( nSprites * ( i + 1 ) ) / nLeaves - ( nSprites * i ) / nLeaves;
+		leaves[i].m_nNumSIMDSprites = ( 3 + leaves[i].m_nNumSprites ) >> 2;
+		nSIMDSprites += leaves[i].m_nNumSIMDSprites;
+	}
+
+	FastSpriteX4_t *pSpriteData = reinterpret_cast<FastSpriteX4_t *> (
+		MemAlloc_AllocAligned( nSIMDSprites * sizeof( FastSpriteX4_t ), sizeof( fltx4 ) ) );
+	FastSpriteX4_t *pNextSprites = pSpriteData;
+	for ( int nLeaf = 0; nLeaf < nLeaves; nLeaf++ )
+	{
+		CFastDetailLeafSpriteList &leaf = leaves[nLeaf];
+		leaf.m_pSprites = pNextSprites;
+		pNextSprites += leaf.m_nNumSIMDSprites;
+		for ( int i = 0; i < leaf.m_nNumSprites; i++ )
 		{
-			Assert( pData->m_nNumSprites );					// ptr with no sprites?
+			FastSpriteX4_t &sprite = leaf.m_pSprites[i >> 2];
+			int nSubField = i & 3;
+			DetailPropSpriteDict_t *pDict = &dicts[ random->RandomInt( 0, ARRAYSIZE( dicts ) - 1 ) ];
+			sprite.m_Pos.X( nSubField ) = random->RandomFloat( -1500, 1500 );
+			sprite.m_Pos.Y( nSubField ) = random->RandomFloat( -1500, 1500 );
+			sprite.m_Pos.Z( nSubField ) = random->RandomFloat( -64, 64 );
+			SubFloat( sprite.m_HalfWidth, nSubField ) = 0.5f * ( pDict->m_LR.x - pDict->m_UL.x );
+			SubFloat( sprite.m_Height, nSubField ) = pDict->m_LR.y - pDict->m_UL.y;
+			for ( int j = 0; j < 3; j++ )
+			{
+				sprite.m_RGBColor[nSubField][j] = random->RandomInt( 0, 255 );
+			}
+			sprite.m_RGBColor[nSubField][3] = 255;
+			sprite.m_pSpriteDefs[nSubField] = pDict;
+			if ( nSubField == 0 )
+			{
+				sprite.ReplicateFirstEntryToOthers();
+			}
+		}
+	}
+
+	Frustum_t frustum;
+	GeneratePerspectiveFrustum( vec3_origin, QAngle( 0, 0, 0 ), 4, 4096, 90, 4.0f / 3.0f, frustum );
+	VPlane planes[FRUSTUM_NUMPLANES];
+	for ( int i = 0; i < FRUSTUM_NUMPLANES; i++ )
+	{
+		planes[i].Init( frustum.GetPlane( i )->normal, frustum.GetPlane( i )->dist );
+	}
+
+	float flOldMaxSqDist = m_flCurMaxSqDist;
+	float flOldFadeSqDist = m_flCurFadeSqDist;
+	m_flCurMaxSqDist = 1200 * 1200;
+	m_flCurFadeSqDist = 800 * 800;
+
+	m_FastSpriteJobs.SetCount( nLeaves );
+	for ( int i = 0; i < nLeaves; i++ )
+	{
+		m_FastSpriteJobs[i].m_pData = &leaves[i];
+	}
 
-			int nCount = BuildOutSortedSprites( pData, viewOrigin, viewForward, viewRight, viewUp );
+	m_FastSpriteView.m_vecOrigin = vec3_origin;
+	m_FastSpriteView.m_vecForward.Init( 1, 0, 0 );
+	m_FastSpriteView.m_vecRight.Init( 0, -1, 0 );
+	m_FastSpriteView.m_vecUp.Init( 0, 0, 1 );
 
-			// part 3 - stuff the sorted sprites into the vb
-			SortInfo_t const *pDraw = m_pFastSortInfo;
-			FastSpriteQuadBuildoutBufferNonSIMDView_t const *pQuadBuffer =
-				( FastSpriteQuadBuildoutBufferNonSIMDView_t const *) m_pBuildoutBuffer;
+	CUtlVector< SortInfo_t > visible;
+	CUtlVector< DetailSpriteVertex_t > reference, serialVerts;
+	CUtlVector< int > serialCounts;
+	for ( int nPass = 0; nPass < 2; nPass++ )
+	{
+		const VPlane *pFrustum = nPass ? planes : NULL;
+		const char *pszPass = nPass ? "with frustum" : "no frustum";
+		m_FastSpriteView.m_pFrustum = pFrustum;
 
-			COMPILE_TIME_ASSERT( sizeof( FastSpriteQuadBuildoutBufferNonSIMDView_t ) ==
-								 sizeof( FastSpriteQuadBuildoutBufferX4_t ) );
+		CFastTimer timer;
+		timer.Start();
+		int nSerialCount = 0;
+		for ( int i = 0; i < nIterations; i++ )
+		{
+			nSerialCount = BuildFastSpriteJobs( false );
+		}
+		timer.End();
+		report.Time( CFmtStr( "serial build, %s", pszPass ), timer, nIterations );
 
-			while( nCount )
+		serialVerts.RemoveAll();
+		serialCounts.RemoveAll();
+		for ( int nLeaf = 0; nLeaf < nLeaves; nLeaf++ )
+		{
+			const FastSpriteLeafJob_t &job = m_FastSpriteJobs[nLeaf];
+			serialCounts.AddToTail( job.m_nCount );
+			serialVerts.AddMultipleToTail( 4 * job.m_nCount, job.m_pVerts );
+
+			// Reference: every sprite of the leaf that survives the culling, furthest first
+			const CFastDetailLeafSpriteList &leaf = leaves[nLeaf];
+			visible.RemoveAll();
+			for ( int i = 0; i < leaf.m_nNumSprites; i++ )
 			{
-				if ( ! nQuadsRemaining )					// no room left?
+				const FastSpriteX4_t &sprite = leaf.m_pSprites[i >> 2];
+
+				// Whole groups go when every lane is behind the view or too far
+				bool bGroupCulled = true;
+				for ( int j = 0; j < 4; j++ )
 				{
-					meshBuilder.End();
-					pMesh->Draw();
-					nQuadsRemaining = nQuadsToDraw;
-					meshBuilder.Begin( pMesh, MATERIAL_QUADS, nQuadsToDraw );
+					Vector vecLane( sprite.m_Pos.X( j ), sprite.m_Pos.Y( j ), sprite.m_Pos.Z( j ) );
+					if ( vecLane.x >= 0 && vecLane.LengthSqr() <= m_flCurMaxSqDist )
+					{
+						bGroupCulled = false;
+					}
 				}
-				int nToDraw = MIN( nCount, nQuadsRemaining );
-				nCount -= nToDraw;
-				nQuadsRemaining -= nToDraw;
-				while( nToDraw-- )
+
+				int nSubField = i & 3;
+				Vector vecPos( sprite.m_Pos.X( nSubField ), sprite.m_Pos.Y( nSubField ), sprite.m_Pos.Z( nSubField ) );
+				float flSqDist = vecPos.LengthSqr();
+				if ( bGroupCulled || flSqDist > m_flCurMaxSqDist )
+					continue;
+
+				if ( pFrustum )
 				{
-					// draw the sucker
-					int nSIMDIdx = pDraw->m_nIndex >> 2;
-					int nSubIdx = pDraw->m_nIndex & 3;
-
-					FastSpriteQuadBuildoutBufferNonSIMDView_t const *pquad = pQuadBuffer+nSIMDIdx;
-
-					// voodoo - since everything is in 4s, offset structure pointer by a couple of floats to handle sub-index
-					pquad = (FastSpriteQuadBuildoutBufferNonSIMDView_t const *) ( ( (int) ( pquad ) )+ ( nSubIdx << 2 ) );
-					uint8 const *pColorsCasted = reinterpret_cast<uint8 const *> ( pquad->m_Alpha );
-
-					uint8 color[4];
-					color[0] = pquad->m_RGBColor[0][0];
-					color[1] = pquad->m_RGBColor[0][1];
-					color[2] = pquad->m_RGBColor[0][2];
-					color[3] = pColorsCasted[MANTISSA_LSB_OFFSET];
-
-					DetailPropSpriteDict_t *pDict = pquad->m_pSpriteDefs[0];
-
-					meshBuilder.Position3f( pquad->m_flX0[0], pquad->m_flY0[0], pquad->m_flZ0[0] );
-					meshBuilder.Color4ubv( color );
-					meshBuilder.TexCoord2f( 0, pDict->m_TexLR.x, pDict->m_TexLR.y );
-					meshBuilder.AdvanceVertex();
-
-					meshBuilder.Position3f( pquad->m_flX1[0], pquad->m_flY1[0], pquad->m_flZ1[0] );
-					meshBuilder.Color4ubv( color );
-					meshBuilder.TexCoord2f( 0, pDict->m_TexLR.x, pDict->m_TexUL.y );
-					meshBuilder.AdvanceVertex();
-
-					meshBuilder.Position3f( pquad->m_flX2[0], pquad->m_flY2[0], pquad->m_flZ2[0] );
-					meshBuilder.Color4ubv( color );
-					meshBuilder.TexCoord2f( 0, pDict->m_TexUL.x, pDict->m_TexUL.y );
-					meshBuilder.AdvanceVertex();
-
-					meshBuilder.Position3f( pquad->m_flX3[0], pquad->m_flY3[0], pquad->m_flZ3[0] );
-					meshBuilder.Color4ubv( color );
-					meshBuilder.TexCoord2f( 0, pDict->m_TexUL.x, pDict->m_TexLR.y );
-					meshBuilder.AdvanceVertex();
-					pDraw++;
+					float flHalfHeight = 0.5f * SubFloat( sprite.m_Height, nSubField );
+					Vector vecCenter( vecPos.x, vecPos.y, vecPos.z - flHalfHeight );
+					float flRadius = fabs( SubFloat( sprite.m_HalfWidth, nSubField ) ) + fabs( flHalfHeight );
+					bool bOutside = false;
+					for ( int j = 0; j < 4; j++ )
+					{
+						bOutside |= DotProduct( vecCenter, pFrustum[j].m_Normal ) - pFrustum[j].m_Dist + flRadius < 0;
+					}
+					if ( bOutside )
+						continue;
 				}
+
+				SortInfo_t &info = visible[ visible.AddToTail() ];
+				info.m_nIndex = i;
+				info.m_flDistance = flSqDist;
+			}
+			std::stable_sort( visible.Base(), visible.Base() + visible.Count(), SortLessFunc );
+
+			reference.SetCount( 4 * visible.Count() );
+			for ( int i = 0; i < visible.Count(); i++ )
+			{
+				const FastSpriteX4_t &sprite = leaf.m_pSprites[ visible[i].m_nIndex >> 2 ];
+				int nSubField = visible[i].m_nIndex & 3;
+				const DetailPropSpriteDict_t *pDict = sprite.m_pSpriteDefs[nSubField];
+
+				Vector vecPos( sprite.m_Pos.X( nSubField ), sprite.m_Pos.Y( nSubField ), sprite.m_Pos.Z( nSubField ) );
+				Vector vecDx( -vecPos.y, vecPos.x, 0 );
+				VectorNormalize( vecDx );
+				vecDx *= SubFloat( sprite.m_HalfWidth, nSubField );
+				Vector vecDy( 0, 0, SubFloat( sprite.m_Height, nSubField ) );
+
+				float flAlpha = 1.0f - clamp( ( visible[i].m_flDistance - m_flCurFadeSqDist ) / ( m_flCurMaxSqDist - m_flCurFadeSqDist ), 0.0f, 1.0f );
+				uint8 color[4];
+				color[0] = sprite.m_RGBColor[nSubField][0];
+				color[1] = sprite.m_RGBColor[nSubField][1];
+				color[2] = sprite.m_RGBColor[nSubField][2];
+				color[3] = (uint8)( 255.0f * flAlpha + 0.5f );
+
+				Vector vecCorner = vecPos + vecDx;
+				DetailSpriteVertex_t *pQuad = &reference[4 * i];
+				SetDetailSpriteVertex( pQuad[0], vecCorner.x, vecCorner.y, vecCorner.z, color, pDict->m_TexLR.x, pDict->m_TexLR.y );
+				vecCorner -= vecDy;
+				SetDetailSpriteVertex( pQuad[1], vecCorner.x, vecCorner.y, vecCorner.z, color, pDict->m_TexLR.x, pDict->m_TexUL.y );
+				vecCorner -= 2 * vecDx;
+				SetDetailSpriteVertex( pQuad[2], vecCorner.x, vecCorner.y, vecCorner.z, color, pDict->m_TexUL.x, pDict->m_TexUL.y );
+				vecCorner += vecDy;
+				SetDetailSpriteVertex( pQuad[3], vecCorner.x, vecCorner.y, vecCorner.z, color, pDict->m_TexUL.x, pDict->m_TexLR.y );
+			}
+
+			// The SIMD build normalizes with a reciprocal square root estimate
+			if ( !report.Check( job.m_nCount == visible.Count(), "%s: leaf %d has %d sprites visible, the reference %d", pszPass, nLeaf, job.m_nCount, visible.Count() ) )
+				continue;
+
+			for ( int i = 0; i < reference.Count(); i++ )
+			{
+				report.Check( DetailSpriteVertsMatch( job.m_pVerts[i], reference[i], 0.05f, 1 ), "%s: leaf %d vertex %d differs from the reference", pszPass, nLeaf, i );
 			}
 		}
+
+		timer.Start();
+		int nThreadedCount = 0;
+		for ( int i = 0; i < nIterations; i++ )
+		{
+			nThreadedCount = BuildFastSpriteJobs( true );
+		}
+		timer.End();
+		report.Time( CFmtStr( "threaded build, %s", pszPass ), timer, nIterations );
+
+		report.Check( nThreadedCount == nSerialCount, "%s: %d sprites visible threaded, %d serial", pszPass, nThreadedCount, nSerialCount );
+		const DetailSpriteVertex_t *pSerialVert = serialVerts.Base();
+		for ( int nLeaf = 0; nLeaf < nLeaves; nLeaf++ )
+		{
+			const FastSpriteLeafJob_t &job = m_FastSpriteJobs[nLeaf];
+			if ( !report.Check( job.m_nCount == serialCounts[nLeaf], "%s: leaf %d has %d sprites threaded, %d serial", pszPass, nLeaf, job.m_nCount, serialCounts[nLeaf] ) )
+				break;
+
+			for ( int i = 0; i < 4 * job.m_nCount; i++, pSerialVert++ )
+			{
+				report.Check( DetailSpriteVertsMatch( job.m_pVerts[i], *pSerialVert, 0.0f, 0 ), "%s: leaf %d vertex %d differs between the threaded and serial builds", pszPass, nLeaf, i );
+			}
+		}
+
+		Msg( "cl_detail_buildout_test: %s, %d of %d sprites visible in %d leaves\n", pszPass, nSerialCount, nSprites, nLeaves );
 	}
-	meshBuilder.End();
-	pMesh->Draw();
-	pRenderContext->PopMatrix();
+
+	TestSortBackToFront( report, nIterations );
+
+	m_FastSpriteJobs.RemoveAll();
+	m_flCurMaxSqDist = flOldMaxSqDist;
+	m_flCurFadeSqDist = flOldFadeSqDist;
+	MemAlloc_FreeAligned( pSpriteData );
+	delete[] leaves;
+
+	report.Finish();
+}
+
+CON_COMMAND_F( cl_detail_buildout_test, "Checks the serial and threaded detail sprite builds and the back to front sorts against scalar references on synthetic leaves. Usage: cl_detail_buildout_test [sprites] [leaves] [iterations]", DEVTEST_COMMAND_FLAGS )
+{
+	int nSprites = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 4000;
+	int nLeaves = ( args.ArgC() > 2 ) ? MAX( atoi( args[2] ), 1 ) : 16;
+	int nIterations = ( args.ArgC() > 3 ) ? MAX( atoi( args[3] ), 1 ) : 100;
+	s_DetailObjectSystem.TestFastSpriteBuildout( nSprites, nLeaves, nIterations );
 }
 
 
@@ -2506,7 +3103,7 @@ void CDetailObjectSystem::RenderFastTranslucentDetailObjectsInLeaf( const Vector
 	if ( m_nSortedFastLeaf != nLeaf )
 	{
 		m_nSortedFastLeaf = nLeaf;
-		pData->m_nNumPendingSprites = BuildOutSortedSprites( pData, viewOrigin, viewForward, viewRight, viewUp );
+		pData->m_nNumPendingSprites = BuildOutSortedSprites( pData, viewOrigin, viewForward, viewRight, viewUp, m_pFastSortInfo, m_pBuildoutBuffer, view->GetFrustum() );
 		pData->m_nStartSpriteIndex = 0;
 	}
 	if ( pData->m_nNumPendingSprites == 0 )
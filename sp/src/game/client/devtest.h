@@ -0,0 +1,78 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Reporting helpers for the development-only self test commands,
+//			which check optimized code paths against the code they replace.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef DEVTEST_H
+#define DEVTEST_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/fasttimer.h"
+
+// Self tests and benchmarks are hidden from release builds
+#define DEVTEST_COMMAND_FLAGS	( FCVAR_DEVELOPMENTONLY | FCVAR_CHEAT )
+
+// Only this many failures are printed per test; the rest are just counted
+#define DEVTEST_MAX_PRINTED_FAILURES	16
+
+//-----------------------------------------------------------------------------
+// Purpose: Counts the checks of one test and prints a pass/fail summary
+//-----------------------------------------------------------------------------
+class CDevTestReport
+{
+public:
+	CDevTestReport( const char *pszName ) : m_pszName( pszName ), m_nChecks( 0 ), m_nFailures( 0 ) {}
+
+	// Returns bPassed. The message is only formatted for failures.
+	bool Check( bool bPassed, PRINTF_FORMAT_STRING const char *pszFormat, ... ) FMTFUNCTION( 3, 4 )
+	{
+		m_nChecks++;
+		if ( bPassed )
+			return true;
+
+		if ( ++m_nFailures <= DEVTEST_MAX_PRINTED_FAILURES )
+		{
+			char szMessage[512];
+			va_list marker;
+			va_start( marker, pszFormat );
+			Q_vsnprintf( szMessage, sizeof( szMessage ), pszFormat, marker );
+			va_end( marker );
+			Warning( "%s: FAILED: %s\n", m_pszName, szMessage );
+		}
+		return false;
+	}
+
+	// Prints how long one of nIterations runs timed by timer took
+	void Time( const char *pszLabel, const CFastTimer &timer, int nIterations )
+	{
+		double flMS = timer.GetDuration().GetMillisecondsF();
+		Msg( "%s: %-32s %10.4f ms total, %10.4f ms per run\n", m_pszName, pszLabel, flMS, nIterations > 0 ? flMS / nIterations : flMS );
+	}
+
+	// Prints the summary; returns true if every check passed
+	bool Finish()
+	{
+		if ( m_nFailures )
+		{
+			Warning( "%s: %d of %d checks FAILED\n", m_pszName, m_nFailures, m_nChecks );
+			return false;
+		}
+
+		Msg( "%s: all %d checks passed\n", m_pszName, m_nChecks );
+		return true;
+	}
+
+	int GetFailures() const { return m_nFailures; }
+
+private:
+	const char *m_pszName;
+	int m_nChecks;
+	int m_nFailures;
+};
+
+#endif // DEVTEST_H
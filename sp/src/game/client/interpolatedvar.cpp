@@ -6,6 +6,8 @@
 
 #include "cbase.h"
 #include "interpolatedvar.h"
+#include "devtest.h"
+#include "tier1/fmtstr.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -28,3 +30,117 @@ float g_flLastPacketTimestamp = 0;
 
 ConVar cl_extrapolate_amount( "cl_extrapolate_amount", "0.25", FCVAR_CHEAT, "Set how many seconds the client will extrapolate entities for." );
 
+
+//-----------------------------------------------------------------------------
+// Compares the SIMD array interpolation with the generic templates
+//-----------------------------------------------------------------------------
+
+// Relative; Hermite folds its basis in a different order than Lerp_Hermite
+#define INTERP_BENCH_TOLERANCE	1e-5f
+
+template< class Type >
+static void CheckInterpolatedArrays( CDevTestReport &report, const char *pszLabel, const Type *pScalar, const Type *pSIMD, int nCount, float frac )
+{
+	const float *pA = (const float *)pScalar;
+	const float *pB = (const float *)pSIMD;
+	int nFloats = nCount * sizeof( Type ) / sizeof( float );
+	for ( int i = 0; i < nFloats; i++ )
+	{
+		report.Check( fabs( pA[i] - pB[i] ) <= INTERP_BENCH_TOLERANCE * MAX( fabs( pA[i] ), 1.0f ), "%s at %.3f: float %d is %g, SIMD %g", pszLabel, frac, i, pA[i], pB[i] );
+	}
+}
+
+template< class Type >
+static void RandomInterpolatedValue( Type &value )
+{
+	value = RandomFloat( 0.0f, 1.0f );
+}
+
+template<>
+void RandomInterpolatedValue( Vector &value )
+{
+	value.Init( RandomFloat( -256.0f, 256.0f ), RandomFloat( -256.0f, 256.0f ), RandomFloat( -256.0f, 256.0f ) );
+}
+
+template< class Type >
+static void TestInterpolatedArrays( CDevTestReport &report, const char *pszType, int nCount, int nIterations, bool bLoopTail )
+{
+	CUtlVector<Type> prev, start, end, scalar, simd;
+	CUtlVector<byte> looping;
+	prev.SetCount( nCount ); start.SetCount( nCount ); end.SetCount( nCount );
+	scalar.SetCount( nCount ); simd.SetCount( nCount ); looping.SetCount( nCount );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		RandomInterpolatedValue( prev[i] );
+		RandomInterpolatedValue( start[i] );
+		RandomInterpolatedValue( end[i] );
+		looping[i] = 0;
+	}
+
+	// Pose parameters and controllers usually don't loop; a looping tail covers the mixed case
+	if ( bLoopTail )
+	{
+		looping[nCount - 1] = 1;
+	}
+
+	CFmtStr lerpLabel( "%d %s%s lerps", nCount, pszType, bLoopTail ? " (looping tail)" : "" );
+	CFmtStr hermiteLabel( "%d %s%s hermites", nCount, pszType, bLoopTail ? " (looping tail)" : "" );
+
+	for ( int j = 0; j < 64; j++ )
+	{
+		float frac = j / 63.0f;
+		InterpolatedVar_LerpArray<Type>( scalar.Base(), frac, start.Base(), end.Base(), looping.Base(), nCount );
+		InterpolatedVar_LerpArray( simd.Base(), frac, start.Base(), end.Base(), looping.Base(), nCount );
+		CheckInterpolatedArrays( report, lerpLabel, scalar.Base(), simd.Base(), nCount, frac );
+
+		InterpolatedVar_HermiteArray<Type>( scalar.Base(), frac, prev.Base(), start.Base(), end.Base(), looping.Base(), nCount );
+		InterpolatedVar_HermiteArray( simd.Base(), frac, prev.Base(), start.Base(), end.Base(), looping.Base(), nCount );
+		CheckInterpolatedArrays( report, hermiteLabel, scalar.Base(), simd.Base(), nCount, frac );
+	}
+
+	CFastTimer timer;
+	for ( int nPass = 0; nPass < 2; nPass++ )
+	{
+		bool bHermite = ( nPass == 1 );
+
+		timer.Start();
+		for ( int j = 0; j < nIterations; j++ )
+		{
+			float frac = ( j & 63 ) / 63.0f;
+			if ( bHermite )
+				InterpolatedVar_HermiteArray<Type>( scalar.Base(), frac, prev.Base(), start.Base(), end.Base(), looping.Base(), nCount );
+			else
+				InterpolatedVar_LerpArray<Type>( scalar.Base(), frac, start.Base(), end.Base(), looping.Base(), nCount );
+		}
+		timer.End();
+		report.Time( CFmtStr( "%s, scalar", bHermite ? hermiteLabel.Access() : lerpLabel.Access() ), timer, nIterations );
+
+		timer.Start();
+		for ( int j = 0; j < nIterations; j++ )
+		{
+			float frac = ( j & 63 ) / 63.0f;
+			if ( bHermite )
+				InterpolatedVar_HermiteArray( simd.Base(), frac, prev.Base(), start.Base(), end.Base(), looping.Base(), nCount );
+			else
+				InterpolatedVar_LerpArray( simd.Base(), frac, start.Base(), end.Base(), looping.Base(), nCount );
+		}
+		timer.End();
+		report.Time( CFmtStr( "%s, SIMD", bHermite ? hermiteLabel.Access() : lerpLabel.Access() ), timer, nIterations );
+	}
+}
+
+CON_COMMAND_F( cl_interp_bench, "Checks SIMD interpolation of float and vector arrays against the scalar path and times both. Usage: cl_interp_bench [array size] [iterations]", DEVTEST_COMMAND_FLAGS )
+{
+	int nCount = ( args.ArgC() > 1 ) ? clamp( atoi( args[1] ), 1, 255 ) : MAXSTUDIOFLEXCTRL;
+	int nIterations = ( args.ArgC() > 2 ) ? MAX( atoi( args[2] ), 1 ) : 10000;
+
+	CDevTestReport report( "cl_interp_bench" );
+	TestInterpolatedArrays<float>( report, "float", nCount, nIterations, false );
+	TestInterpolatedArrays<Vector>( report, "vector", nCount, nIterations, false );
+	if ( nCount > 4 )
+	{
+		TestInterpolatedArrays<float>( report, "float", nCount, nIterations, true );
+		TestInterpolatedArrays<Vector>( report, "vector", nCount, nIterations, true );
+	}
+	report.Finish();
+}
@@ -11,6 +11,8 @@
 #endif
 
 #include "tier1/utllinkedlist.h"
+#include "tier1/utlvector.h"
+#include "mathlib/ssemath.h"
 #include "rangecheckedvar.h"
 #include "lerp_functions.h"
 #include "animationlayer.h"
@@ -175,114 +177,129 @@ public:
 	virtual void SetDebug( bool bDebug ) = 0;
 };
 
+//-----------------------------------------------------------------------------
+// Value storage for array histories. Entries take a block of GetMaxCount()
+// values from their variable's pool the first time they are used and keep it
+// while the history is reused, so adding samples never allocates.
+//-----------------------------------------------------------------------------
+template< typename Type >
+class CInterpolatedVarValuePool
+{
+public:
+	CInterpolatedVarValuePool() : m_nStride( 0 ), m_nBlockSize( 0 ), m_nBlockUsed( 0 ) {}
+	~CInterpolatedVarValuePool() { Purge(); }
+
+	// Frees everything handed out so far
+	void Init( int nStride )
+	{
+		Purge();
+		m_nStride = nStride;
+	}
+
+	Type *Alloc()
+	{
+		if ( m_nBlockUsed == m_nBlockSize )
+		{
+			// Most histories hold three or four samples; grow by doubling past that
+			m_nBlockSize = m_Blocks.Count() ? m_nBlockSize * 2 : 4;
+			m_nBlockUsed = 0;
+			m_Blocks.AddToTail( new Type[ m_nBlockSize * m_nStride ] );
+		}
+		return m_Blocks.Tail() + ( m_nBlockUsed++ ) * m_nStride;
+	}
+
+	void Purge()
+	{
+		for ( int i = 0; i < m_Blocks.Count(); i++ )
+		{
+			delete[] m_Blocks[i];
+		}
+		m_Blocks.Purge();
+		m_nBlockSize = m_nBlockUsed = 0;
+	}
+
+private:
+	CUtlVector< Type * > m_Blocks;
+	int m_nStride;
+	int m_nBlockSize;
+	int m_nBlockUsed;
+};
+
+class CInterpolatedVarNoValuePool
+{
+public:
+	void Init( int nStride ) {}
+};
+
 template< typename Type, bool IS_ARRAY >
 struct CInterpolatedVarEntryBase
 {
+	typedef CInterpolatedVarValuePool<Type> ValuePool_t;
+
 	CInterpolatedVarEntryBase()
 	{
 		value = NULL;
-		count = 0;
 		changetime = 0;
 	}
-	~CInterpolatedVarEntryBase()
-	{
-		delete[] value;
-		value = NULL;
-	}
 
 	// This will transfer the data from another varentry.  This is used to avoid allocation
-	// pointers can be transferred (only one varentry has a copy), but not trivially copied
+	// The entries trade value blocks, so neither is ever left sharing or without storage
 	void FastTransferFrom( CInterpolatedVarEntryBase &src )
 	{
-		Assert(!value);
+		Type *pValue = value;
 		value = src.value;
-		count = src.count;
+		src.value = pValue;
 		changetime = src.changetime;
-		src.value = 0;
-		src.count = 0;
-	}
-
-	CInterpolatedVarEntryBase& operator=( const CInterpolatedVarEntryBase& src )
-	{
-		delete[] value;
-		value = NULL;
-		count = 0;
-		if ( src.value )
-		{
-			count = src.count;
-			value = new Type[count];
-			for ( int i = 0; i < count; i++ )
-			{
-				value[i] = src.value[i];
-			}
-		}
-		return *this;
 	}
 
 	Type *GetValue() { return value; }
 	const Type *GetValue() const { return value; }
 
-	void Init(int maxCount)
+	// Gives the entry storage from the pool if it doesn't have any yet
+	void Init( ValuePool_t &pool )
 	{
-		if ( !maxCount )
+		if ( !value )
 		{
-			DeleteEntry();
+			value = pool.Alloc();
 		}
-		else
-		{
-			// resize
-			if ( maxCount != count )
-			{
-				DeleteEntry();
-			}
+	}
 
-			if ( !value )
-			{
-				count = maxCount;
-				value = new Type[maxCount];
-			}
-		}
-		Assert(count==maxCount);
+	// Uses caller owned storage, for temporaries
+	void InitTemp( Type *pStorage )
+	{
+		value = pStorage;
 	}
+
 	Type *NewEntry( const Type *pValue, int maxCount, float time )
 	{
+		Assert( value );
 		changetime = time;
-		Init(maxCount);
-		if ( value && maxCount)
-		{
-			memcpy( value, pValue, maxCount*sizeof(Type) );
-		}
+		memcpy( value, pValue, maxCount*sizeof(Type) );
 		return value;
 	}
 
-	void DeleteEntry()
-	{
-		delete[] value;
-		value = NULL;
-		count = 0;
-	}
-
 	float		changetime;
-	int			count;
 	Type *		value;
 
 private:
 	CInterpolatedVarEntryBase( const CInterpolatedVarEntryBase &src );
+	CInterpolatedVarEntryBase& operator=( const CInterpolatedVarEntryBase& src );
 };
 
 template<typename Type>
 struct CInterpolatedVarEntryBase<Type, false>
 {
+	typedef CInterpolatedVarNoValuePool ValuePool_t;
+
 	CInterpolatedVarEntryBase() {}
 	~CInterpolatedVarEntryBase() {}
 
 	const Type *GetValue() const { return &value; }
 	Type *GetValue() { return &value; }
 
-	void Init(int maxCount)
-	{
-		Assert(maxCount==1);
-	}
+	void Init( ValuePool_t &pool ) {}
+	void InitTemp( Type *pStorage ) {}
+
 	Type *NewEntry( const Type *pValue, int maxCount, float time )
 	{
 		Assert(maxCount==1);
@@ -295,12 +312,142 @@ struct CInterpolatedVarEntryBase<Type, false>
 		*this = src;
 	}
 
-	void DeleteEntry() {}
-
 	float		changetime;
 	Type		value;
 };
 
+//-----------------------------------------------------------------------------
+// Lerp and Lerp_Hermite over a whole array, without Lerp_Clamp. The float and
+// Vector versions go four floats at a time through the same float operations,
+// in the same order, as the templates.
+//-----------------------------------------------------------------------------
+template< typename Type >
+inline void InterpolatedVar_LerpArray( Type *out, float frac, Type *start, Type *end, const byte *pLooping, int nCount )
+{
+	// Note that QAngle has a specialization that will do quaternion interpolation here...
+	for ( int i = 0; i < nCount; i++ )
+	{
+		if ( pLooping[ i ] )
+		{
+			out[i] = LoopingLerp( frac, start[i], end[i] );
+		}
+		else
+		{
+			out[i] = Lerp( frac, start[i], end[i] );
+		}
+	}
+}
+
+template< typename Type >
+inline void InterpolatedVar_HermiteArray( Type *out, float frac, Type *prev, Type *start, Type *end, const byte *pLooping, int nCount )
+{
+	for ( int i = 0; i < nCount; i++ )
+	{
+		// Note that QAngle has a specialization that will do quaternion interpolation here...
+		if ( pLooping[ i ] )
+		{
+			out[ i ] = LoopingLerp_Hermite( frac, prev[i], start[i], end[i] );
+		}
+		else
+		{
+			out[ i ] = Lerp_Hermite( frac, prev[i], start[i], end[i] );
+		}
+	}
+}
+
+// Number of leading floats, in whole groups of four, that are not looping
+inline int InterpolatedVar_CountSIMDFloats( const byte *pLooping, int nCount )
+{
+	int i = 0;
+	for ( ; i + 4 <= nCount; i += 4 )
+	{
+		if ( pLooping[i] | pLooping[i+1] | pLooping[i+2] | pLooping[i+3] )
+			break;
+	}
+	return i;
+}
+
+inline void InterpolatedVar_LerpFloats( float *out, float frac, const float *start, const float *end, int nFloats )
+{
+	fltx4 fl4Frac = ReplicateX4( frac );
+	for ( int i = 0; i < nFloats; i += 4 )
+	{
+		fltx4 a = LoadUnalignedSIMD( start + i );
+		fltx4 b = LoadUnalignedSIMD( end + i );
+		StoreUnalignedSIMD( out + i, AddSIMD( a, MulSIMD( SubSIMD( b, a ), fl4Frac ) ) );
+	}
+}
+
+inline void InterpolatedVar_HermiteFloats( float *out, float t, const float *prev, const float *start, const float *end, int nFloats )
+{
+	// Same basis as Lerp_Hermite
+	float tSqr = t*t;
+	float tCube = t*tSqr;
+	fltx4 b1 = ReplicateX4( 2*tCube-3*tSqr+1 );
+	fltx4 b2 = ReplicateX4( -2*tCube+3*tSqr );
+	fltx4 b3 = ReplicateX4( tCube-2*tSqr+t );
+	fltx4 b4 = ReplicateX4( tCube-tSqr );
+
+	for ( int i = 0; i < nFloats; i += 4 )
+	{
+		fltx4 p0 = LoadUnalignedSIMD( prev + i );
+		fltx4 p1 = LoadUnalignedSIMD( start + i );
+		fltx4 p2 = LoadUnalignedSIMD( end + i );
+		fltx4 output = MulSIMD( p1, b1 );
+		output = AddSIMD( output, MulSIMD( p2, b2 ) );
+		output = AddSIMD( output, MulSIMD( SubSIMD( p1, p0 ), b3 ) );
+		output = AddSIMD( output, MulSIMD( SubSIMD( p2, p1 ), b4 ) );
+		StoreUnalignedSIMD( out + i, output );
+	}
+}
+
+inline void InterpolatedVar_LerpArray( float *out, float frac, float *start, float *end, const byte *pLooping, int nCount )
+{
+	int nSIMD = InterpolatedVar_CountSIMDFloats( pLooping, nCount );
+	InterpolatedVar_LerpFloats( out, frac, start, end, nSIMD );
+	InterpolatedVar_LerpArray<float>( out + nSIMD, frac, start + nSIMD, end + nSIMD, pLooping + nSIMD, nCount - nSIMD );
+}
+
+inline void InterpolatedVar_HermiteArray( float *out, float frac, float *prev, float *start, float *end, const byte *pLooping, int nCount )
+{
+	int nSIMD = InterpolatedVar_CountSIMDFloats( pLooping, nCount );
+	InterpolatedVar_HermiteFloats( out, frac, prev, start, end, nSIMD );
+	InterpolatedVar_HermiteArray<float>( out + nSIMD, frac, prev + nSIMD, start + nSIMD, end + nSIMD, pLooping + nSIMD, nCount - nSIMD );
+}
+
+// Vectors are three floats each; when none loop the whole array is one run of floats
+inline void InterpolatedVar_LerpArray( Vector *out, float frac, Vector *start, Vector *end, const byte *pLooping, int nCount )
+{
+	if ( nCount < 2 || memchr( pLooping, 1, nCount ) )
+	{
+		InterpolatedVar_LerpArray<Vector>( out, frac, start, end, pLooping, nCount );
+		return;
+	}
+
+	int nFloats = ( nCount * 3 ) & ~3;
+	InterpolatedVar_LerpFloats( out->Base(), frac, start->Base(), end->Base(), nFloats );
+	for ( int i = nFloats; i < nCount * 3; i++ )
+	{
+		out->Base()[i] = Lerp( frac, start->Base()[i], end->Base()[i] );
+	}
+}
+
+inline void InterpolatedVar_HermiteArray( Vector *out, float frac, Vector *prev, Vector *start, Vector *end, const byte *pLooping, int nCount )
+{
+	if ( nCount < 2 || memchr( pLooping, 1, nCount ) )
+	{
+		InterpolatedVar_HermiteArray<Vector>( out, frac, prev, start, end, pLooping, nCount );
+		return;
+	}
+
+	int nFloats = ( nCount * 3 ) & ~3;
+	InterpolatedVar_HermiteFloats( out->Base(), frac, prev->Base(), start->Base(), end->Base(), nFloats );
+	for ( int i = nFloats; i < nCount * 3; i++ )
+	{
+		out->Base()[i] = Lerp_Hermite( frac, prev->Base()[i], start->Base()[i], end->Base()[i] );
+	}
+}
+
 template<typename T>
 class CSimpleRingBuffer
 {
@@ -397,6 +544,15 @@ public:
 		m_firstElement = 0;
 	}
 
+	// Frees the elements as well
+	void Purge()
+	{
+		delete[] m_pElements;
+		m_pElements = NULL;
+		m_maxElement = 0;
+		RemoveAll();
+	}
+
 	void RemoveAtHead()
 	{
 		if ( m_count > 0 )
@@ -504,6 +660,7 @@ protected:
 
 	typedef CInterpolatedVarEntryBase<Type, IS_ARRAY> CInterpolatedVarEntry;
 	typedef CSimpleRingBuffer< CInterpolatedVarEntry > CVarHistory;
+	typedef typename CInterpolatedVarEntry::ValuePool_t CValuePool;
 	friend class CInterpolationInfo;
 
 	class CInterpolationInfo
@@ -563,6 +720,8 @@ protected:
 	// The underlying data element
 	Type								*m_pValue;
 	CVarHistory							m_VarHistory;
+	// Backing store for the history values of array vars
+	CValuePool							m_ValuePool;
 	// Store networked values so when we latch we can detect which values were changed via networking
 	Type *								m_LastNetworkedValue;
 	float								m_LastNetworkedTime;
@@ -688,10 +847,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::RestoreToLastNetworked()
 template< typename Type, bool IS_ARRAY >
 inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::ClearHistory()
 {
-	for ( int i = 0; i < m_VarHistory.Count(); i++ )
-	{
-		m_VarHistory[i].DeleteEntry();
-	}
+	// The entries keep their values for reuse
 	m_VarHistory.RemoveAll();
 }
 
@@ -733,6 +889,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::AddToHead( float changeTi
 		}
 
 	CInterpolatedVarEntry *e = &m_VarHistory[ newslot ];
+	e->Init( m_ValuePool );
 	e->NewEntry( values, m_nMaxCount, changeTime );
 }
 
@@ -1192,6 +1349,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::Copy( IInterpolatedVar *p
 
 		CInterpolatedVarEntry *dest = &m_VarHistory[newslot];
 		CInterpolatedVarEntry *src	= &pSrc->m_VarHistory[i];
+		dest->Init( m_ValuePool );
 		dest->NewEntry( src->GetValue(), m_nMaxCount, src->changetime );
 	}
 }
@@ -1294,6 +1452,10 @@ inline void	CInterpolatedVarArrayBase<Type, IS_ARRAY>::SetMaxCount( int newmax )
 		memset( m_bLooping, 0, sizeof(byte) * m_nMaxCount);
 		memset( m_LastNetworkedValue, 0, sizeof(Type) * m_nMaxCount);
 
+		// The history values are sized by the old count
+		m_VarHistory.Purge();
+		m_ValuePool.Init( m_nMaxCount );
+
 		Reset();
 	}
 }
@@ -1325,17 +1487,9 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Interpolate( Type *out,
 
 	Assert( frac >= 0.0f && frac <= 1.0f );
 
-	// Note that QAngle has a specialization that will do quaternion interpolation here...
+	InterpolatedVar_LerpArray( out, frac, start->GetValue(), end->GetValue(), m_bLooping, m_nMaxCount );
 	for ( int i = 0; i < m_nMaxCount; i++ )
 	{
-		if ( m_bLooping[ i ] )
-		{
-			out[i] = LoopingLerp( frac, start->GetValue()[i], end->GetValue()[i] );
-		}
-		else
-		{
-			out[i] = Lerp( frac, start->GetValue()[i], end->GetValue()[i] );
-		}
 		Lerp_Clamp( out[i] );
 	}
 }
@@ -1388,17 +1542,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::TimeFixup2_Hermite(
 		// Fixed interval into past
 		fixup.changetime = start->changetime - dt1;
 
-		for ( int i = 0; i < m_nMaxCount; i++ )
-		{
-			if ( m_bLooping[i] )
-			{
-				fixup.GetValue()[i] = LoopingLerp( 1-frac, prev->GetValue()[i], start->GetValue()[i] );
-			}
-			else
-			{
-				fixup.GetValue()[i] = Lerp( 1-frac, prev->GetValue()[i], start->GetValue()[i] );
-			}
-		}
+		InterpolatedVar_LerpArray( fixup.GetValue(), 1-frac, prev->GetValue(), start->GetValue(), m_bLooping, m_nMaxCount );
 
 		// Point previous sample at fixed version
 		prev = &fixup;
@@ -1434,21 +1578,12 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Interpolate_Hermite(
 	CDisableRangeChecks disableRangeChecks; 
 
 	CInterpolatedVarEntry fixup;
-	fixup.Init(m_nMaxCount);
+	fixup.InitTemp( (Type*)stackalloc( sizeof(Type) * m_nMaxCount ) );
 	TimeFixup_Hermite( fixup, prev, start, end );
 
+	InterpolatedVar_HermiteArray( out, frac, prev->GetValue(), start->GetValue(), end->GetValue(), m_bLooping, m_nMaxCount );
 	for( int i = 0; i < m_nMaxCount; i++ )
 	{
-		// Note that QAngle has a specialization that will do quaternion interpolation here...
-		if ( m_bLooping[ i ] )
-		{
-			out[ i ] = LoopingLerp_Hermite( frac, prev->GetValue()[i], start->GetValue()[i], end->GetValue()[i] );
-		}
-		else
-		{
-			out[ i ] = Lerp_Hermite( frac, prev->GetValue()[i], start->GetValue()[i], end->GetValue()[i] );
-		}
-
 		// Clamp the output from interpolation. There are edge cases where something like m_flCycle
 		// can get set to a really high or low value when we set it to zero after a really small
 		// time interval (the hermite blender will think it's got a really high velocity and
@@ -1473,7 +1608,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Derivative_Hermite(
 	CDisableRangeChecks disableRangeChecks; 
 
 	CInterpolatedVarEntry fixup;
-	fixup.value = (Type*)_alloca( sizeof(Type) * m_nMaxCount );
+	fixup.InitTemp( (Type*)stackalloc( sizeof(Type) * m_nMaxCount ) );
 	TimeFixup_Hermite( fixup, prev, start, end );
 
 	float divisor = 1.0f / (end->changetime - start->changetime);
@@ -1496,7 +1631,7 @@ inline void CInterpolatedVarArrayBase<Type, IS_ARRAY>::_Derivative_Hermite_Smoot
 	CInterpolatedVarEntry *d )
 {
 	CInterpolatedVarEntry fixup;
-	fixup.Init(m_nMaxCount);
+	fixup.InitTemp( (Type*)stackalloc( sizeof(Type) * m_nMaxCount ) );
 	TimeFixup_Hermite( fixup, b, c, d );
 	for ( int i=0; i < m_nMaxCount; i++ )
 	{
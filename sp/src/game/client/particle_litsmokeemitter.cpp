@@ -7,6 +7,8 @@
 #include "cbase.h"
 #include "particle_litsmokeemitter.h"
 
+extern ConVar cl_particle_simd_simulate;
+
 
 //
 // CLitSmokeEmitter
@@ -121,6 +123,31 @@ void CLitSmokeEmitter::SimulateParticles( CParticleSimulateIterator *pIterator )
 {
 	// Make sure they've called Init().
 	Assert( m_bInitted );
+
+	if ( cl_particle_simd_simulate.GetBool() )
+	{
+		fltx4 timeDelta4 = ReplicateX4( pIterator->GetTimeDelta() );
+
+		LitSmokeParticle *pBatch[4];
+		LitSmokeParticle *pNext = (LitSmokeParticle*)pIterator->GetFirst();
+		int nCount;
+		while ( ( nCount = GetNextParticleBatch( pIterator, pNext, pBatch ) ) != 0 )
+		{
+			ParticleMotionX4_t motion;
+			LoadParticleMotion( motion, pBatch );
+			int nDeadMask = motion.Simulate( timeDelta4 );
+			StoreParticleMotion( motion, pBatch, nCount );
+
+			for ( int i = 0; i < nCount; i++ )
+			{
+				if ( nDeadMask & ( 1 << i ) )
+				{
+					pIterator->RemoveParticle( pBatch[i] );
+				}
+			}
+		}
+		return;
+	}
 	
 	LitSmokeParticle *pParticle = (LitSmokeParticle*)pIterator->GetFirst();
 	while ( pParticle )
@@ -28,6 +28,7 @@ public:
 	virtual void	StartRender( VMatrix &effectMatrix );
 	virtual void RenderParticles( CParticleRenderIterator *pIterator );
 	virtual void SimulateParticles( CParticleSimulateIterator *pIterator );
+	virtual bool IsSimulateThreadSafe() const { return true; }
 
 	virtual	void	Init( const char *materialName, Vector sortOrigin );
 	
@@ -43,6 +43,7 @@ static ConVar particle_simulateoverflow( "particle_simulateoverflow", "0", FCVAR
 ConVar cl_particleeffect_aabb_buffer( "cl_particleeffect_aabb_buffer", "2", FCVAR_CHEAT, "Add this amount to a particle effect's bbox in the leaf system so if it's growing slowly, it won't have to be reinserted as often." );
 ConVar cl_particle_show_bbox( "cl_particle_show_bbox", "0", FCVAR_CHEAT );
 ConVar cl_particle_show_bbox_cost( "cl_particle_show_bbox_cost", "0", FCVAR_CHEAT, "Show # of particles: green->blue->red. Use a negative number to show ALL particles even cheap ones" );
+static ConVar cl_particle_threaded_simulate( "cl_particle_threaded_simulate", "1", 0, "Simulate old-style particle effects that allow it on the job threads" );
 
 // These reflect the convars so we don't parse the string every particle!
 bool g_cl_particle_show_bbox = false;
@@ -1036,7 +1037,8 @@ CEffectMaterial* CParticleEffectBinding::GetEffectMaterial( CParticleSubTexture
 //-----------------------------------------------------------------------------
 // CParticleMgr
 //-----------------------------------------------------------------------------
-CParticleMgr::CParticleMgr()
+CParticleMgr::CParticleMgr() :
+	m_ParticlePool( PARTICLE_SIZE, MAX_TOTAL_PARTICLES, CUtlMemoryPool::GROW_NONE, "CParticleMgr::m_ParticlePool", 16 )
 {
 	m_nToolParticleEffectId = 0;
 	m_bUpdatingEffects = false;
@@ -1054,6 +1056,7 @@ CParticleMgr::CParticleMgr()
 	m_DefaultInvalidSubTexture.m_tCoordMaxs[0] = m_DefaultInvalidSubTexture.m_tCoordMaxs[1] = 1;
 	
 	m_nCurrentParticlesAllocated = 0;
+	m_flThreadedSimulateTimeDelta = 0.0f;
 
 	SetDefLessFunc( m_effectFactories );
 }
@@ -1170,11 +1173,15 @@ void CParticleMgr::LevelInit()
 
 Particle *CParticleMgr::AllocParticle( int size )
 {
+	Assert( size <= PARTICLE_SIZE );
+
+	AUTO_LOCK( m_ParticlePoolMutex );
+
 	// Enforce max particle limit.
 	if ( m_nCurrentParticlesAllocated >= MAX_TOTAL_PARTICLES )
 		return NULL;
 		
-	Particle *pRet = (Particle *)malloc( size );
+	Particle *pRet = (Particle *)m_ParticlePool.Alloc();
 	if ( pRet )
 		++m_nCurrentParticlesAllocated;
 
@@ -1183,11 +1190,14 @@ Particle *CParticleMgr::AllocParticle( int size )
 
 void CParticleMgr::FreeParticle( Particle *pParticle )
 {
+	if ( !pParticle )
+		return;
+
+	AUTO_LOCK( m_ParticlePoolMutex );
+
 	Assert( m_nCurrentParticlesAllocated > 0 );
-	if ( pParticle )
-		--m_nCurrentParticlesAllocated;
-	
-	free( pParticle );
+	--m_nCurrentParticlesAllocated;
+	m_ParticlePool.Free( pParticle );
 }
 
 
@@ -1909,6 +1919,11 @@ void CParticleMgr::UpdateNewEffects( float flTimeDelta )
 	}
 }
 
+void CParticleMgr::SimulateEffectJob( CParticleEffectBinding *&pEffect )
+{
+	pEffect->SimulateParticles( m_flThreadedSimulateTimeDelta );
+}
+
 void CParticleMgr::UpdateAllEffects( float flTimeDelta )
 {
 	// These reflect the convars so we don't parse the strings every particle.
@@ -1921,6 +1936,8 @@ void CParticleMgr::UpdateAllEffects( float flTimeDelta )
 	if( flTimeDelta > 0.1f )
 		flTimeDelta = 0.1f;
 
+	bool bThreaded = cl_particle_threaded_simulate.GetBool();
+
 	FOR_EACH_LL( m_Effects, iEffect )
 	{
 		CParticleEffectBinding *pEffect = m_Effects[iEffect];
@@ -1949,14 +1966,36 @@ void CParticleMgr::UpdateAllEffects( float flTimeDelta )
 		pEffect->m_pSim->Update( flTimeDelta );
 
 		if ( pEffect->GetFirstFrameFlag() )
+		{
 			pEffect->SetFirstFrameFlag( false );
+		}
+		else if ( bThreaded && pEffect->m_pSim->IsSimulateThreadSafe() )
+		{
+			// Simulated with the others below; its leaf system update waits until then
+			m_ThreadedSimulateEffects.AddToTail( pEffect );
+			continue;
+		}
 		else
+		{
 			pEffect->SimulateParticles( flTimeDelta );
+		}
 
 		// Update its position in the leaf system if its bbox changed.
 		pEffect->DetectChanges();
 	}
 
+	if ( m_ThreadedSimulateEffects.Count() )
+	{
+		m_flThreadedSimulateTimeDelta = flTimeDelta;
+		ParallelProcess( "CParticleMgr::SimulateEffectJob", m_ThreadedSimulateEffects.Base(), m_ThreadedSimulateEffects.Count(), this, &CParticleMgr::SimulateEffectJob );
+
+		for ( int i = 0; i < m_ThreadedSimulateEffects.Count(); i++ )
+		{
+			m_ThreadedSimulateEffects[i]->DetectChanges();
+		}
+		m_ThreadedSimulateEffects.RemoveAll();
+	}
+
 	if ( g_bMeasureParticlePerformance )					// use fixed time step
 	{
 		for( float dt=0.0f; dt <= flTimeDelta ; dt+= 0.01f )
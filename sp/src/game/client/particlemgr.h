@@ -126,6 +126,7 @@ entities. Each one is useful under different conditions.
 #endif
 #include "tier1/utlintrusivelist.h"
 #include "tier1/utlstring.h"
+#include "tier1/mempool.h"
 
 
 //-----------------------------------------------------------------------------
@@ -269,6 +270,11 @@ public:
 	virtual void	SetShouldSimulate( bool bSim ) = 0;
 	virtual void	SimulateParticles( CParticleSimulateIterator *pIterator ) = 0;
 
+	// Return true if SimulateParticles only touches this effect's own particles and
+	// data, so it may run on a job thread alongside other effects. Update() and
+	// the rendering calls are always made from the main thread.
+	virtual bool	IsSimulateThreadSafe() const { return false; }
+
 	// Render the particles.
 	virtual void	RenderParticles( CParticleRenderIterator *pIterator ) = 0;
 
@@ -707,6 +713,9 @@ private:
 	// Call Update() on all the effects.
 	void UpdateAllEffects( float flTimeDelta );
 
+	// Job thread half of UpdateAllEffects for effects that can simulate in parallel
+	void SimulateEffectJob( CParticleEffectBinding *&pEffect );
+
 	void UpdateNewEffects( float flTimeDelta );				// update new particle effects
 
 	CParticleSubTextureGroup* FindOrAddSubTextureGroup( IMaterial *pPageMaterial );
@@ -723,6 +732,15 @@ private:
 
 	int m_nCurrentParticlesAllocated;
 
+	// All the old-style particles come from this fixed pool. Particles may be
+	// freed from the job threads while effects simulate in parallel.
+	CUtlMemoryPool m_ParticlePool;
+	CThreadFastMutex m_ParticlePoolMutex;
+
+	// Effects deferred to the job threads by UpdateAllEffects
+	CUtlVector< CParticleEffectBinding* > m_ThreadedSimulateEffects;
+	float m_flThreadedSimulateTimeDelta;
+
 	// Directional lighting info.
 	CParticleLightInfo m_DirectionalLight;
 
@@ -11,11 +11,14 @@
 #include "toolframework_client.h"
 #include "toolframework/itoolframework.h"
 #include "vstdlib/IKeyValuesSystem.h"
+#include "devtest.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
 
+ConVar cl_particle_simd_simulate( "cl_particle_simd_simulate", "1", 0, "Simulate the stock emitter motion four particles at a time" );
+
 // Used for debugging to make sure all particle effects get freed when we exit.
 CUtlLinkedList<CParticleEffect*,int> g_ParticleEffects;
 class CEffectChecker
@@ -225,6 +228,7 @@ CSimpleEmitter::CSimpleEmitter( const char *pDebugName ) : CParticleEffect( pDeb
 {
 	m_flNearClipMin	= 16.0f;
 	m_flNearClipMax	= 64.0f;
+	m_bStockMotion = false;
 }
 
 
@@ -236,6 +240,7 @@ CSmartPtr<CSimpleEmitter> CSimpleEmitter::Create( const char *pDebugName )
 {
 	CSimpleEmitter *pRet = new CSimpleEmitter( pDebugName );
 	pRet->SetDynamicallyAllocated( true );
+	pRet->m_bStockMotion = true;
 	return pRet;
 }
 
@@ -368,6 +373,12 @@ Vector CSimpleEmitter::UpdateColor( const SimpleParticle *pParticle )
 
 void CSimpleEmitter::SimulateParticles( CParticleSimulateIterator *pIterator )
 {
+	if ( m_bStockMotion && cl_particle_simd_simulate.GetBool() )
+	{
+		SimulateStockMotion( pIterator );
+		return;
+	}
+
 	float timeDelta = pIterator->GetTimeDelta();
 
 	SimpleParticle *pParticle = (SimpleParticle*)pIterator->GetFirst();
@@ -388,6 +399,142 @@ void CSimpleEmitter::SimulateParticles( CParticleSimulateIterator *pIterator )
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Same as SimulateParticles with the base class Update* methods, four
+// particles at a time. Only wind-blown particles need their velocity touched.
+//-----------------------------------------------------------------------------
+void CSimpleEmitter::SimulateStockMotion( CParticleSimulateIterator *pIterator )
+{
+	float timeDelta = pIterator->GetTimeDelta();
+	fltx4 timeDelta4 = ReplicateX4( timeDelta );
+
+	SimpleParticle *pBatch[4];
+	SimpleParticle *pNext = (SimpleParticle*)pIterator->GetFirst();
+	int nCount;
+	while ( ( nCount = GetNextParticleBatch( pIterator, pNext, pBatch ) ) != 0 )
+	{
+		for ( int i = 0; i < nCount; i++ )
+		{
+			if ( pBatch[i]->m_iFlags & SIMPLE_PARTICLE_FLAG_WINDBLOWN )
+			{
+				CSimpleEmitter::UpdateVelocity( pBatch[i], timeDelta );
+			}
+		}
+
+		ParticleMotionX4_t motion;
+		LoadParticleMotion( motion, pBatch );
+		int nDeadMask = motion.Simulate( timeDelta4 );
+		StoreParticleMotion( motion, pBatch, nCount );
+
+		fltx4 roll, rollDelta;
+		for ( int i = 0; i < 4; i++ )
+		{
+			SubFloat( roll, i ) = pBatch[i]->m_flRoll;
+			SubFloat( rollDelta, i ) = pBatch[i]->m_flRollDelta;
+		}
+		roll = AddSIMD( roll, MulSIMD( rollDelta, timeDelta4 ) );
+
+		for ( int i = 0; i < nCount; i++ )
+		{
+			pBatch[i]->m_flRoll = SubFloat( roll, i );
+			if ( nDeadMask & ( 1 << i ) )
+			{
+				pIterator->RemoveParticle( pBatch[i] );
+			}
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Simulates the same particles on two scratch emitters, one four-wide and
+// one with the scalar loop, and checks they end up in the same state. About
+// half the particles die during the run and a quarter are wind-blown.
+//-----------------------------------------------------------------------------
+static void AddSimulateBenchParticles( CSimpleEmitter *pEmitter, int nParticles, float flRunTime )
+{
+	PMaterialHandle hMaterial = pEmitter->GetPMaterial( "particle/particle_smokegrenade" );
+
+	// Seeded, so both emitters get the same particles
+	CUniformRandomStream stream;
+	stream.SetSeed( 1 );
+	for ( int i = 0; i < nParticles; i++ )
+	{
+		Vector vecOrigin( stream.RandomFloat( -256, 256 ), stream.RandomFloat( -256, 256 ), stream.RandomFloat( -256, 256 ) );
+		SimpleParticle *pParticle = pEmitter->AddSimpleParticle( hMaterial, vecOrigin, stream.RandomFloat( 0.25f, 1.75f ) * flRunTime );
+		if ( !pParticle )
+			break;
+
+		pParticle->m_vecVelocity.Init( stream.RandomFloat( -64, 64 ), stream.RandomFloat( -64, 64 ), stream.RandomFloat( -64, 64 ) );
+		pParticle->m_flRoll = stream.RandomFloat( 0, 360 );
+		pParticle->m_flRollDelta = stream.RandomFloat( -4, 4 );
+		if ( ( i & 3 ) == 0 )
+		{
+			pParticle->m_iFlags |= SIMPLE_PARTICLE_FLAG_WINDBLOWN;
+		}
+	}
+}
+
+CON_COMMAND_F( cl_particle_simulate_bench, "Checks the four-wide simulation of a CSimpleEmitter against the scalar loop and times both. Usage: cl_particle_simulate_bench [particles] [iterations]", DEVTEST_COMMAND_FLAGS )
+{
+	int nParticles = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 1024;
+	int nIterations = ( args.ArgC() > 2 ) ? MAX( atoi( args[2] ), 1 ) : 100;
+	const float flTimeDelta = 1.0f / 60.0f;
+
+	CDevTestReport report( "cl_particle_simulate_bench" );
+
+	CSmartPtr<CSimpleEmitter> pEmitters[2];
+	bool bOldSIMD = cl_particle_simd_simulate.GetBool();
+	for ( int nPass = 0; nPass < 2; nPass++ )
+	{
+		pEmitters[nPass] = CSimpleEmitter::Create( "cl_particle_simulate_bench" );
+		pEmitters[nPass]->SetSortOrigin( vec3_origin );
+		AddSimulateBenchParticles( pEmitters[nPass].GetObject(), nParticles, nIterations * flTimeDelta );
+
+		cl_particle_simd_simulate.SetValue( nPass == 0 );
+		CFastTimer timer;
+		timer.Start();
+		for ( int i = 0; i < nIterations; i++ )
+		{
+			pEmitters[nPass]->GetBinding().SimulateParticles( flTimeDelta );
+		}
+		timer.End();
+		report.Time( nPass ? "scalar" : "four-wide", timer, nIterations );
+	}
+	cl_particle_simd_simulate.SetValue( bOldSIMD );
+
+	// Removing particles keeps the order of the rest, so the survivors line up
+	CUtlVector< Particle * > survivors[2];
+	for ( int nPass = 0; nPass < 2; nPass++ )
+	{
+		CParticleEffectBinding &binding = pEmitters[nPass]->GetBinding();
+		survivors[nPass].SetCount( binding.GetNumActiveParticles() );
+		survivors[nPass].SetCount( binding.GetActiveParticleList( survivors[nPass].Count(), survivors[nPass].Base() ) );
+	}
+
+	if ( report.Check( survivors[0].Count() == survivors[1].Count(), "%d particles survive four-wide, %d scalar", survivors[0].Count(), survivors[1].Count() ) )
+	{
+		for ( int i = 0; i < survivors[0].Count(); i++ )
+		{
+			const SimpleParticle *pSIMD = (const SimpleParticle *)survivors[0][i];
+			const SimpleParticle *pScalar = (const SimpleParticle *)survivors[1][i];
+			report.Check( VectorsAreEqual( pSIMD->m_Pos, pScalar->m_Pos, 1e-3f ) &&
+				VectorsAreEqual( pSIMD->m_vecVelocity, pScalar->m_vecVelocity, 1e-3f ) &&
+				fabs( pSIMD->m_flLifetime - pScalar->m_flLifetime ) <= 1e-5f &&
+				fabs( pSIMD->m_flRoll - pScalar->m_flRoll ) <= 1e-3f,
+				"particle %d is at (%g %g %g) four-wide, (%g %g %g) scalar", i,
+				pSIMD->m_Pos.x, pSIMD->m_Pos.y, pSIMD->m_Pos.z, pScalar->m_Pos.x, pScalar->m_Pos.y, pScalar->m_Pos.z );
+		}
+	}
+
+	Msg( "cl_particle_simulate_bench: %d of %d particles left after %d iterations\n", survivors[1].Count(), nParticles, nIterations );
+
+	pEmitters[0]->GetBinding().SetRemoveFlag();
+	pEmitters[1]->GetBinding().SetRemoveFlag();
+	report.Finish();
+}
+
+
 void CSimpleEmitter::RenderParticles( CParticleRenderIterator *pIterator )
 {
 	const SimpleParticle *pParticle = (const SimpleParticle *)pIterator->GetFirst();
@@ -14,6 +14,7 @@
 #include "particlemgr.h"
 #include "particlesphererenderer.h"
 #include "smartptr.h"
+#include "mathlib/ssemath.h"
 
 
 // ------------------------------------------------------------------------------------------------ //
@@ -152,6 +153,71 @@ public:
 };
 
 
+//-----------------------------------------------------------------------------
+// The motion the stock emitters simulate for four particles at once: move
+// along the velocity and age. Particle types with m_Pos, m_vecVelocity,
+// m_flLifetime and m_flDieTime gather into it with LoadParticleMotion.
+//-----------------------------------------------------------------------------
+struct ParticleMotionX4_t
+{
+	FourVectors	m_Pos;
+	FourVectors	m_Velocity;
+	fltx4		m_Lifetime;
+	fltx4		m_DieTime;
+
+	// Returns a bit for each particle that has reached its die time
+	int			Simulate( const fltx4 &timeDelta );
+};
+
+inline int ParticleMotionX4_t::Simulate( const fltx4 &timeDelta )
+{
+	FourVectors vecDelta = m_Velocity;
+	vecDelta *= timeDelta;
+	m_Pos += vecDelta;
+	m_Lifetime = AddSIMD( m_Lifetime, timeDelta );
+	return TestSignSIMD( CmpGeSIMD( m_Lifetime, m_DieTime ) );
+}
+
+template< class T >
+inline void LoadParticleMotion( ParticleMotionX4_t &motion, T * const *ppParticles )
+{
+	motion.m_Pos.LoadAndSwizzle( ppParticles[0]->m_Pos, ppParticles[1]->m_Pos, ppParticles[2]->m_Pos, ppParticles[3]->m_Pos );
+	motion.m_Velocity.LoadAndSwizzle( ppParticles[0]->m_vecVelocity, ppParticles[1]->m_vecVelocity, ppParticles[2]->m_vecVelocity, ppParticles[3]->m_vecVelocity );
+	for ( int i = 0; i < 4; i++ )
+	{
+		SubFloat( motion.m_Lifetime, i ) = ppParticles[i]->m_flLifetime;
+		SubFloat( motion.m_DieTime, i ) = ppParticles[i]->m_flDieTime;
+	}
+}
+
+template< class T >
+inline void StoreParticleMotion( const ParticleMotionX4_t &motion, T * const *ppParticles, int nCount )
+{
+	for ( int i = 0; i < nCount; i++ )
+	{
+		ppParticles[i]->m_Pos = motion.m_Pos.Vec( i );
+		ppParticles[i]->m_flLifetime = SubFloat( motion.m_Lifetime, i );
+	}
+}
+
+// Gathers the particles of a simulate iterator four at a time. A short last
+// batch repeats its final particle so every lane holds valid data.
+template< class T >
+inline int GetNextParticleBatch( CParticleSimulateIterator *pIterator, T *&pNext, T **ppBatch )
+{
+	int nCount = 0;
+	for ( ; pNext && nCount < 4; pNext = (T*)pIterator->GetNext() )
+	{
+		ppBatch[nCount++] = pNext;
+	}
+	for ( int i = nCount; i < 4 && nCount; i++ )
+	{
+		ppBatch[i] = ppBatch[nCount - 1];
+	}
+	return nCount;
+}
+
+
 
 // CSimpleEmitter implements a common way to simulate and render particles.
 //
@@ -177,6 +243,9 @@ public:
 	void			SetDrawBeforeViewModel( bool state = true );
 
 	SimpleParticle*	AddSimpleParticle( PMaterialHandle hMaterial, const Vector &vOrigin, float flDieTime=3, unsigned char uchSize=10 );
+
+	// Plain CSimpleEmitters don't reach outside their own particles
+	virtual bool	IsSimulateThreadSafe() const { return m_bStockMotion; }
 	
 // Overridables for variants like CEmberEffect.
 protected:
@@ -193,6 +262,12 @@ protected:
 	float			m_flNearClipMax;
 
 private:
+	// Four-wide version of SimulateParticles for the stock motion
+	void			SimulateStockMotion( CParticleSimulateIterator *pIterator );
+
+	// Set only for plain CSimpleEmitters, whose Update* methods can't be overridden
+	bool			m_bStockMotion;
+
 	CSimpleEmitter( const CSimpleEmitter & ); // not defined, not accessible
 };
 
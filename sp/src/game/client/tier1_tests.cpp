@@ -0,0 +1,1531 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Development-only self tests for the tier1 containers, parsers and
+//			codecs. Each command checks an optimized code path against the
+//			code it replaced and times both.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "cbase.h"
+#include "devtest.h"
+#include "filesystem.h"
+#include "utlbuffer.h"
+#include "tier1/bitbuf.h"
+#include "tier1/datamanager.h"
+#include "vstdlib/jobthread.h"
+#include "tier1/fmtstr.h"
+#include "tier1/kvbinaryimage.h"
+#include "tier1/utlflathashmap.h"
+#include "tier1/utlinterntable.h"
+#include "tier1/utlsymbol.h"
+#include "utldict.h"
+#include "activitylist.h"
+#include "decals.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+//-----------------------------------------------------------------------------
+// KeyValues images
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Purpose: Compares a list of peers against the view of their image, key by
+//			key. KeyValues::GetString converts keys to strings in place, so it
+//			runs after the typed getters.
+//-----------------------------------------------------------------------------
+static void CompareKeyValuesView( CDevTestReport &report, KeyValues *pKey, KeyValuesView view )
+{
+	for ( ; pKey; pKey = pKey->GetNextKey(), view = view.GetNextKey() )
+	{
+		const char *pszName = pKey->GetName();
+		if ( !report.Check( view.IsValid(), "view ends before '%s'", pszName ) )
+			return;
+
+		report.Check( !Q_strcmp( pszName, view.GetName() ), "name '%s' vs. '%s'", pszName, view.GetName() );
+
+		// Pointers aren't stored in images
+		int nType = pKey->GetDataType();
+		int nExpectedType = ( nType == KeyValues::TYPE_PTR ) ? KeyValues::TYPE_NONE : nType;
+		report.Check( nExpectedType == view.GetDataType(), "'%s': type %d vs. %d", pszName, nType, view.GetDataType() );
+
+		// Wide strings are only converted to numbers on Windows
+		if ( nType != KeyValues::TYPE_PTR && nType != KeyValues::TYPE_WSTRING )
+		{
+			if ( nType != KeyValues::TYPE_UINT64 )
+			{
+				report.Check( pKey->GetInt() == view.GetInt(), "'%s': GetInt %d vs. %d", pszName, pKey->GetInt(), view.GetInt() );
+			}
+
+			report.Check( pKey->GetFloat() == view.GetFloat(), "'%s': GetFloat %f vs. %f", pszName, pKey->GetFloat(), view.GetFloat() );
+			report.Check( pKey->GetUint64() == view.GetUint64(), "'%s': GetUint64 %llu vs. %llu", pszName, pKey->GetUint64(), view.GetUint64() );
+			report.Check( pKey->GetColor() == view.GetColor(), "'%s': GetColor differs", pszName );
+		}
+
+		if ( pKey->GetFirstSubKey() )
+		{
+			CompareKeyValuesView( report, pKey->GetFirstSubKey(), view.GetFirstSubKey() );
+		}
+		else
+		{
+			report.Check( !view.GetFirstSubKey(), "'%s': view has subkeys the tree doesn't", pszName );
+		}
+
+		if ( nType != KeyValues::TYPE_PTR )
+		{
+			const char *pszText = pKey->GetString( NULL, "<default>" );
+			report.Check( !Q_strcmp( pszText, view.GetString( NULL, "<default>" ) ), "'%s': GetString '%s' vs. '%s'", pszName, pszText, view.GetString( NULL, "<default>" ) );
+		}
+	}
+
+	report.Check( !view.IsValid(), "view has an extra key '%s'", view.GetName() );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: A tree with every value type, nesting, duplicate names and a
+//			second top level key
+//-----------------------------------------------------------------------------
+static KeyValues *CreateKeyValuesImageTestTree()
+{
+	KeyValues *pRoot = new KeyValues( "root" );
+	pRoot->SetString( "string", "hello world" );
+	pRoot->SetString( "numeric_string", "42.5" );
+	pRoot->SetString( "color_string", "10 20 30 40" );
+	pRoot->SetString( "empty", "" );
+	pRoot->SetInt( "int", -17 );
+	pRoot->SetFloat( "float", 3.25f );
+	pRoot->SetUint64( "uint64", 0x123456789abcULL );
+	pRoot->SetColor( "color", Color( 255, 128, 0, 200 ) );
+	pRoot->SetWString( "wstring", L"wide" );
+	pRoot->SetPtr( "ptr", pRoot );
+	pRoot->FindKey( "sub/deeper", true )->SetInt( "x", 1 );
+	pRoot->AddSubKey( new KeyValues( "dup", "value", "first" ) );
+	pRoot->AddSubKey( new KeyValues( "dup", "value", "second" ) );
+
+	// Enough children for nodes with a child index
+	KeyValues *pWide = pRoot->FindKey( "wide", true );
+	for ( int i = 0; i < 64; i++ )
+	{
+		pWide->SetInt( CFmtStr( "key%d", i ), i );
+	}
+
+	pRoot->SetNextKey( new KeyValues( "second", "value", "peer" ) );
+	return pRoot;
+}
+
+static void TestKeyValuesImageTree( CDevTestReport &report )
+{
+	KeyValues *pRoot = CreateKeyValuesImageTestTree();
+
+	CUtlBuffer buf;
+	CKeyValuesImage image;
+	if ( !report.Check( CKeyValuesImage::Compile( pRoot, buf ) && image.InitFromBuffer( buf ), "couldn't compile the test tree" ) )
+	{
+		pRoot->deleteThis();
+		return;
+	}
+
+	KeyValuesView root = image.GetRoot();
+	report.Check( root.GetInt( "sub/deeper/x" ) == 1, "path lookup" );
+	report.Check( !Q_strcmp( root.GetString( "DUP/value" ), "first" ), "case insensitive lookup should find the first duplicate" );
+	report.Check( !root.FindKey( "missing" ) && root.GetInt( "missing", 5 ) == 5, "missing keys return the default" );
+	report.Check( root.GetInt( "wide/key63" ) == 63, "lookup on a wide node" );
+
+	// Inflating the image and compiling the result must give the same bytes
+	KeyValues *pCopy = new KeyValues( "" );
+	CUtlBuffer copyBuf;
+	report.Check( image.CopyInto( pCopy ) && CKeyValuesImage::Compile( pCopy, copyBuf ) &&
+		copyBuf.TellPut() == buf.TellPut() && !V_memcmp( copyBuf.Base(), buf.Base(), buf.TellPut() ), "inflated tree compiles to a different image" );
+	pCopy->deleteThis();
+
+	// Compared last, since it converts the tree's values to strings
+	CompareKeyValuesView( report, pRoot, root );
+	pRoot->deleteThis();
+
+	// A string node without text must be rejected rather than read out of bounds
+	CUtlMemory< unsigned char > corrupt;
+	corrupt.EnsureCapacity( buf.TellPut() );
+	V_memcpy( corrupt.Base(), buf.Base(), buf.TellPut() );
+
+	const KVImageHeader_t *pHeader = (const KVImageHeader_t *)corrupt.Base();
+	KVImageNode_t *pNodes = (KVImageNode_t *)( corrupt.Base() + pHeader->m_nNodeOffset );
+	for ( int i = 0; i < pHeader->m_nNodeCount; i++ )
+	{
+		if ( pNodes[i].m_nType == KeyValues::TYPE_STRING )
+		{
+			pNodes[i].m_nText = -1;
+			break;
+		}
+	}
+
+	CKeyValuesImage corruptImage;
+	report.Check( !corruptImage.InitFromMemory( corrupt.Base(), buf.TellPut() ), "an image with a string node without text was accepted" );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Compiles a file in memory, compares its view against the text
+//			parser's tree and times parsing the text, inflating the image and
+//			walking it through a view
+//-----------------------------------------------------------------------------
+static void TestKeyValuesImageFile( CDevTestReport &report, const char *pszFile, const char *pszPathID, int nIterations )
+{
+	CKeyValuesImage image;
+	if ( !report.Check( image.LoadOrCompile( g_pFullFileSystem, pszFile, pszPathID, false, true, NULL ), "couldn't compile %s", pszFile ) )
+		return;
+
+	KeyValues *pText = new KeyValues( pszFile );
+	if ( report.Check( pText->LoadFromFile( g_pFullFileSystem, pszFile, pszPathID ), "couldn't parse %s", pszFile ) )
+	{
+		CompareKeyValuesView( report, pText, image.GetRoot() );
+	}
+	pText->deleteThis();
+
+	CUtlBuffer text;
+	if ( !g_pFullFileSystem->ReadFile( pszFile, pszPathID, text ) )
+		return;
+	text.PutChar( 0 );
+
+	CFastTimer timer;
+	timer.Start();
+	for ( int i = 0; i < nIterations; i++ )
+	{
+		KeyValues *pKV = new KeyValues( pszFile );
+		pKV->LoadFromBuffer( pszFile, (const char *)text.Base(), g_pFullFileSystem, pszPathID );
+		pKV->deleteThis();
+	}
+	timer.End();
+	report.Time( "text parse", timer, nIterations );
+
+	timer.Start();
+	for ( int i = 0; i < nIterations; i++ )
+	{
+		KeyValues *pKV = new KeyValues( pszFile );
+		image.CopyInto( pKV );
+		pKV->deleteThis();
+	}
+	timer.End();
+	report.Time( "image inflate", timer, nIterations );
+
+	// Touching every key through a view is all a read-only consumer needs
+	CUtlVector< KeyValuesView > stack;
+	timer.Start();
+	for ( int i = 0; i < nIterations; i++ )
+	{
+		stack.AddToTail( image.GetRoot() );
+		while ( stack.Count() )
+		{
+			KeyValuesView view = stack.Tail();
+			stack.RemoveMultipleFromTail( 1 );
+			for ( ; view; view = view.GetNextKey() )
+			{
+				view.GetString();
+				if ( view.GetFirstSubKey() )
+				{
+					stack.AddToTail( view.GetFirstSubKey() );
+				}
+			}
+		}
+	}
+	timer.End();
+	report.Time( "view walk", timer, nIterations );
+
+	Msg( "%s: %d nodes, %d bytes of text, %d byte image\n", pszFile, image.GetNodeCount(), text.TellPut() - 1, image.GetImageSize() );
+}
+
+CON_COMMAND_F( tier1_test_kvimage, "Checks KeyValues images against the text parser. Usage: tier1_test_kvimage [file] [pathID] [iterations]", DEVTEST_COMMAND_FLAGS )
+{
+	CDevTestReport report( "tier1_test_kvimage" );
+	TestKeyValuesImageTree( report );
+
+	if ( args.ArgC() > 1 )
+	{
+		const char *pszPathID = ( args.ArgC() > 2 ) ? args[2] : "GAME";
+		int nIterations = ( args.ArgC() > 3 ) ? MAX( atoi( args[3] ), 1 ) : 20;
+		TestKeyValuesImageFile( report, args[1], pszPathID, nIterations );
+	}
+
+	report.Finish();
+}
+
+//-----------------------------------------------------------------------------
+// KeyValues child index
+//-----------------------------------------------------------------------------
+
+// What FindKey returned before the child index
+static KeyValues *FindKeyByWalking( KeyValues *pParent, int iKeySymbol )
+{
+	for ( KeyValues *dat = pParent->GetFirstSubKey(); dat; dat = dat->GetNextKey() )
+	{
+		if ( dat->GetNameSymbol() == iKeySymbol )
+			return dat;
+	}
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Looks every name in names up through FindKey and by walking the
+//			list and checks both give the same key
+//-----------------------------------------------------------------------------
+static void CompareIndexedLookups( CDevTestReport &report, const char *pszStep, KeyValues *pParent, const CUtlVector< CUtlString > &names )
+{
+	for ( int i = 0; i < names.Count(); i++ )
+	{
+		int iKeySymbol = KeyValues::CallGetSymbolForString( names[i] );
+		KeyValues *pExpected = FindKeyByWalking( pParent, iKeySymbol );
+		report.Check( pParent->FindKey( iKeySymbol ) == pExpected, "%s: FindKey( symbol ) for '%s'", pszStep, names[i].Get() );
+		report.Check( pParent->FindKey( names[i] ) == pExpected, "%s: FindKey( name ) for '%s'", pszStep, names[i].Get() );
+	}
+}
+
+static void TestKeyValuesChildIndex( CDevTestReport &report, int nChildren )
+{
+	CUtlVector< CUtlString > names;
+	KeyValues *pRoot = new KeyValues( "root" );
+	for ( int i = 0; i < nChildren; i++ )
+	{
+		names.AddToTail( CUtlString( CFmtStr( "key%d", i ) ) );
+		pRoot->SetInt( names.Tail(), i );
+	}
+
+	// A few duplicates, which must not hide the first key of their name
+	pRoot->AddSubKey( new KeyValues( "key0", "value", "duplicate" ) );
+	pRoot->AddSubKey( new KeyValues( "key1", "value", "duplicate" ) );
+	names.AddToTail( CUtlString( "missing" ) );
+
+	report.Check( nChildren <= KeyValues::GetChildIndexThreshold() || pRoot->HasChildIndex(), "a node with %d children wasn't indexed", nChildren );
+	report.Check( pRoot->GetInt() == 0, "GetInt on an indexed node returned the index" );
+	CompareIndexedLookups( report, "built", pRoot, names );
+
+	// Renames, to a new name and to the name of an earlier key
+	pRoot->FindKey( "key2" )->SetName( "renamed" );
+	pRoot->FindKey( "key4" )->SetName( "key3" );
+	names.AddToTail( CUtlString( "renamed" ) );
+	CompareIndexedLookups( report, "renamed", pRoot, names );
+
+	// Removing the first of two duplicates hands its slot to the second
+	for ( int i = 0; i < 2; i++ )
+	{
+		KeyValues *pKey = pRoot->FindKey( names[i] );
+		pRoot->RemoveSubKey( pKey );
+		pKey->deleteThis();
+	}
+	report.Check( !Q_strcmp( pRoot->GetString( "key0/value" ), "duplicate" ), "removing a key didn't uncover its duplicate" );
+
+	// And removing a renamed key finds its slot under the old name
+	KeyValues *pRenamed = pRoot->FindKey( "renamed" );
+	pRoot->RemoveSubKey( pRenamed );
+	pRenamed->deleteThis();
+	CompareIndexedLookups( report, "removed", pRoot, names );
+
+	// Appends through every path, including one linked in by hand the way a
+	// module without the index would
+	pRoot->AddSubKey( new KeyValues( "added" ) );
+	pRoot->FindKey( "created", true );
+	pRoot->CreateNewKey();
+	pRoot->FindLastSubKey()->SetNextKey( new KeyValues( "linked" ) );
+	names.AddToTail( CUtlString( "added" ) );
+	names.AddToTail( CUtlString( "created" ) );
+	names.AddToTail( CUtlString( "linked" ) );
+	CompareIndexedLookups( report, "appended", pRoot, names );
+
+	pRoot->FindKey( "after_linked", true );
+	names.AddToTail( CUtlString( "after_linked" ) );
+	CompareIndexedLookups( report, "appended after a linked key", pRoot, names );
+
+	// Copies and loaded trees are indexed by the code building them
+	KeyValues *pCopy = pRoot->MakeCopy();
+	report.Check( nChildren <= KeyValues::GetChildIndexThreshold() || pCopy->HasChildIndex(), "a copy with %d children wasn't indexed", nChildren );
+	CompareIndexedLookups( report, "copied", pCopy, names );
+	pCopy->deleteThis();
+
+	CUtlBuffer text( 0, 0, CUtlBuffer::TEXT_BUFFER );
+	pRoot->RecursiveSaveToFile( text, 0 );
+	text.PutChar( 0 );
+	KeyValues *pLoaded = new KeyValues( "root" );
+	if ( report.Check( pLoaded->LoadFromBuffer( "kvindex", (const char *)text.Base() ), "couldn't reload the test tree" ) )
+	{
+		report.Check( nChildren <= KeyValues::GetChildIndexThreshold() || pLoaded->HasChildIndex(), "a loaded node with %d children wasn't indexed", nChildren );
+		CompareIndexedLookups( report, "loaded", pLoaded, names );
+	}
+	pLoaded->deleteThis();
+
+	pRoot->deleteThis();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Lookups must not change the tree, so a tree built without an index
+//			stays without one however long the walks get
+//-----------------------------------------------------------------------------
+static void TestKeyValuesLookupsDontIndex( CDevTestReport &report )
+{
+	int nOldThreshold = KeyValues::GetChildIndexThreshold();
+	KeyValues::SetChildIndexThreshold( 0 );
+
+	KeyValues *pRoot = new KeyValues( "root" );
+	for ( int i = 0; i < 4 * MAX( nOldThreshold, 1 ); i++ )
+	{
+		pRoot->SetInt( CFmtStr( "key%d", i ), i );
+	}
+	KeyValues::SetChildIndexThreshold( nOldThreshold );
+
+	for ( int i = 0; i < 8; i++ )
+	{
+		pRoot->FindKey( "missing" );
+	}
+	report.Check( !pRoot->HasChildIndex(), "FindKey built an index" );
+	pRoot->deleteThis();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Times looking every child of a wide node up with and without the
+//			index
+//-----------------------------------------------------------------------------
+static void TimeKeyValuesChildIndex( CDevTestReport &report, int nChildren, int nIterations )
+{
+	CUtlVector< int > symbols;
+	KeyValues *pRoot = new KeyValues( "root" );
+	for ( int i = 0; i < nChildren; i++ )
+	{
+		pRoot->SetInt( CFmtStr( "key%d", i ), i );
+		symbols.AddToTail( pRoot->FindLastSubKey()->GetNameSymbol() );
+	}
+
+	CFastTimer timer;
+	int nMisses = 0;
+	for ( int nPass = 0; nPass < 2; nPass++ )
+	{
+		if ( nPass == 0 )
+		{
+			pRoot->ReleaseChildIndex();
+		}
+		else
+		{
+			pRoot->BuildChildIndex();
+		}
+
+		timer.Start();
+		for ( int i = 0; i < nIterations; i++ )
+		{
+			for ( int j = 0; j < symbols.Count(); j++ )
+			{
+				nMisses += ( pRoot->FindKey( symbols[j] ) == NULL );
+			}
+		}
+		timer.End();
+		report.Time( CFmtStr( "%d children, %s", nChildren, nPass ? "index" : "list walk" ), timer, nIterations );
+	}
+	report.Check( nMisses == 0, "%d keys not found", nMisses );
+
+	pRoot->deleteThis();
+}
+
+CON_COMMAND_F( tier1_test_kvindex, "Checks KeyValues lookups through the child index against walking the list. Usage: tier1_test_kvindex [children] [iterations]", DEVTEST_COMMAND_FLAGS )
+{
+	int nChildren = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 1000;
+	int nIterations = ( args.ArgC() > 2 ) ? MAX( atoi( args[2] ), 1 ) : 20;
+
+	CDevTestReport report( "tier1_test_kvindex" );
+	TestKeyValuesChildIndex( report, KeyValues::GetChildIndexThreshold() + 1 );
+	TestKeyValuesChildIndex( report, nChildren );
+	TestKeyValuesLookupsDontIndex( report );
+	TimeKeyValuesChildIndex( report, nChildren, nIterations );
+	report.Finish();
+}
+
+//-----------------------------------------------------------------------------
+// KeyValues arenas
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// Purpose: Compares two lists of peers key by key
+//-----------------------------------------------------------------------------
+static void CompareKeyValuesTrees( CDevTestReport &report, KeyValues *pExpected, KeyValues *pKey )
+{
+	for ( ; pExpected; pExpected = pExpected->GetNextKey(), pKey = pKey->GetNextKey() )
+	{
+		const char *pszName = pExpected->GetName();
+		if ( !report.Check( pKey != NULL, "tree ends before '%s'", pszName ) )
+			return;
+
+		report.Check( !Q_strcmp( pszName, pKey->GetName() ), "name '%s' vs. '%s'", pszName, pKey->GetName() );
+		report.Check( pExpected->GetDataType() == pKey->GetDataType(), "'%s': type %d vs. %d", pszName, pExpected->GetDataType(), pKey->GetDataType() );
+		if ( pExpected->GetDataType() != KeyValues::TYPE_NONE && pExpected->GetDataType() != KeyValues::TYPE_PTR )
+		{
+			report.Check( !Q_strcmp( pExpected->GetString(), pKey->GetString() ), "'%s': '%s' vs. '%s'", pszName, pExpected->GetString(), pKey->GetString() );
+		}
+
+		if ( pExpected->GetFirstSubKey() )
+		{
+			CompareKeyValuesTrees( report, pExpected->GetFirstSubKey(), pKey->GetFirstSubKey() );
+		}
+		else
+		{
+			report.Check( !pKey->GetFirstSubKey(), "'%s': has extra subkeys", pszName );
+		}
+	}
+
+	report.Check( !pKey, "tree has an extra key '%s'", pKey ? pKey->GetName() : "" );
+}
+
+static void TestKeyValuesArenaTree( CDevTestReport &report )
+{
+	KeyValues *pSource = CreateKeyValuesImageTestTree();
+	CUtlBuffer text( 0, 0, CUtlBuffer::TEXT_BUFFER );
+	pSource->RecursiveSaveToFile( text, 0 );
+	text.PutChar( 0 );
+	pSource->deleteThis();
+
+	KeyValues *pHeap = new KeyValues( "root" );
+	KeyValues *pArena = new KeyValues( "root" );
+	pArena->UseArena( true );
+	bool bLoaded = pHeap->LoadFromBuffer( "kvarena", (const char *)text.Base() ) && pArena->LoadFromBuffer( "kvarena", (const char *)text.Base() );
+	if ( report.Check( bLoaded, "couldn't load the test tree" ) )
+	{
+		report.Check( pArena->IsArenaOwner() && !pHeap->IsArenaOwner(), "only the key using an arena should own one" );
+		CompareKeyValuesTrees( report, pHeap, pArena );
+
+		// Editing keys that live in the arena works like anywhere else
+		pArena->SetString( "string", "a longer string than the one in the arena" );
+		pArena->FindKey( "sub" )->SetInt( "added", 7 );
+		KeyValues *pRemoved = pArena->FindKey( "empty" );
+		pArena->RemoveSubKey( pRemoved );
+		pRemoved->deleteThis();
+		report.Check( !Q_strcmp( pArena->GetString( "string" ), "a longer string than the one in the arena" ) && pArena->GetInt( "sub/added" ) == 7 && !pArena->FindKey( "empty" ), "editing an arena tree" );
+
+		// A copy into its own arena, and one on the heap that may outlive it
+		KeyValues *pArenaCopy = pArena->MakeCopy( true );
+		KeyValues *pHeapCopy = pArena->MakeCopy();
+		report.Check( pArenaCopy->IsArenaOwner() && !pHeapCopy->IsArenaOwner(), "MakeCopy( true ) should give the copy an arena" );
+		CompareKeyValuesTrees( report, pArena, pArenaCopy );
+
+		// Values on the owner itself must be stored, and the arena kept
+		pArena->SetInt( NULL, 42 );
+		report.Check( pArena->GetInt() == 42 && pArena->GetDataType() == KeyValues::TYPE_INT, "SetInt on an arena owner was dropped" );
+		pArena->SetFloat( NULL, 1.5f );
+		report.Check( pArena->GetFloat() == 1.5f, "SetFloat on an arena owner was dropped" );
+		pArena->SetColor( NULL, Color( 1, 2, 3, 4 ) );
+		report.Check( pArena->GetColor() == Color( 1, 2, 3, 4 ), "SetColor on an arena owner was dropped" );
+		pArena->SetPtr( NULL, pHeap );
+		report.Check( pArena->GetPtr() == pHeap, "SetPtr on an arena owner was dropped" );
+		report.Check( pArena->IsArenaOwner() && pArena->GetInt( "sub/added" ) == 7, "setting a value lost the arena" );
+
+		// Deleting the owner frees its keys, so compare the copy afterwards
+		pArena->deleteThis();
+		pArena = NULL;
+		CompareKeyValuesTrees( report, pHeapCopy, pArenaCopy );
+		pArenaCopy->deleteThis();
+		pHeapCopy->deleteThis();
+	}
+
+	if ( pArena )
+	{
+		pArena->deleteThis();
+	}
+	pHeap->deleteThis();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Loads a file with and without an arena, compares the trees and
+//			times loading and freeing both ways
+//-----------------------------------------------------------------------------
+static void TestKeyValuesArenaFile( CDevTestReport &report, const char *pszFile, const char *pszPathID, int nIterations )
+{
+	KeyValues *pHeap = new KeyValues( pszFile );
+	KeyValues *pArena = new KeyValues( pszFile );
+	pArena->UseArena( true );
+	if ( report.Check( pHeap->LoadFromFile( g_pFullFileSystem, pszFile, pszPathID ) && pArena->LoadFromFile( g_pFullFileSystem, pszFile, pszPathID ), "couldn't load %s", pszFile ) )
+	{
+		CompareKeyValuesTrees( report, pHeap, pArena );
+	}
+	pHeap->deleteThis();
+	pArena->deleteThis();
+
+	CUtlBuffer text;
+	if ( !g_pFullFileSystem->ReadFile( pszFile, pszPathID, text ) )
+		return;
+	text.PutChar( 0 );
+
+	CFastTimer timer;
+	for ( int nPass = 0; nPass < 2; nPass++ )
+	{
+		timer.Start();
+		for ( int i = 0; i < nIterations; i++ )
+		{
+			KeyValues *pKV = new KeyValues( pszFile );
+			pKV->UseArena( nPass == 1 );
+			pKV->LoadFromBuffer( pszFile, (const char *)text.Base(), g_pFullFileSystem, pszPathID );
+			pKV->deleteThis();
+		}
+		timer.End();
+		report.Time( nPass ? "load and free, arena" : "load and free, heap", timer, nIterations );
+	}
+}
+
+CON_COMMAND_F( tier1_test_kvarena, "Checks KeyValues trees loaded into an arena against heap allocated ones. Usage: tier1_test_kvarena [file] [pathID] [iterations]", DEVTEST_COMMAND_FLAGS )
+{
+	const char *pszFile = ( args.ArgC() > 1 ) ? args[1] : "scripts/soundscapes_manifest.txt";
+	const char *pszPathID = ( args.ArgC() > 2 ) ? args[2] : "GAME";
+	int nIterations = ( args.ArgC() > 3 ) ? MAX( atoi( args[3] ), 1 ) : 20;
+
+	CDevTestReport report( "tier1_test_kvarena" );
+	TestKeyValuesArenaTree( report );
+	TestKeyValuesArenaFile( report, pszFile, pszPathID, nIterations );
+	report.Finish();
+}
+
+//-----------------------------------------------------------------------------
+// Bit buffer accumulators
+//-----------------------------------------------------------------------------
+
+static float RandomBitBufCoord()
+{
+	switch ( RandomInt( 0, 4 ) )
+	{
+	case 0:		return 0.0f;
+	case 1:		return RandomFloat( -0.05f, 0.05f );
+	case 2:		return (float)RandomInt( -100, 100 );
+	default:	return RandomFloat( -MAX_COORD_FLOAT, MAX_COORD_FLOAT );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes and reads random sequences of fields through bf_write and
+//			bf_read and through the accumulators, which must agree bit for
+//			bit, overflows included
+//-----------------------------------------------------------------------------
+static void TestBitBufAccumulators( CDevTestReport &report, int nIterations )
+{
+	enum { NUM_OPS = 24, BUF_DWORDS = 64 };
+
+	for ( int it = 0; it < nIterations; it++ )
+	{
+		unsigned long pRef[BUF_DWORDS], pTest[BUF_DWORDS];
+		for ( int i = 0; i < BUF_DWORDS; i++ )
+		{
+			pRef[i] = pTest[i] = (unsigned long)RandomInt( INT_MIN, INT_MAX );
+		}
+
+		// Small buffers and odd bit counts so overflows get exercised too
+		int nBytes = 4 * RandomInt( 1, BUF_DWORDS );
+		int nBits = nBytes * 8 - ( RandomInt( 0, 2 ) == 0 ? RandomInt( 0, 31 ) : 0 );
+		int nStartBit = RandomInt( 0, nBits / 2 );
+
+		int nOps = RandomInt( 1, NUM_OPS );
+		int pOp[NUM_OPS], pNumBits[NUM_OPS];
+		unsigned int pValue[NUM_OPS];
+		Vector pVec[NUM_OPS];
+		for ( int i = 0; i < nOps; i++ )
+		{
+			pOp[i] = RandomInt( 0, 8 );
+			pNumBits[i] = RandomInt( 1, 32 );
+			pValue[i] = (unsigned int)RandomInt( INT_MIN, INT_MAX ) & ( pNumBits[i] == 32 ? 0xFFFFFFFF : ( 1u << pNumBits[i] ) - 1 );
+			if ( pOp[i] == 4 || pOp[i] == 5 )
+			{
+				pVec[i].Init( RandomFloat( -1, 1 ), RandomFloat( -1, 1 ), RandomFloat( -1, 1 ) );
+				if ( RandomInt( 0, 1 ) )
+				{
+					VectorNormalize( pVec[i] );
+				}
+			}
+			else
+			{
+				pVec[i].Init( RandomBitBufCoord(), RandomBitBufCoord(), RandomBitBufCoord() );
+			}
+		}
+
+		bf_write ref( pRef, nBytes, nBits ), test( pTest, nBytes, nBits );
+		ref.SetAssertOnOverflow( false );
+		test.SetAssertOnOverflow( false );
+		ref.SeekToBit( nStartBit );
+		test.SeekToBit( nStartBit );
+		{
+			CBitWriteAccumulator acc( test );
+			for ( int i = 0; i < nOps; i++ )
+			{
+				switch ( pOp[i] )
+				{
+				case 0: ref.WriteUBitLong( pValue[i], pNumBits[i] ); acc.WriteUBitLong( pValue[i], pNumBits[i] ); break;
+				case 1: ref.WriteOneBit( pValue[i] & 1 ); acc.WriteOneBit( pValue[i] & 1 ); break;
+				case 2: ref.WriteBitCoord( pVec[i].x ); acc.WriteBitCoord( pVec[i].x ); break;
+				case 3: ref.WriteBitVec3Coord( pVec[i] ); acc.WriteBitVec3Coord( pVec[i] ); break;
+				case 4: ref.WriteBitNormal( pVec[i].x ); acc.WriteBitNormal( pVec[i].x ); break;
+				case 5: ref.WriteBitVec3Normal( pVec[i] ); acc.WriteBitVec3Normal( pVec[i] ); break;
+				case 6: ref.WriteBitAngle( pVec[i].x, 1 + pNumBits[i] % 16 ); acc.WriteBitAngle( pVec[i].x, 1 + pNumBits[i] % 16 ); break;
+				case 7: ref.WriteFloat( pVec[i].y ); acc.WriteFloat( pVec[i].y ); break;
+				case 8: ref.WriteShort( (short)pValue[i] ); acc.WriteShort( (short)pValue[i] ); break;
+				}
+			}
+		}
+
+		// Once a buffer overflows its contents are undefined; only the state has to match
+		bool bOverflowed = ref.IsOverflowed();
+		if ( !report.Check( bOverflowed == test.IsOverflowed() && ref.GetNumBitsWritten() == test.GetNumBitsWritten(), "iteration %d: write state differs", it ) )
+			continue;
+
+		if ( bOverflowed || !report.Check( !V_memcmp( pRef, pTest, sizeof( pRef ) ), "iteration %d: written bits differ", it ) )
+			continue;
+
+		bf_read refRead( pRef, nBytes, nBits ), testRead( pRef, nBytes, nBits );
+		refRead.Seek( nStartBit );
+		testRead.Seek( nStartBit );
+		{
+			CBitReadAccumulator racc( testRead );
+			for ( int i = 0; i < nOps; i++ )
+			{
+				unsigned int nRef = 0, nTest = 0;
+				Vector vecRef( 0, 0, 0 ), vecTest( 0, 0, 0 );
+				switch ( pOp[i] )
+				{
+				case 0: nRef = refRead.ReadUBitLong( pNumBits[i] ); nTest = racc.ReadUBitLong( pNumBits[i] ); break;
+				case 1: nRef = refRead.ReadOneBit(); nTest = racc.ReadOneBit(); break;
+				case 2: vecRef.x = refRead.ReadBitCoord(); vecTest.x = racc.ReadBitCoord(); break;
+				case 3: refRead.ReadBitVec3Coord( vecRef ); racc.ReadBitVec3Coord( vecTest ); break;
+				case 4: vecRef.x = refRead.ReadBitNormal(); vecTest.x = racc.ReadBitNormal(); break;
+				case 5: refRead.ReadBitVec3Normal( vecRef ); racc.ReadBitVec3Normal( vecTest ); break;
+				case 6: vecRef.x = refRead.ReadBitAngle( 1 + pNumBits[i] % 16 ); vecTest.x = racc.ReadBitAngle( 1 + pNumBits[i] % 16 ); break;
+				case 7: vecRef.x = refRead.ReadFloat(); vecTest.x = racc.ReadFloat(); break;
+				case 8: nRef = refRead.ReadShort(); nTest = racc.ReadShort(); break;
+				}
+
+				if ( !report.Check( nRef == nTest && !V_memcmp( &vecRef, &vecTest, sizeof( Vector ) ), "iteration %d: op %d read differently", it, pOp[i] ) )
+					break;
+			}
+		}
+
+		report.Check( refRead.GetNumBitsRead() == testRead.GetNumBitsRead(), "iteration %d: read position differs", it );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The vector array codecs must match the per-field ones; times both
+//			on a temp entity sized batch
+//-----------------------------------------------------------------------------
+static void TestBitBufCoordArrays( CDevTestReport &report, int nIterations )
+{
+	const int nVectors = 256;
+	CUtlVector< Vector > vectors, decoded, decodedArray;
+	vectors.SetCount( nVectors );
+	decoded.SetCount( nVectors );
+	decodedArray.SetCount( nVectors );
+	for ( int i = 0; i < nVectors; i++ )
+	{
+		vectors[i].Init( RandomBitBufCoord(), RandomBitBufCoord(), RandomBitBufCoord() );
+	}
+
+	CUtlMemory< unsigned long > perField( 0, nVectors * 3 * 3 ), array( 0, nVectors * 3 * 3 );
+	V_memset( perField.Base(), 0, perField.Count() * sizeof( unsigned long ) );
+	V_memset( array.Base(), 0, array.Count() * sizeof( unsigned long ) );
+
+	CFastTimer timer;
+	for ( int nMode = 0; nMode < 2; nMode++ )
+	{
+		CUtlMemory< unsigned long > &data = nMode ? array : perField;
+		CUtlVector< Vector > &out = nMode ? decodedArray : decoded;
+		int nBitsWritten = 0;
+
+		timer.Start();
+		for ( int nPass = 0; nPass < nIterations; nPass++ )
+		{
+			bf_write buf( data.Base(), data.Count() * sizeof( unsigned long ) );
+			bf_read read( data.Base(), data.Count() * sizeof( unsigned long ) );
+			if ( nMode == 0 )
+			{
+				for ( int i = 0; i < nVectors; i++ )
+				{
+					buf.WriteBitVec3Coord( vectors[i] );
+				}
+				for ( int i = 0; i < nVectors; i++ )
+				{
+					read.ReadBitVec3Coord( out[i] );
+				}
+			}
+			else
+			{
+				buf.WriteBitVec3CoordArray( vectors.Base(), nVectors );
+				read.ReadBitVec3CoordArray( out.Base(), nVectors );
+			}
+			nBitsWritten = buf.GetNumBitsWritten();
+		}
+		timer.End();
+		report.Time( CFmtStr( "%d vec3 coords, %s", nVectors, nMode ? "array" : "per field" ), timer, nIterations );
+
+		if ( nMode == 1 )
+		{
+			report.Check( !V_memcmp( perField.Base(), array.Base(), ( nBitsWritten + 7 ) / 8 ), "array coords encode differently" );
+			report.Check( !V_memcmp( decoded.Base(), decodedArray.Base(), nVectors * sizeof( Vector ) ), "array coords decode differently" );
+		}
+	}
+}
+
+CON_COMMAND_F( tier1_test_bitbuf, "Checks the word-at-a-time bitbuf codecs against the per-field ones. Usage: tier1_test_bitbuf [iterations]", DEVTEST_COMMAND_FLAGS )
+{
+	int nIterations = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 10000;
+
+	CDevTestReport report( "tier1_test_bitbuf" );
+	TestBitBufAccumulators( report, nIterations );
+	TestBitBufCoordArrays( report, MAX( nIterations / 50, 1 ) );
+	report.Finish();
+}
+
+//-----------------------------------------------------------------------------
+// Sharded data manager
+//-----------------------------------------------------------------------------
+
+struct devtestcacheparams_t
+{
+	unsigned int size;
+};
+
+class CDevTestCacheItem
+{
+public:
+	static CDevTestCacheItem *CreateResource( const devtestcacheparams_t &params )
+	{
+		CDevTestCacheItem *pItem = new CDevTestCacheItem;
+		pItem->m_size = params.size;
+		pItem->m_timeValid = 0.0f;
+		return pItem;
+	}
+	static unsigned int EstimatedSize( const devtestcacheparams_t &params ) { return params.size; }
+	void DestroyResource() { delete this; }
+	CDevTestCacheItem *GetData() { return this; }
+	unsigned int Size() { return m_size; }
+
+	unsigned int m_size;
+	float m_timeValid;
+};
+
+typedef CDataManager< CDevTestCacheItem, devtestcacheparams_t, CDevTestCacheItem *, CThreadFastMutex > CDevTestCacheSingle;
+typedef CShardedDataManager< CDevTestCacheItem, devtestcacheparams_t, CDevTestCacheItem *, CThreadFastMutex > CDevTestCacheSharded;
+
+//-----------------------------------------------------------------------------
+// Purpose: A shard can only hand out so many handles. Full shards must evict
+//			rather than hand out handles that alias, and creating must fail
+//			cleanly once everything is locked.
+//-----------------------------------------------------------------------------
+static void TestShardedDataManagerLimits( CDevTestReport &report )
+{
+	const int nCapacity = CDevTestCacheSharded::NUM_SHARDS * CDevTestCacheSharded::MAX_SHARD_RESOURCES;
+	devtestcacheparams_t params;
+	params.size = 1;
+
+	CDevTestCacheSharded unlocked;
+	CUtlVector< memhandle_t > handles;
+	for ( int i = 0; i < nCapacity + 1000; i++ )
+	{
+		handles.AddToTail( unlocked.CreateResource( params ) );
+	}
+
+	int nValid = 0;
+	for ( int i = 0; i < handles.Count(); i++ )
+	{
+		report.Check( handles[i] != INVALID_MEMHANDLE, "unlocked resource %d wasn't created", i );
+		nValid += ( unlocked.GetResource_NoLockNoLRUTouch( handles[i] ) != NULL );
+	}
+	report.Check( nValid == nCapacity, "%d of %d resources valid after overfilling the shards", nValid, nCapacity );
+	report.Check( unlocked.GetResource_NoLockNoLRUTouch( handles.Tail() ) != NULL, "the newest resource was evicted" );
+	for ( int i = 0; i < CDevTestCacheSharded::NUM_SHARDS; i++ )
+	{
+		report.Check( unlocked.GetShard( i ).ResourceCount() <= CDevTestCacheSharded::MAX_SHARD_RESOURCES, "shard %d holds %d resources", i, unlocked.GetShard( i ).ResourceCount() );
+	}
+	unlocked.FlushAll();
+
+	CDevTestCacheSharded locked;
+	bool bAllCreated = true;
+	for ( int i = 0; i < nCapacity; i++ )
+	{
+		bAllCreated = bAllCreated && ( locked.CreateResource( params, true ) != INVALID_MEMHANDLE );
+	}
+	report.Check( bAllCreated, "locked resources up to the limit weren't all created" );
+	report.Check( locked.CreateResource( params, true ) == INVALID_MEMHANDLE, "a resource past the limit was created while everything is locked" );
+	locked.BreakAllLocks();
+	locked.FlushAll();
+}
+
+struct DataManagerBenchJob_t
+{
+	CDevTestCacheSingle *m_pSingle;
+	CDevTestCacheSharded *m_pSharded;
+	int m_nOps;
+	int m_nMisses;
+};
+
+// Same locking as the Studio_ bone cache functions use for each kind of manager
+static CThreadFastMutex &DataManagerBenchMutex( CDevTestCacheSingle &manager, memhandle_t hCache ) { return manager.AccessMutex(); }
+static CThreadFastMutex &DataManagerBenchMutex( CDevTestCacheSharded &manager, memhandle_t hCache ) { return manager.AccessMutex( hCache ); }
+
+static memhandle_t DataManagerBenchCreate( CDevTestCacheSingle &manager, const devtestcacheparams_t &params )
+{
+	AUTO_LOCK( manager.AccessMutex() );
+	return manager.CreateResource( params );
+}
+
+static memhandle_t DataManagerBenchCreate( CDevTestCacheSharded &manager, const devtestcacheparams_t &params )
+{
+	return manager.CreateResource( params );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: A handful of "entities" per job, each revalidating its cache every
+//			op and recreating it if it got evicted, like bone setup does
+//-----------------------------------------------------------------------------
+template < class MANAGER >
+static void RunDataManagerBench( MANAGER &manager, DataManagerBenchJob_t &job )
+{
+	const int nEntities = 16;
+	memhandle_t handles[nEntities];
+	memset( handles, 0, sizeof( handles ) );
+
+	devtestcacheparams_t params;
+	params.size = 2048;
+
+	for ( int i = 0; i < job.m_nOps; i++ )
+	{
+		memhandle_t &hCache = handles[i % nEntities];
+		CDevTestCacheItem *pItem = NULL;
+		if ( hCache )
+		{
+			AUTO_LOCK( DataManagerBenchMutex( manager, hCache ) );
+			pItem = manager.GetResource_NoLock( hCache );
+			if ( pItem )
+			{
+				pItem->m_timeValid = (float)i;
+			}
+		}
+
+		if ( !pItem )
+		{
+			job.m_nMisses++;
+			hCache = DataManagerBenchCreate( manager, params );
+		}
+	}
+
+	for ( int i = 0; i < nEntities; i++ )
+	{
+		if ( handles[i] )
+		{
+			AUTO_LOCK( DataManagerBenchMutex( manager, handles[i] ) );
+			manager.DestroyResource( handles[i] );
+		}
+	}
+}
+
+static void DataManagerBenchJob( DataManagerBenchJob_t &job )
+{
+	if ( job.m_pSingle )
+	{
+		RunDataManagerBench( *job.m_pSingle, job );
+	}
+	else
+	{
+		RunDataManagerBench( *job.m_pSharded, job );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Times the bone cache access pattern from many jobs at once against
+//			a single mutex CDataManager and the sharded one
+//-----------------------------------------------------------------------------
+static void TimeShardedDataManager( CDevTestReport &report, int nJobs, int nOps )
+{
+	CUtlVector< DataManagerBenchJob_t > jobs;
+	jobs.SetCount( nJobs );
+
+	CFastTimer timer;
+	for ( int nMode = 0; nMode < 2; nMode++ )
+	{
+		// Budget for half of the working set so eviction gets exercised too
+		CDevTestCacheSingle single( nJobs * 8 * 2048 );
+		CDevTestCacheSharded sharded( nJobs * 8 * 2048 );
+
+		for ( int i = 0; i < nJobs; i++ )
+		{
+			jobs[i].m_pSingle = ( nMode == 0 ) ? &single : NULL;
+			jobs[i].m_pSharded = ( nMode == 1 ) ? &sharded : NULL;
+			jobs[i].m_nOps = nOps;
+			jobs[i].m_nMisses = 0;
+		}
+
+		timer.Start();
+		ParallelProcess( "tier1_test_datamanager", jobs.Base(), jobs.Count(), &DataManagerBenchJob );
+		timer.End();
+
+		int nMisses = 0;
+		for ( int i = 0; i < nJobs; i++ )
+		{
+			nMisses += jobs[i].m_nMisses;
+		}
+
+		report.Time( CFmtStr( "%s, %d misses", nMode ? "sharded" : "single mutex", nMisses ), timer, nJobs );
+		report.Check( ( nMode ? sharded.UsedSize() : single.UsedSize() ) == 0, "%s manager still holds resources", nMode ? "sharded" : "single mutex" );
+	}
+}
+
+CON_COMMAND_F( tier1_test_datamanager, "Checks the sharded data manager's handle limits and times it against a single mutex CDataManager. Usage: tier1_test_datamanager [jobs] [ops per job]", DEVTEST_COMMAND_FLAGS )
+{
+	int nJobs = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 64;
+	int nOps = ( args.ArgC() > 2 ) ? MAX( atoi( args[2] ), 1 ) : 20000;
+
+	CDevTestReport report( "tier1_test_datamanager" );
+	TestShardedDataManagerLimits( report );
+	TimeShardedDataManager( report, nJobs, nOps );
+	report.Finish();
+}
+
+//-----------------------------------------------------------------------------
+// Flat hash map
+//-----------------------------------------------------------------------------
+
+static bool FlatHashTestRemovePredicate( int nKey, int nValue )
+{
+	return ( nValue & 3 ) == 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Times string and int lookups against the tree based containers
+//			CUtlFlatHashMap replaced
+//-----------------------------------------------------------------------------
+static void TestFlatHashLookups( CDevTestReport &report, int nCount, int nIterations )
+{
+	CUtlVector< CUtlString > names, upperNames;
+	names.SetCount( nCount );
+	upperNames.SetCount( nCount );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		names[i].Format( "act_test_name_%d", i );
+		upperNames[i].Format( "ACT_TEST_NAME_%d", i );
+	}
+
+	CUtlDict< int, int > dict;
+	CUtlFlatHashMap< CUtlString, int, CaselessStringHashFunctor, CaselessStringEqualFunctor > flatDict;
+	CUtlMap< int, int > intMap( DefLessFunc( int ) );
+	CUtlFlatHashMap< int, int > flatIntMap;
+	for ( int i = 0; i < nCount; i++ )
+	{
+		dict.Insert( names[i], i );
+		flatDict.Insert( names[i].Get(), i );
+		intMap.Insert( i * 7919, i );
+		flatIntMap.Insert( i * 7919, i );
+	}
+
+	// Both dictionaries are caseless
+	for ( int i = 0; i < nCount; i++ )
+	{
+		int idx = dict.Find( upperNames[i] );
+		UtlFlatHashHandle_t h = flatDict.Find( upperNames[i].Get() );
+		report.Check( idx != dict.InvalidIndex() && h != flatDict.InvalidHandle() && dict[idx] == flatDict[h], "'%s' found differently", upperNames[i].Get() );
+	}
+
+	CFastTimer timer;
+	int nFound = 0;
+
+	timer.Start();
+	for ( int nPass = 0; nPass < nIterations; nPass++ )
+	{
+		for ( int i = 0; i < nCount; i++ )
+		{
+			nFound += ( dict.Find( names[i] ) != dict.InvalidIndex() );
+		}
+	}
+	timer.End();
+	report.Time( CFmtStr( "%d strings, CUtlDict", nCount ), timer, nIterations );
+
+	timer.Start();
+	for ( int nPass = 0; nPass < nIterations; nPass++ )
+	{
+		for ( int i = 0; i < nCount; i++ )
+		{
+			nFound += ( flatDict.Find( names[i].Get() ) != flatDict.InvalidHandle() );
+		}
+	}
+	timer.End();
+	report.Time( CFmtStr( "%d strings, CUtlFlatHashMap", nCount ), timer, nIterations );
+
+	timer.Start();
+	for ( int nPass = 0; nPass < nIterations; nPass++ )
+	{
+		for ( int i = 0; i < nCount; i++ )
+		{
+			nFound += ( intMap.Find( i * 7919 ) != intMap.InvalidIndex() );
+		}
+	}
+	timer.End();
+	report.Time( CFmtStr( "%d ints, CUtlMap", nCount ), timer, nIterations );
+
+	timer.Start();
+	for ( int nPass = 0; nPass < nIterations; nPass++ )
+	{
+		for ( int i = 0; i < nCount; i++ )
+		{
+			nFound += ( flatIntMap.Find( i * 7919 ) != flatIntMap.InvalidHandle() );
+		}
+	}
+	timer.End();
+	report.Time( CFmtStr( "%d ints, CUtlFlatHashMap", nCount ), timer, nIterations );
+
+	report.Check( nFound == nCount * nIterations * 4, "%d of %d lookups found", nFound, nCount * nIterations * 4 );
+	Msg( "tier1_test_flathash: average probe length %.2f\n", flatDict.AverageProbeLength() );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Random removals and reinsertions, checked against CUtlMap
+//-----------------------------------------------------------------------------
+static void TestFlatHashRemovals( CDevTestReport &report, int nCount )
+{
+	CUtlMap< int, int > intMap( DefLessFunc( int ) );
+	CUtlFlatHashMap< int, int > flatIntMap;
+	for ( int i = 0; i < nCount; i++ )
+	{
+		intMap.Insert( i * 7919, i );
+		flatIntMap.Insert( i * 7919, i );
+	}
+
+	for ( int i = 0; i < nCount * 4; i++ )
+	{
+		int nKey = RandomInt( 0, nCount - 1 ) * 7919;
+		if ( RandomInt( 0, 1 ) )
+		{
+			bool bInTree = intMap.Remove( nKey );
+			report.Check( flatIntMap.Remove( nKey ) == bInTree, "removing %d disagrees with the tree", nKey );
+		}
+		else
+		{
+			intMap.InsertOrReplace( nKey, i );
+			flatIntMap.Element( flatIntMap.Insert( nKey ) ) = i;
+		}
+	}
+
+	flatIntMap.RemoveIf( FlatHashTestRemovePredicate );
+	FOR_EACH_MAP_FAST( intMap, i )
+	{
+		UtlFlatHashHandle_t h = flatIntMap.Find( intMap.Key( i ) );
+		if ( ( intMap[i] & 3 ) == 0 )
+		{
+			report.Check( h == flatIntMap.InvalidHandle(), "%d survived RemoveIf", intMap.Key( i ) );
+		}
+		else
+		{
+			report.Check( h != flatIntMap.InvalidHandle() && flatIntMap[h] == intMap[i], "%d lost or changed", intMap.Key( i ) );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Real lookups through the tables that moved to flat hash maps
+//-----------------------------------------------------------------------------
+static void TestFlatHashGameTables( CDevTestReport &report, int nIterations )
+{
+	// Game materials translate the same in either case
+	for ( int c = 'A'; c <= 'Z'; c++ )
+	{
+		const char *pszUpper = decalsystem->TranslateDecalForGameMaterial( "Impact.Concrete", (unsigned char)c );
+		const char *pszLower = decalsystem->TranslateDecalForGameMaterial( "Impact.Concrete", (unsigned char)tolower( c ) );
+		report.Check( !Q_strcmp( pszUpper, pszLower ), "game material '%c' gives '%s', '%c' gives '%s'", c, pszUpper, tolower( c ), pszLower );
+	}
+
+	CUtlVector< const char * > activityNames;
+	for ( int i = 0; i < LAST_SHARED_ACTIVITY; i++ )
+	{
+		const char *pszName = ActivityList_NameForIndex( i );
+		if ( pszName )
+			activityNames.AddToTail( pszName );
+	}
+
+	int nFound = 0;
+	CFastTimer timer;
+	timer.Start();
+	for ( int nPass = 0; nPass < nIterations; nPass++ )
+	{
+		for ( int i = 0; i < activityNames.Count(); i++ )
+		{
+			nFound += ( ActivityList_IndexForName( activityNames[i] ) >= 0 );
+		}
+	}
+	timer.End();
+	report.Time( CFmtStr( "%d activity names", activityNames.Count() ), timer, nIterations );
+	report.Check( nFound == activityNames.Count() * nIterations, "%d of %d activity names found", nFound, activityNames.Count() * nIterations );
+}
+
+CON_COMMAND_F( tier1_test_flathash, "Checks CUtlFlatHashMap against CUtlDict and CUtlMap and times them. Usage: tier1_test_flathash [count] [iterations]", DEVTEST_COMMAND_FLAGS )
+{
+	int nCount = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 2000;
+	int nIterations = ( args.ArgC() > 2 ) ? MAX( atoi( args[2] ), 1 ) : 20;
+
+	CDevTestReport report( "tier1_test_flathash" );
+	TestFlatHashLookups( report, nCount, nIterations );
+	TestFlatHashRemovals( report, nCount );
+	TestFlatHashGameTables( report, nIterations );
+	report.Finish();
+}
+
+//-----------------------------------------------------------------------------
+// String interning
+//-----------------------------------------------------------------------------
+
+struct InternTestJob_t
+{
+	CUtlInternTable *m_pTable;
+	CUtlDict< int, int > *m_pDict;
+	CThreadFastMutex *m_pDictMutex;
+	int m_nFirst;
+	int m_nCount;
+	int m_nErrors;
+};
+
+static void InternTestJob( InternTestJob_t &job )
+{
+	char szName[64];
+	for ( int i = 0; i < job.m_nCount; i++ )
+	{
+		// Neighbouring jobs share half their names, like entities spawned with the same keyvalues
+		V_snprintf( szName, sizeof( szName ), "test_entity_%d", job.m_nFirst + i );
+		if ( job.m_pTable )
+		{
+			const char *pInterned = job.m_pTable->Intern( szName );
+			if ( !pInterned || V_strcmp( pInterned, szName ) || job.m_pTable->Find( szName ) != pInterned )
+			{
+				job.m_nErrors++;
+			}
+		}
+		else
+		{
+			AUTO_LOCK( *job.m_pDictMutex );
+			if ( job.m_pDict->Find( szName ) == job.m_pDict->InvalidIndex() )
+			{
+				job.m_pDict->Insert( szName, 0 );
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Interns overlapping name sets from many jobs at once, into a
+//			CUtlInternTable and into a CUtlDict behind one mutex
+//-----------------------------------------------------------------------------
+static void TestInternConcurrent( CDevTestReport &report, int nJobs, int nCount )
+{
+	CUtlVector< InternTestJob_t > jobs;
+	jobs.SetCount( nJobs );
+
+	CFastTimer timer;
+	int nUnique[2];
+	for ( int nMode = 0; nMode < 2; nMode++ )
+	{
+		CUtlInternTable table( false, true );
+		CUtlDict< int, int > dict;
+		CThreadFastMutex dictMutex;
+
+		for ( int i = 0; i < nJobs; i++ )
+		{
+			jobs[i].m_pTable = ( nMode == 0 ) ? &table : NULL;
+			jobs[i].m_pDict = &dict;
+			jobs[i].m_pDictMutex = &dictMutex;
+			jobs[i].m_nFirst = i * nCount / 2;
+			jobs[i].m_nCount = nCount;
+			jobs[i].m_nErrors = 0;
+		}
+
+		timer.Start();
+		ParallelProcess( "tier1_test_intern", jobs.Base(), jobs.Count(), &InternTestJob );
+		timer.End();
+		report.Time( CFmtStr( "%d jobs, %s", nJobs, nMode ? "locked CUtlDict" : "CUtlInternTable" ), timer, 1 );
+
+		for ( int i = 0; i < nJobs; i++ )
+		{
+			report.Check( !jobs[i].m_nErrors, "job %d: %d strings interned wrongly", i, jobs[i].m_nErrors );
+		}
+
+		if ( nMode == 0 )
+		{
+			// Ids must be dense and map back to the strings
+			nUnique[nMode] = table.Count();
+			for ( int i = 0; i < table.Count(); i++ )
+			{
+				int nId;
+				const char *pString = table.String( i );
+				report.Check( pString && table.Find( pString, &nId ) == pString && nId == i, "id %d does not map back", i );
+			}
+		}
+		else
+		{
+			nUnique[nMode] = dict.Count();
+		}
+	}
+
+	report.Check( nUnique[0] == nUnique[1], "%d strings interned, %d in the dictionary", nUnique[0], nUnique[1] );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: CUtlInternSymbolTable must hand out the symbols CUtlSymbolTable
+//			does, and small tables must stay small
+//-----------------------------------------------------------------------------
+static void TestInternSymbolTable( CDevTestReport &report, int nCount, bool bCaseInsensitive )
+{
+	CUtlSymbolTable symbols( 0, 32, bCaseInsensitive );
+	CUtlInternSymbolTable internSymbols( bCaseInsensitive );
+
+	char szName[64];
+	for ( int i = 0; i < nCount; i++ )
+	{
+		// Every name goes in twice, the second time upper case
+		V_snprintf( szName, sizeof( szName ), "symbol_%d", i / 2 );
+		if ( i & 1 )
+		{
+			V_strupr( szName );
+		}
+
+		CUtlSymbol sym = symbols.AddString( szName );
+		CUtlSymbol internSym = internSymbols.AddString( szName );
+		report.Check( (UtlSymId_t)sym == (UtlSymId_t)internSym, "'%s' is symbol %d, interned %d", szName, (UtlSymId_t)sym, (UtlSymId_t)internSym );
+		report.Check( (UtlSymId_t)internSymbols.Find( szName ) == (UtlSymId_t)internSym, "'%s' not found", szName );
+		report.Check( !V_strcmp( symbols.String( sym ), internSymbols.String( internSym ) ), "symbol %d is '%s', interned '%s'", (UtlSymId_t)sym, symbols.String( sym ), internSymbols.String( internSym ) );
+	}
+
+	report.Check( symbols.GetNumStrings() == internSymbols.GetNumStrings(), "%d symbols, %d interned", symbols.GetNumStrings(), internSymbols.GetNumStrings() );
+	report.Check( !internSymbols.Find( "not_a_symbol" ).IsValid(), "found a symbol never added" );
+
+	CUtlInternTable empty, small;
+	report.Check( empty.GetMemoryUsage() == 0, "empty table uses %d bytes", empty.GetMemoryUsage() );
+	for ( int i = 0; i < 8; i++ )
+	{
+		V_snprintf( szName, sizeof( szName ), "small_%d", i );
+		small.Intern( szName );
+	}
+	report.Check( small.GetMemoryUsage() < 1024, "8 strings use %d bytes", small.GetMemoryUsage() );
+}
+
+CON_COMMAND_F( tier1_test_intern, "Checks concurrent string interning and CUtlInternSymbolTable, and times interning against a locked CUtlDict. Usage: tier1_test_intern [jobs] [strings per job]", DEVTEST_COMMAND_FLAGS )
+{
+	int nJobs = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 64;
+	int nCount = ( args.ArgC() > 2 ) ? MAX( atoi( args[2] ), 1 ) : 5000;
+
+	CDevTestReport report( "tier1_test_intern" );
+	TestInternConcurrent( report, nJobs, nCount );
+	TestInternSymbolTable( report, 2000, false );
+	TestInternSymbolTable( report, 2000, true );
+	report.Finish();
+}
+
+//-----------------------------------------------------------------------------
+// String scanning
+//-----------------------------------------------------------------------------
+
+static inline char StrTestToLower( char c )
+{
+	return ( c >= 'A' && c <= 'Z' ) ? c + ( 'a' - 'A' ) : c;
+}
+
+static inline bool StrTestIsSpace( char c )
+{
+	return c == ' ' || ( c >= '\t' && c <= '\r' );
+}
+
+static int StrTestMatchLength( const char *pA, const char *pB )
+{
+	int n = 0;
+	while ( pA[n] && StrTestToLower( pA[n] ) == StrTestToLower( pB[n] ) )
+	{
+		n++;
+	}
+	return n;
+}
+
+static int StrTestFindFirstOf( const char *pBuf, int nLen, const char *pChars, int nChars )
+{
+	for ( int i = 0; i < nLen; i++ )
+	{
+		if ( memchr( pChars, pBuf[i], nChars ) || StrTestIsSpace( pBuf[i] ) )
+			return i;
+	}
+	return nLen;
+}
+
+static int StrTestSkipWhitespace( const char *pBuf, int nLen )
+{
+	int n = 0;
+	while ( n < nLen && StrTestIsSpace( pBuf[n] ) )
+	{
+		n++;
+	}
+	return n;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Pairs of entity name like strings that differ only near the end,
+//			some only in case
+//-----------------------------------------------------------------------------
+static void MakeStrTestStrings( CUtlVector< CUtlString > &strings, int nCount )
+{
+	strings.SetCount( nCount * 2 );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		int nLen = RandomInt( 1, 96 );
+		char szA[128], szB[128];
+		for ( int j = 0; j < nLen; j++ )
+		{
+			szA[j] = "abcdefghij_KLMNOP 0123456789\t-.:"[RandomInt( 0, 31 )];
+			szB[j] = ( RandomInt( 0, 3 ) || !V_isalpha( szA[j] ) ) ? szA[j] : ( szA[j] ^ ( 'a' - 'A' ) );
+		}
+		szA[nLen] = szB[nLen] = 0;
+		if ( RandomInt( 0, 1 ) )
+		{
+			szB[RandomInt( 0, nLen - 1 )] = 'z';
+		}
+		strings[i * 2] = szA;
+		strings[i * 2 + 1] = szB;
+	}
+}
+
+static const char s_StrTestStops[] = { 0, '"', '{', '}' };
+
+//-----------------------------------------------------------------------------
+// Purpose: The vectorized scanners must agree with byte at a time loops from
+//			every alignment
+//-----------------------------------------------------------------------------
+static void TestStrScanners( CDevTestReport &report, const CUtlVector< CUtlString > &strings )
+{
+	for ( int i = 0; i < strings.Count(); i += 2 )
+	{
+		const char *pA = strings[i].Get();
+		const char *pB = strings[i + 1].Get();
+		int nLen = strings[i].Length();
+		for ( int k = 0; k < MIN( nLen, 16 ); k++ )
+		{
+			int nMatch = StrTestMatchLength( pA + k, pB + k );
+			report.Check( V_StrCaselessMatchLength( pA + k, pB + k ) == nMatch, "match length of '%s' and '%s'", pA + k, pB + k );
+			report.Check( V_FindFirstOf( pA + k, nLen - k, s_StrTestStops, ARRAYSIZE( s_StrTestStops ), true ) == StrTestFindFirstOf( pA + k, nLen - k, s_StrTestStops, ARRAYSIZE( s_StrTestStops ) ), "first stop in '%s'", pA + k );
+			report.Check( V_SkipWhitespace( pA + k, nLen - k ) == StrTestSkipWhitespace( pA + k, nLen - k ), "leading whitespace of '%s'", pA + k );
+			report.Check( ( V_stricmp( pA + k, pB + k ) == 0 ) == ( nMatch == nLen - k ), "V_stricmp of '%s' and '%s'", pA + k, pB + k );
+			report.Check( ( V_strnicmp( pA + k, pB + k, 8 ) == 0 ) == ( nMatch >= MIN( 8, nLen - k ) ), "V_strnicmp of '%s' and '%s'", pA + k, pB + k );
+		}
+
+		// Any tail of a string is found in a twin that only differs in case
+		const char *pTail = pA + nLen / 2;
+		if ( StrTestMatchLength( pA, pB ) != nLen )
+			continue;
+
+		report.Check( V_stristr( pB, pTail ) != NULL, "'%s' not found in '%s'", pTail, pB );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: UTF-8 validation of known good and bad sequences, then of long
+//			runs of ASCII with one bad byte somewhere past the first vector
+//-----------------------------------------------------------------------------
+static void TestStrUTF8( CDevTestReport &report )
+{
+	static const struct
+	{
+		const char *m_pString;
+		bool m_bValid;
+	}
+	s_Cases[] =
+	{
+		{ "plain", true },
+		{ "h\xc3\xa9llo", true },
+		{ "\xe2\x82\xac", true },
+		{ "\xf0\x9f\x98\x80", true },
+		{ "\xc0\xaf", false },			// overlong
+		{ "\xe0\x80\xaf", false },		// overlong
+		{ "\xed\xa0\x80", false },		// surrogate
+		{ "\xf4\x90\x80\x80", false },	// past U+10FFFF
+		{ "\xe2\x82", false },			// truncated
+		{ "\x80", false },				// stray continuation
+	};
+
+	for ( int i = 0; i < ARRAYSIZE( s_Cases ); i++ )
+	{
+		report.Check( V_IsValidUTF8( s_Cases[i].m_pString ) == s_Cases[i].m_bValid, "case %d validated wrongly", i );
+	}
+
+	char szLong[256];
+	for ( int i = 0; i < 64; i++ )
+	{
+		int nLen = RandomInt( 17, sizeof( szLong ) - 1 );
+		for ( int j = 0; j < nLen; j++ )
+		{
+			szLong[j] = (char)RandomInt( 1, 0x7f );
+		}
+		szLong[nLen] = 0;
+		report.Check( V_IsValidUTF8( szLong ) && V_IsValidUTF8( szLong, nLen ), "%d bytes of ASCII rejected", nLen );
+
+		szLong[RandomInt( 16, nLen - 1 )] = (char)0xff;
+		report.Check( !V_IsValidUTF8( szLong ) && !V_IsValidUTF8( szLong, nLen ), "0xff in %d bytes accepted", nLen );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Times the scanners against the byte loops, and a script file's
+//			worth of keyvalues through the text parser
+//-----------------------------------------------------------------------------
+static void TimeStrScanners( CDevTestReport &report, const CUtlVector< CUtlString > &strings, int nIterations )
+{
+	int nCount = strings.Count() / 2;
+	int nSink = 0;
+	CFastTimer timer;
+
+	timer.Start();
+	for ( int nPass = 0; nPass < nIterations; nPass++ )
+	{
+		for ( int i = 0; i < nCount; i++ )
+		{
+			nSink += StrTestMatchLength( strings[i * 2].Get(), strings[i * 2 + 1].Get() );
+			nSink += StrTestFindFirstOf( strings[i * 2].Get(), strings[i * 2].Length(), s_StrTestStops, ARRAYSIZE( s_StrTestStops ) );
+		}
+	}
+	timer.End();
+	report.Time( CFmtStr( "%d compares + scans, bytewise", nCount ), timer, nIterations );
+
+	timer.Start();
+	for ( int nPass = 0; nPass < nIterations; nPass++ )
+	{
+		for ( int i = 0; i < nCount; i++ )
+		{
+			nSink -= V_StrCaselessMatchLength( strings[i * 2].Get(), strings[i * 2 + 1].Get() );
+			nSink -= V_FindFirstOf( strings[i * 2].Get(), strings[i * 2].Length(), s_StrTestStops, ARRAYSIZE( s_StrTestStops ), true );
+		}
+	}
+	timer.End();
+	report.Time( CFmtStr( "%d compares + scans, vectorized", nCount ), timer, nIterations );
+	report.Check( nSink == 0, "timed loops disagree" );
+
+	CUtlBuffer text( 0, 0, CUtlBuffer::TEXT_BUFFER );
+	text.PutString( "\"test\"\n{\n" );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		text.Printf( "\t// entry %d\n\t\"key_%d\"\t\t\"%s\"\n\tunquoted_%d\t%d\n", i, i, strings[i * 2].Get(), i, i );
+	}
+	text.PutString( "}\n" );
+	report.Check( V_IsValidUTF8( (const char *)text.Base(), text.TellPut() ), "generated script is not UTF-8" );
+
+	CFmtStr lastKey( "unquoted_%d", nCount - 1 );
+
+	timer.Start();
+	for ( int nPass = 0; nPass < nIterations; nPass++ )
+	{
+		text.SeekGet( CUtlBuffer::SEEK_HEAD, 0 );
+		KeyValues *pKV = new KeyValues( "test" );
+		bool bLoaded = pKV->LoadFromBuffer( "test", text );
+		report.Check( bLoaded && pKV->GetInt( lastKey, -1 ) == nCount - 1, "pass %d: script parsed wrongly", nPass );
+		report.Check( bLoaded && !V_strcmp( pKV->GetString( "key_0" ), strings[0].Get() ), "pass %d: quoted value parsed wrongly", nPass );
+		pKV->deleteThis();
+	}
+	timer.End();
+	report.Time( CFmtStr( "KeyValues, %d bytes", text.TellPut() ), timer, nIterations );
+}
+
+CON_COMMAND_F( tier1_test_strtools, "Checks the vectorized string scanners against byte at a time loops and times them. Usage: tier1_test_strtools [strings] [iterations]", DEVTEST_COMMAND_FLAGS )
+{
+	int nCount = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 2000;
+	int nIterations = ( args.ArgC() > 2 ) ? MAX( atoi( args[2] ), 1 ) : 20;
+
+	CUtlVector< CUtlString > strings;
+	MakeStrTestStrings( strings, nCount );
+
+	CDevTestReport report( "tier1_test_strtools" );
+	TestStrScanners( report, strings );
+	TestStrUTF8( report );
+	TimeStrScanners( report, strings, nIterations );
+	report.Finish();
+}
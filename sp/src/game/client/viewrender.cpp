@@ -3970,6 +3970,14 @@ void CRendering3dView::SetupRenderablesList( int viewID )
 		setupInfo.m_flRenderDistSq = (viewID == VIEW_SHADOW_DEPTH_TEXTURE) ? MIN(zFar, fMaxDist) : fMaxDist;
 		setupInfo.m_flRenderDistSq *= setupInfo.m_flRenderDistSq;
 
+		// The engine culls against the same frustum once this view is pushed
+		Frustum_t frustum;
+		if ( !m_bOrtho )
+		{
+			GeneratePerspectiveFrustum( origin, angles, zNear, zFar, fov, m_flAspectRatio, frustum );
+			setupInfo.m_pFrustum = &frustum;
+		}
+
 		ClientLeafSystem()->BuildRenderablesList( setupInfo );
 	}
 }
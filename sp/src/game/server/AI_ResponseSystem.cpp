@@ -35,6 +35,8 @@
 ConVar rr_debugresponses( "rr_debugresponses", "0", FCVAR_NONE, "Show verbose matching output (1 for simple, 2 for rule scoring). If set to 3, it will only show response success/failure for npc_selected NPCs." );
 ConVar rr_debugrule( "rr_debugrule", "", FCVAR_NONE, "If set to the name of the rule, that rule's score will be shown whenever a concept is passed into the response rules system.");
 ConVar rr_dumpresponses( "rr_dumpresponses", "0", FCVAR_NONE, "Dump all response_rules.txt and rules (requires restart)" );
+ConVar rr_ruleindex( "rr_ruleindex", "1", FCVAR_NONE, "Use the compiled concept index to pick candidate rules instead of scoring every rule." );
+ConVar rr_verifyruleindex( "rr_verifyruleindex", "0", FCVAR_CHEAT, "Score every rule alongside the concept index and warn if they ever select differently. Also checks every rule's own criteria against both whenever the index is rebuilt." );
 
 #ifdef MAPBASE
 ConVar rr_enhanced_saverestore( "rr_enhanced_saverestore", "0", FCVAR_NONE, "Enables enhanced save/restore capabilities for the Response System." );
@@ -44,7 +46,7 @@ ConVar rr_enhanced_saverestore( "rr_enhanced_saverestore", "0", FCVAR_NONE, "Ena
 ConVar rr_disableemptyrules( "rr_disableemptyrules", "1", FCVAR_NONE, "Disables rules with no remaining responses, e.g. rules which use norepeat responses." );
 #endif
 
-static CUtlSymbolTable g_RS;
+static CUtlInternSymbolTable g_RS;
 
 inline static char *CopyString( const char *in )
 {
@@ -76,6 +78,10 @@ public:
 #endif
 		maxval = 0.0f;
 		minval = 0.0f;
+		tokenval = 0.0f;
+#ifdef MAPBASE
+		tokenbits = 0;
+#endif
 
 		token = UTL_INVAL_SYMBOL;
 		rawtoken = UTL_INVAL_SYMBOL;
@@ -136,6 +142,12 @@ public:
 	float	maxval;
 	float	minval;
 
+	// Token pre-parsed as a number so comparisons don't need to atof() it every time
+	float	tokenval;
+#ifdef MAPBASE
+	int		tokenbits;
+#endif
+
 	bool	valid : 1;      //1
 	bool	isnumeric : 1;  //2
 	bool	notequal : 1;   //3
@@ -152,7 +164,7 @@ public:
 		token = g_RS.AddString( s );
 	}
 
-	char const *GetToken()
+	char const *GetToken() const
 	{
 		if ( token.IsValid() )
 		{
@@ -738,6 +750,15 @@ public:
 	float		LookupEnumeration( const char *name, bool& found );
 
 	int			FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose );
+	float		CollectBestMatchingRules( const AI_CriteriaSet& set, const CUtlVector< unsigned short > *pCandidates, CUtlVector< int >& bestrules, bool verbose );
+
+	// Rule index
+	void		InvalidateRuleIndex() { m_bRuleIndexDirty = true; }
+	void		BuildRuleIndex();
+	const char	*GetRuleIndexConcept( const Rule *rule );
+	void		GatherCandidateRules( const AI_CriteriaSet& set, CUtlVector< unsigned short >& candidates );
+	void		AppendRuleTestCriteria( AI_CriteriaSet& set, const CUtlVector< unsigned short >& criteria, int depth );
+	int			VerifyRuleIndex();
 
 #ifdef EZ2
 	void		DisableEmptyRules();
@@ -769,6 +790,14 @@ public:
 	CUtlDict< Rule, short >	m_Rules;
 	CUtlDict< Enumeration, short > m_Enumerations;
 
+	// Rules bucketed by the concept they require, compiled lazily from m_Rules.
+	// Rules which can't be bucketed (no required exact concept) are scored for every query.
+	CUtlDict< int, int >	m_RuleIndexBuckets;
+	CUtlVector< CUtlVector< unsigned short > >	m_RuleIndexBucketRules;
+	CUtlVector< unsigned short >	m_RuleIndexUnbucketed;
+	int			m_nRuleIndexCount;
+	bool		m_bRuleIndexDirty;
+
 	char		token[ 1204 ];
 
 	bool		m_bUnget;
@@ -821,6 +850,8 @@ CResponseSystem::CResponseSystem()
 	m_bUnget = false;
 	m_bPrecache = true;
 	m_bCustomManagable = false;
+	m_nRuleIndexCount = 0;
+	m_bRuleIndexDirty = true;
 }
 
 //-----------------------------------------------------------------------------
@@ -876,6 +907,7 @@ void CResponseSystem::Clear()
 	m_Criteria.RemoveAll();
 	m_Rules.RemoveAll();
 	m_Enumerations.RemoveAll();
+	InvalidateRuleIndex();
 }
 
 //-----------------------------------------------------------------------------
@@ -1071,6 +1103,10 @@ void CResponseSystem::ComputeMatcher( Criteria *c, Matcher& matcher )
 
 	matcher.SetToken( token );
 	matcher.SetRaw( rawtoken );
+	matcher.tokenval = (float)atof( token );
+#ifdef MAPBASE
+	matcher.tokenbits = atoi( token );
+#endif
 	matcher.valid = true;
 }
 
@@ -1091,7 +1127,7 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 	if (m.isbit)
 	{
 		int v1 = v;
-		int v2 = atoi(m.GetToken());
+		int v2 = m.tokenbits;
 		if (m.notequal)
 			return (v1 & v2) == 0;
 		else
@@ -1143,7 +1179,7 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 	{
 		if ( m.isnumeric )
 		{
-			if ( v == (float)atof( m.GetToken() ) )
+			if ( v == m.tokenval )
 				return false;
 		}
 		else
@@ -1166,7 +1202,7 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 		if ( !setValue || !setValue[0] )
 			return false;
 
-		return v == (float)atof( m.GetToken() );
+		return v == m.tokenval;
 	}
 
 #ifdef MAPBASE
@@ -1826,21 +1862,232 @@ bool CResponseSystem::GetBestResponse( ResponseSearchResult& searchResult, Rule
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: 
-// Input  : set - 
-//			verbose - 
-// Output : int
+// Purpose: Returns the concept a rule must be queried with in order to score,
+//			or NULL if the rule has to be considered for every query
 //-----------------------------------------------------------------------------
-int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose )
+const char *CResponseSystem::GetRuleIndexConcept( const Rule *rule )
 {
-	CUtlVector< int >	bestrules;
-	float bestscore = 0.001f;
+	int count = rule->m_Criteria.Count();
+	for ( int i = 0; i < count; i++ )
+	{
+		Criteria *c = &m_Criteria[ rule->m_Criteria[ i ] ];
+		if ( c->IsSubCriteriaType() || !c->required || !c->name )
+			continue;
+
+		if ( Q_stricmp( c->name, "concept" ) )
+			continue;
+
+		// Only plain equality matchers can be bucketed, since anything else
+		// could match more than one concept
+		const Matcher &m = c->matcher;
+		if ( !m.valid || m.isnumeric || m.notequal || m.usemin || m.usemax )
+			continue;
+
+#ifdef MAPBASE
+		if ( m.isbit )
+			continue;
+#endif
+
+		const char *pszConcept = m.GetToken();
+		if ( !pszConcept[0] )
+			continue;
+
+#ifdef MAPBASE
+		// Wildcards and regex are resolved by Matcher_NamesMatch at query time
+		if ( pszConcept[0] == '@' || Matcher_ContainsWildcard( pszConcept ) )
+			continue;
+#endif
+
+		return pszConcept;
+	}
 
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Partitions m_Rules by required concept
+//-----------------------------------------------------------------------------
+void CResponseSystem::BuildRuleIndex()
+{
+	m_RuleIndexBuckets.RemoveAll();
+	m_RuleIndexBucketRules.Purge();
+	m_RuleIndexUnbucketed.Purge();
+
+	// Rule indices are appended in ascending order so every bucket stays sorted,
+	// which lets candidates be merged without disturbing tie order
 	int c = m_Rules.Count();
+	for ( int i = 0; i < c; i++ )
+	{
+		const char *pszConcept = GetRuleIndexConcept( &m_Rules[ i ] );
+		if ( !pszConcept )
+		{
+			m_RuleIndexUnbucketed.AddToTail( i );
+			continue;
+		}
+
+		// CUtlDict is case-insensitive, matching how concepts are compared
+		int bucket = m_RuleIndexBuckets.Find( pszConcept );
+		if ( bucket == m_RuleIndexBuckets.InvalidIndex() )
+		{
+			bucket = m_RuleIndexBuckets.Insert( pszConcept, m_RuleIndexBucketRules.AddToTail() );
+		}
+
+		m_RuleIndexBucketRules[ m_RuleIndexBuckets[ bucket ] ].AddToTail( i );
+	}
+
+	m_nRuleIndexCount = c;
+	m_bRuleIndexDirty = false;
+
+	// Scores every rule's criteria against every rule, so only on request
+	if ( rr_verifyruleindex.GetBool() )
+	{
+		VerifyRuleIndex();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if the indexed and linear matchers picked the same rules
+//-----------------------------------------------------------------------------
+static bool RuleIndexResultsMatch( float indexedscore, const CUtlVector< int >& indexedrules, float linearscore, const CUtlVector< int >& linearrules )
+{
+	if ( indexedscore != linearscore || indexedrules.Count() != linearrules.Count() )
+		return false;
+
+	for ( int i = 0; i < linearrules.Count(); i++ )
+	{
+		if ( indexedrules[ i ] != linearrules[ i ] )
+			return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds a value satisfying each plain equality criterion in the list
+//-----------------------------------------------------------------------------
+void CResponseSystem::AppendRuleTestCriteria( AI_CriteriaSet& set, const CUtlVector< unsigned short >& criteria, int depth )
+{
+	for ( int i = 0; i < criteria.Count(); i++ )
+	{
+		Criteria *c = &m_Criteria[ criteria[ i ] ];
+		if ( c->IsSubCriteriaType() )
+		{
+			if ( depth < 4 )
+			{
+				AppendRuleTestCriteria( set, c->subcriteria, depth + 1 );
+			}
+			continue;
+		}
+
+		const Matcher &m = c->matcher;
+		if ( !c->name || !m.valid || m.notequal || m.usemin || m.usemax )
+			continue;
+
+		set.AppendCriteria( c->name, m.GetToken() );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Deterministic check of the rule index. Queries both matchers with
+//			a criteria set built from each rule's own criteria, plus an empty
+//			set, and compares the rules they select.
+// Output : Number of criteria sets the matchers disagreed on
+//-----------------------------------------------------------------------------
+int CResponseSystem::VerifyRuleIndex()
+{
+	CUtlVector< unsigned short > candidates;
+	CUtlVector< int > indexedrules;
+	CUtlVector< int > linearrules;
+
+	int mismatches = 0;
+	int c = m_Rules.Count();
+	for ( int i = -1; i < c; i++ )
+	{
+		AI_CriteriaSet set;
+		if ( i >= 0 )
+		{
+			AppendRuleTestCriteria( set, m_Rules[ i ].m_Criteria, 0 );
+		}
+
+		candidates.RemoveAll();
+		indexedrules.RemoveAll();
+		linearrules.RemoveAll();
+
+		GatherCandidateRules( set, candidates );
+		float indexedscore = CollectBestMatchingRules( set, &candidates, indexedrules, false );
+		float linearscore = CollectBestMatchingRules( set, NULL, linearrules, false );
+
+		if ( !RuleIndexResultsMatch( indexedscore, indexedrules, linearscore, linearrules ) )
+		{
+			Warning( "Response rule index mismatch for the criteria of rule '%s': indexed %d rules (score %.3f) vs. linear %d rules (score %.3f)\n",
+				i >= 0 ? m_Rules.GetElementName( i ) : "<empty>", indexedrules.Count(), indexedscore, linearrules.Count(), linearscore );
+			++mismatches;
+		}
+	}
+
+	Assert( mismatches == 0 );
+	return mismatches;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Fills candidates with every rule which could score against the set, in rule order
+//-----------------------------------------------------------------------------
+void CResponseSystem::GatherCandidateRules( const AI_CriteriaSet& set, CUtlVector< unsigned short >& candidates )
+{
+	if ( m_bRuleIndexDirty || m_nRuleIndexCount != m_Rules.Count() )
+	{
+		BuildRuleIndex();
+	}
+
+	const CUtlVector< unsigned short > *pBucket = NULL;
+
+	int iConcept = set.FindCriterionIndex( "concept" );
+	if ( iConcept != -1 && set.GetValue( iConcept ) )
+	{
+		int bucket = m_RuleIndexBuckets.Find( set.GetValue( iConcept ) );
+		if ( bucket != m_RuleIndexBuckets.InvalidIndex() )
+		{
+			pBucket = &m_RuleIndexBucketRules[ m_RuleIndexBuckets[ bucket ] ];
+		}
+	}
+
+	const CUtlVector< unsigned short > &unbucketed = m_RuleIndexUnbucketed;
+	int nBucket = pBucket ? pBucket->Count() : 0;
+	int nUnbucketed = unbucketed.Count();
+
+	candidates.EnsureCapacity( nBucket + nUnbucketed );
+
+	// Merge the two sorted lists
+	int i = 0, j = 0;
+	while ( i < nBucket || j < nUnbucketed )
+	{
+		if ( j >= nUnbucketed || ( i < nBucket && (*pBucket)[ i ] < unbucketed[ j ] ) )
+		{
+			candidates.AddToTail( (*pBucket)[ i++ ] );
+		}
+		else
+		{
+			candidates.AddToTail( unbucketed[ j++ ] );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Scores the candidate rules (or every rule if pCandidates is NULL)
+//			and collects the ones tied for the best score
+// Output : The best score
+//-----------------------------------------------------------------------------
+float CResponseSystem::CollectBestMatchingRules( const AI_CriteriaSet& set, const CUtlVector< unsigned short > *pCandidates, CUtlVector< int >& bestrules, bool verbose )
+{
+	float bestscore = 0.001f;
+
+	int c = pCandidates ? pCandidates->Count() : m_Rules.Count();
 	int i;
 	for ( i = 0; i < c; i++ )
 	{
-		float score = ScoreCriteriaAgainstRule( set, i, verbose );
+		int irule = pCandidates ? (*pCandidates)[ i ] : i;
+
+		float score = ScoreCriteriaAgainstRule( set, irule, verbose );
 		// Check equals so that we keep track of all matching rules
 		if ( score >= bestscore )
 		{
@@ -1852,10 +2099,52 @@ int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbo
 			}
 
 			// Add to bucket
-			bestrules.AddToTail( i );
+			bestrules.AddToTail( irule );
 		}
 	}
 
+	return bestscore;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+// Input  : set - 
+//			verbose - 
+// Output : int
+//-----------------------------------------------------------------------------
+int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose )
+{
+	CUtlVector< int >	bestrules;
+
+	// Verbose output and rr_debugrule need to see every rule scored
+	const char *pszDebugRule = rr_debugrule.GetString();
+	bool bUseIndex = rr_ruleindex.GetBool() && !verbose && !( pszDebugRule && pszDebugRule[0] );
+
+	if ( bUseIndex )
+	{
+		CUtlVector< unsigned short > candidates;
+		GatherCandidateRules( set, candidates );
+
+		float bestscore = CollectBestMatchingRules( set, &candidates, bestrules, verbose );
+
+		if ( rr_verifyruleindex.GetBool() )
+		{
+			CUtlVector< int > linearrules;
+			float linearscore = CollectBestMatchingRules( set, NULL, linearrules, verbose );
+
+			if ( !RuleIndexResultsMatch( bestscore, bestrules, linearscore, linearrules ) )
+			{
+				Warning( "Response rule index mismatch: indexed %d rules (score %.3f) vs. linear %d rules (score %.3f)\n",
+					bestrules.Count(), bestscore, linearrules.Count(), linearscore );
+				bestrules.Swap( linearrules );
+			}
+		}
+	}
+	else
+	{
+		CollectBestMatchingRules( set, NULL, bestrules, verbose );
+	}
+
 	int bestCount = bestrules.Count();
 	if ( bestCount <= 0 )
 		return -1;
@@ -2863,6 +3152,8 @@ void CResponseSystem::ParseRule( void )
 
 	if ( validRule )
 	{
+		InvalidateRuleIndex();
+
 #ifdef MAPBASE
 		short existing = m_Rules.Find( ruleName );
 		if ( existing != m_Rules.InvalidIndex() )
@@ -3075,6 +3366,7 @@ void CResponseSystem::CopyRuleFrom( Rule *pSrcRule, int iRule, CResponseSystem *
 
 	// Add rule.
 	pCustomSystem->m_Rules.Insert( m_Rules.GetElementName( iRule ), dstRule );
+	pCustomSystem->InvalidateRuleIndex();
 }
 
 #ifdef MAPBASE
@@ -538,6 +538,25 @@ void CBaseAnimatingOverlay::GetSkeleton( CStudioHdr *pStudioHdr, Vector pos[], Q
 	boneSetup.CalcBoneAdj( pos, q, GetEncodedControllerArray() );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Only a skeleton with no layers playing matches the base class one
+//-----------------------------------------------------------------------------
+bool CBaseAnimatingOverlay::CanShareSkeleton( void )
+{
+	CStudioHdr *pStudioHdr = GetModelPtr();
+	if ( !pStudioHdr || !pStudioHdr->SequencesAvailable() )
+		return false;
+
+	for ( int i = 0; i < m_AnimOverlay.Count(); i++ )
+	{
+		CAnimationLayer &layer = m_AnimOverlay[i];
+		if ( layer.m_flWeight > 0 && layer.IsActive() && layer.m_nOrder >= 0 && layer.m_nOrder < m_AnimOverlay.Count() )
+			return false;
+	}
+
+	return BaseClass::CanShareSkeleton();
+}
+
 
 
 //-----------------------------------------------------------------------------
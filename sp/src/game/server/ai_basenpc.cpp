@@ -165,6 +165,14 @@ ConVar	ai_frametime_limit( "ai_frametime_limit", "50", FCVAR_NONE, "frametime li
 
 ConVar	ai_use_think_optimizations( "ai_use_think_optimizations", "1" );
 
+#ifdef _DEBUG
+ConVar	ai_frame_think_limit( "ai_frame_think_limit", "30", FCVAR_NONE, "Milliseconds of NPC thinking allowed per frame before NPCs are deferred to the next tick." );
+#else
+ConVar	ai_frame_think_limit( "ai_frame_think_limit", "10", FCVAR_NONE, "Milliseconds of NPC thinking allowed per frame before NPCs are deferred to the next tick." );
+#endif
+ConVar	ai_frame_think_limit_normal_scale( "ai_frame_think_limit_normal_scale", "1.5", FCVAR_NONE, "NPCs at AIE_NORMAL efficiency are only deferred once NPC thinking exceeds ai_frame_think_limit times this." );
+ConVar	ai_frame_think_max_defer( "ai_frame_think_max_defer", "0.25", FCVAR_NONE, "Longest an NPC at AIE_NORMAL efficiency can be deferred by the frame think limit, in seconds. Less efficient tiers may be deferred proportionally longer." );
+
 ConVar	ai_test_moveprobe_ignoresmall( "ai_test_moveprobe_ignoresmall", "0" );
 
 #ifdef HL2_EPISODIC
@@ -3766,32 +3774,20 @@ void CAI_BaseNPC::UpdateEfficiency( bool bInPVS )
 
 	//---------------------------------
 
-	CBasePlayer *pPlayer = AI_GetSinglePlayer(); 
-	static Vector vPlayerEyePosition;
-	static Vector vPlayerForward;
-	static int iPrevFrame = -1;
-	if ( gpGlobals->framecount != iPrevFrame )
-	{
-		iPrevFrame = gpGlobals->framecount;
-		if ( pPlayer )
-		{
-			pPlayer->EyePositionAndVectors( &vPlayerEyePosition, &vPlayerForward, NULL, NULL );
-		}
-	}
-
-	Vector	vToNPC		= GetAbsOrigin() - vPlayerEyePosition;
-	float	playerDist	= VectorNormalize( vToNPC );
+	// Rank against the nearest player, but count any player looking this way as facing
+	float	playerDist;
+	float	playerDot;
+	CBasePlayer *pPlayer = AI_GetNearestPlayerView( GetAbsOrigin(), &playerDist, &playerDot );
 	bool	bPlayerFacing;
 
 	bool	bClientPVSExpanded = UTIL_ClientPVSIsExpanded();
 
 	if ( pPlayer )
 	{
-		bPlayerFacing = ( bClientPVSExpanded || ( bInPVS && vPlayerForward.Dot( vToNPC ) > 0 ) );
+		bPlayerFacing = ( bClientPVSExpanded || ( bInPVS && playerDot > 0 ) );
 	}
 	else
 	{
-		playerDist = 0;
 		bPlayerFacing = true;
 	}
 
@@ -3892,7 +3888,7 @@ void CAI_BaseNPC::UpdateEfficiency( bool bInPVS )
 
 	if ( !pPlayer )
 	{
-		// No heuristic currently for dedicated servers
+		// Nobody connected to rank against
 		SetEfficiency( minEfficiency );
 		return;
 	}
@@ -4216,18 +4212,6 @@ void CAI_BaseNPC::RebalanceThinks()
 
 		int i;
 
-		CBasePlayer *pPlayer = AI_GetSinglePlayer();
-		Vector vPlayerForward;
-		Vector vPlayerEyePosition;
-
-		vPlayerForward.Init();
-		vPlayerEyePosition.Init();
-
-		if ( pPlayer )
-		{
-			pPlayer->EyePositionAndVectors( &vPlayerEyePosition, &vPlayerForward, NULL, NULL );
-		}
-
 		int iTicksPer10Hz = TIME_TO_TICKS( .1 );
 		int iMinTickRebalance = gpGlobals->tickcount - 1; // -1 needed for alternate ticks
 		int iMaxTickRebalance = gpGlobals->tickcount + iTicksPer10Hz;
@@ -4248,12 +4232,9 @@ void CAI_BaseNPC::RebalanceThinks()
 				{
 					rebalanceCandidates[iInfo].bInPVS = false;
 				}
-				else if ( pPlayer )
+				else if ( AI_GetNearestPlayerView( pCandidate->EyePosition(), &rebalanceCandidates[iInfo].distPlayer, &rebalanceCandidates[iInfo].dotPlayer ) )
 				{
-					Vector vToCandidate = pCandidate->EyePosition() - vPlayerEyePosition;
 					rebalanceCandidates[iInfo].bInPVS = ( UTIL_FindClientInPVS( pCandidate->edict() ) != NULL );
-					rebalanceCandidates[iInfo].distPlayer = VectorNormalize( vToCandidate );
-					rebalanceCandidates[iInfo].dotPlayer = vPlayerForward.Dot( vToCandidate );
 				}
 				else
 				{
@@ -4349,12 +4330,6 @@ bool CAI_BaseNPC::PreNPCThink()
 
 	bool bUseThinkLimits = ( !m_bInChoreo && ShouldUseFrameThinkLimits() );
 
-#ifdef _DEBUG
-	const float NPC_THINK_LIMIT = 30.0 / 1000.0;
-#else
-	const float NPC_THINK_LIMIT = ( !IsXbox() ) ? (10.0 / 1000.0) : (12.5 / 1000.0);
-#endif
-
 	g_StartTimeCurThink = 0;
 
 	if ( bUseThinkLimits && VCRGetMode() == VCR_Disabled )
@@ -4373,16 +4348,26 @@ bool CAI_BaseNPC::PreNPCThink()
 				timescale = 1;
 
 			iPrevFrame = gpGlobals->framecount;
-			frameTimeLimit = NPC_THINK_LIMIT * timescale;
+			frameTimeLimit = ( ai_frame_think_limit.GetFloat() / 1000.0 ) * timescale;
 			g_NpcTimeThisFrame = 0;
 		}
 		else
 		{
-			if ( g_NpcTimeThisFrame > NPC_THINK_LIMIT )
+			// Efficient NPCs are far from or hidden from every player, so they give up
+			// their slot first. NPCs running at full rate get some headroom over the limit.
+			AI_Efficiency_t efficiency = MIN( GetEfficiency(), AIE_SUPER_EFFICIENT );
+			float flLimit = frameTimeLimit;
+			if ( efficiency == AIE_NORMAL )
+			{
+				flLimit *= ai_frame_think_limit_normal_scale.GetFloat();
+			}
+
+			if ( g_NpcTimeThisFrame > flLimit )
 			{
 				float timeSinceLastRealThink = gpGlobals->curtime - m_flLastRealThinkTime;
-				// Don't bump anyone more that a quarter second
-				if ( timeSinceLastRealThink <= .25 )
+				// Don't bump anyone for too long, or they'll visibly stall
+				float flMaxDefer = ai_frame_think_max_defer.GetFloat() * ( 1 + (int)efficiency );
+				if ( timeSinceLastRealThink <= flMaxDefer )
 				{
 					DbgFrameLimitMsg( "Bumped %d (%d)\n", this, gpGlobals->framecount );
 					m_iFrameBlocked = gpGlobals->framecount;
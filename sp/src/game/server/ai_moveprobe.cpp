@@ -16,6 +16,9 @@
 #include "ai_routedist.h"
 #include "props.h"
 #include "vphysics/object_hash.h"
+#include "physics_shared.h"
+#include "tier1/generichash.h"
+#include "collisionutils.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -31,6 +34,11 @@ ConVar	ai_moveprobe_usetracelist( "ai_moveprobe_usetracelist", "0" );
 
 ConVar	ai_strong_optimizations_no_checkstand( "ai_strong_optimizations_no_checkstand", "0" );
 
+ConVar	ai_moveprobe_cache( "ai_moveprobe_cache", "1", FCVAR_NONE, "Remember recent ground probes and reuse them for repeated moves." );
+ConVar	ai_moveprobe_cache_shared( "ai_moveprobe_cache_shared", "1", FCVAR_NONE, "Share remembered ground probes between NPCs of the same class and hull." );
+ConVar	ai_moveprobe_cache_time( "ai_moveprobe_cache_time", "0.25", FCVAR_NONE, "How long a remembered ground probe stays valid, in seconds." );
+ConVar	ai_moveprobe_cache_quantize( "ai_moveprobe_cache_quantize", "0.5", FCVAR_NONE, "Probe start/end positions within this many units of each other share a cache entry." );
+
 #ifdef DEBUG
 ConVar ai_old_check_stand_position( "ai_old_check_stand_position", "0" );
 #define UseOldCheckStandPosition() (ai_old_check_stand_position.GetBool())
@@ -142,6 +150,7 @@ CAI_MoveProbe::CAI_MoveProbe(CAI_BaseNPC *pOuter)
 	m_bIgnoreTransientEntities( false ),
 	m_pTraceListData( NULL )
 {
+	ClearProbeCache();
 }
 
 //-----------------------------------------------------------------------------
@@ -1007,6 +1016,440 @@ void CAI_MoveProbe::ClimbMoveLimit( const Vector &vecStart, const Vector &vecEnd
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Ground probe cache
+//
+// Local navigation, path simplification and triangulation probe the same
+// segments over and over. Recent NAV_GROUND results are remembered per NPC,
+// and shared between NPCs of the same class and hull when the prober itself
+// can't have affected the result. Entries expire after ai_moveprobe_cache_time.
+// Once a tick, before entities think, every entry that an awake physics object
+// (doors, trains and held objects included) or a moving NPC or player overlaps
+// is thrown away, so lookups themselves don't have to search for movers.
+//-----------------------------------------------------------------------------
+
+#define AI_SHARED_PROBE_CACHE_SIZE 512
+
+// Key flag for probes starting where the NPC is standing
+#define AI_PROBE_CACHE_FROM_ORIGIN 0x80000000
+
+static AIMoveProbeCacheEntry_t g_SharedProbeCache[AI_SHARED_PROBE_CACHE_SIZE];
+static bool g_bSharedProbeCacheInit = false;
+
+static CUtlVector<AIMoveProbeMover_t> g_ProbeCacheMovers;
+
+struct AIMoveProbeBounds_t
+{
+	EHANDLE hEntity;
+	Vector vecMins;
+	Vector vecMaxs;
+};
+
+// Where each NPC and player was at the previous invalidation, by entity index
+static AIMoveProbeBounds_t g_ProbeCacheCharacterBounds[MAX_EDICTS];
+
+static int g_nProbeCacheHits;
+static int g_nProbeCacheSharedHits;
+static int g_nProbeCacheMisses;
+
+//-------------------------------------
+
+static void ClearSharedProbeCache()
+{
+	for ( int i = 0; i < AI_SHARED_PROBE_CACHE_SIZE; i++ )
+	{
+		g_SharedProbeCache[i].flTime = -1;
+	}
+	g_bSharedProbeCacheInit = true;
+}
+
+//-------------------------------------
+
+static bool IsProbeCacheEntryValid( const AIMoveProbeCacheEntry_t &entry )
+{
+	if ( entry.flTime < 0 || gpGlobals->curtime - entry.flTime > ai_moveprobe_cache_time.GetFloat() || gpGlobals->curtime < entry.flTime )
+		return false;
+
+	// The obstruction went away
+	if ( IsMoveBlocked( entry.fStatus ) && !entry.hObstruction.Get() )
+		return false;
+
+	return true;
+}
+
+//-------------------------------------
+// Throws away live entries touched by any mover other than pIgnore
+//-------------------------------------
+
+static void InvalidateProbeCacheEntries( AIMoveProbeCacheEntry_t *pEntries, int nEntries, const CUtlVector<AIMoveProbeMover_t> &movers, const CBaseEntity *pIgnore )
+{
+	for ( int i = 0; i < nEntries; i++ )
+	{
+		AIMoveProbeCacheEntry_t &entry = pEntries[i];
+		if ( !IsProbeCacheEntryValid( entry ) )
+		{
+			entry.flTime = -1;
+			continue;
+		}
+
+		for ( int j = 0; j < movers.Count(); j++ )
+		{
+			// Probes never collide with the NPC doing the probing
+			if ( movers[j].pEntity == pIgnore )
+				continue;
+
+			if ( IsBoxIntersectingBox( entry.vecSweptMins, entry.vecSweptMaxs, movers[j].vecMins, movers[j].vecMaxs ) )
+			{
+				entry.flTime = -1;
+				break;
+			}
+		}
+	}
+}
+
+//-------------------------------------
+// Adds an NPC or player to the movers if it moved since the last call,
+// covering both where it was and where it is now
+//-------------------------------------
+
+static void AddProbeCacheCharacterMover( CBaseEntity *pEntity )
+{
+	AIMoveProbeBounds_t &last = g_ProbeCacheCharacterBounds[ pEntity->entindex() ];
+
+	Vector vecMins, vecMaxs;
+	pEntity->CollisionProp()->WorldSpaceAABB( &vecMins, &vecMaxs );
+
+	if ( last.hEntity.Get() == pEntity )
+	{
+		if ( vecMins == last.vecMins && vecMaxs == last.vecMaxs )
+			return;
+
+		AIMoveProbeMover_t &mover = g_ProbeCacheMovers[ g_ProbeCacheMovers.AddToTail() ];
+		mover.pEntity = pEntity;
+		VectorMin( vecMins, last.vecMins, mover.vecMins );
+		VectorMax( vecMaxs, last.vecMaxs, mover.vecMaxs );
+	}
+	else
+	{
+		// Just spawned or teleported in as far as we know
+		AIMoveProbeMover_t &mover = g_ProbeCacheMovers[ g_ProbeCacheMovers.AddToTail() ];
+		mover.pEntity = pEntity;
+		mover.vecMins = vecMins;
+		mover.vecMaxs = vecMaxs;
+	}
+
+	last.hEntity = pEntity;
+	last.vecMins = vecMins;
+	last.vecMaxs = vecMaxs;
+}
+
+//-------------------------------------
+
+static void InvalidateProbeCaches()
+{
+	g_ProbeCacheMovers.RemoveAll();
+
+	if ( physenv )
+	{
+		int nActive = physenv->GetActiveObjectCount();
+		if ( nActive )
+		{
+			IPhysicsObject **pActiveList = (IPhysicsObject **)stackalloc( sizeof(IPhysicsObject *) * nActive );
+			physenv->GetActiveObjects( pActiveList );
+
+			for ( int i = 0; i < nActive; i++ )
+			{
+				CBaseEntity *pEntity = static_cast<CBaseEntity *>( pActiveList[i]->GetGameData() );
+				if ( !pEntity || pEntity->MyCombatCharacterPointer() )
+					continue;
+
+				AIMoveProbeMover_t &mover = g_ProbeCacheMovers[ g_ProbeCacheMovers.AddToTail() ];
+				mover.pEntity = pEntity;
+				pEntity->CollisionProp()->WorldSpaceAABB( &mover.vecMins, &mover.vecMaxs );
+			}
+		}
+	}
+
+	// NPCs and players can walk into the probed space without being awake physics objects
+	CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
+	int nAIs = g_AI_Manager.NumAIs();
+	for ( int i = 0; i < nAIs; i++ )
+	{
+		AddProbeCacheCharacterMover( ppAIs[i] );
+	}
+
+	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+	{
+		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
+		if ( pPlayer )
+		{
+			AddProbeCacheCharacterMover( pPlayer );
+		}
+	}
+
+	if ( !g_ProbeCacheMovers.Count() )
+		return;
+
+	if ( g_bSharedProbeCacheInit )
+	{
+		InvalidateProbeCacheEntries( g_SharedProbeCache, AI_SHARED_PROBE_CACHE_SIZE, g_ProbeCacheMovers, NULL );
+	}
+
+	for ( int i = 0; i < nAIs; i++ )
+	{
+		CAI_MoveProbe *pMoveProbe = ppAIs[i]->GetMoveProbe();
+		if ( pMoveProbe )
+		{
+			pMoveProbe->InvalidateProbeCache( g_ProbeCacheMovers );
+		}
+	}
+}
+
+//-------------------------------------
+
+class CAI_MoveProbeCacheSystem : public CAutoGameSystemPerFrame
+{
+public:
+	CAI_MoveProbeCacheSystem() : CAutoGameSystemPerFrame( "CAI_MoveProbeCacheSystem" ) {}
+
+	virtual void LevelInitPreEntity()		{ Reset(); }
+	virtual void LevelShutdownPostEntity()	{ Reset(); }
+
+	virtual void FrameUpdatePreEntityThink()
+	{
+		if ( ai_moveprobe_cache.GetBool() )
+		{
+			InvalidateProbeCaches();
+		}
+	}
+
+private:
+	void Reset()
+	{
+		// Entries from the previous map must never be served on the next one
+		ClearSharedProbeCache();
+		g_ProbeCacheMovers.Purge();
+		for ( int i = 0; i < MAX_EDICTS; i++ )
+		{
+			g_ProbeCacheCharacterBounds[i].hEntity = NULL;
+		}
+	}
+};
+
+static CAI_MoveProbeCacheSystem g_AI_MoveProbeCacheSystem;
+
+//-------------------------------------
+
+static inline int QuantizeProbeCoord( float flCoord, float flInvQuantize )
+{
+	return (int)floorf( flCoord * flInvQuantize + 0.5f );
+}
+
+//-------------------------------------
+
+void CAI_MoveProbe::ClearProbeCache()
+{
+	for ( int i = 0; i < PROBE_CACHE_SIZE; i++ )
+	{
+		m_ProbeCache[i].flTime = -1;
+	}
+	m_iNextProbeCacheEntry = 0;
+}
+
+//-------------------------------------
+
+void CAI_MoveProbe::InvalidateProbeCache( const CUtlVector<AIMoveProbeMover_t> &movers )
+{
+	InvalidateProbeCacheEntries( m_ProbeCache, PROBE_CACHE_SIZE, movers, GetOuter() );
+}
+
+//-------------------------------------
+
+bool CAI_MoveProbe::BuildProbeCacheKey( const Vector &vecStart, const Vector &vecEnd, unsigned int collisionMask, const CBaseEntity *pTarget, float pctToCheckStandPositions, unsigned flags, AIMoveProbeCacheKey_t *pKey ) const
+{
+	if ( !ai_moveprobe_cache.GetBool() || ( flags & AIMLF_DRAW_RESULTS ) )
+		return false;
+
+	if ( ai_moveprobe_debug.GetBool() && (GetOuter()->m_debugOverlays & OVERLAY_NPC_SELECTED_BIT) )
+		return false;
+
+	float flQuantize = ai_moveprobe_cache_quantize.GetFloat();
+	float flInvQuantize = ( flQuantize > 0.001f ) ? 1.0f / flQuantize : 1000.0f;
+
+	memset( pKey, 0, sizeof(*pKey) );
+
+	for ( int i = 0; i < 3; i++ )
+	{
+		pKey->start[i] = QuantizeProbeCoord( vecStart[i], flInvQuantize );
+		pKey->end[i] = QuantizeProbeCoord( vecEnd[i], flInvQuantize );
+	}
+
+	pKey->collisionMask = collisionMask;
+	pKey->flags = ( flags & ~AIMLF_STOP_AT_BLOCKED );
+
+	// TestGroundMove lets NPCs walk out of physics objects they start embedded in,
+	// which depends on the probe starting where the NPC is standing
+	if ( ( vecStart - GetLocalOrigin() ).Length2DSqr() < 0.1 && fabsf( vecStart.z - GetLocalOrigin().z ) < StepHeight() * 0.5 )
+		pKey->flags |= AI_PROBE_CACHE_FROM_ORIGIN;
+
+	pKey->pct = (int)( pctToCheckStandPositions * 100.0f );
+	pKey->hTarget = ( pTarget ) ? pTarget->GetRefEHandle().ToInt() : 0;
+	pKey->hull = GetHullType();
+	pKey->iClassname = (int)(intp)STRING( GetOuter()->m_iClassname );
+
+	return true;
+}
+
+//-------------------------------------
+
+static void ApplyProbeCacheEntry( const AIMoveProbeCacheEntry_t &entry, Navigation_t navType, const Vector &vecStart, const Vector &vecEnd, AIMoveTrace_t *pTrace )
+{
+	pTrace->fStatus = entry.fStatus;
+	pTrace->vEndPosition = entry.vEndPosition + ( vecStart - entry.vecStart );
+	pTrace->vHitNormal = entry.vHitNormal;
+	pTrace->pObstruction = entry.hObstruction.Get();
+	pTrace->flTotalDist = ComputePathDistance( navType, vecStart, vecEnd );
+	pTrace->flDistObstructed = entry.flDistObstructed;
+	pTrace->flStepUpDistance = entry.flStepUpDistance;
+}
+
+//-------------------------------------
+
+bool CAI_MoveProbe::LookupProbeCache( const AIMoveProbeCacheKey_t &key, const Vector &vecStart, const Vector &vecEnd, AIMoveTrace_t *pTrace )
+{
+	for ( int i = 0; i < PROBE_CACHE_SIZE; i++ )
+	{
+		AIMoveProbeCacheEntry_t &entry = m_ProbeCache[i];
+		if ( entry.flTime < 0 || !( entry.key == key ) )
+			continue;
+
+		if ( !IsProbeCacheEntryValid( entry ) )
+		{
+			entry.flTime = -1;
+			break;
+		}
+
+		ApplyProbeCacheEntry( entry, NAV_GROUND, vecStart, vecEnd, pTrace );
+		g_nProbeCacheHits++;
+		return true;
+	}
+
+	if ( ai_moveprobe_cache_shared.GetBool() )
+	{
+		if ( !g_bSharedProbeCacheInit )
+			ClearSharedProbeCache();
+
+		AIMoveProbeCacheEntry_t &entry = g_SharedProbeCache[ HashItem( key ) % AI_SHARED_PROBE_CACHE_SIZE ];
+		if ( entry.flTime >= 0 && entry.key == key )
+		{
+			// Whoever probed this didn't see us, so we can't be the obstruction
+			if ( IsProbeCacheEntryValid( entry ) && entry.hObstruction.Get() != GetOuter() )
+			{
+				ApplyProbeCacheEntry( entry, NAV_GROUND, vecStart, vecEnd, pTrace );
+				g_nProbeCacheSharedHits++;
+				return true;
+			}
+		}
+	}
+
+	g_nProbeCacheMisses++;
+	return false;
+}
+
+//-------------------------------------
+
+void CAI_MoveProbe::StoreProbeCache( const AIMoveProbeCacheKey_t &key, const Vector &vecStart, const Vector &vecEnd, const AIMoveTrace_t &trace )
+{
+	// NPCs and players move on their own, so don't remember being blocked by them
+	if ( trace.pObstruction && trace.pObstruction->MyCombatCharacterPointer() )
+		return;
+
+	AIMoveProbeCacheEntry_t &entry = m_ProbeCache[m_iNextProbeCacheEntry];
+	m_iNextProbeCacheEntry = ( m_iNextProbeCacheEntry + 1 ) % PROBE_CACHE_SIZE;
+
+	entry.key = key;
+	entry.flTime = gpGlobals->curtime;
+	entry.vecStart = vecStart;
+	entry.fStatus = trace.fStatus;
+	entry.vEndPosition = trace.vEndPosition;
+	entry.vHitNormal = trace.vHitNormal;
+	entry.hObstruction = trace.pObstruction;
+	entry.flDistObstructed = trace.flDistObstructed;
+	entry.flStepUpDistance = trace.flStepUpDistance;
+
+	// Floor probes can reach well above and below the segment itself
+	float flPad = MAX( StepHeight() * 2, 32.0f );
+	VectorMin( vecStart, vecEnd, entry.vecSweptMins );
+	VectorMax( vecStart, vecEnd, entry.vecSweptMaxs );
+	entry.vecSweptMins += WorldAlignMins() - Vector( 0, 0, flPad );
+	entry.vecSweptMaxs += WorldAlignMaxs() + Vector( 0, 0, flPad );
+
+	if ( !ai_moveprobe_cache_shared.GetBool() )
+		return;
+
+	// Other NPCs can only use this if our own body couldn't have been in the way,
+	// since probes never collide with the NPC doing the probing
+	Vector vecOuterMins, vecOuterMaxs;
+	GetOuter()->CollisionProp()->WorldSpaceAABB( &vecOuterMins, &vecOuterMaxs );
+	if ( IsBoxIntersectingBox( entry.vecSweptMins, entry.vecSweptMaxs, vecOuterMins, vecOuterMaxs ) )
+		return;
+
+	if ( !g_bSharedProbeCacheInit )
+		ClearSharedProbeCache();
+
+	g_SharedProbeCache[ HashItem( key ) % AI_SHARED_PROBE_CACHE_SIZE ] = entry;
+}
+
+//-------------------------------------
+
+CON_COMMAND( ai_moveprobe_cache_report, "Report ground probe cache hits and misses since the last report" )
+{
+	int nTotal = g_nProbeCacheHits + g_nProbeCacheSharedHits + g_nProbeCacheMisses;
+	Msg( "Move probe cache: %d probes, %d hits, %d shared hits, %d misses (%.1f%% answered from cache)\n",
+		nTotal, g_nProbeCacheHits, g_nProbeCacheSharedHits, g_nProbeCacheMisses,
+		( nTotal ) ? 100.0f * ( g_nProbeCacheHits + g_nProbeCacheSharedHits ) / nTotal : 0.0f );
+
+	g_nProbeCacheHits = g_nProbeCacheSharedHits = g_nProbeCacheMisses = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Probes a sequence of moves with the same parameters. With
+//			AIMLF_STOP_AT_BLOCKED, probing ends after the first blocked move.
+// Output : Number of requests probed
+//-----------------------------------------------------------------------------
+int CAI_MoveProbe::MoveLimitBatch( Navigation_t navType, AIMoveProbeRequest_t *pRequests, int nRequests, 
+	unsigned int collisionMask, const CBaseEntity *pTarget, float pctToCheckStandPositions, unsigned flags )
+{
+	int i;
+	for ( i = 0; i < nRequests; i++ )
+	{
+		AIMoveProbeRequest_t &request = pRequests[i];
+
+		// Batches often revisit the same segment (e.g. winding around both sides of an obstacle)
+		int j;
+		for ( j = 0; j < i; j++ )
+		{
+			if ( pRequests[j].vecStart == request.vecStart && pRequests[j].vecEnd == request.vecEnd )
+				break;
+		}
+
+		if ( j < i )
+		{
+			request.moveTrace = pRequests[j].moveTrace;
+			request.bClear = pRequests[j].bClear;
+		}
+		else
+		{
+			request.bClear = MoveLimit( navType, request.vecStart, request.vecEnd, collisionMask, pTarget, pctToCheckStandPositions, flags, &request.moveTrace );
+		}
+
+		if ( !request.bClear && ( flags & AIMLF_STOP_AT_BLOCKED ) )
+			return i + 1;
+	}
+
+	return i;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -1026,10 +1469,19 @@ bool CAI_MoveProbe::MoveLimit( Navigation_t navType, const Vector &vecStart,
 	pTrace->fStatus = AIMR_OK;
 	pTrace->vEndPosition = vecStart;
 
+	AIMoveProbeCacheKey_t cacheKey;
+	bool bUseCache = ( navType == NAV_GROUND && BuildProbeCacheKey( vecStart, vecEnd, collisionMask, pTarget, pctToCheckStandPositions, flags, &cacheKey ) );
+
 	switch (navType)
 	{
 	case NAV_GROUND:	
 	{
+		if ( bUseCache && LookupProbeCache( cacheKey, vecStart, vecEnd, pTrace ) )
+		{
+			bUseCache = false;
+			break;
+		}
+
 		unsigned testGroundMoveFlags = AITGM_DEFAULT;
 		if (flags & AIMLF_2D )
 			testGroundMoveFlags |= AITGM_2D;
@@ -1062,6 +1514,11 @@ bool CAI_MoveProbe::MoveLimit( Navigation_t navType, const Vector &vecStart,
 
 		const_cast<CAI_MoveProbe *>(this)->m_bIgnoreTransientEntities = false;
 
+		if ( bUseCache )
+		{
+			StoreProbeCache( cacheKey, vecStart, vecEnd, *pTrace );
+		}
+
 		break;
 	}
 
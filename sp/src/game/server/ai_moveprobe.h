@@ -36,6 +36,64 @@ enum AI_MoveLimitFlags_t
 	AIMLF_DRAW_RESULTS = 0x02,
 	AIMLF_IGNORE_TRANSIENTS = 0x04,
 	AIMLF_QUICK_REJECT = 0x08,
+	AIMLF_STOP_AT_BLOCKED = 0x10,	// MoveLimitBatch() only: don't probe past the first blocked move
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: One move in a batch submitted to CAI_MoveProbe::MoveLimitBatch()
+//-----------------------------------------------------------------------------
+
+struct AIMoveProbeRequest_t
+{
+	Vector			vecStart;
+	Vector			vecEnd;
+
+	// Results
+	AIMoveTrace_t	moveTrace;
+	bool			bClear;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: A remembered ground probe. Keys are quantized so repeated probes
+//			of nearly the same segment can be answered without tracing.
+//-----------------------------------------------------------------------------
+
+struct AIMoveProbeCacheKey_t
+{
+	int				start[3];
+	int				end[3];
+	unsigned		collisionMask;
+	unsigned		flags;
+	int				pct;
+	int				hTarget;
+	int				hull;
+	int				iClassname;
+
+	bool operator==( const AIMoveProbeCacheKey_t &other ) const { return !memcmp( this, &other, sizeof(*this) ); }
+};
+
+struct AIMoveProbeCacheEntry_t
+{
+	AIMoveProbeCacheKey_t	key;
+	float			flTime;				// When probed. Entries with flTime < 0 are unused
+	Vector			vecStart;			// The exact start that was probed
+	Vector			vecSweptMins;		// Space the probe could have touched
+	Vector			vecSweptMaxs;
+
+	AIMoveResult_t	fStatus;
+	Vector			vEndPosition;
+	Vector			vHitNormal;
+	EHANDLE			hObstruction;
+	float			flDistObstructed;
+	float			flStepUpDistance;
+};
+
+// Something that moved since the probe caches were last checked
+struct AIMoveProbeMover_t
+{
+	CBaseEntity		*pEntity;
+	Vector			vecMins;
+	Vector			vecMaxs;
 };
 
 class CAI_MoveProbe : public CAI_Component
@@ -51,6 +109,12 @@ public:
 	bool				MoveLimit( Navigation_t navType, const Vector &vecStart, const Vector &vecEnd, unsigned int collisionMask, const CBaseEntity *pTarget, AIMoveTrace_t* pMove = NULL );
 	bool				MoveLimit( Navigation_t navType, const Vector &vecStart, const Vector &vecEnd, unsigned int collisionMask, const CBaseEntity *pTarget, float pctToCheckStandPositions, AIMoveTrace_t* pMove = NULL );
 	bool				MoveLimit( Navigation_t navType, const Vector &vecStart, const Vector &vecEnd, unsigned int collisionMask, const CBaseEntity *pTarget, float pctToCheckStandPositions, unsigned flags, AIMoveTrace_t* pMove = NULL );
+
+	// Probes a sequence of moves, answering repeats from the probe cache. Returns the number of requests probed.
+	int					MoveLimitBatch( Navigation_t navType, AIMoveProbeRequest_t *pRequests, int nRequests, unsigned int collisionMask, const CBaseEntity *pTarget, float pctToCheckStandPositions = 100.0f, unsigned flags = AIMLF_DEFAULT );
+
+	void				ClearProbeCache();
+	void				InvalidateProbeCache( const CUtlVector<AIMoveProbeMover_t> &movers );
 	
 	bool				CheckStandPosition( const Vector &vecStart, unsigned int collisionMask ) const;
 	bool				FloorPoint( const Vector &vecStart, unsigned int collisionMask, float flStartZ, float flEndZ, Vector *pVecResult ) const;
@@ -109,6 +173,11 @@ private:
 	void				ResetTraceListData() const	{ if ( m_pTraceListData ) const_cast<CAI_MoveProbe *>(this)->m_pTraceListData->Reset(); }
 	bool				OldCheckStandPosition( const Vector &vecStart, unsigned int collisionMask ) const;
 
+	// Ground probe memoization
+	bool				BuildProbeCacheKey( const Vector &vecStart, const Vector &vecEnd, unsigned int collisionMask, const CBaseEntity *pTarget, float pctToCheckStandPositions, unsigned flags, AIMoveProbeCacheKey_t *pKey ) const;
+	bool				LookupProbeCache( const AIMoveProbeCacheKey_t &key, const Vector &vecStart, const Vector &vecEnd, AIMoveTrace_t *pTrace );
+	void				StoreProbeCache( const AIMoveProbeCacheKey_t &key, const Vector &vecStart, const Vector &vecEnd, const AIMoveTrace_t &trace );
+
 	// these check connections between positions in space, regardless of routes
 	void				GroundMoveLimit( const Vector &vecStart, const Vector &vecEnd, unsigned int collisionMask, const CBaseEntity *pTarget, unsigned testGroundMoveFlags, float pctToCheckStandPositions, AIMoveTrace_t* pMoveTrace ) const;
 	void				FlyMoveLimit( const Vector &vecStart, const Vector &vecEnd, unsigned int collisionMask, const CBaseEntity *pTarget, AIMoveTrace_t* pMoveTrace) const;
@@ -134,6 +203,14 @@ private:
 
 	EHANDLE				m_hLastBlockingEnt;
 
+	enum
+	{
+		PROBE_CACHE_SIZE = 8
+	};
+
+	AIMoveProbeCacheEntry_t	m_ProbeCache[PROBE_CACHE_SIZE];
+	int					m_iNextProbeCacheEntry;
+
 	DECLARE_SIMPLE_DATADESC();
 };
 
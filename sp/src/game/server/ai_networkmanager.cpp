@@ -518,8 +518,10 @@ void CAI_NetworkManager::LoadNetworkGraph( void )
 
 	MEM_ALLOC_CREDIT();
 
-	// Read the file in one gulp
-	CUtlBuffer buf;
+	// The graph is parsed front to back, so stream it through a small window
+	// instead of reading the whole file in one gulp
+	CUtlBuffer queuedBuf;
+	CUtlStreamReadBuffer streamBuf;
 	bool bHaveAIN = false;
 	if ( IsX360() && g_pQueuedLoader->IsMapLoading() )
 	{
@@ -530,7 +532,7 @@ void CAI_NetworkManager::LoadNetworkGraph( void )
 		{
 			if ( nDataSize != 0 )
 			{
-				buf.Put( pData, nDataSize );
+				queuedBuf.Put( pData, nDataSize );
 				bHaveAIN = true;
 			}
 			filesystem->FreeOptimalReadBuffer( pData );
@@ -539,12 +541,14 @@ void CAI_NetworkManager::LoadNetworkGraph( void )
 	
 
 
-	if ( !bHaveAIN && !filesystem->ReadFile( szNrpFilename, "game", buf ) )
+	if ( !bHaveAIN && !streamBuf.Open( filesystem, szNrpFilename, "game" ) )
 	{
 		DevWarning( 2, "Couldn't read %s!\n", szNrpFilename );
 		return;
 	}
 
+	CUtlBuffer &buf = bHaveAIN ? queuedBuf : streamBuf;
+
 	DevMsg( "Checking version\n" );
 
 	// ---------------------------
@@ -1118,27 +1118,24 @@ inline int GetNextPoint( int nLastNode, int nDirection, int nNumNodes )
 //-----------------------------------------------------------------------------
 AI_Waypoint_t *CAI_Pathfinder::BuildRouteThroughPoints( Vector *vecPoints, int nNumPoints, int nDirection, int nStartIndex, int nEndIndex, Navigation_t navType, CBaseEntity *pTarget )
 {
-	AIMoveTrace_t endTrace;
-	endTrace.fStatus = AIMR_OK;
-
 	CAI_MoveProbe *pMoveProbe = GetOuter()->GetMoveProbe();
 
-	AI_Waypoint_t *pFirstRoute = NULL;
-	AI_Waypoint_t *pHeadRoute = NULL;
+	// Gather every leg of the route up front so they can be probed as one batch.
+	// The first leg gets us onto the first point.
+	// FIXME: Must be able to move to the first position (these needs some parameterization) 
+	AIMoveProbeRequest_t *pLegs = (AIMoveProbeRequest_t *)stackalloc( sizeof(AIMoveProbeRequest_t) * ( nNumPoints + 1 ) );
+	int *pLegPoints = (int *)stackalloc( sizeof(int) * ( nNumPoints + 1 ) );
+	int nLegs = 0;
+
+	pLegs[nLegs].vecStart = GetOuter()->GetAbsOrigin();
+	pLegs[nLegs].vecEnd = vecPoints[nStartIndex];
+	pLegPoints[nLegs] = nStartIndex;
+	nLegs++;
 
+	bool bReachedEnd = false;
 	int nCurIndex = nStartIndex;
 	int nNextIndex;
 
-	// FIXME: Must be able to move to the first position (these needs some parameterization) 
-	pMoveProbe->MoveLimit( navType, GetOuter()->GetAbsOrigin(), vecPoints[nStartIndex], MASK_NPCSOLID, pTarget, &endTrace );
-	if ( IsMoveBlocked( endTrace ) )
-	{
-		// NDebugOverlay::HorzArrow( GetOuter()->GetAbsOrigin(), vecPoints[nStartIndex], 8.0f, 255, 0, 0, 0, true, 4.0f );
-		return NULL;
-	}
-
-	// NDebugOverlay::HorzArrow( GetOuter()->GetAbsOrigin(), vecPoints[nStartIndex], 8.0f, 0, 255, 0, 0, true, 4.0f );
-
 	int nRunAwayCount = 0;
 	while ( nRunAwayCount++ < nNumPoints )
 	{
@@ -1146,47 +1143,57 @@ AI_Waypoint_t *CAI_Pathfinder::BuildRouteThroughPoints( Vector *vecPoints, int n
 		nNextIndex = GetNextPoint( nCurIndex, nDirection, nNumPoints );
 
 		// Try and build a local route between the current and next point
-		pMoveProbe->MoveLimit( navType, vecPoints[nCurIndex], vecPoints[nNextIndex], MASK_NPCSOLID, pTarget, &endTrace );
-		if ( IsMoveBlocked( endTrace ) )
+		pLegs[nLegs].vecStart = vecPoints[nCurIndex];
+		pLegs[nLegs].vecEnd = vecPoints[nNextIndex];
+		pLegPoints[nLegs] = nNextIndex;
+		nLegs++;
+
+		// See if we're done
+		if ( nNextIndex == nEndIndex )
 		{
-			// TODO: Triangulate here if we failed?
+			bReachedEnd = true;
+			break;
+		}
 
-			// We failed, so give up
-			if ( pHeadRoute )
-			{
-				DeleteAll( pHeadRoute );
-			}
+		// Advance one node
+		nCurIndex = nNextIndex;
+	}
 
-			// NDebugOverlay::HorzArrow( vecPoints[nCurIndex], vecPoints[nNextIndex], 8.0f, 255, 0, 0, 0, true, 4.0f );
-			return NULL;
-		}
+	int nProbed = pMoveProbe->MoveLimitBatch( navType, pLegs, nLegs, MASK_NPCSOLID, pTarget, 100.0f, AIMLF_STOP_AT_BLOCKED );
+	if ( nProbed < nLegs || !pLegs[nLegs - 1].bClear )
+	{
+		// TODO: Triangulate here if we failed?
 
-		// NDebugOverlay::HorzArrow( vecPoints[nCurIndex], vecPoints[nNextIndex], 8.0f, 0, 255, 0, 0, true, 4.0f );
+		// NDebugOverlay::HorzArrow( pLegs[nProbed - 1].vecStart, pLegs[nProbed - 1].vecEnd, 8.0f, 255, 0, 0, 0, true, 4.0f );
+		return NULL;
+	}
+
+	AI_Waypoint_t *pFirstRoute = NULL;
+	AI_Waypoint_t *pHeadRoute = NULL;
+
+	// Every leg after the first starts at a waypoint
+	for ( int i = 1; i < nLegs; i++ )
+	{
+		const Vector &vecLegStart = vecPoints[ pLegPoints[i - 1] ];
 
 		if ( pHeadRoute == NULL )
 		{
 			// Start a new route head
-			pFirstRoute = pHeadRoute = new AI_Waypoint_t( vecPoints[nCurIndex], 0.0f, navType, bits_WP_TO_DETOUR, NO_NODE );
+			pFirstRoute = pHeadRoute = new AI_Waypoint_t( vecLegStart, 0.0f, navType, bits_WP_TO_DETOUR, NO_NODE );
 		}
 		else
 		{
 			// Link a new waypoint into the path
-			AI_Waypoint_t *pNewNode = new AI_Waypoint_t( vecPoints[nCurIndex], 0.0f, navType, bits_WP_TO_DETOUR|bits_WP_DONT_SIMPLIFY, NO_NODE );
-			pHeadRoute->SetNext( pNewNode );
-			pHeadRoute = pNewNode;
-		}
-
-		// See if we're done
-		if ( nNextIndex == nEndIndex )
-		{
-			AI_Waypoint_t *pNewNode = new AI_Waypoint_t( vecPoints[nEndIndex], 0.0f, navType, bits_WP_TO_DETOUR, NO_NODE );
+			AI_Waypoint_t *pNewNode = new AI_Waypoint_t( vecLegStart, 0.0f, navType, bits_WP_TO_DETOUR|bits_WP_DONT_SIMPLIFY, NO_NODE );
 			pHeadRoute->SetNext( pNewNode );
 			pHeadRoute = pNewNode;
-			break;
 		}
+	}
 
-		// Advance one node
-		nCurIndex = nNextIndex;
+	if ( bReachedEnd )
+	{
+		AI_Waypoint_t *pNewNode = new AI_Waypoint_t( vecPoints[nEndIndex], 0.0f, navType, bits_WP_TO_DETOUR, NO_NODE );
+		pHeadRoute->SetNext( pNewNode );
 	}
 
 	return pFirstRoute;
@@ -454,7 +454,8 @@ int CAI_Senses::LookForNPCs( int iDistance )
 	{
 		AI_PROFILE_SENSES(CAI_Senses_LookForNPCs);
 
-		m_TimeLastLookNPCs = gpGlobals->curtime;
+		// Stagger the first search so NPCs spawned together don't keep searching on the same tick
+		m_TimeLastLookNPCs = ( m_TimeLastLookNPCs < 0 ) ? gpGlobals->curtime - random->RandomFloat( 0, timeNPCs ) : gpGlobals->curtime;
 
 		if ( efficiency < AIE_SUPER_EFFICIENT )
 		{
@@ -514,7 +515,7 @@ int CAI_Senses::LookForObjects( int iDistance )
 	if ( gpGlobals->curtime - m_TimeLastLookMisc > AI_MISC_SEARCH_TIME )
 	{
 		AI_PROFILE_SENSES(CAI_Senses_LookForObjects);
-		m_TimeLastLookMisc = gpGlobals->curtime;
+		m_TimeLastLookMisc = ( m_TimeLastLookMisc < 0 ) ? gpGlobals->curtime - random->RandomFloat( 0, AI_MISC_SEARCH_TIME ) : gpGlobals->curtime;
 		
 		BeginGather();
 
@@ -17,6 +17,83 @@
 
 //-----------------------------------------------------------------------------
 
+struct AIPlayerView_t
+{
+	int			iPlayer;
+	Vector		vecEyePosition;
+	Vector		vecForward;
+};
+
+static AIPlayerView_t g_AIPlayerViews[MAX_PLAYERS];
+static int g_nAIPlayerViews;
+static int g_iAIPlayerViewsFrame = -1;
+
+CBasePlayer *AI_GetNearestPlayerView( const Vector &vecPoint, float *pflDist, float *pflBestDot )
+{
+	// Player views only change once per frame, but this is called for every NPC
+	if ( g_iAIPlayerViewsFrame != gpGlobals->framecount )
+	{
+		g_iAIPlayerViewsFrame = gpGlobals->framecount;
+		g_nAIPlayerViews = 0;
+
+		if ( AI_IsSinglePlayer() )
+		{
+			CBasePlayer *pPlayer = AI_GetSinglePlayer();
+			if ( pPlayer )
+			{
+				AIPlayerView_t &view = g_AIPlayerViews[g_nAIPlayerViews++];
+				view.iPlayer = pPlayer->entindex();
+				pPlayer->EyePositionAndVectors( &view.vecEyePosition, &view.vecForward, NULL, NULL );
+			}
+		}
+		else
+		{
+			for ( int i = 1; i <= gpGlobals->maxClients && g_nAIPlayerViews < MAX_PLAYERS; i++ )
+			{
+				CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
+				if ( !pPlayer || !pPlayer->IsConnected() )
+					continue;
+
+				AIPlayerView_t &view = g_AIPlayerViews[g_nAIPlayerViews++];
+				view.iPlayer = pPlayer->entindex();
+				pPlayer->EyePositionAndVectors( &view.vecEyePosition, &view.vecForward, NULL, NULL );
+			}
+		}
+	}
+
+	int iNearest = -1;
+	float flNearestDist = FLT_MAX;
+	float flBestDot = -1.0f;
+
+	for ( int i = 0; i < g_nAIPlayerViews; i++ )
+	{
+		const AIPlayerView_t &view = g_AIPlayerViews[i];
+
+		Vector vecToPoint = vecPoint - view.vecEyePosition;
+		float flDist = VectorNormalize( vecToPoint );
+
+		if ( flDist < flNearestDist )
+		{
+			flNearestDist = flDist;
+			iNearest = view.iPlayer;
+		}
+
+		flBestDot = MAX( flBestDot, view.vecForward.Dot( vecToPoint ) );
+	}
+
+	// Views only hold indices so a player leaving mid-frame can't leave a dangling pointer
+	CBasePlayer *pNearest = ( iNearest != -1 ) ? UTIL_PlayerByIndex( iNearest ) : NULL;
+
+	if ( pflDist )
+		*pflDist = ( pNearest ) ? flNearestDist : 0;
+	if ( pflBestDot )
+		*pflBestDot = ( pNearest ) ? flBestDot : 1;
+
+	return pNearest;
+}
+
+//-----------------------------------------------------------------------------
+
 BEGIN_SIMPLE_DATADESC( CAI_MoveMonitor )
 	DEFINE_FIELD( m_vMark, FIELD_POSITION_VECTOR ), 
 	DEFINE_FIELD( m_flMarkTolerance, FIELD_FLOAT )
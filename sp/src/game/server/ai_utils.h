@@ -36,6 +36,17 @@ inline bool AI_IsSinglePlayer()
 	return ( gpGlobals->maxClients == 1 );
 }
 
+//-----------------------------------------------------------------------------
+//
+// Function to find the player whose eyes are nearest a point. Works in
+// multiplayer as well, so NPC efficiency can be ranked against every player.
+// pflBestDot receives the largest dot of any player's view with the direction
+// to the point, so > 0 means at least one player is facing it.
+//
+//-----------------------------------------------------------------------------
+
+CBasePlayer *AI_GetNearestPlayerView( const Vector &vecPoint, float *pflDist = NULL, float *pflBestDot = NULL );
+
 
 //-----------------------------------------------------------------------------
 //
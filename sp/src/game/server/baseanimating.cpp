@@ -31,6 +31,8 @@
 #include "ai_speech.h"
 #include "gib.h"
 #include "CRagdollMagnet.h"
+#include "tier1/utlflathashmap.h"
+#include "tier1/generichash.h"
 #endif
 #ifdef MAPBASE_VSCRIPT
 #include "mapbase/vscript_funcs_shared.h"
@@ -388,6 +390,8 @@ CBaseAnimating::CBaseAnimating()
 	m_fadeMaxDist = 0;
 	m_flFadeScale = 0.0f;
 	m_fBoneCacheFlags = 0;
+	m_iAnimLODTick = -1;
+	m_bAnimLODCulled = false;
 }
 
 CBaseAnimating::~CBaseAnimating()
@@ -1967,6 +1971,171 @@ void CBaseAnimating::BuildMatricesWithBoneMerge(
 
 ConVar sv_pvsskipanimation( "sv_pvsskipanimation", "1", FCVAR_ARCHIVE, "Skips SetupBones when npc's are outside the PVS" );
 ConVar ai_setupbones_debug( "ai_setupbones_debug", "0", 0, "Shows that bones that are setup every think" );
+ConVar sv_anim_lod( "sv_anim_lod", "1", 0, "Skips IK and refreshes the bone cache less often for animating entities outside the players' PVS" );
+ConVar sv_anim_lod_interval( "sv_anim_lod_interval", "0.5", 0, "How long, in seconds, the bone cache of an entity culled by sv_anim_lod stays valid" );
+ConVar sv_anim_share_skeletons( "sv_anim_share_skeletons", "1", 0, "Lets entities with the same model, sequence, cycle and pose parameters share one skeleton per tick" );
+
+
+//-----------------------------------------------------------------------------
+// Skeletons shared between entities for one tick, so a room of identical idle
+// NPCs or props playing in lockstep only animates once. The key is everything
+// the base GetSkeleton reads; the rest of the tick's state (curtime for
+// autoplay sequences) is the same for everyone.
+//-----------------------------------------------------------------------------
+struct SharedSkeletonKey_t
+{
+	const studiohdr_t *m_pStudioHdr;
+	int m_nSequence;
+	int m_nBoneMask;
+	float m_flCycle;
+	float m_flPoseParameter[CBaseAnimating::NUM_POSEPAREMETERS];
+	float m_flEncodedController[CBaseAnimating::NUM_BONECTRLS];
+};
+
+struct SharedSkeletonKeyHashFunctor
+{
+	unsigned int operator()( const SharedSkeletonKey_t &key ) const { return HashBlock( &key, sizeof( key ) ); }
+};
+
+struct SharedSkeletonKeyEqualFunctor
+{
+	bool operator()( const SharedSkeletonKey_t &a, const SharedSkeletonKey_t &b ) const { return memcmp( &a, &b, sizeof( a ) ) == 0; }
+};
+
+class CSharedSkeletonCache
+{
+public:
+	// Don't let a map full of unique poses grow this without bound
+	enum { MAX_SKELETONS_PER_TICK = 256 };
+
+	CSharedSkeletonCache() : m_nTick( -1 ), m_nHits( 0 ), m_nMisses( 0 ), m_nLastHits( 0 ), m_nLastMisses( 0 ) {}
+
+	bool Find( const SharedSkeletonKey_t &key, int nBones, Vector pos[], Quaternion q[] );
+	void Add( const SharedSkeletonKey_t &key, int nBones, const Vector pos[], const Quaternion q[] );
+
+	void GetLastTickStats( int &nHits, int &nMisses ) const { nHits = m_nLastHits; nMisses = m_nLastMisses; }
+
+private:
+	void CheckTick();
+
+	typedef CUtlFlatHashMap< SharedSkeletonKey_t, int, SharedSkeletonKeyHashFunctor, SharedSkeletonKeyEqualFunctor > SkeletonIndex_t;
+
+	CThreadFastMutex m_Mutex;
+	SkeletonIndex_t m_Index;		// key -> first bone in m_Pos and m_Q
+	CUtlVector< Vector > m_Pos;
+	CUtlVector< Quaternion > m_Q;
+	int m_nTick;
+	int m_nHits;
+	int m_nMisses;
+	int m_nLastHits;
+	int m_nLastMisses;
+};
+
+static CSharedSkeletonCache g_SharedSkeletonCache;
+
+void CSharedSkeletonCache::CheckTick()
+{
+	if ( m_nTick == gpGlobals->tickcount )
+		return;
+
+	m_nTick = gpGlobals->tickcount;
+	m_nLastHits = m_nHits;
+	m_nLastMisses = m_nMisses;
+	m_nHits = m_nMisses = 0;
+
+	m_Index.RemoveAll();
+	m_Pos.RemoveAll();
+	m_Q.RemoveAll();
+}
+
+bool CSharedSkeletonCache::Find( const SharedSkeletonKey_t &key, int nBones, Vector pos[], Quaternion q[] )
+{
+	AUTO_LOCK( m_Mutex );
+	CheckTick();
+
+	UtlFlatHashHandle_t h = m_Index.Find( key );
+	if ( h == m_Index.InvalidHandle() )
+	{
+		m_nMisses++;
+		return false;
+	}
+
+	int nFirst = m_Index[h];
+	memcpy( pos, m_Pos.Base() + nFirst, nBones * sizeof( Vector ) );
+	memcpy( q, m_Q.Base() + nFirst, nBones * sizeof( Quaternion ) );
+	m_nHits++;
+	return true;
+}
+
+void CSharedSkeletonCache::Add( const SharedSkeletonKey_t &key, int nBones, const Vector pos[], const Quaternion q[] )
+{
+	AUTO_LOCK( m_Mutex );
+	CheckTick();
+
+	if ( m_Index.Count() >= MAX_SKELETONS_PER_TICK )
+		return;
+
+	bool bInserted;
+	UtlFlatHashHandle_t h = m_Index.Insert( key, m_Pos.Count(), &bInserted );
+	if ( !bInserted )
+		return;
+
+	Assert( m_Index[h] == m_Pos.Count() );
+	m_Pos.AddMultipleToTail( nBones, pos );
+	m_Q.AddMultipleToTail( nBones, q );
+}
+
+//-----------------------------------------------------------------------------
+// GetSkeleton, shared with any entity that asked for the same pose this tick
+//-----------------------------------------------------------------------------
+static void GetSharedSkeleton( CBaseAnimating *pAnimating, CStudioHdr *pStudioHdr, Vector pos[], Quaternion q[], int boneMask )
+{
+	if ( !sv_anim_share_skeletons.GetBool() || !pAnimating->CanShareSkeleton() )
+	{
+		pAnimating->GetSkeleton( pStudioHdr, pos, q, boneMask );
+		return;
+	}
+
+	SharedSkeletonKey_t key;
+	memset( &key, 0, sizeof( key ) );
+	key.m_pStudioHdr = pStudioHdr->GetRenderHdr();
+	key.m_nSequence = pAnimating->GetSequence();
+	key.m_nBoneMask = boneMask;
+	key.m_flCycle = pAnimating->GetCycle();
+	memcpy( key.m_flPoseParameter, pAnimating->GetPoseParameterArray(), sizeof( key.m_flPoseParameter ) );
+	memcpy( key.m_flEncodedController, pAnimating->GetEncodedControllerArray(), sizeof( key.m_flEncodedController ) );
+
+	int nBones = pStudioHdr->numbones();
+	if ( g_SharedSkeletonCache.Find( key, nBones, pos, q ) )
+		return;
+
+	pAnimating->GetSkeleton( pStudioHdr, pos, q, boneMask );
+	g_SharedSkeletonCache.Add( key, nBones, pos, q );
+}
+
+CON_COMMAND( sv_anim_lod_report, "Reports how many animating entities sv_anim_lod culled this tick and how many skeletons were shared last tick" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nAnimating = 0, nCulled = 0;
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		CBaseAnimating *pAnimating = pEntity->GetBaseAnimating();
+		if ( !pAnimating || !pAnimating->GetModelPtr() )
+			continue;
+
+		nAnimating++;
+		if ( pAnimating->IsAnimationLODCulled() )
+		{
+			nCulled++;
+		}
+	}
+
+	int nHits, nMisses;
+	g_SharedSkeletonCache.GetLastTickStats( nHits, nMisses );
+	Msg( "sv_anim_lod_report: %d of %d animating entities culled; last tick %d skeletons shared, %d computed\n", nCulled, nAnimating, nHits, nMisses );
+}
 
 
 
@@ -1989,6 +2158,48 @@ bool CBaseAnimating::CanSkipAnimation( void )
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Animation LOD. True when no player can see this entity, so its
+//			bones don't need IK and can be refreshed less often.
+//-----------------------------------------------------------------------------
+bool CBaseAnimating::IsAnimationLODCulled( void )
+{
+	if ( !sv_anim_lod.GetBool() || ( m_fBoneCacheFlags & (BCF_NO_ANIMATION_SKIP | BCF_IS_IN_SPAWN) ) )
+		return false;
+
+	if ( m_iAnimLODTick != gpGlobals->tickcount )
+	{
+		bool bCulled;
+		CAI_BaseNPC *pNPC = MyNPCPointer();
+		if ( pNPC )
+		{
+			bCulled = !pNPC->HasCondition( COND_IN_PVS );
+		}
+		else
+		{
+			Vector vecMins, vecMaxs;
+			CollisionProp()->WorldSpaceAABB( &vecMins, &vecMaxs );
+			bCulled = ( UTIL_FindClientInPVS( vecMins, vecMaxs ) == NULL );
+		}
+
+		// Anything parented to us (players riding along, bone merged props,
+		// attached followers) reads our bones and needs them current
+		m_bAnimLODCulled = bCulled && !FirstMoveChild();
+		m_iAnimLODTick = gpGlobals->tickcount;
+	}
+
+	return m_bAnimLODCulled;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The base skeleton only depends on the networked animation state
+//			unless IK adds to it
+//-----------------------------------------------------------------------------
+bool CBaseAnimating::CanShareSkeleton( void )
+{
+	return m_pIk == NULL;
+}
+
 
 void CBaseAnimating::SetupBones( matrix3x4_t *pBoneToWorld, int boneMask )
 {
@@ -2026,7 +2237,7 @@ void CBaseAnimating::SetupBones( matrix3x4_t *pBoneToWorld, int boneMask )
 	}
 	else 
 	{
-		if ( m_pIk )
+		if ( m_pIk && !IsAnimationLODCulled() )
 		{
 			// FIXME: pass this into Studio_BuildMatrices to skip transforms
 			CBoneBitList boneComputed;
@@ -2041,7 +2252,12 @@ void CBaseAnimating::SetupBones( matrix3x4_t *pBoneToWorld, int boneMask )
 		else
 		{
 			// Msg( "%.03f : %s:%s\n", gpGlobals->curtime, GetClassname(), GetEntityName().ToCStr() );
-			GetSkeleton( pStudioHdr, pos, q, boneMask );
+
+			// No IK for LOD culled entities; keep GetSkeleton from adding rules to a context nothing will solve
+			CIKContext *pIk = m_pIk;
+			m_pIk = NULL;
+			GetSharedSkeleton( this, pStudioHdr, pos, q, boneMask );
+			m_pIk = pIk;
 		}
 	}
 	
@@ -2890,7 +3106,7 @@ void CBaseAnimating::UnlockStudioHdr()
 // Purpose: return the index to the shared bone cache
 // Output :
 //-----------------------------------------------------------------------------
-CBoneCache *CBaseAnimating::GetBoneCache( void )
+CBoneCache *CBaseAnimating::GetBoneCache( bool bIgnoreAnimLOD )
 {
 	CStudioHdr *pStudioHdr = GetModelPtr( );
 	Assert(pStudioHdr);
@@ -2904,7 +3120,9 @@ CBoneCache *CBaseAnimating::GetBoneCache( void )
 #endif
 	if ( pcache )
 	{
-		if ( pcache->IsValid( gpGlobals->curtime ) && (pcache->m_boneMask & boneMask) == boneMask && pcache->m_timeValid <= gpGlobals->curtime)
+		// Nobody is looking at LOD culled entities, so their bones can be older
+		float flMaxAge = ( !bIgnoreAnimLOD && IsAnimationLODCulled() ) ? MAX( sv_anim_lod_interval.GetFloat(), 0.1f ) : 0.1f;
+		if ( pcache->IsValid( gpGlobals->curtime, flMaxAge ) && (pcache->m_boneMask & boneMask) == boneMask && pcache->m_timeValid <= gpGlobals->curtime)
 		{
 			// Msg("%s:%s:%s (%x:%x:%8.4f) cache\n", GetClassname(), GetDebugName(), STRING(GetModelName()), boneMask, pcache->m_boneMask, pcache->m_timeValid );
 			// in memory and still valid, use it!
@@ -2989,7 +3207,7 @@ bool CBaseAnimating::TestHitboxes( const Ray_t &ray, unsigned int fContentsMask,
 	if ( !set || !set->numhitboxes )
 		return false;
 
-	CBoneCache *pcache = GetBoneCache( );
+	CBoneCache *pcache = GetBoneCache( true );
 
 	matrix3x4_t *hitboxbones[MAXSTUDIOBONES];
 	pcache->ReadCachedBonePointers( hitboxbones, pStudioHdr->numbones() );
@@ -3400,7 +3618,7 @@ bool CBaseAnimating::ComputeHitboxSurroundingBox( Vector *pVecWorldMins, Vector
 	if ( !set || !set->numhitboxes )
 		return false;
 
-	CBoneCache *pCache = GetBoneCache();
+	CBoneCache *pCache = GetBoneCache( true );
 
 	// Compute a box in world space that surrounds this entity
 	pVecWorldMins->Init( FLT_MAX, FLT_MAX, FLT_MAX );
@@ -3440,7 +3658,7 @@ bool CBaseAnimating::ComputeEntitySpaceHitboxSurroundingBox( Vector *pVecWorldMi
 	if ( !set || !set->numhitboxes )
 		return false;
 
-	CBoneCache *pCache = GetBoneCache();
+	CBoneCache *pCache = GetBoneCache( true );
 	matrix3x4_t *hitboxbones[MAXSTUDIOBONES];
 	pCache->ReadCachedBonePointers( hitboxbones, pStudioHdr->numbones() );
 
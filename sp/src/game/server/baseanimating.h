@@ -136,6 +136,9 @@ public:
 	virtual bool CanBecomeRagdoll( void ); //Check if this entity will ragdoll when dead.
 
 	virtual	void GetSkeleton( CStudioHdr *pStudioHdr, Vector pos[], Quaternion q[], int boneMask );
+	// True if GetSkeleton depends only on the model, sequence, cycle, pose parameters and
+	// bone controllers, so entities that match on those can share one result per tick
+	virtual bool CanShareSkeleton( void );
 
 	virtual void GetBoneTransform( int iBone, matrix3x4_t &pBoneToWorld );
 	virtual void SetupBones( matrix3x4_t *pBoneToWorld, int boneMask );
@@ -286,7 +289,9 @@ public:
 	void ReportMissingActivity( int iActivity );
 	virtual bool TestCollision( const Ray_t &ray, unsigned int fContentsMask, trace_t& tr );
 	virtual bool TestHitboxes( const Ray_t &ray, unsigned int fContentsMask, trace_t& tr );
-	class CBoneCache *GetBoneCache( void );
+	// Hitbox and trace queries pass bIgnoreAnimLOD to get current bones even
+	// when animation LOD lets the cache age
+	class CBoneCache *GetBoneCache( bool bIgnoreAnimLOD = false );
 	void InvalidateBoneCache();
 	void InvalidateBoneCacheIfOlderThan( float deltaTime );
 	virtual int DrawDebugTextOverlays( void );
@@ -400,6 +405,7 @@ public: // From Alien Swarm SDK
 #endif
 
 	bool CanSkipAnimation( void );
+	bool IsAnimationLODCulled( void );
 
 public:
 	CNetworkVar( int, m_nForceBone );
@@ -473,6 +479,10 @@ private:
 	memhandle_t		m_boneCacheHandle;
 	unsigned short	m_fBoneCacheFlags;		// Used for bone cache state on model
 
+	// Animation LOD result, computed once per tick
+	int				m_iAnimLODTick;
+	bool			m_bAnimLODCulled;
+
 protected:
 	CNetworkVar( float, m_fadeMinDist );	// Point at which fading is absolute
 	CNetworkVar( float, m_fadeMaxDist );	// Point at which fading is inactive
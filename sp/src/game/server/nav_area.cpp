@@ -534,6 +534,9 @@ CNavArea::~CNavArea()
 	if (m_isReset)
 		return;
 
+	// don't pull the area out from under a search running on another thread
+	NavFlushPathSearches();
+
 	// tell the other areas and ladders we are going away
 	AreaDestroyNotification notification( this );
 	TheNavMesh->ForAllAreas( notification );
@@ -5455,61 +5458,99 @@ const CNavArea::CAreaBindInfoArray &CNavArea::ComputeVisibilityDelta( const CNav
 		return delta;
 	}
 
-	// add any visible areas in my list that are not in 'others' list into the delta
-	int i, j;
-	for( i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
+	// both lists are sorted by area ID, so walk them together one area at a time
+	const CAreaBindInfoArray &mine = m_potentiallyVisibleAreas;
+	const CAreaBindInfoArray &theirs = other->m_potentiallyVisibleAreas;
+	int i = 0, j = 0;
+
+	while( i < mine.Count() || j < theirs.Count() )
 	{
-		if ( m_potentiallyVisibleAreas[i].area )
+		if ( i < mine.Count() && mine[i].area == NULL )
 		{
-			// is my visible area also in adjacent area's vis list
-			for( j=0; j<other->m_potentiallyVisibleAreas.Count(); ++j )
-			{
-				if ( m_potentiallyVisibleAreas[i].area == other->m_potentiallyVisibleAreas[j].area &&
-					 m_potentiallyVisibleAreas[i].attributes == other->m_potentiallyVisibleAreas[j].attributes )
-				{
-					// mutually identically visible
-					break;
-				}
-			}
+			++i;
+			continue;
+		}
 
-			if ( j == other->m_potentiallyVisibleAreas.Count() )
-			{
-				// my vis area not in adjacent area's vis list or has different visibility attributes - add to delta
-				delta.AddToTail( m_potentiallyVisibleAreas[i] );
-			}
+		if ( j < theirs.Count() && theirs[j].area == NULL )
+		{
+			++j;
+			continue;
 		}
-	}
 
-	// add explicit NOT_VISIBLE references to areas in 'others' list that are NOT in mine
-	for( j=0; j<other->m_potentiallyVisibleAreas.Count(); ++j )
-	{
-		if ( other->m_potentiallyVisibleAreas[j].area )
+		unsigned int myID = ( i < mine.Count() ) ? mine[i].area->GetID() : UINT_MAX;
+		unsigned int theirID = ( j < theirs.Count() ) ? theirs[j].area->GetID() : UINT_MAX;
+		unsigned int id = MIN( myID, theirID );
+
+		// find the run of entries for this area in each list
+		int myEnd = i;
+		while( myEnd < mine.Count() && mine[ myEnd ].area && mine[ myEnd ].area->GetID() == id )
+			++myEnd;
+
+		int theirEnd = j;
+		while( theirEnd < theirs.Count() && theirs[ theirEnd ].area && theirs[ theirEnd ].area->GetID() == id )
+			++theirEnd;
+
+		if ( myEnd > i )
 		{
-			for( i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
+			// add any visible areas in my list that are not in 'others' list, or have different visibility attributes
+			for( ; i < myEnd; ++i )
 			{
-				if ( m_potentiallyVisibleAreas[i].area == other->m_potentiallyVisibleAreas[j].area )
+				int k;
+				for( k = j; k < theirEnd; ++k )
 				{
-					// area in both lists - already handled in delta above
-					break;
+					if ( mine[i].attributes == theirs[k].attributes )
+					{
+						// mutually identically visible
+						break;
+					}
 				}
-			}
 
-			if ( i == m_potentiallyVisibleAreas.Count() )
+				if ( k == theirEnd )
+				{
+					delta.AddToTail( mine[i] );
+				}
+			}
+		}
+		else
+		{
+			// 'other' has area in their list that we don't - mark it explicitly NOT_VISIBLE
+			for( int k = j; k < theirEnd; ++k )
 			{
-				// 'other' has area in their list that we don't - mark it explicitly NOT_VISIBLE
 				AreaBindInfo info;
-				info.area = other->m_potentiallyVisibleAreas[j].area;
+				info.area = theirs[k].area;
 				info.attributes = NOT_VISIBLE;
 
 				delta.AddToTail( info );
 			}
 		}
+
+		j = theirEnd;
 	}
 
 	return delta;
 }
 
 
+//--------------------------------------------------------------------------------------------------------
+static int CompareAreaBindInfoIDs( const CNavArea::AreaBindInfo *info1, const CNavArea::AreaBindInfo *info2 )
+{
+	unsigned int id1 = ( info1->area ) ? info1->area->GetID() : 0;
+	unsigned int id2 = ( info2->area ) ? info2->area->GetID() : 0;
+
+	if ( id1 != id2 )
+		return ( id1 < id2 ) ? -1 : 1;
+
+	return (int)info1->attributes - (int)info2->attributes;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+void CNavArea::SortPotentiallyVisibleAreas( CNavArea *&area )
+{
+	area->m_potentiallyVisibleAreas.Sort( CompareAreaBindInfoIDs );
+}
+
+
 //--------------------------------------------------------------------------------------------------------
 void CNavArea::ResetPotentiallyVisibleAreas()
 {
@@ -5525,7 +5566,8 @@ void CNavArea::ResetPotentiallyVisibleAreas()
  */
 
 CNavArea *g_pCurVisArea;
-CTSListWithFreeList< CNavArea::AreaBindInfo > g_ComputedVis;
+CNavArea **g_pCurVisCollected;							// the areas ComputeVisToArea() is being run on
+CUtlVector< unsigned char > g_CurVisThisToOther;		// visibility from g_pCurVisArea to each of them, by index
 
 void CNavArea::ComputeVisToArea( CNavArea *&pOtherArea )
 {
@@ -5555,16 +5597,12 @@ void CNavArea::ComputeVisToArea( CNavArea *&pOtherArea )
 		}
 	}
 
-	CNavArea::AreaBindInfo info;
-	if ( visThisToOther != NOT_VISIBLE )
-	{
-		info.area = area;
-		info.attributes = visThisToOther;
-		g_ComputedVis.PushItem( info );
-	}
+	// store by index rather than in completion order, so the result doesn't depend on thread timing
+	g_CurVisThisToOther[ &pOtherArea - g_pCurVisCollected ] = (unsigned char)visThisToOther;
 
 	if ( visOtherToThis != NOT_VISIBLE )
 	{
+		CNavArea::AreaBindInfo info;
 		info.area = g_pCurVisArea;
 		info.attributes = visOtherToThis;
 		area->m_potentiallyVisibleAreas.AddToTail( info );
@@ -5609,12 +5647,19 @@ void CNavArea::ComputeVisibilityToMesh( void )
 	SetupPVS();
 
 	g_pCurVisArea = this;
+	g_pCurVisCollected = collector.m_area.Base();
+	g_CurVisThisToOther.SetCount( collector.m_area.Count() );
 	ParallelProcess( "CNavArea::ComputeVisibilityToMesh", collector.m_area.Base(), collector.m_area.Count(), &ComputeVisToArea );
 
-	m_potentiallyVisibleAreas.EnsureCapacity( g_ComputedVis.Count() );
-	while ( g_ComputedVis.Count() )
+	FOR_EACH_VEC( collector.m_area, it )
 	{
-		g_ComputedVis.PopItem( &m_potentiallyVisibleAreas[ m_potentiallyVisibleAreas.AddToTail() ] );
+		if ( g_CurVisThisToOther[ it ] != NOT_VISIBLE )
+		{
+			AreaBindInfo info;
+			info.area = collector.m_area[ it ];
+			info.attributes = g_CurVisThisToOther[ it ];
+			m_potentiallyVisibleAreas.AddToTail( info );
+		}
 	}
 
 	FOR_EACH_VEC( collector.m_area, it )
@@ -14,6 +14,7 @@
 
 #include "nav_ladder.h"
 #include "tier1/memstack.h"
+#include "tier0/threadtools.h"
 
 // BOTPORT: Clean up relationship between team index and danger storage in nav areas
 enum { MAX_NAV_TEAMS = 2 };
@@ -428,8 +429,8 @@ public:
 	BOOL IsMarked( void ) const			{ return (m_marker == m_masterMarker) ? true : false; }
 	
 	void SetParent( CNavArea *parent, NavTraverseType how = NUM_TRAVERSE_TYPES )	{ m_parent = parent; m_parentHow = how; }
-	CNavArea *GetParent( void ) const	{ return m_parent; }
-	NavTraverseType GetParentHow( void ) const	{ return m_parentHow; }
+	CNavArea *GetParent( void ) const;							// if a CNavSearchScratch is active on this thread, these query its state instead
+	NavTraverseType GetParentHow( void ) const;
 
 	bool IsOpen( void ) const;									// true if on "open list"
 	void AddToOpenList( void );									// add to open list in decreasing value order
@@ -446,13 +447,13 @@ public:
 	static void ClearSearchLists( void );						// clears the open and closed lists for a new search
 
 	void SetTotalCost( float value )	{ Assert( value >= 0.0 && !IS_NAN(value) ); m_totalCost = value; }
-	float GetTotalCost( void ) const	{ return m_totalCost; }
+	float GetTotalCost( void ) const;
 
 	void SetCostSoFar( float value )	{ Assert( value >= 0.0 && !IS_NAN(value) ); m_costSoFar = value; }
-	float GetCostSoFar( void ) const	{ return m_costSoFar; }
+	float GetCostSoFar( void ) const;
 
 	void SetPathLengthSoFar( float value )	{ Assert( value >= 0.0 && !IS_NAN(value) ); m_pathLengthSoFar = value; }
-	float GetPathLengthSoFar( void ) const	{ return m_pathLengthSoFar; }
+	float GetPathLengthSoFar( void ) const;
 
 	//- editing -----------------------------------------------------------------------------------------
 	virtual void Draw( void ) const;							// draw area for debugging & editing
@@ -739,6 +740,7 @@ private:
 	void ComputeVisibilityToMesh( void );						// compute visibility to surrounding mesh
 	void ResetPotentiallyVisibleAreas();
 	static void ComputeVisToArea( CNavArea *&pOtherArea );
+	static void SortPotentiallyVisibleAreas( CNavArea *&area );	// sort visibility list by area ID, as ComputeVisibilityDelta() expects
 
 #ifndef _X360
 	typedef CUtlVectorConservative<AreaBindInfo> CAreaBindInfoArray; // shaves 8 bytes off structure caused by need to support editing
@@ -750,7 +752,7 @@ private:
 	CAreaBindInfoArray m_potentiallyVisibleAreas;				// list of areas potentially visible from inside this area (after PostLoad(), use area portion of union)
 	bool m_isInheritedFrom;										// latch used during visibility inheritance computation
 
-	const CAreaBindInfoArray &ComputeVisibilityDelta( const CNavArea *other ) const;	// return a list of the delta between our visibility list and the given adjacent area
+	const CAreaBindInfoArray &ComputeVisibilityDelta( const CNavArea *other ) const;	// return a list of the delta between our visibility list and the given adjacent area - both lists must be sorted by area ID
 
 	uint32 m_nVisTestCounter;
 	static uint32 s_nCurrVisTestCounter;
@@ -762,6 +764,89 @@ typedef CUtlVector< CNavArea * > NavAreaVector;
 extern NavAreaVector TheNavAreas;
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A* bookkeeping for a single area during a search run through a CNavSearchScratch
+ */
+struct NavSearchNode_t
+{
+	CNavArea *parent;											// the area just prior to this on in the search path
+	float costSoFar;											// distance travelled so far
+	float totalCost;											// the distance so far plus an estimate of the distance left
+	float pathLengthSoFar;										// length of path so far, needed for limiting pathfind max path length
+	unsigned int stamp;											// node is only valid if this equals the owning scratch's stamp
+	unsigned char how;											// how we get from parent to us
+	bool isOpen;
+	bool isClosed;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Per-search A* state, kept outside of CNavArea so that several path searches can run at
+ * once on different threads. Nodes are indexed by area ID and lazily reset via a stamp,
+ * so starting a new search is as cheap as CNavArea::ClearSearchLists().
+ * While a scratch is active on a thread, CNavArea::GetParent(), GetCostSoFar() and friends
+ * read from it, so existing cost functors work unchanged.
+ */
+class CNavSearchScratch
+{
+public:
+	CNavSearchScratch( void );
+
+	void ClearSearchLists( void );								// begin a new search
+
+	void Activate( void );										// route CNavArea search accessors on this thread to us
+	void Deactivate( void );
+
+	// search interface used by NavAreaBuildPath()
+	void SetParent( CNavArea *area, CNavArea *parent, NavTraverseType how = NUM_TRAVERSE_TYPES );
+	CNavArea *GetParent( const CNavArea *area ) const	{ return GetNode( area ).parent; }
+	NavTraverseType GetParentHow( const CNavArea *area ) const	{ return (NavTraverseType)GetNode( area ).how; }
+
+	void SetTotalCost( CNavArea *area, float value )	{ Assert( value >= 0.0 && !IS_NAN(value) ); Touch( area ).totalCost = value; }
+	float GetTotalCost( const CNavArea *area ) const	{ return GetNode( area ).totalCost; }
+
+	void SetCostSoFar( CNavArea *area, float value )	{ Assert( value >= 0.0 && !IS_NAN(value) ); Touch( area ).costSoFar = value; }
+	float GetCostSoFar( const CNavArea *area ) const	{ return GetNode( area ).costSoFar; }
+
+	void SetPathLengthSoFar( CNavArea *area, float value )	{ Assert( value >= 0.0 && !IS_NAN(value) ); Touch( area ).pathLengthSoFar = value; }
+	float GetPathLengthSoFar( const CNavArea *area ) const	{ return GetNode( area ).pathLengthSoFar; }
+
+	bool IsOpen( const CNavArea *area ) const			{ return GetNode( area ).isOpen; }
+	void AddToOpenList( CNavArea *area );
+	void UpdateOnOpenList( CNavArea *area )				{ AddToOpenList( area ); }	// stale heap entries are skipped when popped
+	bool IsOpenListEmpty( void );
+	CNavArea *PopOpenList( void );
+
+	bool IsClosed( const CNavArea *area ) const			{ return GetNode( area ).isClosed; }
+	void AddToClosedList( CNavArea *area )				{ Touch( area ).isClosed = true; }
+	void RemoveFromClosedList( CNavArea *area )			{ Touch( area ).isClosed = false; }
+
+	static const NavSearchNode_t *GetActiveNode( const CNavArea *area );	// NULL if no scratch is active on this thread
+
+private:
+	const NavSearchNode_t &GetNode( const CNavArea *area ) const;
+	NavSearchNode_t &Touch( const CNavArea *area );
+	void RemoveOpenListTop( void );
+
+	struct OpenEntry_t
+	{
+		float totalCost;
+		CNavArea *area;
+	};
+
+	CUtlVector< NavSearchNode_t > m_nodes;
+	CUtlVector< OpenEntry_t > m_openHeap;						// binary min-heap on totalCost
+	unsigned int m_stamp;
+
+	static const NavSearchNode_t s_emptyNode;
+	static CInterlockedInt s_activeCount;						// number of threads with an active scratch, to skip the TLS lookup when zero
+	static CThreadLocalPtr< CNavSearchScratch > s_active;
+};
+
+
+
 //--------------------------------------------------------------------------------------------------------------
 //--------------------------------------------------------------------------------------------------------------
 //
@@ -861,6 +946,95 @@ inline CNavArea *CNavArea::PopOpenList( void )
 	return NULL;
 }
 
+//--------------------------------------------------------------------------------------------------------------
+inline const NavSearchNode_t &CNavSearchScratch::GetNode( const CNavArea *area ) const
+{
+	unsigned int id = area->GetID();
+	if ( id < (unsigned int)m_nodes.Count() && m_nodes[ id ].stamp == m_stamp )
+		return m_nodes[ id ];
+
+	return s_emptyNode;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline NavSearchNode_t &CNavSearchScratch::Touch( const CNavArea *area )
+{
+	unsigned int id = area->GetID();
+	if ( id >= (unsigned int)m_nodes.Count() )
+	{
+		int first = m_nodes.AddMultipleToTail( id + 1 - m_nodes.Count() );
+		for( int i=first; i<m_nodes.Count(); ++i )
+		{
+			m_nodes[i].stamp = 0;
+		}
+	}
+
+	NavSearchNode_t &node = m_nodes[ id ];
+	if ( node.stamp != m_stamp )
+	{
+		node = s_emptyNode;
+		node.stamp = m_stamp;
+	}
+
+	return node;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavSearchScratch::SetParent( CNavArea *area, CNavArea *parent, NavTraverseType how )
+{
+	NavSearchNode_t &node = Touch( area );
+	node.parent = parent;
+	node.how = (unsigned char)how;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline const NavSearchNode_t *CNavSearchScratch::GetActiveNode( const CNavArea *area )
+{
+	if ( s_activeCount == 0 )
+		return NULL;
+
+	const CNavSearchScratch *scratch = s_active;
+	if ( scratch == NULL )
+		return NULL;
+
+	return &scratch->GetNode( area );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline CNavArea *CNavArea::GetParent( void ) const
+{
+	const NavSearchNode_t *node = CNavSearchScratch::GetActiveNode( this );
+	return ( node ) ? node->parent : m_parent;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline NavTraverseType CNavArea::GetParentHow( void ) const
+{
+	const NavSearchNode_t *node = CNavSearchScratch::GetActiveNode( this );
+	return ( node ) ? (NavTraverseType)node->how : m_parentHow;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavArea::GetTotalCost( void ) const
+{
+	const NavSearchNode_t *node = CNavSearchScratch::GetActiveNode( this );
+	return ( node ) ? node->totalCost : m_totalCost;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavArea::GetCostSoFar( void ) const
+{
+	const NavSearchNode_t *node = CNavSearchScratch::GetActiveNode( this );
+	return ( node ) ? node->costSoFar : m_costSoFar;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavArea::GetPathLengthSoFar( void ) const
+{
+	const NavSearchNode_t *node = CNavSearchScratch::GetActiveNode( this );
+	return ( node ) ? node->pathLengthSoFar : m_pathLengthSoFar;
+}
+
 //--------------------------------------------------------------------------------------------------------------
 inline bool CNavArea::IsClosed( void ) const
 {
@@ -1397,12 +1397,13 @@ NavErrorType CNavMesh::Load( void )
 	char filename[256];
 	Q_snprintf( filename, sizeof( filename ), FORMAT_NAVFILE, STRING( gpGlobals->mapname ) );
 
+	// Loose .nav files are parsed straight out of a read-only mapping rather than copied to the heap
 	bool navIsInBsp = false;
-	CUtlBuffer fileBuffer( 4096, 1024*1024, CUtlBuffer::READ_ONLY );
-	if ( !filesystem->ReadFile( filename, "MOD", fileBuffer ) )	// this ignores .nav files embedded in the .bsp ...
+	CUtlMappedBuffer fileBuffer;
+	if ( !fileBuffer.Open( filesystem, filename, "MOD" ) )	// this ignores .nav files embedded in the .bsp ...
 	{
 		navIsInBsp = true;
-		if ( !filesystem->ReadFile( filename, "BSP", fileBuffer ) )	// ... and this looks for one if it's the only one around.
+		if ( !fileBuffer.Open( filesystem, filename, "BSP" ) )	// ... and this looks for one if it's the only one around.
 		{
 			return NAV_CANT_ACCESS_FILE;
 		}
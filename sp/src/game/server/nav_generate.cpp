@@ -17,6 +17,7 @@
 #include "viewport_panel_names.h"
 //#include "terror/TerrorShared.h"
 #include "fmtstr.h"
+#include "vstdlib/jobthread.h"
 
 #ifdef TERROR
 #include "func_simpleladder.h"
@@ -42,6 +43,8 @@ ConVar nav_generate_fixup_jump_areas( "nav_generate_fixup_jump_areas", "1", FCVA
 ConVar nav_generate_incremental_range( "nav_generate_incremental_range", "2000", FCVAR_CHEAT );
 ConVar nav_generate_incremental_tolerance( "nav_generate_incremental_tolerance", "0", FCVAR_CHEAT, "Z tolerance for adding new nav areas." );
 ConVar nav_area_max_size( "nav_area_max_size", "50", FCVAR_CHEAT, "Max area size created in nav generation" );
+ConVar nav_generate_threaded( "nav_generate_threaded", "1", FCVAR_CHEAT, "Trace walkable space sampling steps in parallel batches during nav generation. The resulting mesh is identical either way." );
+ConVar nav_generate_sample_batch( "nav_generate_sample_batch", "256", FCVAR_CHEAT, "Max number of sampling steps traced ahead of the search in one parallel batch when nav_generate_threaded is set." );
 
 // Common bounding box for traces
 Vector NavTraceMins( -0.45, -0.45, 0 );
@@ -3449,6 +3452,7 @@ void CNavMesh::BeginGeneration( bool incremental )
 
 	// the system will see this NULL and select the next walkable seed
 	m_currentNode = NULL;
+	BeginSampling();
 
 	// if there are no seed points, we can't generate
 	if (m_walkableSeeds.Count() == 0)
@@ -3640,6 +3644,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 			}
 
 			// sampling is complete, now build nav areas
+			EndSampling();
 			m_generationState = CREATE_AREAS_FROM_SAMPLES;
 
 			return true;
@@ -4108,6 +4113,13 @@ CNavNode *CNavMesh::AddNode( const Vector &destPos, const Vector &normal, NavDir
 		m_currentNode = node;
 	}
 
+	if ( m_isSamplingThreaded )
+	{
+		// crouch and cliff checks are traced in parallel once sampling is done, see EndSampling()
+		m_sampledNodes.AddToTail( node );
+		return node;
+	}
+
 	node->CheckCrouch();
 
 	// determine if there's a cliff nearby and set an attribute on this node
@@ -4389,232 +4401,463 @@ bool CNavMesh::SampleStep( void )
 			{
 				// have not searched in this direction yet
 
-				// start at current node position
-				Vector pos = *m_currentNode->GetPosition();
+				// mark direction as visited
+				m_generationDir = (NavDirType)dir;
+				m_currentNode->MarkAsVisited( m_generationDir );
 
-				// snap to grid
-				int cx = SnapToGrid( pos.x );
-				int cy = SnapToGrid( pos.y );
+				// test if we can move to new position
+				NavSampleProbe_t probe;
+				if ( m_isSamplingThreaded )
+				{
+					GetSampleProbe( *m_currentNode->GetPosition(), m_generationDir, &probe );
+				}
+				else
+				{
+					probe.from = *m_currentNode->GetPosition();
+					probe.dir = m_generationDir;
+					SampleAdjacentPosition( probe );
+				}
 
-				// attempt to move to adjacent node
-				switch( dir )
+				if ( probe.isWalkable )
 				{
-					case NORTH:		cy -= GenerationStepSize; break;
-					case SOUTH:		cy += GenerationStepSize; break;
-					case EAST:		cx += GenerationStepSize; break;
-					case WEST:		cx -= GenerationStepSize; break;
+					// we can move here
+					// create a new navigation node, and update current node pointer
+					AddNode( probe.to, probe.toNormal, m_generationDir, m_currentNode, probe.isOnDisplacement, probe.obstacleHeight, probe.obstacleStartDist, probe.obstacleEndDist );
 				}
 
-				pos.x = cx;
-				pos.y = cy;
+				return true;
+			}
+		}
 
-				m_generationDir = (NavDirType)dir;
+		// all directions have been searched from this node - pop back to its parent and continue
+		m_currentNode = m_currentNode->GetParent();
+	}
+}
 
-				// mark direction as visited
-				m_currentNode->MarkAsVisited( m_generationDir );
 
-				// sanity check to not generate across the world for incremental generation
-				const float incrementalRange = nav_generate_incremental_range.GetFloat();
-				if ( m_generationMode == GENERATE_INCREMENTAL && incrementalRange > 0 )
-				{
-					bool inRange = false;
-					for ( int i=0; i<m_walkableSeeds.Count(); ++i )
-					{
-						const Vector &seedPos = m_walkableSeeds[i].pos;
-						if ( (seedPos - pos).IsLengthLessThan( incrementalRange ) )
-						{
-							inRange = true;
-							break;
-						}
-					}
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Take one sampling step from 'probe.from' in 'probe.dir', and fill in where we ended up.
+ * This only reads the world and the existing mesh, so many steps can be traced at once
+ * on worker threads.
+ */
+void CNavMesh::SampleAdjacentPosition( NavSampleProbe_t &probe )
+{
+	probe.isWalkable = false;
 
-					if ( !inRange )
-					{
-						return true;
-					}
-				}
+	// start at current node position
+	Vector pos = probe.from;
+
+	// snap to grid
+	int cx = SnapToGrid( pos.x );
+	int cy = SnapToGrid( pos.y );
+
+	// attempt to move to adjacent node
+	switch( probe.dir )
+	{
+		case NORTH:		cy -= GenerationStepSize; break;
+		case SOUTH:		cy += GenerationStepSize; break;
+		case EAST:		cx += GenerationStepSize; break;
+		case WEST:		cx -= GenerationStepSize; break;
+	}
+
+	pos.x = cx;
+	pos.y = cy;
+
+	// sanity check to not generate across the world for incremental generation
+	const float incrementalRange = nav_generate_incremental_range.GetFloat();
+	if ( m_generationMode == GENERATE_INCREMENTAL && incrementalRange > 0 )
+	{
+		bool inRange = false;
+		for ( int i=0; i<m_walkableSeeds.Count(); ++i )
+		{
+			const Vector &seedPos = m_walkableSeeds[i].pos;
+			if ( (seedPos - pos).IsLengthLessThan( incrementalRange ) )
+			{
+				inRange = true;
+				break;
+			}
+		}
+
+		if ( !inRange )
+		{
+			return;
+		}
+	}
 
-				if ( m_generationMode == GENERATE_SIMPLIFY )
+	if ( m_generationMode == GENERATE_SIMPLIFY )
+	{
+		if ( !m_simplifyGenerationExtent.Contains( pos ) )
+		{
+			return;
+		}
+	}
+
+	// test if we can move to new position
+	trace_t result;
+	Vector from( probe.from );
+	CTraceFilterWalkableEntities filter( NULL, COLLISION_GROUP_NONE, WALK_THRU_EVERYTHING );
+	Vector to, toNormal;
+	float obstacleHeight = 0, obstacleStartDist = 0, obstacleEndDist = GenerationStepSize;
+	if ( TraceAdjacentNode( 0, from, pos, &result ) )
+	{
+		to = result.endpos;
+		toNormal = result.plane.normal;
+	}
+	else
+	{
+		// test going up ClimbUpHeight
+		bool success = false;
+		for ( float height = StepHeight; height <= ClimbUpHeight; height += 1.0f )
+		{						
+			trace_t tr;
+			Vector start( from );
+			Vector end( pos );
+			start.z += height;
+			end.z += height;
+			UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+			if ( !tr.startsolid && tr.fraction == 1.0f )
+			{
+				if ( !StayOnFloor( &tr ) )
 				{
-					if ( !m_simplifyGenerationExtent.Contains( pos ) )
-					{
-						return true;
-					}
+					break;
 				}
 
-				// test if we can move to new position
-				trace_t result;
-				Vector from( *m_currentNode->GetPosition() );
-				CTraceFilterWalkableEntities filter( NULL, COLLISION_GROUP_NONE, WALK_THRU_EVERYTHING );
-				Vector to, toNormal;
-				float obstacleHeight = 0, obstacleStartDist = 0, obstacleEndDist = GenerationStepSize;
-				if ( TraceAdjacentNode( 0, from, pos, &result ) )
+				to = tr.endpos;
+				toNormal = tr.plane.normal;
+
+				start = end = from;
+				end.z += height;
+				UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+				if ( tr.fraction < 1.0f )
 				{
-					to = result.endpos;
-					toNormal = result.plane.normal;
+					break;
 				}
-				else
+
+				// keep track of far up we had to go to find a path to the next node
+				obstacleHeight = height;
+				success = true;
+				break;
+			}
+			else
+			{
+				// Could not trace from node to node at this height, something is in the way.
+				// Trace in the other direction to see if we hit something
+				Vector vecToObstacleStart = tr.endpos - start;
+				Assert( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) );
+				if ( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) )
 				{
-					// test going up ClimbUpHeight
-					bool success = false;
-					for ( float height = StepHeight; height <= ClimbUpHeight; height += 1.0f )
-					{						
-						trace_t tr;
-						Vector start( from );
-						Vector end( pos );
-						start.z += height;
-						end.z += height;
-						UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-						if ( !tr.startsolid && tr.fraction == 1.0f )
+					UTIL_TraceHull( end, start, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+					if ( !tr.startsolid && tr.fraction < 1.0 )
+					{
+						// We hit something going the other direction.  There is some obstacle between the two nodes.
+						Vector vecToObstacleEnd = tr.endpos - start;
+						Assert( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize ) );
+						if ( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize )  )
 						{
-							if ( !StayOnFloor( &tr ) )
+							// Remember the distances to start and end of the obstacle (with respect to the "from" node).
+							// Keep track of the last distances to obstacle as we keep increasing the height we do a trace for.
+							// If we do eventually clear the obstacle, these values will be the start and end distance to the
+							// very tip of the obstacle.
+							obstacleStartDist = vecToObstacleStart.Length();
+							obstacleEndDist = vecToObstacleEnd.Length();
+							if ( obstacleEndDist == 0 )
 							{
-								break;
+								obstacleEndDist = GenerationStepSize;
 							}
+						}								
+					}
+				}
+			}
+		}
 
-							to = tr.endpos;
-							toNormal = tr.plane.normal;
+		if ( !success )
+		{
+			return;
+		}
+	}
 
-							start = end = from;
-							end.z += height;
-							UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-							if ( tr.fraction < 1.0f )
-							{
-								break;
-							}
+	// Don't generate nodes if we spill off the end of the world onto skybox
+	if ( result.surface.flags & ( SURF_SKY|SURF_SKY2D ) )
+	{
+		return;
+	}
 
-							// keep track of far up we had to go to find a path to the next node
-							obstacleHeight = height;
-							success = true;
-							break;
-						}
-						else
-						{
-							// Could not trace from node to node at this height, something is in the way.
-							// Trace in the other direction to see if we hit something
-							Vector vecToObstacleStart = tr.endpos - start;
-							Assert( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) );
-							if ( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) )
-							{
-								UTIL_TraceHull( end, start, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-								if ( !tr.startsolid && tr.fraction < 1.0 )
-								{
-									// We hit something going the other direction.  There is some obstacle between the two nodes.
-									Vector vecToObstacleEnd = tr.endpos - start;
-									Assert( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize ) );
-									if ( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize )  )
-									{
-										// Remember the distances to start and end of the obstacle (with respect to the "from" node).
-										// Keep track of the last distances to obstacle as we keep increasing the height we do a trace for.
-										// If we do eventually clear the obstacle, these values will be the start and end distance to the
-										// very tip of the obstacle.
-										obstacleStartDist = vecToObstacleStart.Length();
-										obstacleEndDist = vecToObstacleEnd.Length();
-										if ( obstacleEndDist == 0 )
-										{
-											obstacleEndDist = GenerationStepSize;
-										}
-									}								
-								}
-							}
-						}
-					}
+	// If we're incrementally generating, don't overlap existing nav areas.
+	Vector testPos( to );
+	bool overlapSE = IsNodeOverlapped( testPos, Vector(  1,  1, HalfHumanHeight ) );
+	bool overlapSW = IsNodeOverlapped( testPos, Vector( -1,  1, HalfHumanHeight ) );
+	bool overlapNE = IsNodeOverlapped( testPos, Vector(  1, -1, HalfHumanHeight ) );
+	bool overlapNW = IsNodeOverlapped( testPos, Vector( -1, -1, HalfHumanHeight ) );
+	if ( overlapSE && overlapSW && overlapNE && overlapNW && m_generationMode != GENERATE_SIMPLIFY )
+	{
+		return;
+	}
 
-					if ( !success )
-					{
-						return true;
-					}
-				}
+	int nTolerance = nav_generate_incremental_tolerance.GetInt();
+	if ( nTolerance > 0 && m_generationMode == GENERATE_INCREMENTAL )
+	{
+		bool bValid = false;
+		int zPos = to.z;
+		for ( int i=0; i<m_walkableSeeds.Count(); ++i )
+		{
+			const Vector &seedPos = m_walkableSeeds[i].pos;
+			int zMin = seedPos.z - nTolerance;
+			int zMax = seedPos.z + nTolerance;
 
-				// Don't generate nodes if we spill off the end of the world onto skybox
-				if ( result.surface.flags & ( SURF_SKY|SURF_SKY2D ) )
-				{
-					return true;
-				}
+			if ( zPos >= zMin && zPos <= zMax )
+			{
+				bValid = true;
+				break;
+			}
+		}
+
+		if ( !bValid )
+			return;
+	}
 
-				// If we're incrementally generating, don't overlap existing nav areas.
-				Vector testPos( to );
-				bool overlapSE = IsNodeOverlapped( testPos, Vector(  1,  1, HalfHumanHeight ) );
-				bool overlapSW = IsNodeOverlapped( testPos, Vector( -1,  1, HalfHumanHeight ) );
-				bool overlapNE = IsNodeOverlapped( testPos, Vector(  1, -1, HalfHumanHeight ) );
-				bool overlapNW = IsNodeOverlapped( testPos, Vector( -1, -1, HalfHumanHeight ) );
-				if ( overlapSE && overlapSW && overlapNE && overlapNW && m_generationMode != GENERATE_SIMPLIFY )
+
+	bool isOnDisplacement = result.IsDispSurface();
+
+	if ( nav_displacement_test.GetInt() > 0 )
+	{
+		// Test for nodes under displacement surfaces.
+		// This happens during development, and is a pain because the space underneath a displacement
+		// is not 'solid'.
+		Vector start = to + Vector( 0, 0, 0 );
+		Vector end = start + Vector( 0, 0, nav_displacement_test.GetInt() );
+		UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
+
+		if ( result.fraction > 0 )
+		{
+			end = start;
+			start = result.endpos;
+			UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
+			if ( result.fraction < 1 )
+			{
+				// if we made it down to within StepHeight, maybe we're on a static prop
+				if ( result.endpos.z > to.z + StepHeight )
 				{
-					return true;
+					return;
 				}
+			}
+		}
+	}
 
-				int nTolerance = nav_generate_incremental_tolerance.GetInt();
-				if ( nTolerance > 0 && m_generationMode == GENERATE_INCREMENTAL )
-				{
-					bool bValid = false;
-					int zPos = to.z;
-					for ( int i=0; i<m_walkableSeeds.Count(); ++i )
-					{
-						const Vector &seedPos = m_walkableSeeds[i].pos;
-						int zMin = seedPos.z - nTolerance;
-						int zMax = seedPos.z + nTolerance;
+	float deltaZ = to.z - probe.from.z;
+	// If there's an obstacle in the way and it's traversable, or the obstacle is not higher than the destination node itself minus a small epsilon
+	// (meaning the obstacle was just the height change to get to the destination node, no extra obstacle between the two), clear obstacle height
+	// and distances
+	if ( ( obstacleHeight < MaxTraversableHeight ) || ( deltaZ > ( obstacleHeight - 2.0f ) ) )
+	{
+		obstacleHeight = 0;
+		obstacleStartDist = 0;
+		obstacleEndDist = GenerationStepSize;
+	}
 
-						if ( zPos >= zMin && zPos <= zMax )
-						{
-							bValid = true;
-							break;
-						}
-					}
+	// we can move here
+	probe.isWalkable = true;
+	probe.to = to;
+	probe.toNormal = toNormal;
+	probe.isOnDisplacement = isOnDisplacement;
+	probe.obstacleHeight = obstacleHeight;
+	probe.obstacleStartDist = obstacleStartDist;
+	probe.obstacleEndDist = obstacleEndDist;
+}
 
-					if ( !bValid )
-						return true;
-				}
 
+//--------------------------------------------------------------------------------------------------------------
+static CUtlHash< NavSampleProbe_t, CSampleProbeHashFuncs, CSampleProbeHashFuncs > *s_pSampleProbeHash;
 
-				bool isOnDisplacement = result.IsDispSurface();
 
-				if ( nav_displacement_test.GetInt() > 0 )
-				{
-					// Test for nodes under displacement surfaces.
-					// This happens during development, and is a pain because the space underneath a displacement
-					// is not 'solid'.
-					Vector start = to + Vector( 0, 0, 0 );
-					Vector end = start + Vector( 0, 0, nav_displacement_test.GetInt() );
-					UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
-
-					if ( result.fraction > 0 )
-					{
-						end = start;
-						start = result.endpos;
-						UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
-						if ( result.fraction < 1 )
-						{
-							// if we made it down to within StepHeight, maybe we're on a static prop
-							if ( result.endpos.z > to.z + StepHeight )
-							{
-								return true;
-							}
-						}
-					}
-				}
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Prepare for a series of SampleStep() calls
+ */
+void CNavMesh::BeginSampling( void )
+{
+	m_isSamplingThreaded = nav_generate_threaded.GetBool();
+	m_sampledNodes.RemoveAll();
+
+	if ( s_pSampleProbeHash )
+	{
+		s_pSampleProbeHash->RemoveAll();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the result of stepping from 'from' in 'dir'.
+ * Steps are computed in parallel batches, ahead of the (strictly ordered) search that consumes them.
+ * Since a step only depends on its starting position, the mesh is identical to a serial sample.
+ */
+void CNavMesh::GetSampleProbe( const Vector &from, NavDirType dir, NavSampleProbe_t *probe )
+{
+	if ( !s_pSampleProbeHash )
+	{
+		s_pSampleProbeHash = new CUtlHash< NavSampleProbe_t, CSampleProbeHashFuncs, CSampleProbeHashFuncs >( 16*1024 );
+	}
 
-				float deltaZ = to.z - m_currentNode->GetPosition()->z;
-				// If there's an obstacle in the way and it's traversable, or the obstacle is not higher than the destination node itself minus a small epsilon
-				// (meaning the obstacle was just the height change to get to the destination node, no extra obstacle between the two), clear obstacle height
-				// and distances
-				if ( ( obstacleHeight < MaxTraversableHeight ) || ( deltaZ > ( obstacleHeight - 2.0f ) ) )
+	probe->from = from;
+	probe->dir = dir;
+
+	UtlHashHandle_t hProbe = s_pSampleProbeHash->Find( *probe );
+	if ( hProbe == s_pSampleProbeHash->InvalidHandle() )
+	{
+		SpeculateSampleProbes( *probe );
+		hProbe = s_pSampleProbeHash->Find( *probe );
+	}
+
+	if ( hProbe == s_pSampleProbeHash->InvalidHandle() )
+	{
+		Assert( !"GetSampleProbe: requested probe was not computed" );
+		SampleAdjacentPosition( *probe );
+		return;
+	}
+
+	*probe = s_pSampleProbeHash->Element( hProbe );
+	s_pSampleProbeHash->Remove( hProbe );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Compute 'request', every step still pending on the current search stack, and then the steps
+ * from positions those will create, wave by wave, up to nav_generate_sample_batch steps.
+ */
+void CNavMesh::SpeculateSampleProbes( const NavSampleProbe_t &request )
+{
+	VPROF( "CNavMesh::SpeculateSampleProbes" );
+
+	const int batchSize = MAX( 1, nav_generate_sample_batch.GetInt() );
+
+	CUtlVector< NavSampleProbe_t > wave;
+	wave.EnsureCapacity( batchSize );
+	wave.AddToTail( request );
+
+	// the search will pop back through these nodes, trying their remaining directions
+	for( CNavNode *node = m_currentNode; node && wave.Count() < batchSize; node = node->GetParent() )
+	{
+		for( int dir = NORTH; dir < NUM_DIRECTIONS; ++dir )
+		{
+			if ( node->HasVisited( (NavDirType)dir ) )
+				continue;
+
+			NavSampleProbe_t probe;
+			probe.from = *node->GetPosition();
+			probe.dir = (NavDirType)dir;
+
+			if ( s_pSampleProbeHash->Find( probe ) == s_pSampleProbeHash->InvalidHandle() )
+			{
+				wave.AddToTail( probe );
+			}
+		}
+	}
+
+	int computed = 0;
+	while( wave.Count() )
+	{
+		ParallelProcess( "CNavMesh::SampleAdjacentPosition", wave.Base(), wave.Count(), this, &CNavMesh::SampleAdjacentPosition );
+		computed += wave.Count();
+
+		CUtlVector< NavSampleProbe_t > nextWave;
+		FOR_EACH_VEC( wave, it )
+		{
+			const NavSampleProbe_t &probe = wave[ it ];
+
+			bool didInsert;
+			s_pSampleProbeHash->Insert( probe, &didInsert );
+
+			// speculate that a step onto new ground will create a node, which will then be sampled
+			if ( !didInsert || !probe.isWalkable || computed + nextWave.Count() >= batchSize )
+				continue;
+
+			if ( CNavNode::GetNode( probe.to ) )
+				continue;
+
+			for( int dir = NORTH; dir < NUM_DIRECTIONS; ++dir )
+			{
+				// AddNode() marks the way back as visited when the step is nearly level
+				if ( dir == OppositeDirection( probe.dir ) && fabs( probe.from.z - probe.to.z ) < 50.0f )
+					continue;
+
+				NavSampleProbe_t next;
+				next.from = probe.to;
+				next.dir = (NavDirType)dir;
+
+				if ( s_pSampleProbeHash->Find( next ) == s_pSampleProbeHash->InvalidHandle() )
 				{
-					obstacleHeight = 0;
-					obstacleStartDist = 0;
-					obstacleEndDist = GenerationStepSize;
+					nextWave.AddToTail( next );
 				}
+			}
+		}
+
+		wave.Swap( nextWave );
+	}
+}
 
-				// we can move here
-				// create a new navigation node, and update current node pointer
-				AddNode( to, toNormal, m_generationDir, m_currentNode, isOnDisplacement, obstacleHeight, obstacleStartDist, obstacleEndDist );
 
-				return true;
+//--------------------------------------------------------------------------------------------------------------
+void CNavMesh::CheckSampledNodeCrouch( CNavNode *&node )
+{
+	node->CheckCrouch();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static int CompareNodeIDs( CNavNode * const *node1, CNavNode * const *node2 )
+{
+	return (int)(*node1)->GetID() - (int)(*node2)->GetID();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Finish sampling walkable space
+ */
+void CNavMesh::EndSampling( void )
+{
+	if ( s_pSampleProbeHash )
+	{
+		s_pSampleProbeHash->RemoveAll();
+	}
+
+	if ( m_sampledNodes.Count() )
+	{
+		// AddNode() can reach the same node several times, only check each once
+		m_sampledNodes.Sort( CompareNodeIDs );
+
+		int count = 0;
+		FOR_EACH_VEC( m_sampledNodes, it )
+		{
+			if ( count == 0 || m_sampledNodes[ count-1 ] != m_sampledNodes[ it ] )
+			{
+				m_sampledNodes[ count++ ] = m_sampledNodes[ it ];
 			}
 		}
+		m_sampledNodes.SetCountNonDestructively( count );
 
-		// all directions have been searched from this node - pop back to its parent and continue
-		m_currentNode = m_currentNode->GetParent();
+		ParallelProcess( "CNavNode::CheckCrouch", m_sampledNodes.Base(), m_sampledNodes.Count(), this, &CNavMesh::CheckSampledNodeCrouch );
+
+		FOR_EACH_VEC( m_sampledNodes, it )
+		{
+			CNavNode *node = m_sampledNodes[ it ];
+
+			// determine if there's a cliff nearby and set an attribute on this node
+			for ( int i = 0; i < NUM_DIRECTIONS; i++ )
+			{
+				if ( CheckCliff( node->GetPosition(), (NavDirType)i ) )
+				{
+					node->SetAttributes( node->GetAttributes() | NAV_MESH_CLIFF );
+					break;
+				}
+			}
+		}
 	}
+
+	m_sampledNodes.RemoveAll();
+	m_isSamplingThreaded = false;
 }
 
 
@@ -13,9 +13,11 @@
 #include "filesystem.h"
 #include "nav_mesh.h"
 #include "nav_node.h"
+#include "nav_pathfind.h"
 #include "fmtstr.h"
 #include "utlbuffer.h"
 #include "tier0/vprof.h"
+#include "vstdlib/jobthread.h"
 #ifdef TERROR
 #include "func_simpleladder.h"
 #endif
@@ -63,6 +65,7 @@ CNavMesh::CNavMesh( void )
 	m_editMode = NORMAL;
 	m_bQuitWhenFinished = false;
 	m_hostThreadModeRestoreValue = 0;
+	m_isSamplingThreaded = false;
 	m_placeCount = 0;
 	m_placeName = NULL;
 
@@ -156,6 +159,9 @@ CNavArea *CNavMesh::GetMarkedArea( void ) const
  */
 void CNavMesh::DestroyNavigationMesh( bool incremental )
 {
+	// asynchronous searches may still be walking the areas we are about to change
+	NavFlushPathSearches();
+
 	m_blockedAreas.RemoveAll();
 	m_avoidanceObstacleAreas.RemoveAll();
 	m_transientAreas.RemoveAll();
@@ -3215,6 +3221,9 @@ void CNavMesh::EndVisibilityComputations( void )
 {
 	g_pNavVisPairHash->RemoveAll();
 
+	// ComputeVisibilityDelta() walks the lists in step, which needs them in area ID order
+	ParallelProcess( "CNavArea::SortPotentiallyVisibleAreas", TheNavAreas.Base(), TheNavAreas.Count(), &CNavArea::SortPotentiallyVisibleAreas );
+
 	int avgVisLength = 0;
 	int maxVisLength = 0;
 	int minVisLength = 999999999;
@@ -205,6 +205,42 @@ public:
 };
 
 
+//--------------------------------------------------------------------------------------------------------
+// for nav mesh sampling - the outcome of taking one step from a node. It depends only on the
+// world and the starting position, so it can be computed ahead of time on any thread.
+struct NavSampleProbe_t
+{
+	Vector from;												// position of the node we are stepping from
+	NavDirType dir;												// direction of the step
+
+	bool isWalkable;											// if false, no node is added in this direction
+	Vector to;
+	Vector toNormal;
+	bool isOnDisplacement;
+	float obstacleHeight;
+	float obstacleStartDist;
+	float obstacleEndDist;
+};
+
+
+// for nav mesh sampling
+class CSampleProbeHashFuncs
+{
+public:
+	CSampleProbeHashFuncs( int ) {}
+
+	bool operator()( const NavSampleProbe_t &lhs, const NavSampleProbe_t &rhs ) const
+	{
+		return ( lhs.dir == rhs.dir && lhs.from == rhs.from );
+	}
+
+	unsigned int operator()( const NavSampleProbe_t &item ) const
+	{
+		return Hash12( &item.from ) ^ ( (unsigned int)item.dir * 0x9E3779B9 );
+	}
+};
+
+
 //--------------------------------------------------------------------------------------------------------------
 //
 // The 'place directory' is used to save and load places from
@@ -1163,6 +1199,14 @@ private:
 	void DestroyLadders( void );
 
 	bool SampleStep( void );									// sample the walkable areas of the map
+	void SampleAdjacentPosition( NavSampleProbe_t &probe );		// trace one sampling step - safe to call from worker threads
+	void GetSampleProbe( const Vector &from, NavDirType dir, NavSampleProbe_t *probe );	// fetch a sampling step, computing a batch of them in parallel if needed
+	void SpeculateSampleProbes( const NavSampleProbe_t &request );	// compute the requested step, and the steps the search is likely to need next
+	void BeginSampling( void );									// prepare for a series of SampleStep() calls
+	void EndSampling( void );									// finish sampling, running the per-node checks deferred while threaded
+	void CheckSampledNodeCrouch( CNavNode *&node );
+	bool m_isSamplingThreaded;									// if true, sampling traces are batched across worker threads
+	CUtlVector< CNavNode * > m_sampledNodes;					// nodes reached by AddNode() during threaded sampling
 	void CreateNavAreasFromNodes( void );						// cover all of the sampled nodes with nav areas
 
 	bool TestArea( CNavNode *node, int width, int height );		// check if an area of size (width, height) can fit, starting from node as upper left corner
@@ -0,0 +1,476 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose:
+//
+// $NoKeywords: $
+//=============================================================================//
+// nav_pathfind.cpp
+// Per-search scratch state and asynchronous path searches on the Navigation Mesh
+
+#include "cbase.h"
+#include "nav_mesh.h"
+#include "nav_pathfind.h"
+#include "tier0/tslist.h"
+#include "vstdlib/jobthread.h"
+
+// NOTE: This has to be the last file included!
+#include "tier0/memdbgon.h"
+
+
+ConVar nav_async_pathfind( "nav_async_pathfind", "1", FCVAR_GAMEDLL, "If nonzero, NavAreaBuildPathAsync() searches run on the thread pool. Otherwise they run immediately on the main thread." );
+
+
+const NavSearchNode_t CNavSearchScratch::s_emptyNode = { NULL, 0.0f, 0.0f, 0.0f, 0, NUM_TRAVERSE_TYPES, false, false };
+CInterlockedInt CNavSearchScratch::s_activeCount;
+CThreadLocalPtr< CNavSearchScratch > CNavSearchScratch::s_active;
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavSearchScratch::CNavSearchScratch( void )
+{
+	m_stamp = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Clears the open and closed lists for a new search
+ */
+void CNavSearchScratch::ClearSearchLists( void )
+{
+	// effectively clears all nodes, by invalidating their stamps
+	++m_stamp;
+	if ( m_stamp == 0 )
+	{
+		// stamp wrapped - really clear the nodes so stale ones can't match
+		for( int i=0; i<m_nodes.Count(); ++i )
+		{
+			m_nodes[i].stamp = 0;
+		}
+
+		m_stamp = 1;
+	}
+
+	m_openHeap.RemoveAll();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Make CNavArea search accessors on this thread read from this scratch
+ */
+void CNavSearchScratch::Activate( void )
+{
+	Assert( s_active == NULL );
+
+	s_active = this;
+	++s_activeCount;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavSearchScratch::Deactivate( void )
+{
+	Assert( s_active == this );
+
+	--s_activeCount;
+	s_active = NULL;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Add to open list in increasing total cost order.
+ * An area already on the list is simply pushed again, the older entry is skipped when popped.
+ */
+void CNavSearchScratch::AddToOpenList( CNavArea *area )
+{
+	NavSearchNode_t &node = Touch( area );
+	node.isOpen = true;
+
+	OpenEntry_t entry;
+	entry.totalCost = node.totalCost;
+	entry.area = area;
+
+	// sift up
+	int i = m_openHeap.AddToTail();
+	while( i > 0 )
+	{
+		int parent = ( i - 1 ) / 2;
+		if ( m_openHeap[ parent ].totalCost <= entry.totalCost )
+			break;
+
+		m_openHeap[ i ] = m_openHeap[ parent ];
+		i = parent;
+	}
+
+	m_openHeap[ i ] = entry;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Discard stale entries from the top of the open list, and return true if nothing is left
+ */
+bool CNavSearchScratch::IsOpenListEmpty( void )
+{
+	while( m_openHeap.Count() )
+	{
+		const OpenEntry_t &top = m_openHeap[0];
+		const NavSearchNode_t &node = GetNode( top.area );
+		if ( node.isOpen && node.totalCost == top.totalCost )
+			return false;
+
+		// superseded by a cheaper entry, or already popped
+		RemoveOpenListTop();
+	}
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Remove and return the first element of the open list
+ */
+CNavArea *CNavSearchScratch::PopOpenList( void )
+{
+	if ( IsOpenListEmpty() )
+		return NULL;
+
+	CNavArea *area = m_openHeap[0].area;
+	Touch( area ).isOpen = false;
+
+	RemoveOpenListTop();
+
+	return area;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Remove the root of the open list heap
+ */
+void CNavSearchScratch::RemoveOpenListTop( void )
+{
+	// move the last entry to the root and sift down
+	OpenEntry_t last = m_openHeap.Tail();
+	m_openHeap.RemoveMultipleFromTail( 1 );
+
+	int count = m_openHeap.Count();
+	if ( count == 0 )
+		return;
+
+	int i = 0;
+	while( true )
+	{
+		int child = 2 * i + 1;
+		if ( child >= count )
+			break;
+
+		if ( child + 1 < count && m_openHeap[ child + 1 ].totalCost < m_openHeap[ child ].totalCost )
+			++child;
+
+		if ( last.totalCost <= m_openHeap[ child ].totalCost )
+			break;
+
+		m_openHeap[ i ] = m_openHeap[ child ];
+		i = child;
+	}
+
+	m_openHeap[ i ] = last;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Walk the scratch's parent links back from 'endArea' and store the path in 'result'
+ */
+void NavBuildPathSearchResult( const CNavSearchScratch &scratch, CNavArea *startArea, CNavArea *endArea, CNavPathSearchResult *result )
+{
+	result->m_path.RemoveAll();
+	result->m_closestArea = endArea;
+	result->m_cost = 0.0f;
+
+	if ( endArea == NULL )
+		return;
+
+	if ( endArea == startArea )
+	{
+		NavPathStep_t step = { startArea, NUM_TRAVERSE_TYPES };
+		result->m_path.AddToTail( step );
+		return;
+	}
+
+	result->m_cost = scratch.GetCostSoFar( endArea );
+
+	// count the path length so the steps can be stored in order
+	int count = 0;
+	for( CNavArea *area = endArea; area; area = scratch.GetParent( area ) )
+	{
+		++count;
+
+		// guard against a corrupt parent chain
+		if ( count > TheNavAreas.Count() )
+		{
+			Assert( !"NavBuildPathSearchResult: parent loop" );
+			result->m_pathFound = false;
+			return;
+		}
+	}
+
+	result->m_path.SetCount( count );
+
+	int i = count - 1;
+	for( CNavArea *area = endArea; area; area = scratch.GetParent( area ) )
+	{
+		result->m_path[i].area = area;
+		result->m_path[i].how = scratch.GetParentHow( area );
+		--i;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Bookkeeping for a single NavQueuePathSearch() call
+ */
+struct NavPathSearchRequest_t
+{
+	NavPathSearchHandle_t handle;
+	INavPathSearchJob *job;
+	CJob *threadJob;											// NULL if the search ran synchronously
+	CNavPathSearchResult result;
+	volatile bool isCancelled;
+};
+
+static CUtlVector< NavPathSearchRequest_t * > s_navPathSearchRequests;		// in flight or awaiting collection
+static CUtlVector< NavPathSearchRequest_t * > s_navPathSearchRetired;		// cancelled, but possibly still running
+static NavPathSearchHandle_t s_navPathSearchNextHandle = NAV_PATH_SEARCH_INVALID + 1;
+
+// scratches are reused between searches, each worker takes one for the duration of a search
+static CTSList< CNavSearchScratch * > s_navSearchScratchPool;
+
+
+//--------------------------------------------------------------------------------------------------------------
+static CNavSearchScratch *AcquireNavSearchScratch( void )
+{
+	CNavSearchScratch *scratch;
+	if ( !s_navSearchScratchPool.PopItem( &scratch ) )
+	{
+		scratch = new CNavSearchScratch;
+	}
+
+	return scratch;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static void ReleaseNavSearchScratch( CNavSearchScratch *scratch )
+{
+	s_navSearchScratchPool.PushItem( scratch );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Runs on a worker thread (or the main thread, if async searches are disabled)
+ */
+static void RunNavPathSearch( NavPathSearchRequest_t *request )
+{
+	if ( request->isCancelled )
+		return;
+
+	CNavSearchScratch *scratch = AcquireNavSearchScratch();
+	request->job->Run( *scratch, &request->result );
+	ReleaseNavSearchScratch( scratch );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static bool IsNavPathSearchFinished( const NavPathSearchRequest_t *request )
+{
+	return ( request->threadJob == NULL || request->threadJob->IsFinished() );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static void DestroyNavPathSearch( NavPathSearchRequest_t *request )
+{
+	if ( request->threadJob )
+	{
+		request->threadJob->WaitForFinishAndRelease();
+	}
+
+	delete request->job;
+	delete request;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Free cancelled requests whose searches have finished
+ */
+static void ReapNavPathSearches( void )
+{
+	FOR_EACH_VEC_BACK( s_navPathSearchRetired, it )
+	{
+		NavPathSearchRequest_t *request = s_navPathSearchRetired[ it ];
+		if ( IsNavPathSearchFinished( request ) )
+		{
+			DestroyNavPathSearch( request );
+			s_navPathSearchRetired.FastRemove( it );
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static int FindNavPathSearch( NavPathSearchHandle_t handle )
+{
+	FOR_EACH_VEC( s_navPathSearchRequests, it )
+	{
+		if ( s_navPathSearchRequests[ it ]->handle == handle )
+			return it;
+	}
+
+	return s_navPathSearchRequests.InvalidIndex();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Queue a path search and return a handle to poll it with. Takes ownership of 'job'.
+ */
+NavPathSearchHandle_t NavQueuePathSearch( INavPathSearchJob *job )
+{
+	Assert( ThreadInMainThread() );
+
+	ReapNavPathSearches();
+
+	NavPathSearchRequest_t *request = new NavPathSearchRequest_t;
+	request->handle = s_navPathSearchNextHandle++;
+	if ( s_navPathSearchNextHandle == NAV_PATH_SEARCH_INVALID )
+	{
+		++s_navPathSearchNextHandle;
+	}
+	request->job = job;
+	request->threadJob = NULL;
+	request->isCancelled = false;
+
+	s_navPathSearchRequests.AddToTail( request );
+
+	if ( nav_async_pathfind.GetBool() && g_pThreadPool && g_pThreadPool->NumThreads() > 0 )
+	{
+		request->threadJob = ThreadExecute( &RunNavPathSearch, request );
+	}
+	else
+	{
+		RunNavPathSearch( request );
+	}
+
+	return request->handle;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Check on a queued search. Once it is complete, its result is copied into 'result'
+ * and the handle becomes invalid.
+ */
+NavPathSearchStatus NavPollPathSearch( NavPathSearchHandle_t handle, CNavPathSearchResult *result )
+{
+	Assert( ThreadInMainThread() );
+
+	int it = FindNavPathSearch( handle );
+	if ( it == s_navPathSearchRequests.InvalidIndex() )
+		return NAV_PATH_SEARCH_UNKNOWN;
+
+	NavPathSearchRequest_t *request = s_navPathSearchRequests[ it ];
+	if ( !IsNavPathSearchFinished( request ) )
+		return NAV_PATH_SEARCH_PENDING;
+
+	if ( result )
+	{
+		result->m_pathFound = request->result.m_pathFound;
+		result->m_closestArea = request->result.m_closestArea;
+		result->m_cost = request->result.m_cost;
+		result->m_path.Swap( request->result.m_path );
+	}
+
+	s_navPathSearchRequests.Remove( it );
+	DestroyNavPathSearch( request );
+
+	return NAV_PATH_SEARCH_COMPLETE;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Abandon a queued search without waiting for it
+ */
+void NavCancelPathSearch( NavPathSearchHandle_t handle )
+{
+	Assert( ThreadInMainThread() );
+
+	int it = FindNavPathSearch( handle );
+	if ( it == s_navPathSearchRequests.InvalidIndex() )
+		return;
+
+	NavPathSearchRequest_t *request = s_navPathSearchRequests[ it ];
+	request->isCancelled = true;
+
+	s_navPathSearchRequests.Remove( it );
+	s_navPathSearchRetired.AddToTail( request );
+
+	ReapNavPathSearches();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Wait for every search to finish and throw away all requests, since their results
+ * reference areas that are about to go away. Outstanding handles become invalid.
+ */
+void NavFlushPathSearches( void )
+{
+	if ( s_navPathSearchRequests.Count() == 0 && s_navPathSearchRetired.Count() == 0 )
+		return;
+
+	Assert( ThreadInMainThread() );
+
+	FOR_EACH_VEC( s_navPathSearchRequests, it )
+	{
+		s_navPathSearchRequests[ it ]->isCancelled = true;
+		DestroyNavPathSearch( s_navPathSearchRequests[ it ] );
+	}
+	s_navPathSearchRequests.RemoveAll();
+
+	FOR_EACH_VEC( s_navPathSearchRetired, it )
+	{
+		DestroyNavPathSearch( s_navPathSearchRetired[ it ] );
+	}
+	s_navPathSearchRetired.RemoveAll();
+
+	// nothing is running now, so the scratches can go too
+	CNavSearchScratch *scratch;
+	while( s_navSearchScratchPool.PopItem( &scratch ) )
+	{
+		delete scratch;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+int NavGetPendingPathSearchCount( void )
+{
+	int count = 0;
+	FOR_EACH_VEC( s_navPathSearchRequests, it )
+	{
+		if ( !IsNavPathSearchFinished( s_navPathSearchRequests[ it ] ) )
+			++count;
+	}
+
+	return count;
+}
@@ -85,6 +85,41 @@ public:
 	}
 };
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Search state for NavAreaBuildPathImpl() that uses the open/closed lists built into CNavArea.
+ * This is the classic (main thread only) behavior - the resulting path can be walked with
+ * CNavArea::GetParent() after the search.
+ */
+class CNavAreaSearchLists
+{
+public:
+	void ClearSearchLists( void )								{ CNavArea::ClearSearchLists(); }
+
+	void SetParent( CNavArea *area, CNavArea *parent, NavTraverseType how = NUM_TRAVERSE_TYPES )	{ area->SetParent( parent, how ); }
+	CNavArea *GetParent( const CNavArea *area ) const			{ return area->GetParent(); }
+
+	void SetTotalCost( CNavArea *area, float value )			{ area->SetTotalCost( value ); }
+	float GetTotalCost( const CNavArea *area ) const			{ return area->GetTotalCost(); }
+
+	void SetCostSoFar( CNavArea *area, float value )			{ area->SetCostSoFar( value ); }
+	float GetCostSoFar( const CNavArea *area ) const			{ return area->GetCostSoFar(); }
+
+	void SetPathLengthSoFar( CNavArea *area, float value )		{ area->SetPathLengthSoFar( value ); }
+	float GetPathLengthSoFar( const CNavArea *area ) const		{ return area->GetPathLengthSoFar(); }
+
+	bool IsOpen( const CNavArea *area ) const					{ return area->IsOpen(); }
+	void AddToOpenList( CNavArea *area )						{ area->AddToOpenList(); }
+	void UpdateOnOpenList( CNavArea *area )						{ area->UpdateOnOpenList(); }
+	bool IsOpenListEmpty( void )								{ return CNavArea::IsOpenListEmpty(); }
+	CNavArea *PopOpenList( void )								{ return CNavArea::PopOpenList(); }
+
+	bool IsClosed( const CNavArea *area ) const					{ return area->IsClosed(); }
+	void AddToClosedList( CNavArea *area )						{ area->AddToClosedList(); }
+	void RemoveFromClosedList( CNavArea *area )					{ area->RemoveFromClosedList(); }
+};
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Find path from startArea to goalArea via an A* search, using supplied cost heuristic.
@@ -96,10 +131,11 @@ public:
  * If 'goalPos' is NULL, will use the center of 'goalArea' as the goal position.
  * If 'maxPathLength' is nonzero, path building will stop when this length is reached.
  * Returns true if a path exists.
+ * 'search' holds the open/closed lists and per-area costs - see CNavAreaSearchLists and CNavSearchScratch.
  */
 #define IGNORE_NAV_BLOCKERS true
-template< typename CostFunctor >
-bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+template< typename SearchState, typename CostFunctor >
+bool NavAreaBuildPathImpl( SearchState &search, CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea, float maxPathLength, int teamID, bool ignoreNavBlockers )
 {
 	VPROF_BUDGET( "NavAreaBuildPath", "NextBotSpiky" );
 
@@ -108,12 +144,13 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 		*closestArea = startArea;
 	}
 
-	bool isDebug = ( g_DebugPathfindCounter-- > 0 );
+	// debug drawing is only possible from the main thread
+	bool isDebug = ThreadInMainThread() && ( g_DebugPathfindCounter-- > 0 );
 
 	if (startArea == NULL)
 		return false;
 
-	startArea->SetParent( NULL );
+	search.SetParent( startArea, NULL );
 
 	if (goalArea != NULL && goalArea->IsBlocked( teamID, ignoreNavBlockers ))
 		goalArea = NULL;
@@ -131,28 +168,28 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 	Vector actualGoalPos = (goalPos) ? *goalPos : goalArea->GetCenter();
 
 	// start search
-	CNavArea::ClearSearchLists();
+	search.ClearSearchLists();
 
 	// compute estimate of path length
 	/// @todo Cost might work as "manhattan distance"
-	startArea->SetTotalCost( (startArea->GetCenter() - actualGoalPos).Length() );
+	search.SetTotalCost( startArea, (startArea->GetCenter() - actualGoalPos).Length() );
 
 	float initCost = costFunc( startArea, NULL, NULL, NULL, -1.0f );	
 	if (initCost < 0.0f)
 		return false;
-	startArea->SetCostSoFar( initCost );
-	startArea->SetPathLengthSoFar( 0.0 );
+	search.SetCostSoFar( startArea, initCost );
+	search.SetPathLengthSoFar( startArea, 0.0 );
 
-	startArea->AddToOpenList();
+	search.AddToOpenList( startArea );
 
 	// keep track of the area we visit that is closest to the goal
-	float closestAreaDist = startArea->GetTotalCost();
+	float closestAreaDist = search.GetTotalCost( startArea );
 
 	// do A* search
-	while( !CNavArea::IsOpenListEmpty() )
+	while( !search.IsOpenListEmpty() )
 	{
 		// get next area to check
-		CNavArea *area = CNavArea::PopOpenList();
+		CNavArea *area = search.PopOpenList();
 
 		if ( isDebug )
 		{
@@ -329,7 +366,7 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 
 			// don't backtrack
 			Assert( newArea );
-			if ( newArea == area->GetParent() )
+			if ( newArea == search.GetParent( area ) )
 				continue;
 			if ( newArea == area ) // self neighbor?
 				continue;
@@ -346,13 +383,13 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 
 			// Safety check against a bogus functor.  The cost of the path
 			// A...B, C should always be at least as big as the path A...B.
-			Assert( newCostSoFar >= area->GetCostSoFar() );
+			Assert( newCostSoFar >= search.GetCostSoFar( area ) );
 
 			// And now that we've asserted, let's be a bit more defensive.
 			// Make sure that any jump to a new area incurs some pathfinsing
 			// cost, to avoid us spinning our wheels over insignificant cost
 			// benefit, floating point precision bug, or busted cost functor.
-			float minNewCostSoFar = area->GetCostSoFar() * 1.00001 + 0.00001;
+			float minNewCostSoFar = search.GetCostSoFar( area ) * 1.00001 + 0.00001;
 			newCostSoFar = Max( newCostSoFar, minNewCostSoFar );
 				
 			// stop if path length limit reached
@@ -360,14 +397,14 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 			{
 				// keep track of path length so far
 				float deltaLength = ( newArea->GetCenter() - area->GetCenter() ).Length();
-				float newLengthSoFar = area->GetPathLengthSoFar() + deltaLength;
+				float newLengthSoFar = search.GetPathLengthSoFar( area ) + deltaLength;
 				if ( newLengthSoFar > maxPathLength )
 					continue;
 				
-				newArea->SetPathLengthSoFar( newLengthSoFar );
+				search.SetPathLengthSoFar( newArea, newLengthSoFar );
 			}
 
-			if ( ( newArea->IsOpen() || newArea->IsClosed() ) && newArea->GetCostSoFar() <= newCostSoFar )
+			if ( ( search.IsOpen( newArea ) || search.IsClosed( newArea ) ) && search.GetCostSoFar( newArea ) <= newCostSoFar )
 			{
 				// this is a worse path - skip it
 				continue;
@@ -385,36 +422,68 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 					closestAreaDist = newCostRemaining;
 				}
 				
-				newArea->SetCostSoFar( newCostSoFar );
-				newArea->SetTotalCost( newCostSoFar + newCostRemaining );
+				search.SetCostSoFar( newArea, newCostSoFar );
+				search.SetTotalCost( newArea, newCostSoFar + newCostRemaining );
 
-				if ( newArea->IsClosed() )
+				if ( search.IsClosed( newArea ) )
 				{
-					newArea->RemoveFromClosedList();
+					search.RemoveFromClosedList( newArea );
 				}
 
-				if ( newArea->IsOpen() )
+				if ( search.IsOpen( newArea ) )
 				{
 					// area already on open list, update the list order to keep costs sorted
-					newArea->UpdateOnOpenList();
+					search.UpdateOnOpenList( newArea );
 				}
 				else
 				{
-					newArea->AddToOpenList();
+					search.AddToOpenList( newArea );
 				}
 
-				newArea->SetParent( area, how );
+				search.SetParent( newArea, area, how );
 			}
 		}
 
 		// we have searched this area
-		area->AddToClosedList();
+		search.AddToClosedList( area );
 	}
 
 	return false;
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Find path from startArea to goalArea via an A* search, using supplied cost heuristic.
+ * The path is defined by following parent pointers back from goalArea to startArea.
+ * See NavAreaBuildPathImpl() for parameters. Main thread only.
+ */
+template< typename CostFunctor >
+bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+{
+	CNavAreaSearchLists search;
+	return NavAreaBuildPathImpl( search, startArea, goalArea, goalPos, costFunc, closestArea, maxPathLength, teamID, ignoreNavBlockers );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * As above, but keeps all search state in 'scratch' so it can run on any thread, concurrently
+ * with other searches. The cost functor must be safe to call from that thread.
+ * The path is defined by scratch.GetParent() from goalArea back to startArea.
+ */
+template< typename CostFunctor >
+bool NavAreaBuildPath( CNavSearchScratch &scratch, CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+{
+	// route any GetCostSoFar()/GetParent() calls made by the cost functor to the scratch
+	scratch.Activate();
+	bool result = NavAreaBuildPathImpl( scratch, startArea, goalArea, goalPos, costFunc, closestArea, maxPathLength, teamID, ignoreNavBlockers );
+	scratch.Deactivate();
+
+	return result;
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Compute distance between two areas. Return -1 if can't reach 'endArea' from 'startArea'.
@@ -983,4 +1052,114 @@ void SelectSeparatedShuffleSet( int maxCount, float minSeparation, const CUtlVec
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------------------
+//
+// Asynchronous path searches
+//
+// NavAreaBuildPathAsync() hands a search to the thread pool and returns immediately with a handle.
+// Poll the handle with NavPollPathSearch() on later frames until it completes. Requests are owned by
+// the main thread; cost functors are copied into the request and run on a worker thread, so they
+// must not touch entities or other non thread-safe state.
+//
+
+typedef unsigned int NavPathSearchHandle_t;
+#define NAV_PATH_SEARCH_INVALID 0
+
+enum NavPathSearchStatus
+{
+	NAV_PATH_SEARCH_UNKNOWN,									// invalid, cancelled, or already collected handle
+	NAV_PATH_SEARCH_PENDING,									// still queued or running
+	NAV_PATH_SEARCH_COMPLETE,									// finished - result has been returned and the handle released
+};
+
+struct NavPathStep_t
+{
+	CNavArea *area;
+	NavTraverseType how;										// how we get to this area from the previous step
+};
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The outcome of an asynchronous path search
+ */
+class CNavPathSearchResult
+{
+public:
+	CNavPathSearchResult( void ) : m_pathFound( false ), m_closestArea( NULL ), m_cost( 0.0f ) {}
+
+	void Reset( void )	{ m_pathFound = false; m_closestArea = NULL; m_cost = 0.0f; m_path.RemoveAll(); }
+
+	bool m_pathFound;											// true if the goal was reached
+	CNavArea *m_closestArea;									// goal area, or the area closest to the goal if the search failed
+	float m_cost;												// cost so far of the last area in the path
+	CUtlVector< NavPathStep_t > m_path;							// start area to m_closestArea
+};
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A queued search, run on a worker thread with a CNavSearchScratch of its own
+ */
+class INavPathSearchJob
+{
+public:
+	virtual ~INavPathSearchJob() {}
+	virtual void Run( CNavSearchScratch &scratch, CNavPathSearchResult *result ) = 0;
+};
+
+extern void NavBuildPathSearchResult( const CNavSearchScratch &scratch, CNavArea *startArea, CNavArea *endArea, CNavPathSearchResult *result );
+
+//--------------------------------------------------------------------------------------------------------------
+template< typename CostFunctor >
+class CNavPathSearchJob : public INavPathSearchJob
+{
+public:
+	CNavPathSearchJob( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, const CostFunctor &costFunc, float maxPathLength, int teamID, bool ignoreNavBlockers )
+		: m_startArea( startArea ), m_goalArea( goalArea ), m_hasGoalPos( goalPos != NULL ), m_costFunc( costFunc ), m_maxPathLength( maxPathLength ), m_teamID( teamID ), m_ignoreNavBlockers( ignoreNavBlockers )
+	{
+		m_goalPos = ( goalPos ) ? *goalPos : vec3_origin;
+	}
+
+	virtual void Run( CNavSearchScratch &scratch, CNavPathSearchResult *result )
+	{
+		CNavArea *closestArea = NULL;
+
+		scratch.ClearSearchLists();
+		result->m_pathFound = NavAreaBuildPath( scratch, m_startArea, m_goalArea, m_hasGoalPos ? &m_goalPos : NULL, m_costFunc, &closestArea, m_maxPathLength, m_teamID, m_ignoreNavBlockers );
+
+		NavBuildPathSearchResult( scratch, m_startArea, closestArea, result );
+	}
+
+private:
+	CNavArea *m_startArea;
+	CNavArea *m_goalArea;
+	Vector m_goalPos;
+	bool m_hasGoalPos;
+	CostFunctor m_costFunc;
+	float m_maxPathLength;
+	int m_teamID;
+	bool m_ignoreNavBlockers;
+};
+
+extern NavPathSearchHandle_t NavQueuePathSearch( INavPathSearchJob *job );		// takes ownership of 'job'
+extern NavPathSearchStatus NavPollPathSearch( NavPathSearchHandle_t handle, CNavPathSearchResult *result );
+extern void NavCancelPathSearch( NavPathSearchHandle_t handle );
+extern void NavFlushPathSearches( void );						// wait for all searches and discard their results - call before areas are destroyed
+extern int NavGetPendingPathSearchCount( void );
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Queue a NavAreaBuildPath() search to be run on a worker thread.
+ * 'costFunc' is copied, and must be safe to run off the main thread.
+ */
+template< typename CostFunctor >
+NavPathSearchHandle_t NavAreaBuildPathAsync( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, const CostFunctor &costFunc, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+{
+	if ( startArea == NULL )
+		return NAV_PATH_SEARCH_INVALID;
+
+	return NavQueuePathSearch( new CNavPathSearchJob< CostFunctor >( startArea, goalArea, goalPos, costFunc, maxPathLength, teamID, ignoreNavBlockers ) );
+}
+
+
 #endif // _NAV_PATHFIND_H_
@@ -125,6 +125,7 @@ public:
 	virtual void			PostDataUpdate( DataUpdateType_t updateType );
 
 	virtual bool			Interpolate( float currentTime );
+	virtual bool			PrepareThreadedInterpolation() { return false; }
 
 	bool					ShouldFlipViewModel();
 	void					UpdateAnimationParity( void );
@@ -8,6 +8,8 @@
 #include "igamesystem.h"
 #include "utlsymbol.h"
 #include "utldict.h"
+#include "utlflathashmap.h"
+#include "utlstring.h"
 #include "KeyValues.h"
 #include "filesystem.h"
 
@@ -92,13 +94,22 @@ private:
 		CUtlVector< int >	indices;
 	};
 
+	typedef CUtlFlatHashMap< CUtlString, DecalEntry, CaselessStringHashFunctor, CaselessStringEqualFunctor > DecalMap_t;
+
 	CUtlVector< DecalListEntry >	m_AllDecals;
-	CUtlDict< DecalEntry, int >		m_Decals;
+	DecalMap_t						m_Decals;
 	CUtlSymbolTable					m_DecalFileNames;
-	CUtlDict< int, int >			m_GameMaterialTranslation;
+	CUtlFlatHashMap< unsigned char, CUtlString >	m_GameMaterialTranslation;
 };
 
 static CDecalEmitterSystem g_DecalSystem( "CDecalEmitterSystem" );
+
+// Game materials match case-insensitively, as they did when the translation
+// table was a CUtlDict
+static inline unsigned char GameMaterialKey( int gamematerial )
+{
+	return (unsigned char)tolower( (unsigned char)gamematerial );
+}
 IDecalEmitterSystem *decalsystem = &g_DecalSystem;
 
 //-----------------------------------------------------------------------------
@@ -111,8 +122,8 @@ int CDecalEmitterSystem::GetDecalIndexForName( char const *decalname )
 	if ( !decalname  || !decalname[ 0 ] )
 		return -1;
 
-	int idx = m_Decals.Find( decalname );
-	if ( idx == m_Decals.InvalidIndex() )
+	UtlFlatHashHandle_t idx = m_Decals.Find( decalname );
+	if ( idx == m_Decals.InvalidHandle() )
 		return -1;
 
 	DecalEntry *e = &m_Decals[ idx ];
@@ -262,10 +273,16 @@ void CDecalEmitterSystem::LoadDecalsFromScript( char const *filename )
 				if ( !Q_stricmp( sub->GetString(), "" ) )
 					continue;
 
-				int idx = m_Decals.Find( sub->GetString() );
-				if ( idx != m_Decals.InvalidIndex() )
+				// Game materials are single characters
+				const char *pMaterial = sub->GetName();
+				if ( !pMaterial[0] || pMaterial[1] )
+					continue;
+
+				UtlFlatHashHandle_t idx = m_Decals.Find( sub->GetString() );
+				if ( idx != m_Decals.InvalidHandle() )
 				{
-					m_GameMaterialTranslation.Insert( sub->GetName(), idx );
+					// Store the name rather than the handle, handles move as the map grows
+					m_GameMaterialTranslation.Insert( GameMaterialKey( pMaterial[0] ), m_Decals.Key( idx ) );
 				}
 				else
 				{
@@ -286,15 +303,11 @@ void CDecalEmitterSystem::LoadDecalsFromScript( char const *filename )
 //-----------------------------------------------------------------------------
 char const *CDecalEmitterSystem::ImpactDecalForGameMaterial( int gamematerial )
 {
-	char gm[ 2 ];
-	gm[0] = (char)gamematerial;
-	gm[1] = 0;
-
-	int idx = m_GameMaterialTranslation.Find( gm );
-	if ( idx == m_GameMaterialTranslation.InvalidIndex() )
+	UtlFlatHashHandle_t idx = m_GameMaterialTranslation.Find( GameMaterialKey( gamematerial ) );
+	if ( idx == m_GameMaterialTranslation.InvalidHandle() )
 		return NULL;
 
-	return m_Decals.GetElementName( m_GameMaterialTranslation.Element(idx) );
+	return m_GameMaterialTranslation.Element( idx ).Get();
 }
 
 //-----------------------------------------------------------------------------
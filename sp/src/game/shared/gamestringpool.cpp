@@ -8,6 +8,7 @@
 #include "cbase.h"
 
 #include "utlhashtable.h"
+#include "tier1/utlinterntable.h"
 #ifndef GC
 #include "igamesystem.h"
 #endif
@@ -20,7 +21,8 @@
 #include "tier0/memdbgon.h"
 
 //-----------------------------------------------------------------------------
-// Purpose: The actual storage for pooled per-level strings
+// Purpose: The actual storage for pooled per-level strings. Allocate and Find
+//			are safe to call from worker threads; FreeAll is not.
 //-----------------------------------------------------------------------------
 #ifdef GC
 class CGameStringPool
@@ -40,26 +42,24 @@ class CGameStringPool : public CBaseGameSystem
 		m_Strings.DbgCheckIntegrity();
 		m_KeyLookupCache.DbgCheckIntegrity();
 #endif
-		m_Strings.Purge();
+		m_Strings.RemoveAll();
 		m_KeyLookupCache.Purge();
 	}
 
-	CUtlHashtable<CUtlConstString> m_Strings;
+	CUtlInternTable m_Strings;
 	CUtlHashtable<const void*, const char*> m_KeyLookupCache;
+	CThreadSpinRWLock m_KeyLookupLock;
 
 public:
 
-	CGameStringPool() : m_Strings(256) { }
+	CGameStringPool() : m_Strings( false, false, 4096 ) { }
 
 	~CGameStringPool() { FreeAll(); }
 
 	void Dump( void )
 	{
-		CUtlVector<const char*> strings( 0, m_Strings.Count() );
-		for ( UtlHashHandle_t i = m_Strings.FirstHandle(); i != m_Strings.InvalidHandle(); i = m_Strings.NextHandle(i) )
-		{
-			strings.AddToTail( m_Strings[i] );
-		}
+		CUtlVector<const char*> strings;
+		m_Strings.GetStrings( strings );
 
 		struct _Local {
 			static int __cdecl F(const char * const *a, const char * const *b) { return strcmp(*a, *b); }
@@ -76,21 +76,28 @@ public:
 
 	const char *Find(const char *string)
 	{
-		UtlHashHandle_t i = m_Strings.Find( string );
-		return i == m_Strings.InvalidHandle() ? NULL : m_Strings[ i ].Get();
+		return m_Strings.Find( string );
 	}
 
 	const char *Allocate(const char *string)
 	{
-		return m_Strings[ m_Strings.Insert( string ) ].Get();
+		return m_Strings.Intern( string );
 	}
 
 	const char *AllocateWithKey(const char *string, const void* key)
 	{
-		const char * &cached = m_KeyLookupCache[ m_KeyLookupCache.Insert( key, NULL ) ];
-		if (cached == NULL)
+		m_KeyLookupLock.LockForRead();
+		UtlHashHandle_t i = m_KeyLookupCache.Find( key );
+		const char *cached = ( i != m_KeyLookupCache.InvalidHandle() ) ? m_KeyLookupCache[i] : NULL;
+		m_KeyLookupLock.UnlockRead();
+
+		if ( cached == NULL )
 		{
 			cached = Allocate( string );
+
+			m_KeyLookupLock.LockForWrite();
+			m_KeyLookupCache.Insert( key, cached );
+			m_KeyLookupLock.UnlockWrite();
 		}
 		return cached;
 	}
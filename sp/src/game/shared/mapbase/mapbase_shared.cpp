@@ -17,6 +17,7 @@
 #include "saverestore_utlvector.h"
 #include "props_shared.h"
 #include "utlbuffer.h"
+#include "tier1/mempool.h"
 #include "usermessages.h"
 #ifdef CLIENT_DLL
 #include "hud_closecaption.h"
@@ -883,3 +884,54 @@ CON_COMMAND_SHARED( con_group_toggle, "Toggles a console group." )
 {
 	ToggleConsoleGroups( args.Arg( 1 ) );
 }
+
+//-----------------------------------------------------------------------------
+// Purpose: Prints the thread-safe memory pools in this module. Allocation
+//			rates are measured since the previous mem_pool_stats.
+//-----------------------------------------------------------------------------
+CON_COMMAND_SHARED( mem_pool_stats, "Prints usage, allocation rate and lock contention for the thread-safe memory pools." )
+{
+	static CUtlMap<const char *, uint64> s_LastAllocs( DefLessFunc( const char * ) );
+	static double s_flLastTime = 0.0;
+
+	double flNow = Plat_FloatTime();
+	double flElapsed = s_flLastTime > 0.0 ? flNow - s_flLastTime : 0.0;
+	s_flLastTime = flNow;
+
+	CUtlVector<CMemoryPoolMT::Stats_t> stats;
+	CMemoryPoolMT::GetAllStats( stats );
+	if ( !stats.Count() )
+	{
+		Msg( "No thread-safe memory pools in this module.\n" );
+		return;
+	}
+
+	Msg( "%-40s %6s %8s %8s %8s %6s %12s %10s %8s %10s\n", "pool", "size", "in use", "cached", "peak", "blobs", "allocs", "allocs/s", "batches", "contended" );
+	for ( int i = 0; i < stats.Count(); i++ )
+	{
+		const CMemoryPoolMT::Stats_t &pool = stats[i];
+
+		float flRate = 0.0f;
+		unsigned short nLast = s_LastAllocs.Find( pool.m_pszAllocOwner );
+		if ( nLast != s_LastAllocs.InvalidIndex() )
+		{
+			if ( flElapsed > 0.0 )
+			{
+				flRate = (float)( ( pool.m_nAllocs - s_LastAllocs[nLast] ) / flElapsed );
+			}
+			s_LastAllocs[nLast] = pool.m_nAllocs;
+		}
+		else
+		{
+			s_LastAllocs.Insert( pool.m_pszAllocOwner, pool.m_nAllocs );
+		}
+
+		Msg( "%-40s %6d %8d %8d %8d %6d %12llu %10.1f %8d %10d\n", pool.m_pszAllocOwner ? pool.m_pszAllocOwner : "(unnamed)", pool.m_nBlockSize, pool.m_nInUse, pool.m_nCached,
+			pool.m_nPeakFromPool, pool.m_nBlobs, pool.m_nAllocs, flRate, pool.m_nBatches, pool.m_nContention );
+	}
+
+	if ( flElapsed <= 0.0 )
+	{
+		Msg( "Run mem_pool_stats again to see allocation rates.\n" );
+	}
+}
@@ -21,6 +21,7 @@
 #include "predictioncopy.h"
 #include "engine/ivmodelinfo.h"
 #include "tier1/fmtstr.h"
+#include "tier1/utlmap.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -1373,6 +1374,493 @@ void CPredictionCopy::DetermineWatchField( const char *operation, int entindex,
 	m_pWatchField = FindFieldByName( pwatchvar.GetString(), dmap );
 }
 
+//-----------------------------------------------------------------------------
+// Compiled copy plans
+//
+// Which fields CopyFields visits only depends on the root map, the copy type
+// and which side is packed, so each combination is compiled once into a
+// plan instead of walking the datamaps with a type switch per field:
+//  - copy runs: every plain data field, sorted by destination offset and
+//    merged into a single memcpy wherever both sides are contiguous
+//  - compare runs: the same minus FTYPEDESC_NOERRORCHECK and float based
+//    fields, checked with memcmp
+//  - float, vector and quaternion fields, checked per component with the
+//    same == and tolerance tests as CompareFloat, so NaN never matches and
+//    -0 matches +0
+//  - strings, which are copied by length
+// Maps that embed another map through a pointer are left to the field walk.
+//-----------------------------------------------------------------------------
+static ConVar pred_copy_plans( "pred_copy_plans", "1", 0, "Use precompiled copy plans for prediction copies and error checks." );
+
+struct PredCopyRun_t
+{
+	int		m_nDestOffset;
+	int		m_nSrcOffset;
+	int		m_nBytes;
+};
+
+struct PredCopyFloatField_t
+{
+	int		m_nDestOffset;
+	int		m_nSrcOffset;
+	int		m_nFloats;
+	float	m_flTolerance;
+};
+
+struct PredCopyStringField_t
+{
+	int		m_nDestOffset;
+	int		m_nSrcOffset;
+	bool	m_bCheck;
+};
+
+class CPredictionCopyPlan
+{
+public:
+	CPredictionCopyPlan( int type, int destOffsetIndex, int srcOffsetIndex );
+
+	bool	Compile( datamap_t *dmap );
+
+	void	Copy( void *dest, void const *src ) const;
+	// Returns true if any error checked field differs beyond its tolerance.
+	bool	Differs( void const *dest, void const *src ) const;
+
+	void	PrintStats( const char *classname ) const;
+
+private:
+	bool	CompileFields_R( int chain_count, typedescription_t *pFields, int fieldCount, int destBase, int srcBase );
+
+	static void	AddRun( CUtlVector< PredCopyRun_t > &runs, int destOffset, int srcOffset, int bytes );
+	static void	MergeRuns( CUtlVector< PredCopyRun_t > &runs );
+	static int __cdecl RunLessFunc( const PredCopyRun_t *lhs, const PredCopyRun_t *rhs );
+
+	int			m_nType;
+	int			m_nDestOffsetIndex;
+	int			m_nSrcOffsetIndex;
+	int			m_nFields;
+
+	CUtlVector< PredCopyRun_t >				m_CopyRuns;
+	CUtlVector< PredCopyRun_t >				m_CompareRuns;
+	CUtlVector< PredCopyFloatField_t >		m_FloatFields;
+	CUtlVector< PredCopyStringField_t >		m_StringFields;
+};
+
+CPredictionCopyPlan::CPredictionCopyPlan( int type, int destOffsetIndex, int srcOffsetIndex )
+{
+	m_nType				= type;
+	m_nDestOffsetIndex	= destOffsetIndex;
+	m_nSrcOffsetIndex	= srcOffsetIndex;
+	m_nFields			= 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Walks the chain the same way TransferData_R does
+// Output : Returns false if the map can't be expressed as a plan
+//-----------------------------------------------------------------------------
+bool CPredictionCopyPlan::Compile( datamap_t *dmap )
+{
+	int chain_count = ++g_nChainCount;
+
+	for ( datamap_t *pMap = dmap; pMap; pMap = pMap->baseMap )
+	{
+		if ( !CompileFields_R( chain_count, pMap->dataDesc, pMap->dataNumFields, 0, 0 ) )
+			return false;
+	}
+
+	MergeRuns( m_CopyRuns );
+	MergeRuns( m_CompareRuns );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Mirrors the field selection and type handling of CopyFields
+//-----------------------------------------------------------------------------
+bool CPredictionCopyPlan::CompileFields_R( int chain_count, typedescription_t *pFields, int fieldCount, int destBase, int srcBase )
+{
+	for ( int i = 0; i < fieldCount; i++ )
+	{
+		typedescription_t *pField = &pFields[ i ];
+		int flags = pField->flags;
+
+		if ( pField->override_field != NULL )
+		{
+			pField->override_field->override_count = chain_count;
+		}
+
+		if ( pField->override_count == chain_count )
+			continue;
+
+		if ( pField->fieldType != FIELD_EMBEDDED )
+		{
+			if ( flags & FTYPEDESC_PRIVATE )
+				continue;
+
+			if ( m_nType == PC_NON_NETWORKED_ONLY && ( flags & FTYPEDESC_INSENDTABLE ) )
+				continue;
+
+			if ( m_nType == PC_NETWORKED_ONLY && !( flags & FTYPEDESC_INSENDTABLE ) )
+				continue;
+		}
+
+		int destOffset = destBase + pField->fieldOffset[ m_nDestOffsetIndex ];
+		int srcOffset = srcBase + pField->fieldOffset[ m_nSrcOffsetIndex ];
+		int count = pField->fieldSize;
+		bool bCheck = !( flags & FTYPEDESC_NOERRORCHECK );
+		int floats = 0;
+		int bytes;
+
+		switch ( pField->fieldType )
+		{
+		case FIELD_EMBEDDED:
+			// Data behind a pointer isn't at a fixed offset from the object
+			if ( ( flags & FTYPEDESC_PTR ) && 
+				( m_nDestOffsetIndex == TD_OFFSET_NORMAL || m_nSrcOffsetIndex == TD_OFFSET_NORMAL ) )
+				return false;
+
+			if ( !CompileFields_R( chain_count, pField->td->dataDesc, pField->td->dataNumFields, destOffset, srcOffset ) )
+				return false;
+			continue;
+
+		case FIELD_STRING:
+			{
+				PredCopyStringField_t &string = m_StringFields[ m_StringFields.AddToTail() ];
+				string.m_nDestOffset = destOffset;
+				string.m_nSrcOffset = srcOffset;
+				string.m_bCheck = bCheck;
+				++m_nFields;
+			}
+			continue;
+
+		case FIELD_FLOAT:
+			bytes = sizeof( float ) * count;
+			floats = count;
+			break;
+		case FIELD_VECTOR:
+			bytes = sizeof( Vector ) * count;
+			floats = 3 * count;
+			break;
+		case FIELD_QUATERNION:
+			bytes = sizeof( Quaternion ) * count;
+			floats = 4 * count;
+			break;
+		case FIELD_COLOR32:
+			bytes = 4 * count;
+			break;
+		case FIELD_BOOLEAN:
+			bytes = sizeof( bool ) * count;
+			break;
+		case FIELD_INTEGER:
+			bytes = sizeof( int ) * count;
+			break;
+		case FIELD_SHORT:
+			bytes = sizeof( short ) * count;
+			break;
+		case FIELD_CHARACTER:
+			bytes = count;
+			break;
+		case FIELD_EHANDLE:
+			bytes = sizeof( EHANDLE ) * count;
+			break;
+
+		default:
+			// FIELD_VOID, and the types CopyFields doesn't copy
+			continue;
+		}
+
+		++m_nFields;
+		AddRun( m_CopyRuns, destOffset, srcOffset, bytes );
+
+		if ( !bCheck )
+			continue;
+
+		// Floats are never compared bitwise, memcmp would call two identical
+		// NaNs equal and -0 and +0 different, unlike the field walk
+		if ( floats )
+		{
+			PredCopyFloatField_t &floatField = m_FloatFields[ m_FloatFields.AddToTail() ];
+			floatField.m_nDestOffset = destOffset;
+			floatField.m_nSrcOffset = srcOffset;
+			floatField.m_nFloats = floats;
+			floatField.m_flTolerance = MAX( pField->fieldTolerance, 0.0f );
+		}
+		else
+		{
+			AddRun( m_CompareRuns, destOffset, srcOffset, bytes );
+		}
+	}
+
+	return true;
+}
+
+void CPredictionCopyPlan::AddRun( CUtlVector< PredCopyRun_t > &runs, int destOffset, int srcOffset, int bytes )
+{
+	PredCopyRun_t &run = runs[ runs.AddToTail() ];
+	run.m_nDestOffset = destOffset;
+	run.m_nSrcOffset = srcOffset;
+	run.m_nBytes = bytes;
+}
+
+int __cdecl CPredictionCopyPlan::RunLessFunc( const PredCopyRun_t *lhs, const PredCopyRun_t *rhs )
+{
+	return lhs->m_nDestOffset - rhs->m_nDestOffset;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sorts runs by destination and merges the ones that are contiguous
+//  on both sides. Gaps are never bridged, the unpacked side may have other
+//  members in them.
+//-----------------------------------------------------------------------------
+void CPredictionCopyPlan::MergeRuns( CUtlVector< PredCopyRun_t > &runs )
+{
+	if ( runs.Count() < 2 )
+		return;
+
+	runs.Sort( RunLessFunc );
+
+	int last = 0;
+	for ( int i = 1; i < runs.Count(); i++ )
+	{
+		PredCopyRun_t &prev = runs[ last ];
+		const PredCopyRun_t &run = runs[ i ];
+
+		int destEnd = prev.m_nDestOffset + prev.m_nBytes;
+		if ( run.m_nDestOffset <= destEnd &&
+			run.m_nDestOffset - prev.m_nDestOffset == run.m_nSrcOffset - prev.m_nSrcOffset )
+		{
+			prev.m_nBytes = MAX( destEnd, run.m_nDestOffset + run.m_nBytes ) - prev.m_nDestOffset;
+			continue;
+		}
+
+		runs[ ++last ] = run;
+	}
+
+	runs.SetCountNonDestructively( last + 1 );
+}
+
+void CPredictionCopyPlan::Copy( void *dest, void const *src ) const
+{
+	char *pDest = (char *)dest;
+	const char *pSrc = (const char *)src;
+
+	for ( int i = 0; i < m_CopyRuns.Count(); i++ )
+	{
+		const PredCopyRun_t &run = m_CopyRuns[ i ];
+		memcpy( pDest + run.m_nDestOffset, pSrc + run.m_nSrcOffset, run.m_nBytes );
+	}
+
+	for ( int i = 0; i < m_StringFields.Count(); i++ )
+	{
+		const PredCopyStringField_t &string = m_StringFields[ i ];
+		const char *pString = pSrc + string.m_nSrcOffset;
+		memcpy( pDest + string.m_nDestOffset, pString, Q_strlen( pString ) + 1 );
+	}
+}
+
+bool CPredictionCopyPlan::Differs( void const *dest, void const *src ) const
+{
+	const char *pDest = (const char *)dest;
+	const char *pSrc = (const char *)src;
+
+	for ( int i = 0; i < m_CompareRuns.Count(); i++ )
+	{
+		const PredCopyRun_t &run = m_CompareRuns[ i ];
+		if ( memcmp( pDest + run.m_nDestOffset, pSrc + run.m_nSrcOffset, run.m_nBytes ) )
+			return true;
+	}
+
+	for ( int i = 0; i < m_FloatFields.Count(); i++ )
+	{
+		const PredCopyFloatField_t &field = m_FloatFields[ i ];
+		const float *pOut = (const float *)( pDest + field.m_nDestOffset );
+		const float *pIn = (const float *)( pSrc + field.m_nSrcOffset );
+
+		for ( int j = 0; j < field.m_nFloats; j++ )
+		{
+			if ( pOut[ j ] == pIn[ j ] )
+				continue;
+
+			if ( field.m_flTolerance > 0.0f && fabs( pOut[ j ] - pIn[ j ] ) <= field.m_flTolerance )
+				continue;
+
+			return true;
+		}
+	}
+
+	for ( int i = 0; i < m_StringFields.Count(); i++ )
+	{
+		const PredCopyStringField_t &string = m_StringFields[ i ];
+		if ( string.m_bCheck && Q_strcmp( pDest + string.m_nDestOffset, pSrc + string.m_nSrcOffset ) )
+			return true;
+	}
+
+	return false;
+}
+
+void CPredictionCopyPlan::PrintStats( const char *classname ) const
+{
+	static const char *s_pTypeNames[] = { "everything", "non-networked", "networked" };
+
+	Msg( "  %-32s %-14s %s->%s: %4d fields, %4d copy runs, %4d compare runs, %3d float fields, %d strings\n",
+		classname,
+		s_pTypeNames[ m_nType ],
+		m_nSrcOffsetIndex == TD_OFFSET_PACKED ? "packed" : "normal",
+		m_nDestOffsetIndex == TD_OFFSET_PACKED ? "packed" : "normal",
+		m_nFields,
+		m_CopyRuns.Count(),
+		m_CompareRuns.Count(),
+		m_FloatFields.Count(),
+		m_StringFields.Count() );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Plans for every (map, type, packing) combination seen so far.
+//  Maps that can't be compiled keep a NULL entry so they aren't retried.
+//-----------------------------------------------------------------------------
+struct PredCopyPlanKey_t
+{
+	datamap_t	*m_pMap;
+	int			m_nType;
+	int			m_nDestOffsetIndex;
+	int			m_nSrcOffsetIndex;
+};
+
+static bool PredCopyPlanKeyLessFunc( const PredCopyPlanKey_t &lhs, const PredCopyPlanKey_t &rhs )
+{
+	if ( lhs.m_pMap != rhs.m_pMap )
+		return lhs.m_pMap < rhs.m_pMap;
+	if ( lhs.m_nType != rhs.m_nType )
+		return lhs.m_nType < rhs.m_nType;
+	if ( lhs.m_nDestOffsetIndex != rhs.m_nDestOffsetIndex )
+		return lhs.m_nDestOffsetIndex < rhs.m_nDestOffsetIndex;
+	return lhs.m_nSrcOffsetIndex < rhs.m_nSrcOffsetIndex;
+}
+
+class CPredictionCopyPlanCache
+{
+public:
+	CPredictionCopyPlanCache() : m_Plans( PredCopyPlanKeyLessFunc ) 
+	{
+		m_nFastCopies = m_nFastChecks = m_nFullChecks = 0;
+	}
+
+	~CPredictionCopyPlanCache()
+	{
+		FOR_EACH_MAP_FAST( m_Plans, i )
+		{
+			delete m_Plans[ i ];
+		}
+	}
+
+	const CPredictionCopyPlan *FindOrCompile( datamap_t *dmap, int type, int destOffsetIndex, int srcOffsetIndex );
+
+	void	PrintStats();
+
+	int		m_nFastCopies;
+	int		m_nFastChecks;
+	int		m_nFullChecks;
+
+private:
+	CUtlMap< PredCopyPlanKey_t, CPredictionCopyPlan * >	m_Plans;
+};
+
+static CPredictionCopyPlanCache g_PredictionCopyPlans;
+
+const CPredictionCopyPlan *CPredictionCopyPlanCache::FindOrCompile( datamap_t *dmap, int type, int destOffsetIndex, int srcOffsetIndex )
+{
+	PredCopyPlanKey_t key;
+	key.m_pMap = dmap;
+	key.m_nType = type;
+	key.m_nDestOffsetIndex = destOffsetIndex;
+	key.m_nSrcOffsetIndex = srcOffsetIndex;
+
+	unsigned short i = m_Plans.Find( key );
+	if ( i != m_Plans.InvalidIndex() )
+		return m_Plans[ i ];
+
+	// Packed offsets aren't valid until the prediction system lays the map out
+	if ( ( destOffsetIndex == TD_OFFSET_PACKED || srcOffsetIndex == TD_OFFSET_PACKED ) && 
+		!dmap->packed_offsets_computed )
+		return NULL;
+
+	CPredictionCopyPlan *pPlan = new CPredictionCopyPlan( type, destOffsetIndex, srcOffsetIndex );
+	if ( !pPlan->Compile( dmap ) )
+	{
+		delete pPlan;
+		pPlan = NULL;
+	}
+
+	m_Plans.Insert( key, pPlan );
+	return pPlan;
+}
+
+void CPredictionCopyPlanCache::PrintStats()
+{
+	Msg( "%d prediction copy plans\n", m_Plans.Count() );
+
+	FOR_EACH_MAP( m_Plans, i )
+	{
+		const PredCopyPlanKey_t &key = m_Plans.Key( i );
+		if ( m_Plans[ i ] )
+		{
+			m_Plans[ i ]->PrintStats( key.m_pMap->dataClassName );
+		}
+		else
+		{
+			Msg( "  %-32s uses the field walk\n", key.m_pMap->dataClassName );
+		}
+	}
+
+	Msg( "%d planned copies, %d planned error checks, %d full error checks\n", m_nFastCopies, m_nFastChecks, m_nFullChecks );
+}
+
+#if defined( CLIENT_DLL )
+CON_COMMAND( cl_pred_copy_plan_stats, "Print the compiled prediction copy plans and how often they were used." )
+{
+	g_PredictionCopyPlans.PrintStats();
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs the transfer through a compiled plan when nothing needs
+//  per-field reporting
+// Output : Returns true if the transfer was handled
+//-----------------------------------------------------------------------------
+bool CPredictionCopy::TransferDataCompiled( datamap_t *dmap )
+{
+	if ( !pred_copy_plans.GetBool() || m_pWatchField )
+		return false;
+
+	// Error checks that copy as well copy toleranced fields, and ones that
+	// describe fields need to see every field, leave both to the field walk
+	if ( m_bErrorCheck && ( m_bPerformCopy || m_FieldCompareFunc ) )
+		return false;
+
+	const CPredictionCopyPlan *pPlan = g_PredictionCopyPlans.FindOrCompile( dmap, m_nType, m_nDestOffsetIndex, m_nSrcOffsetIndex );
+	if ( !pPlan )
+		return false;
+
+	if ( !m_bErrorCheck )
+	{
+		if ( m_bPerformCopy )
+		{
+			pPlan->Copy( m_pDest, m_pSrc );
+			++g_PredictionCopyPlans.m_nFastCopies;
+		}
+		return true;
+	}
+
+	// Nothing differs, so the field walk would report no errors. Otherwise
+	// let it count and report them.
+	if ( pPlan->Differs( m_pDest, m_pSrc ) )
+	{
+		++g_PredictionCopyPlans.m_nFullChecks;
+		return false;
+	}
+
+	++g_PredictionCopyPlans.m_nFastChecks;
+	return true;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : *operation - 
@@ -1391,6 +1879,9 @@ int CPredictionCopy::TransferData( const char *operation, int entindex, datamap_
 	
 	DetermineWatchField( operation, entindex, dmap );
 
+	if ( TransferDataCompiled( dmap ) )
+		return m_nErrorCount;
+
 	TransferData_R( g_nChainCount, dmap );
 
 	return m_nErrorCount;
@@ -25,176 +25,188 @@ extern CNetMsgScriptHelper *g_ScriptNetMsg;
 #endif
 
 //-----------------------------------------------------------------------------
-// Purpose: Write a delta compressed user command.
-// Input  : *buf - 
-//			*to - 
-//			*from - 
-// Output : static
+// Purpose: Writes the fixed usercmd fields. These go through a bit accumulator
+//			since a usercmd is dozens of small fields.
 //-----------------------------------------------------------------------------
-void WriteUsercmd( bf_write *buf, const CUserCmd *to, const CUserCmd *from )
+static void WriteUsercmdFields( CBitWriteAccumulator &buf, const CUserCmd *to, const CUserCmd *from )
 {
 	if ( to->command_number != ( from->command_number + 1 ) )
 	{
-		buf->WriteOneBit( 1 );
-		buf->WriteUBitLong( to->command_number, 32 );
+		buf.WriteOneBit( 1 );
+		buf.WriteUBitLong( to->command_number, 32 );
 	}
 	else
 	{
-		buf->WriteOneBit( 0 );
+		buf.WriteOneBit( 0 );
 	}
 
 	if ( to->tick_count != ( from->tick_count + 1 ) )
 	{
-		buf->WriteOneBit( 1 );
-		buf->WriteUBitLong( to->tick_count, 32 );
+		buf.WriteOneBit( 1 );
+		buf.WriteUBitLong( to->tick_count, 32 );
 	}
 	else
 	{
-		buf->WriteOneBit( 0 );
+		buf.WriteOneBit( 0 );
 	}
 
 
 	if ( to->viewangles[ 0 ] != from->viewangles[ 0 ] )
 	{
-		buf->WriteOneBit( 1 );
-		buf->WriteFloat( to->viewangles[ 0 ] );
+		buf.WriteOneBit( 1 );
+		buf.WriteFloat( to->viewangles[ 0 ] );
 	}
 	else
 	{
-		buf->WriteOneBit( 0 );
+		buf.WriteOneBit( 0 );
 	}
 
 	if ( to->viewangles[ 1 ] != from->viewangles[ 1 ] )
 	{
-		buf->WriteOneBit( 1 );
-		buf->WriteFloat( to->viewangles[ 1 ] );
+		buf.WriteOneBit( 1 );
+		buf.WriteFloat( to->viewangles[ 1 ] );
 	}
 	else
 	{
-		buf->WriteOneBit( 0 );
+		buf.WriteOneBit( 0 );
 	}
 
 	if ( to->viewangles[ 2 ] != from->viewangles[ 2 ] )
 	{
-		buf->WriteOneBit( 1 );
-		buf->WriteFloat( to->viewangles[ 2 ] );
+		buf.WriteOneBit( 1 );
+		buf.WriteFloat( to->viewangles[ 2 ] );
 	}
 	else
 	{
-		buf->WriteOneBit( 0 );
+		buf.WriteOneBit( 0 );
 	}
 
 	if ( to->forwardmove != from->forwardmove )
 	{
-		buf->WriteOneBit( 1 );
-		buf->WriteFloat( to->forwardmove );
+		buf.WriteOneBit( 1 );
+		buf.WriteFloat( to->forwardmove );
 	}
 	else
 	{
-		buf->WriteOneBit( 0 );
+		buf.WriteOneBit( 0 );
 	}
 
 	if ( to->sidemove != from->sidemove )
 	{
-		buf->WriteOneBit( 1 );
-		buf->WriteFloat( to->sidemove );
+		buf.WriteOneBit( 1 );
+		buf.WriteFloat( to->sidemove );
 	}
 	else
 	{
-		buf->WriteOneBit( 0 );
+		buf.WriteOneBit( 0 );
 	}
 
 	if ( to->upmove != from->upmove )
 	{
-		buf->WriteOneBit( 1 );
-		buf->WriteFloat( to->upmove );
+		buf.WriteOneBit( 1 );
+		buf.WriteFloat( to->upmove );
 	}
 	else
 	{
-		buf->WriteOneBit( 0 );
+		buf.WriteOneBit( 0 );
 	}
 
 	if ( to->buttons != from->buttons )
 	{
-		buf->WriteOneBit( 1 );
-	  	buf->WriteUBitLong( to->buttons, 32 );
+		buf.WriteOneBit( 1 );
+	  	buf.WriteUBitLong( to->buttons, 32 );
  	}
 	else
 	{
-		buf->WriteOneBit( 0 );
+		buf.WriteOneBit( 0 );
 	}
 
 	if ( to->impulse != from->impulse )
 	{
-		buf->WriteOneBit( 1 );
-	    buf->WriteUBitLong( to->impulse, 8 );
+		buf.WriteOneBit( 1 );
+	    buf.WriteUBitLong( to->impulse, 8 );
 	}
 	else
 	{
-		buf->WriteOneBit( 0 );
+		buf.WriteOneBit( 0 );
 	}
 
 
 	if ( to->weaponselect != from->weaponselect )
 	{
-		buf->WriteOneBit( 1 );
-		buf->WriteUBitLong( to->weaponselect, MAX_EDICT_BITS );
+		buf.WriteOneBit( 1 );
+		buf.WriteUBitLong( to->weaponselect, MAX_EDICT_BITS );
 
 		if ( to->weaponsubtype != from->weaponsubtype )
 		{
-			buf->WriteOneBit( 1 );
-			buf->WriteUBitLong( to->weaponsubtype, WEAPON_SUBTYPE_BITS );
+			buf.WriteOneBit( 1 );
+			buf.WriteUBitLong( to->weaponsubtype, WEAPON_SUBTYPE_BITS );
 		}
 		else
 		{
-			buf->WriteOneBit( 0 );
+			buf.WriteOneBit( 0 );
 		}
 	}
 	else
 	{
-		buf->WriteOneBit( 0 );
+		buf.WriteOneBit( 0 );
 	}
 
 
 	// TODO: Can probably get away with fewer bits.
 	if ( to->mousedx != from->mousedx )
 	{
-		buf->WriteOneBit( 1 );
-		buf->WriteShort( to->mousedx );
+		buf.WriteOneBit( 1 );
+		buf.WriteShort( to->mousedx );
 	}
 	else
 	{
-		buf->WriteOneBit( 0 );
+		buf.WriteOneBit( 0 );
 	}
 
 	if ( to->mousedy != from->mousedy )
 	{
-		buf->WriteOneBit( 1 );
-		buf->WriteShort( to->mousedy );
+		buf.WriteOneBit( 1 );
+		buf.WriteShort( to->mousedy );
 	}
 	else
 	{
-		buf->WriteOneBit( 0 );
+		buf.WriteOneBit( 0 );
 	}
 
 #if defined( HL2_CLIENT_DLL )
 	if ( to->entitygroundcontact.Count() != 0 )
 	{
-		buf->WriteOneBit( 1 );
-		buf->WriteShort( to->entitygroundcontact.Count() );
+		buf.WriteOneBit( 1 );
+		buf.WriteShort( to->entitygroundcontact.Count() );
 		int i;
 		for (i = 0; i < to->entitygroundcontact.Count(); i++)
 		{
-			buf->WriteUBitLong( to->entitygroundcontact[i].entindex, MAX_EDICT_BITS );
-			buf->WriteBitCoord( to->entitygroundcontact[i].minheight );
-			buf->WriteBitCoord( to->entitygroundcontact[i].maxheight );
+			buf.WriteUBitLong( to->entitygroundcontact[i].entindex, MAX_EDICT_BITS );
+			buf.WriteBitCoord( to->entitygroundcontact[i].minheight );
+			buf.WriteBitCoord( to->entitygroundcontact[i].maxheight );
 		}
 	}
 	else
 	{
-		buf->WriteOneBit( 0 );
+		buf.WriteOneBit( 0 );
 	}
 #endif
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Write a delta compressed user command.
+// Input  : *buf - 
+//			*to - 
+//			*from - 
+// Output : static
+//-----------------------------------------------------------------------------
+void WriteUsercmd( bf_write *buf, const CUserCmd *to, const CUserCmd *from )
+{
+	{
+		CBitWriteAccumulator acc( *buf );
+		WriteUsercmdFields( acc, to, from );
+	}
 
 #if defined( MAPBASE_VSCRIPT ) && defined( CLIENT_DLL )
 	Assert( g_ScriptNetMsg );
@@ -214,24 +226,13 @@ void WriteUsercmd( bf_write *buf, const CUserCmd *to, const CUserCmd *from )
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: Read in a delta compressed usercommand.
-// Input  : *buf - 
-//			*move - 
-//			*from - 
-// Output : static void ReadUsercmd
+// Purpose: Reads the fields written by WriteUsercmdFields
 //-----------------------------------------------------------------------------
-#if defined( MAPBASE_VSCRIPT ) && defined( GAME_DLL )
-void ReadUsercmd( bf_read *buf, CUserCmd *move, CUserCmd *from, CBaseEntity *pPlayer )
-#else
-void ReadUsercmd( bf_read *buf, CUserCmd *move, CUserCmd *from )
-#endif
+static void ReadUsercmdFields( CBitReadAccumulator &buf, CUserCmd *move, CUserCmd *from )
 {
-	// Assume no change
-	*move = *from;
-
-	if ( buf->ReadOneBit() )
+	if ( buf.ReadOneBit() )
 	{
-		move->command_number = buf->ReadUBitLong( 32 );
+		move->command_number = buf.ReadUBitLong( 32 );
 	}
 	else
 	{
@@ -239,9 +240,9 @@ void ReadUsercmd( bf_read *buf, CUserCmd *move, CUserCmd *from )
 		move->command_number = from->command_number + 1;
 	}
 
-	if ( buf->ReadOneBit() )
+	if ( buf.ReadOneBit() )
 	{
-		move->tick_count = buf->ReadUBitLong( 32 );
+		move->tick_count = buf.ReadUBitLong( 32 );
 	}
 	else
 	{
@@ -250,87 +251,109 @@ void ReadUsercmd( bf_read *buf, CUserCmd *move, CUserCmd *from )
 	}
 
 	// Read direction
-	if ( buf->ReadOneBit() )
+	if ( buf.ReadOneBit() )
 	{
-		move->viewangles[0] = buf->ReadFloat();
+		move->viewangles[0] = buf.ReadFloat();
 	}
 
-	if ( buf->ReadOneBit() )
+	if ( buf.ReadOneBit() )
 	{
-		move->viewangles[1] = buf->ReadFloat();
+		move->viewangles[1] = buf.ReadFloat();
 	}
 
-	if ( buf->ReadOneBit() )
+	if ( buf.ReadOneBit() )
 	{
-		move->viewangles[2] = buf->ReadFloat();
+		move->viewangles[2] = buf.ReadFloat();
 	}
 
 	// Moved value validation and clamping to CBasePlayer::ProcessUsercmds()
 
 	// Read movement
-	if ( buf->ReadOneBit() )
+	if ( buf.ReadOneBit() )
 	{
-		move->forwardmove = buf->ReadFloat();
+		move->forwardmove = buf.ReadFloat();
 	}
 
-	if ( buf->ReadOneBit() )
+	if ( buf.ReadOneBit() )
 	{
-		move->sidemove = buf->ReadFloat();
+		move->sidemove = buf.ReadFloat();
 	}
 
-	if ( buf->ReadOneBit() )
+	if ( buf.ReadOneBit() )
 	{
-		move->upmove = buf->ReadFloat();
+		move->upmove = buf.ReadFloat();
 	}
 
 	// read buttons
-	if ( buf->ReadOneBit() )
+	if ( buf.ReadOneBit() )
 	{
-		move->buttons = buf->ReadUBitLong( 32 );
+		move->buttons = buf.ReadUBitLong( 32 );
 	}
 
-	if ( buf->ReadOneBit() )
+	if ( buf.ReadOneBit() )
 	{
-		move->impulse = buf->ReadUBitLong( 8 );
+		move->impulse = buf.ReadUBitLong( 8 );
 	}
 
 
-	if ( buf->ReadOneBit() )
+	if ( buf.ReadOneBit() )
 	{
-		move->weaponselect = buf->ReadUBitLong( MAX_EDICT_BITS );
-		if ( buf->ReadOneBit() )
+		move->weaponselect = buf.ReadUBitLong( MAX_EDICT_BITS );
+		if ( buf.ReadOneBit() )
 		{
-			move->weaponsubtype = buf->ReadUBitLong( WEAPON_SUBTYPE_BITS );
+			move->weaponsubtype = buf.ReadUBitLong( WEAPON_SUBTYPE_BITS );
 		}
 	}
 
 
 	move->random_seed = MD5_PseudoRandom( move->command_number ) & 0x7fffffff;
 
-	if ( buf->ReadOneBit() )
+	if ( buf.ReadOneBit() )
 	{
-		move->mousedx = buf->ReadShort();
+		move->mousedx = buf.ReadShort();
 	}
 
-	if ( buf->ReadOneBit() )
+	if ( buf.ReadOneBit() )
 	{
-		move->mousedy = buf->ReadShort();
+		move->mousedy = buf.ReadShort();
 	}
 
 #if defined( HL2_DLL )
-	if ( buf->ReadOneBit() )
+	if ( buf.ReadOneBit() )
 	{
-		move->entitygroundcontact.SetCount( buf->ReadShort() );
+		move->entitygroundcontact.SetCount( buf.ReadShort() );
 
 		int i;
 		for (i = 0; i < move->entitygroundcontact.Count(); i++)
 		{
-			move->entitygroundcontact[i].entindex = buf->ReadUBitLong( MAX_EDICT_BITS );
-			move->entitygroundcontact[i].minheight = buf->ReadBitCoord( );
-			move->entitygroundcontact[i].maxheight = buf->ReadBitCoord( );
+			move->entitygroundcontact[i].entindex = buf.ReadUBitLong( MAX_EDICT_BITS );
+			move->entitygroundcontact[i].minheight = buf.ReadBitCoord( );
+			move->entitygroundcontact[i].maxheight = buf.ReadBitCoord( );
 		}
 	}
 #endif
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Read in a delta compressed usercommand.
+// Input  : *buf - 
+//			*move - 
+//			*from - 
+// Output : static void ReadUsercmd
+//-----------------------------------------------------------------------------
+#if defined( MAPBASE_VSCRIPT ) && defined( GAME_DLL )
+void ReadUsercmd( bf_read *buf, CUserCmd *move, CUserCmd *from, CBaseEntity *pPlayer )
+#else
+void ReadUsercmd( bf_read *buf, CUserCmd *move, CUserCmd *from )
+#endif
+{
+	// Assume no change
+	*move = *from;
+
+	{
+		CBitReadAccumulator acc( *buf );
+		ReadUsercmdFields( acc, move, from );
+	}
 
 #if defined( MAPBASE_VSCRIPT ) && defined( GAME_DLL )
 	if ( buf->ReadOneBit() )
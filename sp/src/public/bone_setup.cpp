@@ -23,6 +23,8 @@
 #include "vphysics_interface.h"
 #ifdef CLIENT_DLL
 	#include "posedebugger.h"
+	#include "devtest.h"
+	#include "tier1/fmtstr.h"
 #endif
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -212,30 +214,31 @@ short *CBoneCache::CachedToStudio()
 	return (short *)( (char *)(this+1) + m_cachedToStudioOffset );
 }
 
-// Construct a singleton
-static CDataManager<CBoneCache, bonecacheparams_t, CBoneCache *, CThreadFastMutex> g_StudioBoneCache( 128 * 1024L );
+// Construct a singleton. Sharded since bone setup looks caches up from several
+// threads at once; a handle's shard mutex stands in for the old global one.
+static CShardedDataManager<CBoneCache, bonecacheparams_t, CBoneCache *, CThreadFastMutex> g_StudioBoneCache( 128 * 1024L );
 
 CBoneCache *Studio_GetBoneCache( memhandle_t cacheHandle )
 {
-	AUTO_LOCK( g_StudioBoneCache.AccessMutex() );
+	AUTO_LOCK( g_StudioBoneCache.AccessMutex( cacheHandle ) );
 	return g_StudioBoneCache.GetResource_NoLock( cacheHandle );
 }
 
 memhandle_t Studio_CreateBoneCache( bonecacheparams_t &params )
 {
-	AUTO_LOCK( g_StudioBoneCache.AccessMutex() );
+	// Locks the shard it picks
 	return g_StudioBoneCache.CreateResource( params );
 }
 
 void Studio_DestroyBoneCache( memhandle_t cacheHandle )
 {
-	AUTO_LOCK( g_StudioBoneCache.AccessMutex() );
+	AUTO_LOCK( g_StudioBoneCache.AccessMutex( cacheHandle ) );
 	g_StudioBoneCache.DestroyResource( cacheHandle );
 }
 
 void Studio_InvalidateBoneCache( memhandle_t cacheHandle )
 {
-	AUTO_LOCK( g_StudioBoneCache.AccessMutex() );
+	AUTO_LOCK( g_StudioBoneCache.AccessMutex( cacheHandle ) );
 	CBoneCache *pCache = g_StudioBoneCache.GetResource_NoLock( cacheHandle );
 	if ( pCache )
 	{
@@ -368,13 +371,570 @@ void ExtractAnimValue( int frame, mstudioanimvalue_t *panimvalue, float scale, f
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Four-wide bone kernels
+//
+// These hold four bones' quaternions with each component in its own fltx4, so
+// the math runs once for all four. Alignment, blending, normalization and the
+// matrix conversion do the same float operations as the scalar code; slerp
+// and the euler conversion use polynomial sin/cos/acos that are good to a few
+// ulp. The client's studio_simd_bones_test checks them against the scalar
+// path.
+//-----------------------------------------------------------------------------
+static ConVar anim_simd( "anim_simd", "1", FCVAR_REPLICATED, "Use the four-wide SIMD kernels for animation decompression, blending and bone matrices." );
+
+// Every caller of the kernels checks this. The 360 keeps its own VMX paths.
+static FORCEINLINE bool UseAnimSIMD()
+{
+	return IsPC() && anim_simd.GetBool();
+}
+
+struct FourQuaternions_t
+{
+	fltx4 x, y, z, w;
+};
+
+static FORCEINLINE void LoadFourQuaternions( FourQuaternions_t &out, const Quaternion *const pIn[4] )
+{
+	out.x = LoadUnalignedSIMD( pIn[0]->Base() );
+	out.y = LoadUnalignedSIMD( pIn[1]->Base() );
+	out.z = LoadUnalignedSIMD( pIn[2]->Base() );
+	out.w = LoadUnalignedSIMD( pIn[3]->Base() );
+	TransposeSIMD( out.x, out.y, out.z, out.w );
+}
+
+static FORCEINLINE void StoreFourQuaternions( const FourQuaternions_t &in, Quaternion *const pOut[4], int nCount = 4 )
+{
+	fltx4 q[4] = { in.x, in.y, in.z, in.w };
+	TransposeSIMD( q[0], q[1], q[2], q[3] );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		StoreUnalignedSIMD( pOut[i]->Base(), q[i] );
+	}
+}
+
+static FORCEINLINE fltx4 AbsSIMD4( const fltx4 &x )
+{
+	return MaxSIMD( x, NegSIMD( x ) );
+}
+
+//-----------------------------------------------------------------------------
+// sin and cos, as in Cephes: reduce to [-pi/4, pi/4] around a multiple of
+// pi/4, evaluate both polynomials, then swap and negate by octant
+//-----------------------------------------------------------------------------
+static FORCEINLINE void SinCosSIMD4( const fltx4 &x, fltx4 &sine, fltx4 &cosine )
+{
+	fltx4 ax = AbsSIMD4( x );
+
+	// Even octant nearest to |x|
+	fltx4 j = FloorSIMD( MulSIMD( ax, ReplicateX4( 1.27323954473516f ) ) );
+	j = AddSIMD( j, SubSIMD( j, MulSIMD( Four_Twos, FloorSIMD( MulSIMD( j, Four_PointFives ) ) ) ) );
+
+	// Extended precision |x| - j * pi/4
+	fltx4 r = SubSIMD( ax, MulSIMD( j, ReplicateX4( 0.78515625f ) ) );
+	r = SubSIMD( r, MulSIMD( j, ReplicateX4( 2.4187564849853515625e-4f ) ) );
+	r = SubSIMD( r, MulSIMD( j, ReplicateX4( 3.77489497744594108e-8f ) ) );
+
+	fltx4 z = MulSIMD( r, r );
+	fltx4 polyCos = MaddSIMD( ReplicateX4( 2.443315711809948e-5f ), z, ReplicateX4( -1.388731625493765e-3f ) );
+	polyCos = MaddSIMD( polyCos, z, ReplicateX4( 4.166664568298827e-2f ) );
+	polyCos = MulSIMD( MulSIMD( polyCos, z ), z );
+	polyCos = AddSIMD( SubSIMD( polyCos, MulSIMD( Four_PointFives, z ) ), Four_Ones );
+
+	fltx4 polySin = MaddSIMD( ReplicateX4( -1.9515295891e-4f ), z, ReplicateX4( 8.3321608736e-3f ) );
+	polySin = MaddSIMD( polySin, z, ReplicateX4( -1.6666654611e-1f ) );
+	polySin = MaddSIMD( MulSIMD( polySin, z ), r, r );
+
+	// Octant 0: (s, c), 2: (c, -s), 4: (-s, -c), 6: (-c, s)
+	fltx4 octant = SubSIMD( j, MulSIMD( ReplicateX4( 8.0f ), FloorSIMD( MulSIMD( j, ReplicateX4( 0.125f ) ) ) ) );
+	fltx4 bSwap = OrSIMD( CmpEqSIMD( octant, Four_Twos ), CmpEqSIMD( octant, ReplicateX4( 6.0f ) ) );
+	fltx4 bNegSin = XorSIMD( CmpGeSIMD( octant, ReplicateX4( 4.0f ) ), CmpLtSIMD( x, Four_Zeros ) );
+	fltx4 bNegCos = AndSIMD( CmpGtSIMD( octant, Four_Ones ), CmpLtSIMD( octant, ReplicateX4( 5.0f ) ) );
+
+	fltx4 s = MaskedAssign( bSwap, polyCos, polySin );
+	fltx4 c = MaskedAssign( bSwap, polySin, polyCos );
+	sine = MaskedAssign( bNegSin, NegSIMD( s ), s );
+	cosine = MaskedAssign( bNegCos, NegSIMD( c ), c );
+}
+
+static FORCEINLINE fltx4 SinSIMD4( const fltx4 &x )
+{
+	fltx4 sine, cosine;
+	SinCosSIMD4( x, sine, cosine );
+	return sine;
+}
+
+//-----------------------------------------------------------------------------
+// acos, Abramowitz & Stegun 4.4.46 (error < 2e-8 on [0, 1]), mirrored for
+// negative input
+//-----------------------------------------------------------------------------
+static FORCEINLINE fltx4 ArcCosSIMD4( const fltx4 &x )
+{
+	fltx4 ax = AbsSIMD4( x );
+	fltx4 p = MaddSIMD( ReplicateX4( -0.0012624911f ), ax, ReplicateX4( 0.0066700901f ) );
+	p = MaddSIMD( p, ax, ReplicateX4( -0.0170881256f ) );
+	p = MaddSIMD( p, ax, ReplicateX4( 0.0308918810f ) );
+	p = MaddSIMD( p, ax, ReplicateX4( -0.0501743046f ) );
+	p = MaddSIMD( p, ax, ReplicateX4( 0.0889789874f ) );
+	p = MaddSIMD( p, ax, ReplicateX4( -0.2145988016f ) );
+	p = MaddSIMD( p, ax, ReplicateX4( 1.5707963050f ) );
+	fltx4 r = MulSIMD( p, SqrtSIMD( SubSIMD( Four_Ones, ax ) ) );
+	return MaskedAssign( CmpLtSIMD( x, Four_Zeros ), SubSIMD( ReplicateX4( M_PI_F ), r ), r );
+}
+
+static FORCEINLINE fltx4 QuaternionDotSIMD4( const FourQuaternions_t &p, const FourQuaternions_t &q )
+{
+	return AddSIMD( AddSIMD( AddSIMD( MulSIMD( p.x, q.x ), MulSIMD( p.y, q.y ) ), MulSIMD( p.z, q.z ) ), MulSIMD( p.w, q.w ) );
+}
+
+//-----------------------------------------------------------------------------
+// QuaternionAlign( p, q, q ) in the lanes set in fl4Allow
+//-----------------------------------------------------------------------------
+static FORCEINLINE void QuaternionAlignSIMD4( const FourQuaternions_t &p, FourQuaternions_t &q, const fltx4 &fl4Allow )
+{
+	// Same comparison as the scalar code, so near-orthogonal pairs agree
+	fltx4 dx = SubSIMD( p.x, q.x ), dy = SubSIMD( p.y, q.y ), dz = SubSIMD( p.z, q.z ), dw = SubSIMD( p.w, q.w );
+	fltx4 sx = AddSIMD( p.x, q.x ), sy = AddSIMD( p.y, q.y ), sz = AddSIMD( p.z, q.z ), sw = AddSIMD( p.w, q.w );
+	fltx4 a = AddSIMD( AddSIMD( AddSIMD( MulSIMD( dx, dx ), MulSIMD( dy, dy ) ), MulSIMD( dz, dz ) ), MulSIMD( dw, dw ) );
+	fltx4 b = AddSIMD( AddSIMD( AddSIMD( MulSIMD( sx, sx ), MulSIMD( sy, sy ) ), MulSIMD( sz, sz ) ), MulSIMD( sw, sw ) );
+
+	fltx4 bFlip = AndSIMD( CmpGtSIMD( a, b ), fl4Allow );
+	q.x = MaskedAssign( bFlip, NegSIMD( q.x ), q.x );
+	q.y = MaskedAssign( bFlip, NegSIMD( q.y ), q.y );
+	q.z = MaskedAssign( bFlip, NegSIMD( q.z ), q.z );
+	q.w = MaskedAssign( bFlip, NegSIMD( q.w ), q.w );
+}
+
+static FORCEINLINE void QuaternionNormalizeSIMD4( FourQuaternions_t &q )
+{
+	fltx4 radius = QuaternionDotSIMD4( q, q );
+	fltx4 iradius = DivSIMD( Four_Ones, SqrtSIMD( radius ) );
+	iradius = MaskedAssign( CmpEqSIMD( radius, Four_Zeros ), Four_Ones, iradius );
+	q.x = MulSIMD( q.x, iradius );
+	q.y = MulSIMD( q.y, iradius );
+	q.z = MulSIMD( q.z, iradius );
+	q.w = MulSIMD( q.w, iradius );
+}
+
+//-----------------------------------------------------------------------------
+// QuaternionBlendNoAlign per lane
+//-----------------------------------------------------------------------------
+static FORCEINLINE void QuaternionBlendNoAlignSIMD4( const FourQuaternions_t &p, const FourQuaternions_t &q, const fltx4 &t, FourQuaternions_t &qt )
+{
+	fltx4 sclp = SubSIMD( Four_Ones, t );
+	qt.x = AddSIMD( MulSIMD( sclp, p.x ), MulSIMD( t, q.x ) );
+	qt.y = AddSIMD( MulSIMD( sclp, p.y ), MulSIMD( t, q.y ) );
+	qt.z = AddSIMD( MulSIMD( sclp, p.z ), MulSIMD( t, q.z ) );
+	qt.w = AddSIMD( MulSIMD( sclp, p.w ), MulSIMD( t, q.w ) );
+	QuaternionNormalizeSIMD4( qt );
+}
+
+//-----------------------------------------------------------------------------
+// QuaternionSlerpNoAlign per lane. Returns false, leaving qt unset, if any
+// lane has p and q opposite; the scalar code special cases that.
+//-----------------------------------------------------------------------------
+static FORCEINLINE bool QuaternionSlerpNoAlignSIMD4( const FourQuaternions_t &p, const FourQuaternions_t &q, const fltx4 &t, FourQuaternions_t &qt )
+{
+	fltx4 cosom = QuaternionDotSIMD4( p, q );
+	fltx4 fl4Epsilon = ReplicateX4( 0.000001f );
+	if ( TestSignSIMD( CmpGtSIMD( AddSIMD( Four_Ones, cosom ), fl4Epsilon ) ) != 0xF )
+		return false;
+
+	// Nearly equal rotations lerp
+	fltx4 sclp = SubSIMD( Four_Ones, t );
+	fltx4 sclq = t;
+	fltx4 bSlerp = CmpGtSIMD( SubSIMD( Four_Ones, cosom ), fl4Epsilon );
+	if ( TestSignSIMD( bSlerp ) )
+	{
+		fltx4 omega = ArcCosSIMD4( MinSIMD( cosom, Four_Ones ) );
+		fltx4 sinom = MaskedAssign( bSlerp, SinSIMD4( omega ), Four_Ones );
+		sclp = MaskedAssign( bSlerp, DivSIMD( SinSIMD4( MulSIMD( sclp, omega ) ), sinom ), sclp );
+		sclq = MaskedAssign( bSlerp, DivSIMD( SinSIMD4( MulSIMD( sclq, omega ) ), sinom ), sclq );
+	}
+
+	qt.x = AddSIMD( MulSIMD( sclp, p.x ), MulSIMD( sclq, q.x ) );
+	qt.y = AddSIMD( MulSIMD( sclp, p.y ), MulSIMD( sclq, q.y ) );
+	qt.z = AddSIMD( MulSIMD( sclp, p.z ), MulSIMD( sclq, q.z ) );
+	qt.w = AddSIMD( MulSIMD( sclp, p.w ), MulSIMD( sclq, q.w ) );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// AngleQuaternion( RadianEuler ) per lane
+//-----------------------------------------------------------------------------
+static FORCEINLINE void AngleQuaternionSIMD4( const fltx4 &x, const fltx4 &y, const fltx4 &z, FourQuaternions_t &q )
+{
+	fltx4 sr, sp, sy, cr, cp, cy;
+	SinCosSIMD4( MulSIMD( z, Four_PointFives ), sy, cy );
+	SinCosSIMD4( MulSIMD( y, Four_PointFives ), sp, cp );
+	SinCosSIMD4( MulSIMD( x, Four_PointFives ), sr, cr );
+
+	fltx4 srXcp = MulSIMD( sr, cp ), crXsp = MulSIMD( cr, sp );
+	q.x = SubSIMD( MulSIMD( srXcp, cy ), MulSIMD( crXsp, sy ) );
+	q.y = AddSIMD( MulSIMD( crXsp, cy ), MulSIMD( srXcp, sy ) );
+
+	fltx4 crXcp = MulSIMD( cr, cp ), srXsp = MulSIMD( sr, sp );
+	q.z = SubSIMD( MulSIMD( crXcp, sy ), MulSIMD( srXsp, cy ) );
+	q.w = AddSIMD( MulSIMD( crXcp, cy ), MulSIMD( srXsp, sy ) );
+}
+
+//-----------------------------------------------------------------------------
+// QuaternionMatrix( q, pos ) per lane. Transposing each row's four columns
+// across the lanes gives that row of all four matrices.
+//-----------------------------------------------------------------------------
+static FORCEINLINE void QuaternionMatrixSIMD4( const FourQuaternions_t &q, const Vector *const pPos[4], matrix3x4_t *const pOut[4], int nCount = 4 )
+{
+	fltx4 x2 = AddSIMD( q.x, q.x ), y2 = AddSIMD( q.y, q.y ), z2 = AddSIMD( q.z, q.z );
+	fltx4 xx = MulSIMD( q.x, x2 ), xy = MulSIMD( q.x, y2 ), xz = MulSIMD( q.x, z2 );
+	fltx4 yy = MulSIMD( q.y, y2 ), yz = MulSIMD( q.y, z2 ), zz = MulSIMD( q.z, z2 );
+	fltx4 wx = MulSIMD( q.w, x2 ), wy = MulSIMD( q.w, y2 ), wz = MulSIMD( q.w, z2 );
+
+	fltx4 rows[3][4] =
+	{
+		{ SubSIMD( SubSIMD( Four_Ones, yy ), zz ), SubSIMD( xy, wz ), AddSIMD( xz, wy ), Four_Zeros },
+		{ AddSIMD( xy, wz ), SubSIMD( SubSIMD( Four_Ones, xx ), zz ), SubSIMD( yz, wx ), Four_Zeros },
+		{ SubSIMD( xz, wy ), AddSIMD( yz, wx ), SubSIMD( SubSIMD( Four_Ones, xx ), yy ), Four_Zeros },
+	};
+
+	for ( int r = 0; r < 3; r++ )
+	{
+		TransposeSIMD( rows[r][0], rows[r][1], rows[r][2], rows[r][3] );
+		for ( int i = 0; i < nCount; i++ )
+		{
+			StoreUnalignedSIMD( pOut[i]->m_flMatVal[r], rows[r][i] );
+		}
+	}
+
+	for ( int i = 0; i < nCount; i++ )
+	{
+		( *pOut[i] )[0][3] = pPos[i]->x;
+		( *pOut[i] )[1][3] = pPos[i]->y;
+		( *pOut[i] )[2][3] = pPos[i]->z;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Queues animated bone rotations so the animation decoders can convert and
+// blend them four at a time. Results land when a group fills and on Flush(),
+// so nothing may read the outputs before then.
+//-----------------------------------------------------------------------------
+class CBoneRotationBatch
+{
+public:
+	CBoneRotationBatch() : m_nCount( 0 ) {}
+	~CBoneRotationBatch() { Assert( m_nCount == 0 ); }
+
+	// pOut = blend( angle1, angle2, s ) if bBlend, else angle1, then aligned
+	// to pAlignment if there is one; as CalcBoneQuaternion
+	void Add( const RadianEuler &angle1, const RadianEuler &angle2, float s, bool bBlend, const Quaternion *pAlignment, Quaternion *pOut );
+	void Flush();
+
+private:
+	float m_flAngle1[3][4];
+	float m_flAngle2[3][4];
+	float m_flS[4];
+	float m_flBlend[4];
+	float m_flAlign[4];
+	const Quaternion *m_pAlignment[4];
+	Quaternion *m_pOut[4];
+	int m_nCount;
+};
+
+void CBoneRotationBatch::Add( const RadianEuler &angle1, const RadianEuler &angle2, float s, bool bBlend, const Quaternion *pAlignment, Quaternion *pOut )
+{
+	int i = m_nCount++;
+	for ( int j = 0; j < 3; j++ )
+	{
+		m_flAngle1[j][i] = angle1[j];
+		m_flAngle2[j][i] = angle2[j];
+	}
+	m_flS[i] = s;
+	m_flBlend[i] = bBlend ? 1.0f : 0.0f;
+	m_flAlign[i] = pAlignment ? 1.0f : 0.0f;
+	m_pAlignment[i] = pAlignment ? pAlignment : pOut;
+	m_pOut[i] = pOut;
+
+	if ( m_nCount == 4 )
+	{
+		Flush();
+	}
+}
+
+void CBoneRotationBatch::Flush()
+{
+	if ( m_nCount == 0 )
+		return;
+
+	// Pad the group with lanes that are thrown away
+	for ( int i = m_nCount; i < 4; i++ )
+	{
+		for ( int j = 0; j < 3; j++ )
+		{
+			m_flAngle1[j][i] = m_flAngle2[j][i] = 0.0f;
+		}
+		m_flS[i] = m_flBlend[i] = m_flAlign[i] = 0.0f;
+		m_pAlignment[i] = m_pAlignment[0];
+	}
+
+	FourQuaternions_t q;
+	AngleQuaternionSIMD4( LoadUnalignedSIMD( m_flAngle1[0] ), LoadUnalignedSIMD( m_flAngle1[1] ), LoadUnalignedSIMD( m_flAngle1[2] ), q );
+
+	fltx4 bBlend = CmpGtSIMD( LoadUnalignedSIMD( m_flBlend ), Four_Zeros );
+	if ( TestSignSIMD( bBlend ) )
+	{
+		FourQuaternions_t q2, qt;
+		AngleQuaternionSIMD4( LoadUnalignedSIMD( m_flAngle2[0] ), LoadUnalignedSIMD( m_flAngle2[1] ), LoadUnalignedSIMD( m_flAngle2[2] ), q2 );
+		QuaternionAlignSIMD4( q, q2, bBlend );
+		QuaternionBlendNoAlignSIMD4( q, q2, LoadUnalignedSIMD( m_flS ), qt );
+		q.x = MaskedAssign( bBlend, qt.x, q.x );
+		q.y = MaskedAssign( bBlend, qt.y, q.y );
+		q.z = MaskedAssign( bBlend, qt.z, q.z );
+		q.w = MaskedAssign( bBlend, qt.w, q.w );
+	}
+
+	fltx4 bAlign = CmpGtSIMD( LoadUnalignedSIMD( m_flAlign ), Four_Zeros );
+	if ( TestSignSIMD( bAlign ) )
+	{
+		FourQuaternions_t alignment;
+		LoadFourQuaternions( alignment, m_pAlignment );
+		QuaternionAlignSIMD4( alignment, q, bAlign );
+	}
+
+	StoreFourQuaternions( q, m_pOut, m_nCount );
+	m_nCount = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: QuaternionMatrix( q[i], pos[i], localMatrices[i] ) for the bones in
+//			boneMask, leaving out pSkipBones
+//-----------------------------------------------------------------------------
+void Studio_CalcLocalMatrices( const CStudioHdr *pStudioHdr, const Vector pos[], const Quaternion q[], int boneMask, matrix3x4_t localMatrices[], const CBoneBitList *pSkipBones )
+{
+	int nBones = pStudioHdr->numbones();
+	if ( !UseAnimSIMD() )
+	{
+		for ( int i = 0; i < nBones; i++ )
+		{
+			if ( ( pStudioHdr->boneFlags( i ) & boneMask ) && !( pSkipBones && pSkipBones->Get( i ) ) )
+			{
+				QuaternionMatrix( q[i], pos[i], localMatrices[i] );
+			}
+		}
+		return;
+	}
+
+	const Quaternion *pQ[4];
+	const Vector *pPos[4];
+	matrix3x4_t *pOut[4];
+	int nCount = 0;
+	for ( int i = 0; i < nBones; i++ )
+	{
+		if ( !( pStudioHdr->boneFlags( i ) & boneMask ) || ( pSkipBones && pSkipBones->Get( i ) ) )
+			continue;
+
+		pQ[nCount] = &q[i];
+		pPos[nCount] = &pos[i];
+		pOut[nCount] = &localMatrices[i];
+		if ( ++nCount == 4 )
+		{
+			FourQuaternions_t q4;
+			LoadFourQuaternions( q4, pQ );
+			QuaternionMatrixSIMD4( q4, pPos, pOut );
+			nCount = 0;
+		}
+	}
+
+	for ( int i = 0; i < nCount; i++ )
+	{
+		QuaternionMatrix( *pQ[i], *pPos[i], *pOut[i] );
+	}
+}
+
+#ifdef CLIENT_DLL
+//-----------------------------------------------------------------------------
+// Checks the four-wide kernels against the scalar mathlib on random input.
+// Client only, since this file is built into both DLLs.
+//-----------------------------------------------------------------------------
+
+// The polynomial sin/cos/acos are good to a few ulp; this leaves headroom
+#define SIMD_BONES_TOLERANCE	1e-4f
+
+static void RandomBoneQuaternion( Quaternion &q )
+{
+	RadianEuler angles( RandomFloat( -M_PI_F, M_PI_F ), RandomFloat( -M_PI_F, M_PI_F ), RandomFloat( -M_PI_F, M_PI_F ) );
+	AngleQuaternion( angles, q );
+}
+
+static float QuaternionMaxError( const Quaternion &a, const Quaternion &b )
+{
+	return MAX( MAX( fabs( a.x - b.x ), fabs( a.y - b.y ) ), MAX( fabs( a.z - b.z ), fabs( a.w - b.w ) ) );
+}
+
+CON_COMMAND_F( studio_simd_bones_test, "Checks the SIMD bone kernels against the scalar ones and times them. Usage: studio_simd_bones_test [bones]", DEVTEST_COMMAND_FLAGS )
+{
+	int nBones = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 4 ) & ~3 : 4096;
+
+	CUtlVector<Quaternion> p, q, scalar, simd;
+	CUtlVector<RadianEuler> angle1, angle2;
+	CUtlVector<float> t;
+	CUtlVector<Vector> pos;
+	CUtlVector<matrix3x4_t> matScalar, matSIMD;
+	p.SetCount( nBones ); q.SetCount( nBones ); scalar.SetCount( nBones ); simd.SetCount( nBones );
+	angle1.SetCount( nBones ); angle2.SetCount( nBones ); t.SetCount( nBones ); pos.SetCount( nBones );
+	matScalar.SetCount( nBones ); matSIMD.SetCount( nBones );
+
+	for ( int i = 0; i < nBones; i++ )
+	{
+		RandomBoneQuaternion( p[i] );
+		RandomBoneQuaternion( q[i] );
+		angle1[i].Init( RandomFloat( -2.0f * M_PI_F, 2.0f * M_PI_F ), RandomFloat( -2.0f * M_PI_F, 2.0f * M_PI_F ), RandomFloat( -2.0f * M_PI_F, 2.0f * M_PI_F ) );
+		angle2[i].Init( angle1[i].x + RandomFloat( -0.2f, 0.2f ), angle1[i].y + RandomFloat( -0.2f, 0.2f ), angle1[i].z + RandomFloat( -0.2f, 0.2f ) );
+		t[i] = RandomFloat( 0.0f, 1.0f );
+		pos[i].Init( RandomFloat( -64.0f, 64.0f ), RandomFloat( -64.0f, 64.0f ), RandomFloat( -64.0f, 64.0f ) );
+	}
+
+	CDevTestReport report( "studio_simd_bones_test" );
+	CFastTimer timer;
+
+	// Animation decode: euler to quaternion, blended and aligned
+	{
+		CBoneRotationBatch batch;
+		for ( int i = 0; i < nBones; i++ )
+		{
+			batch.Add( angle1[i], angle2[i], t[i], ( i & 1 ) != 0, ( i & 2 ) ? &p[i] : NULL, &simd[i] );
+		}
+		batch.Flush();
+
+		for ( int i = 0; i < nBones; i++ )
+		{
+			Quaternion q1, q2;
+			AngleQuaternion( angle1[i], q1 );
+			if ( i & 1 )
+			{
+				AngleQuaternion( angle2[i], q2 );
+				QuaternionBlend( q1, q2, t[i], scalar[i] );
+			}
+			else
+			{
+				scalar[i] = q1;
+			}
+			if ( i & 2 )
+			{
+				QuaternionAlign( p[i], scalar[i], scalar[i] );
+			}
+
+			float flError = QuaternionMaxError( scalar[i], simd[i] );
+			report.Check( flError < SIMD_BONES_TOLERANCE, "bone %d: decode off by %g", i, flError );
+		}
+	}
+
+	// Slerp
+	timer.Start();
+	for ( int i = 0; i < nBones; i++ )
+	{
+		QuaternionSlerp( p[i], q[i], t[i], scalar[i] );
+	}
+	timer.End();
+	report.Time( CFmtStr( "%d slerps, scalar", nBones ), timer, 1 );
+
+	int nFallbacks = 0;
+	timer.Start();
+	for ( int i = 0; i < nBones; i += 4 )
+	{
+		const Quaternion *pP[4] = { &p[i], &p[i+1], &p[i+2], &p[i+3] };
+		const Quaternion *pQ[4] = { &q[i], &q[i+1], &q[i+2], &q[i+3] };
+		Quaternion *pOut[4] = { &simd[i], &simd[i+1], &simd[i+2], &simd[i+3] };
+		FourQuaternions_t p4, q4, qt;
+		LoadFourQuaternions( p4, pP );
+		LoadFourQuaternions( q4, pQ );
+		QuaternionAlignSIMD4( p4, q4, LoadAlignedSIMD( g_SIMD_AllOnesMask ) );
+		if ( !QuaternionSlerpNoAlignSIMD4( p4, q4, LoadUnalignedSIMD( &t[i] ), qt ) )
+		{
+			nFallbacks++;
+			for ( int k = 0; k < 4; k++ )
+			{
+				QuaternionSlerp( p[i+k], q[i+k], t[i+k], simd[i+k] );
+			}
+			continue;
+		}
+		StoreFourQuaternions( qt, pOut );
+	}
+	timer.End();
+	report.Time( CFmtStr( "%d slerps, SIMD (%d groups fell back)", nBones, nFallbacks ), timer, 1 );
+
+	for ( int i = 0; i < nBones; i++ )
+	{
+		float flError = QuaternionMaxError( scalar[i], simd[i] );
+		report.Check( flError < SIMD_BONES_TOLERANCE, "bone %d: slerp off by %g", i, flError );
+	}
+
+	// Blend
+	for ( int i = 0; i < nBones; i += 4 )
+	{
+		const Quaternion *pP[4] = { &p[i], &p[i+1], &p[i+2], &p[i+3] };
+		const Quaternion *pQ[4] = { &q[i], &q[i+1], &q[i+2], &q[i+3] };
+		Quaternion *pOut[4] = { &simd[i], &simd[i+1], &simd[i+2], &simd[i+3] };
+		FourQuaternions_t p4, q4, qt;
+		LoadFourQuaternions( p4, pP );
+		LoadFourQuaternions( q4, pQ );
+		QuaternionAlignSIMD4( p4, q4, LoadAlignedSIMD( g_SIMD_AllOnesMask ) );
+		QuaternionBlendNoAlignSIMD4( p4, q4, ReplicateX4( t[i] ), qt );
+		StoreFourQuaternions( qt, pOut );
+
+		for ( int k = 0; k < 4; k++ )
+		{
+			QuaternionBlend( p[i+k], q[i+k], t[i], scalar[i+k] );
+			float flError = QuaternionMaxError( scalar[i+k], simd[i+k] );
+			report.Check( flError < SIMD_BONES_TOLERANCE, "bone %d: blend off by %g", i + k, flError );
+		}
+	}
+
+	// Local bone matrices
+	timer.Start();
+	for ( int i = 0; i < nBones; i++ )
+	{
+		QuaternionMatrix( p[i], pos[i], matScalar[i] );
+	}
+	timer.End();
+	report.Time( CFmtStr( "%d bone matrices, scalar", nBones ), timer, 1 );
+
+	timer.Start();
+	for ( int i = 0; i < nBones; i += 4 )
+	{
+		const Quaternion *pP[4] = { &p[i], &p[i+1], &p[i+2], &p[i+3] };
+		const Vector *pPos[4] = { &pos[i], &pos[i+1], &pos[i+2], &pos[i+3] };
+		matrix3x4_t *pOut[4] = { &matSIMD[i], &matSIMD[i+1], &matSIMD[i+2], &matSIMD[i+3] };
+		FourQuaternions_t p4;
+		LoadFourQuaternions( p4, pP );
+		QuaternionMatrixSIMD4( p4, pPos, pOut );
+	}
+	timer.End();
+	report.Time( CFmtStr( "%d bone matrices, SIMD", nBones ), timer, 1 );
+
+	for ( int i = 0; i < nBones; i++ )
+	{
+		float flError = 0.0f;
+		for ( int r = 0; r < 3; r++ )
+		{
+			for ( int c = 0; c < 4; c++ )
+			{
+				flError = MAX( flError, fabs( matScalar[i][r][c] - matSIMD[i][r][c] ) );
+			}
+		}
+		report.Check( flError < SIMD_BONES_TOLERANCE, "bone %d: matrix off by %g", i, flError );
+	}
+
+	report.Finish();
+}
+#endif // CLIENT_DLL
+
 //-----------------------------------------------------------------------------
 // Purpose: return a sub frame rotation for a single bone
 //-----------------------------------------------------------------------------
 void CalcBoneQuaternion( int frame, float s, 
 						const Quaternion &baseQuat, const RadianEuler &baseRot, const Vector &baseRotScale, 
 						int iBaseFlags, const Quaternion &baseAlignment, 
-						const mstudioanim_t *panim, Quaternion &q )
+						const mstudioanim_t *panim, Quaternion &q, CBoneRotationBatch *pBatch = NULL )
 {
 	if ( panim->flags & STUDIO_ANIM_RAWROT )
 	{
@@ -404,6 +964,7 @@ void CalcBoneQuaternion( int frame, float s,
 	}
 
 	mstudioanim_valueptr_t *pValuesPtr = panim->pRotV();
+	const Quaternion *pAlignment = ( !(panim->flags & STUDIO_ANIM_DELTA) && (iBaseFlags & BONE_FIXED_ALIGNMENT) ) ? &baseAlignment : NULL;
 
 	if (s > 0.001f)
 	{
@@ -425,7 +986,14 @@ void CalcBoneQuaternion( int frame, float s,
 		}
 
 		Assert( angle1.IsValid() && angle2.IsValid() );
-		if (angle1.x != angle2.x || angle1.y != angle2.y || angle1.z != angle2.z)
+		bool bBlend = (angle1.x != angle2.x || angle1.y != angle2.y || angle1.z != angle2.z);
+		if ( pBatch )
+		{
+			pBatch->Add( angle1, angle2, s, bBlend, pAlignment, &q );
+			return;
+		}
+
+		if (bBlend)
 		{
 			AngleQuaternion( angle1, q1 );
 			AngleQuaternion( angle2, q2 );
@@ -461,13 +1029,19 @@ void CalcBoneQuaternion( int frame, float s,
 		}
 
 		Assert( angle.IsValid() );
+		if ( pBatch )
+		{
+			pBatch->Add( angle, angle, 0.0f, false, pAlignment, &q );
+			return;
+		}
+
 		AngleQuaternion( angle, q );
 	}
 
 	Assert( q.IsValid() );
 
 	// align to unified bone
-	if (!(panim->flags & STUDIO_ANIM_DELTA) && (iBaseFlags & BONE_FIXED_ALIGNMENT))
+	if ( pAlignment )
 	{
 		QuaternionAlign( baseAlignment, q, q );
 	}
@@ -476,15 +1050,15 @@ void CalcBoneQuaternion( int frame, float s,
 inline void CalcBoneQuaternion( int frame, float s, 
 						const mstudiobone_t *pBone,
 						const mstudiolinearbone_t *pLinearBones,
-						const mstudioanim_t *panim, Quaternion &q )
+						const mstudioanim_t *panim, Quaternion &q, CBoneRotationBatch *pBatch = NULL )
 {
 	if (pLinearBones)
 	{
-		CalcBoneQuaternion( frame, s, pLinearBones->quat(panim->bone), pLinearBones->rot(panim->bone), pLinearBones->rotscale(panim->bone), pLinearBones->flags(panim->bone), pLinearBones->qalignment(panim->bone), panim, q );
+		CalcBoneQuaternion( frame, s, pLinearBones->quat(panim->bone), pLinearBones->rot(panim->bone), pLinearBones->rotscale(panim->bone), pLinearBones->flags(panim->bone), pLinearBones->qalignment(panim->bone), panim, q, pBatch );
 	}
 	else
 	{
-		CalcBoneQuaternion( frame, s, pBone->quat, pBone->rot, pBone->rotscale, pBone->flags, pBone->qAlignment, panim, q );
+		CalcBoneQuaternion( frame, s, pBone->quat, pBone->rot, pBone->rotscale, pBone->flags, pBone->qAlignment, panim, q, pBatch );
 	}
 }
 
@@ -965,6 +1539,9 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 		return;
 	}
 
+	CBoneRotationBatch rotationBatch;
+	CBoneRotationBatch *pBatch = UseAnimSIMD() ? &rotationBatch : NULL;
+
 	// FIXME: change encoding so that bone -1 is never the case
 	while (panim && panim->bone < 255)
 	{
@@ -975,7 +1552,7 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 
 			if (k >= 0 && pweight[k] > 0.0f)
 			{
-				CalcBoneQuaternion( iLocalFrame, s, &pAnimbone[panim->bone], pAnimLinearBones, panim, q[j] );
+				CalcBoneQuaternion( iLocalFrame, s, &pAnimbone[panim->bone], pAnimLinearBones, panim, q[j], pBatch );
 				CalcBonePosition  ( iLocalFrame, s, &pAnimbone[panim->bone], pAnimLinearBones, panim, pos[j] );
 #ifdef STUDIO_ENABLE_PERF_COUNTERS
 				pStudioHdr->m_nPerfAnimatedBones++;
@@ -984,6 +1561,7 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 		}
 		panim = panim->pNext();
 	}
+	rotationBatch.Flush();
 
 	// cross fade in previous zeroframe data
 	if (flStall > 0.0f)
@@ -1095,6 +1673,9 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 		return;
 	}
 
+	CBoneRotationBatch rotationBatch;
+	CBoneRotationBatch *pBatch = UseAnimSIMD() ? &rotationBatch : NULL;
+
 	// BUGBUG: the sequence, the anim, and the model can have all different bone mappings.
 	for (i = 0; i < pStudioHdr->numbones(); i++, pbone++, pweight++)
 	{
@@ -1102,7 +1683,7 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 		{
 			if (*pweight > 0 && (pStudioHdr->boneFlags(i) & boneMask))
 			{
-				CalcBoneQuaternion( iLocalFrame, s, pbone, pLinearBones, panim, q[i] );
+				CalcBoneQuaternion( iLocalFrame, s, pbone, pLinearBones, panim, q[i], pBatch );
 				CalcBonePosition  ( iLocalFrame, s, pbone, pLinearBones, panim, pos[i] );
 #ifdef STUDIO_ENABLE_PERF_COUNTERS
 				pStudioHdr->m_nPerfAnimatedBones++;
@@ -1128,6 +1709,7 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 #endif
 		}
 	}
+	rotationBatch.Flush();
 
 	// cross fade in previous zeroframe data
 	if (flStall > 0.0f)
@@ -1370,6 +1952,69 @@ void WorldSpaceSlerp(
 
 
 
+//-----------------------------------------------------------------------------
+// Slerps or blends q1[iBones[k]] toward q2[iBones[k]] by the matching s1, as
+// the scalar loops in SlerpBones and BlendBones do one bone at a time
+//-----------------------------------------------------------------------------
+static void LoadBoneGroup( const CStudioHdr *pStudioHdr, const Quaternion q1[], const Quaternion q2[], const int iBones[4], FourQuaternions_t &p, FourQuaternions_t &q, fltx4 &fl4Allow )
+{
+	const Quaternion *pP[4], *pQ[4];
+	float flAllow[4];
+	for ( int k = 0; k < 4; k++ )
+	{
+		pP[k] = &q2[iBones[k]];
+		pQ[k] = &q1[iBones[k]];
+		flAllow[k] = ( pStudioHdr->boneFlags( iBones[k] ) & BONE_FIXED_ALIGNMENT ) ? 0.0f : 1.0f;
+	}
+	LoadFourQuaternions( p, pP );
+	LoadFourQuaternions( q, pQ );
+	fl4Allow = CmpGtSIMD( LoadUnalignedSIMD( flAllow ), Four_Zeros );
+}
+
+static void SlerpBoneGroup( const CStudioHdr *pStudioHdr, Quaternion q1[], const QuaternionAligned q2[], const int iBones[4], const float flS1[4] )
+{
+	FourQuaternions_t p, q, qt;
+	fltx4 fl4Allow;
+	LoadBoneGroup( pStudioHdr, q1, q2, iBones, p, q, fl4Allow );
+	QuaternionAlignSIMD4( p, q, fl4Allow );
+
+	if ( QuaternionSlerpNoAlignSIMD4( p, q, LoadUnalignedSIMD( flS1 ), qt ) )
+	{
+		Quaternion *pOut[4] = { &q1[iBones[0]], &q1[iBones[1]], &q1[iBones[2]], &q1[iBones[3]] };
+		StoreFourQuaternions( qt, pOut );
+		return;
+	}
+
+	// Opposite rotations; let the scalar code pick the perpendicular
+	for ( int k = 0; k < 4; k++ )
+	{
+		int i = iBones[k];
+		Quaternion q3;
+		if ( pStudioHdr->boneFlags(i) & BONE_FIXED_ALIGNMENT )
+		{
+			QuaternionSlerpNoAlign( q2[i], q1[i], flS1[k], q3 );
+		}
+		else
+		{
+			QuaternionSlerp( q2[i], q1[i], flS1[k], q3 );
+		}
+		q1[i] = q3;
+	}
+}
+
+static void BlendBoneGroup( const CStudioHdr *pStudioHdr, Quaternion q1[], const Quaternion q2[], const int iBones[4], float s1 )
+{
+	FourQuaternions_t p, q, qt;
+	fltx4 fl4Allow;
+	LoadBoneGroup( pStudioHdr, q1, q2, iBones, p, q, fl4Allow );
+	QuaternionAlignSIMD4( p, q, fl4Allow );
+	QuaternionBlendNoAlignSIMD4( p, q, ReplicateX4( s1 ), qt );
+
+	Quaternion *pOut[4] = { &q1[iBones[0]], &q1[iBones[1]], &q1[iBones[2]], &q1[iBones[3]] };
+	StoreFourQuaternions( qt, pOut );
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: blend together q1,pos1 with q2,pos2.  Return result in q1,pos1.  
 //			0 returns q1, pos1.  1 returns q2, pos2
@@ -1480,6 +2125,52 @@ void SlerpBones(
 	}
 
 	QuaternionAligned q3;
+	if ( UseAnimSIMD() )
+	{
+		// Rotations go four at a time; positions are cheap enough as they are
+		int iGroup[4];
+		float flGroupS1[4];
+		int nGroup = 0;
+		for ( i = 0; i < nBoneCount; i++ )
+		{
+			s2 = pS2[i];
+			if ( s2 <= 0.0f )
+				continue;
+
+			s1 = 1.0 - s2;
+
+			pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
+			pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
+			pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
+
+			iGroup[nGroup] = i;
+			flGroupS1[nGroup] = s1;
+			if ( ++nGroup == 4 )
+			{
+				SlerpBoneGroup( pStudioHdr, q1, q2, iGroup, flGroupS1 );
+				nGroup = 0;
+			}
+		}
+
+		for ( j = 0; j < nGroup; j++ )
+		{
+			i = iGroup[j];
+			if ( pStudioHdr->boneFlags(i) & BONE_FIXED_ALIGNMENT )
+			{
+				QuaternionSlerpNoAlign( q2[i], q1[i], flGroupS1[j], q3 );
+			}
+			else
+			{
+				QuaternionSlerp( q2[i], q1[i], flGroupS1[j], q3 );
+			}
+			q1[i][0] = q3[0];
+			q1[i][1] = q3[1];
+			q1[i][2] = q3[2];
+			q1[i][3] = q3[3];
+		}
+		return;
+	}
+
 	for (i = 0; i < nBoneCount; i++)
 	{
 		s2 = pS2[i];
@@ -1590,6 +2281,11 @@ void BlendBones(
 	float s2 = s;
 	float s1 = 1.0 - s2;
 
+	// Rotations go four at a time when SIMD is on
+	int iGroup[4];
+	int nGroup = 0;
+	bool bSIMD = UseAnimSIMD();
+
 	for (i = 0; i < pStudioHdr->numbones(); i++)
 	{
 		// skip unused bones
@@ -1609,6 +2305,21 @@ void BlendBones(
 
 		if (j >= 0 && seqdesc.weight( j ) > 0.0)
 		{
+			pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
+			pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
+			pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
+
+			if ( bSIMD )
+			{
+				iGroup[nGroup] = i;
+				if ( ++nGroup == 4 )
+				{
+					BlendBoneGroup( pStudioHdr, q1, q2, iGroup, s1 );
+					nGroup = 0;
+				}
+				continue;
+			}
+
 			if (pStudioHdr->boneFlags(i) & BONE_FIXED_ALIGNMENT)
 			{
 				QuaternionBlendNoAlign( q2[i], q1[i], s1, q3 );
@@ -1621,11 +2332,22 @@ void BlendBones(
 			q1[i][1] = q3[1];
 			q1[i][2] = q3[2];
 			q1[i][3] = q3[3];
-			pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
-			pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
-			pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
 		}
 	}
+
+	for (j = 0; j < nGroup; j++)
+	{
+		i = iGroup[j];
+		if (pStudioHdr->boneFlags(i) & BONE_FIXED_ALIGNMENT)
+		{
+			QuaternionBlendNoAlign( q2[i], q1[i], s1, q3 );
+		}
+		else
+		{
+			QuaternionBlend( q2[i], q1[i], s1, q3 );
+		}
+		q1[i] = q3;
+	}
 }
 
 
@@ -4558,20 +5280,36 @@ void Studio_BuildMatrices(
 		VectorScale( rotationmatrix[2], flScale, rotationmatrix[2] );
 	}
 
+	// Every bone's local matrix can be built up front, four at a time
+	matrix3x4_t *pLocalMatrices = NULL;
+	if (iBone == -1)
+	{
+		pLocalMatrices = (matrix3x4_t *)stackalloc( pStudioHdr->numbones() * sizeof(matrix3x4_t) );
+		Studio_CalcLocalMatrices( pStudioHdr, pos, q, boneMask, pLocalMatrices );
+	}
+
 	for (j = chainlength - 1; j >= 0; j--)
 	{
 		i = chain[j];
 		if (pStudioHdr->boneFlags(i) & boneMask)
 		{
-			QuaternionMatrix( q[i], pos[i], bonematrix );
+			const matrix3x4_t *pBoneMatrix = &bonematrix;
+			if (pLocalMatrices)
+			{
+				pBoneMatrix = &pLocalMatrices[i];
+			}
+			else
+			{
+				QuaternionMatrix( q[i], pos[i], bonematrix );
+			}
 
 			if (pStudioHdr->boneParent(i) == -1) 
 			{
-				ConcatTransforms (rotationmatrix, bonematrix, bonetoworld[i]);
+				ConcatTransforms (rotationmatrix, *pBoneMatrix, bonetoworld[i]);
 			} 
 			else 
 			{
-				ConcatTransforms (bonetoworld[pStudioHdr->boneParent(i)], bonematrix, bonetoworld[i]);
+				ConcatTransforms (bonetoworld[pStudioHdr->boneParent(i)], *pBoneMatrix, bonetoworld[i]);
 			}
 		}
 	}
@@ -331,6 +331,10 @@ void Studio_BuildMatrices(
 	int boneMask
 	);
 
+// QuaternionMatrix( q[i], pos[i], localMatrices[i] ) for every bone in boneMask
+// and not in pSkipBones, batched
+void Studio_CalcLocalMatrices( const CStudioHdr *pStudioHdr, const Vector pos[], const Quaternion q[], int boneMask, matrix3x4_t localMatrices[], const CBoneBitList *pSkipBones = NULL );
+
 
 // Get a bone->bone relative transform
 void Studio_CalcBoneToBoneTransform( const CStudioHdr *pStudioHdr, int inputBoneIndex, int outputBoneIndex, matrix3x4_t &matrixOut );
@@ -16,6 +16,7 @@
 #include <string.h>
 #include "stringregistry.h"
 #include "utldict.h"
+#include "utlflathashmap.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -23,10 +24,13 @@
 #if !defined(_STATIC_LINKED) || defined(CLIENT_DLL)
 
 //-----------------------------------------------------------------------------
-// Purpose: This class wraps the containers that do the actual work
+// Purpose: This class wraps the containers that do the actual work. The dict
+//			owns the strings and hands out the keys; name lookups go through a
+//			flat hash index over the dict's own copies of the names.
 //-----------------------------------------------------------------------------
 struct StringTable_t : public CUtlDict<int, unsigned short>
 {
+	CUtlFlatHashMap< const char *, unsigned short, CaselessStringHashFunctor, CaselessStringEqualFunctor > m_Index;
 };
 
 
@@ -38,7 +42,11 @@ struct StringTable_t : public CUtlDict<int, unsigned short>
 //-----------------------------------------------------------------------------
 unsigned short CStringRegistry::AddString(const char *stringText, int stringID)
 {
-	return m_pStringList->Insert( stringText, stringID );
+	unsigned short index = m_pStringList->Insert( stringText, stringID );
+
+	// Duplicates keep resolving to the first string added
+	m_pStringList->m_Index.Insert( m_pStringList->GetElementName( index ), index );
+	return index;
 }
 
 //-----------------------------------------------------------------------------
@@ -48,10 +56,10 @@ unsigned short CStringRegistry::AddString(const char *stringText, int stringID)
 //-----------------------------------------------------------------------------
 int	CStringRegistry::GetStringID( const char *stringText )
 {
-	unsigned short index = m_pStringList->Find( stringText );
-	if ( m_pStringList->IsValidIndex( index ) )
+	UtlFlatHashHandle_t h = m_pStringList->m_Index.Find( stringText );
+	if ( h != m_pStringList->m_Index.InvalidHandle() )
 	{
-		return (*m_pStringList)[index];
+		return (*m_pStringList)[ m_pStringList->m_Index[h] ];
 	}
 
 	return -1;
@@ -104,6 +112,7 @@ int CStringRegistry::GetIDForKey( unsigned short key )
 void CStringRegistry::ClearStrings(void)
 {
 	m_pStringList->RemoveAll();
+	m_pStringList->m_Index.RemoveAll();
 }
 
 //-----------------------------------------------------------------------------
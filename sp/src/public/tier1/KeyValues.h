@@ -39,6 +39,8 @@ class CUtlBuffer;
 class Color;
 typedef void * FileHandle_t;
 class CKeyValuesGrowableStringTable;
+class CKeyValuesChildIndex;
+class CKeyValuesArena;
 
 //-----------------------------------------------------------------------------
 // Purpose: Simple recursive data access class
@@ -147,6 +149,31 @@ public:
 	void SetNextKey( KeyValues * pDat);
 	KeyValues *FindLastSubKey();	// returns the LAST subkey in the list.  This requires a linked list iteration to find the key.  Returns NULL if we don't have any children
 
+	// Child index. Once a node has more than the threshold number of
+	// subkeys, the code adding them (AddSubKey, CreateKey, FindKey( name,
+	// true ), the loaders and MakeCopy) gives it a hash of its children so
+	// lookups are constant time. Lookups never build or change the index, so
+	// a finished tree can be read from several threads. The index follows
+	// RemoveSubKey and SetName too; code that relinks children by hand with
+	// SetNextKey must call ReleaseChildIndex() on the parent first.
+	void BuildChildIndex( bool bRecursive = false );	// builds it now regardless of the threshold
+	void ReleaseChildIndex();
+	bool HasChildIndex() const { return m_bHasChildIndex != 0; }
+	static void SetChildIndexThreshold( int nThreshold );	// 0 disables automatically built indices
+	static int GetChildIndexThreshold();
+
+	// Arena allocation. With UseArena( true ), every key and value string that
+	// LoadFromFile/LoadFromBuffer create under this key comes out of one bump
+	// allocated arena owned by this key and freed in one go when it is
+	// deleted, rather than being allocated and freed node by node. The
+	// per-key API is unchanged, but keys from the arena must not outlive the
+	// owner (MakeCopy one that needs to) and such trees must not be handed to
+	// code outside this module that will deleteThis them. Only keys without
+	// a value of their own get an arena; values set on the owner afterwards
+	// are stored as usual.
+	void UseArena( bool bState );
+	bool IsArenaOwner() const { return m_bOwnsArena != 0; }
+
 	//
 	// These functions can be used to treat it like a true key/values tree instead of 
 	// confusing values with keys.
@@ -216,6 +243,7 @@ public:
 
 	// Allocate & create a new copy of the keys
 	KeyValues *MakeCopy( void ) const;
+	KeyValues *MakeCopy( bool bUseArena ) const;	// with bUseArena, the copy owns an arena holding all of its keys and strings
 
 	// Make a new copy of all subkeys, add them all to the passed-in keyvalues
 	void CopySubkeys( KeyValues *pParent ) const;
@@ -256,6 +284,9 @@ public:
 	void RecursiveMergeKeyValues( KeyValues *baseKV );
 
 private:
+	friend class CKeyValuesChildIndex;
+	friend class CKeyValuesArenaScope;
+
 	KeyValues( KeyValues& );	// prevent copy constructor being used
 
 	// prevent delete being called except through deleteThis()
@@ -272,6 +303,22 @@ private:
 
 	void RecursiveCopyKeyValues( KeyValues& src );
 	void RemoveEverything();
+
+	static void DestroyKey( KeyValues *pKey );
+	char *AllocValueString( int nSize );
+	void FreeValueString();
+	void ReleaseArena();
+	CKeyValuesArena *GetArena() const;
+	bool IsArenaInUnion() const { return m_bOwnsArena && !m_bArenaSpilled; }
+	void PrepareUnionValue();
+
+	CKeyValuesChildIndex *GetChildIndex() const;
+	void SetChildIndex( CKeyValuesChildIndex *pIndex );
+
+	void IndexChildrenIfWide();
+	KeyValues *FindIndexedChild( int iKeySymbol, KeyValues **ppLastChild ) const;
+	void AddToChildIndex( KeyValues *pChild );
+	void RemoveFromChildIndex( KeyValues *pChild, KeyValues *pPrev );
 //	void RecursiveSaveToFile( IBaseFileSystem *filesystem, CUtlBuffer &buffer, int indentLevel );
 //	void WriteConvertedString( CUtlBuffer &buffer, const char *pszString );
 	
@@ -315,12 +362,21 @@ private:
 		float m_flValue;
 		void *m_pValue;
 		unsigned char m_Color[4];
+		CKeyValuesChildIndex *m_pChildIndex;	// TYPE_NONE keys with m_bHasChildIndex set, unless they own an arena
+		CKeyValuesArena *m_pArena;				// TYPE_NONE keys with m_bOwnsArena set, unless it was spilled
 	};
 	
 	char	   m_iDataType;
 	char	   m_bHasEscapeSequences; // true, if while parsing this KeyValue, Escape Sequences are used (default false)
 	char	   m_bEvaluateConditionals; // true, if while parsing this KeyValue, conditionals blocks are evaluated (default true)
-	char	   unused[1];
+	// Former padding byte; Init() clears it
+	unsigned char m_bHasChildIndex : 1;	// m_pChildIndex is valid
+	unsigned char m_bIndexedChild : 1;	// this node has been added to its parent's index
+	unsigned char m_bUseArena : 1;		// loads into this node allocate from its arena
+	unsigned char m_bOwnsArena : 1;		// this node owns an arena; released in RemoveEverything
+	unsigned char m_bArenaSpilled : 1;	// the owned arena was moved out of m_pArena to make room for a value
+	unsigned char m_bArenaNode : 1;		// this node's memory lives in an arena
+	unsigned char m_bArenaValue : 1;	// m_sValue lives in an arena
 
 	KeyValues *m_pPeer;	// pointer to next key in list
 	KeyValues *m_pSub;	// pointer to Start of a new sub key list
@@ -333,6 +389,8 @@ private:
 	static const char *(*s_pfGetStringForSymbol)( int symbol );
 	static CKeyValuesGrowableStringTable *s_pGrowableStringTable;
 
+	static int s_nChildIndexThreshold;
+
 public:
 	// Functions that invoke the default behavior
 	static int GetSymbolForStringClassic( const char *name, bool bCreate = true );
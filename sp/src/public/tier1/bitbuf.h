@@ -217,6 +217,17 @@ public:
 	void			WriteBitVec3Normal( const Vector& fa );
 	void			WriteBitAngles( const QAngle& fa );
 
+	// Batched versions of the above. The output is bit-for-bit what calling the
+	// single value functions in a loop would produce, but the bits are packed
+	// through a CBitWriteAccumulator instead of being masked into the buffer
+	// one field at a time.
+	void			WriteBitAngleArray( const float *pAngles, int nCount, int numbits );
+	void			WriteBitCoordArray( const float *pValues, int nCount );
+	void			WriteBitVec3CoordArray( const Vector *pVectors, int nCount );
+	void			WriteBitNormalArray( const float *pValues, int nCount );
+	void			WriteBitVec3NormalArray( const Vector *pVectors, int nCount );
+	void			WriteBitAnglesArray( const QAngle *pAngles, int nCount );
+
 
 // Byte functions.
 public:
@@ -592,6 +603,14 @@ public:
 	void			ReadBitVec3Normal( Vector& fa );
 	void			ReadBitAngles( QAngle& fa );
 
+	// Batched readers matching the bf_write array functions
+	void			ReadBitAngleArray( float *pAngles, int nCount, int numbits );
+	void			ReadBitCoordArray( float *pValues, int nCount );
+	void			ReadBitVec3CoordArray( Vector *pVectors, int nCount );
+	void			ReadBitNormalArray( float *pValues, int nCount );
+	void			ReadBitVec3NormalArray( Vector *pVectors, int nCount );
+	void			ReadBitAnglesArray( QAngle *pAngles, int nCount );
+
 	// Faster for comparisons but do not fully decode float values
 	unsigned int	ReadBitCoordBits();
 	unsigned int	ReadBitCoordMPBits( bool bIntegral, bool bLowPrecision );
@@ -803,6 +822,194 @@ BITBUF_INLINE int bf_read::CompareBits( bf_read * RESTRICT other, int numbits )
 }
 
 
+//-----------------------------------------------------------------------------
+// Word-at-a-time writer. Fields are packed into a 64-bit accumulator and only
+// whole dwords are stored, instead of every WriteUBitLong reading, masking and
+// storing two dwords. The bits produced are identical to the same sequence of
+// bf_write calls; the bf_write's position is updated by Flush() and when the
+// accumulator goes out of scope, so don't touch the bf_write directly while an
+// accumulator on it is live.
+//
+// Overflow is detected the same way bf_write does it: the overflow flag gets
+// set and the position is clamped to the end of the buffer.
+//-----------------------------------------------------------------------------
+class CBitWriteAccumulator
+{
+public:
+	CBitWriteAccumulator( bf_write &buf );
+	~CBitWriteAccumulator() { Flush(); }
+
+	void			WriteOneBit( int nValue ) { WriteUBitLong( nValue ? 1 : 0, 1 ); }
+	void			WriteUBitLong( unsigned int data, int numbits );
+	void			WriteSBitLong( int data, int numbits );
+	void			WriteShort( int val ) { WriteSBitLong( val, sizeof(short) << 3 ); }
+	void			WriteFloat( float val );
+
+	void			WriteBitAngle( float fAngle, int numbits );
+	void			WriteBitCoord( const float f );
+	void			WriteBitVec3Coord( const Vector& fa );
+	void			WriteBitNormal( float f );
+	void			WriteBitVec3Normal( const Vector& fa );
+
+	// Stores the partially filled dword and updates the bf_write's position.
+	// Writing can continue afterwards.
+	void			Flush();
+
+	bool			IsOverflowed() const { return m_Buf.IsOverflowed(); }
+	int				GetNumBitsWritten() const { return m_iCurBit; }
+
+private:
+	void			Sync();
+	void			WriteUBitLongOverflow( unsigned int data, int numbits );
+
+	bf_write		&m_Buf;
+	uint64			m_nAccum;		// Pending bits, first written bit in bit 0
+	int				m_nAccumBits;	// Valid bits in m_nAccum; always < 32 between calls
+	int				m_iDWord;		// Buffer dword the low bits of m_nAccum go to
+	int				m_iCurBit;
+};
+
+inline CBitWriteAccumulator::CBitWriteAccumulator( bf_write &buf ) : m_Buf( buf )
+{
+	Sync();
+}
+
+// Picks up the bf_write's position, keeping the bits already written to the
+// current dword so the final store can write it back whole
+inline void CBitWriteAccumulator::Sync()
+{
+	m_iCurBit = m_Buf.m_iCurBit;
+	m_iDWord = m_iCurBit >> 5;
+	m_nAccumBits = m_iCurBit & 31;
+	m_nAccum = m_nAccumBits ? ( LoadLittleDWord( m_Buf.m_pData, m_iDWord ) & ( ( 1u << m_nAccumBits ) - 1 ) ) : 0;
+}
+
+inline void CBitWriteAccumulator::Flush()
+{
+	if ( m_nAccumBits )
+	{
+		// Preserve whatever follows the write position, like WriteUBitLong does
+		unsigned int mask = ( 1u << m_nAccumBits ) - 1;
+		unsigned int dword = LoadLittleDWord( m_Buf.m_pData, m_iDWord );
+		StoreLittleDWord( m_Buf.m_pData, m_iDWord, ( dword & ~mask ) | ( (unsigned int)m_nAccum & mask ) );
+	}
+
+	m_Buf.m_iCurBit = m_iCurBit;
+}
+
+BITBUF_INLINE void CBitWriteAccumulator::WriteUBitLong( unsigned int data, int numbits )
+{
+	Assert( numbits > 0 && numbits <= 32 );
+
+	if ( m_Buf.m_nDataBits - m_iCurBit < numbits )
+	{
+		WriteUBitLongOverflow( data, numbits );
+		return;
+	}
+
+	m_nAccum |= (uint64)( data & (unsigned int)( ( (uint64)1 << numbits ) - 1 ) ) << m_nAccumBits;
+	m_nAccumBits += numbits;
+	m_iCurBit += numbits;
+
+	if ( m_nAccumBits >= 32 )
+	{
+		Assert( ( m_iDWord*4 + sizeof(long) ) <= (unsigned int)m_Buf.m_nDataBytes );
+		StoreLittleDWord( m_Buf.m_pData, m_iDWord, (unsigned int)m_nAccum );
+		m_nAccum >>= 32;
+		m_nAccumBits -= 32;
+		++m_iDWord;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Word-at-a-time reader. Keeps a 64-bit window of upcoming bits and refills it
+// a dword at a time, so most reads are a shift and a mask. Like the writer, the
+// bf_read's position is updated by Flush() and on destruction.
+//-----------------------------------------------------------------------------
+class CBitReadAccumulator
+{
+public:
+	CBitReadAccumulator( bf_read &buf );
+	~CBitReadAccumulator() { Flush(); }
+
+	int				ReadOneBit() { return ReadUBitLong( 1 ); }
+	unsigned int	ReadUBitLong( int numbits );
+	int				ReadShort() { return (short)ReadUBitLong( 16 ); }
+	float			ReadFloat();
+
+	float			ReadBitAngle( int numbits );
+	float			ReadBitCoord();
+	void			ReadBitVec3Coord( Vector& fa );
+	float			ReadBitNormal();
+	void			ReadBitVec3Normal( Vector& fa );
+
+	// Updates the bf_read's position. Reading can continue afterwards.
+	void			Flush() { m_Buf.m_iCurBit = m_iCurBit; }
+
+	bool			IsOverflowed() const { return m_Buf.IsOverflowed(); }
+	int				GetNumBitsRead() const { return m_iCurBit; }
+
+private:
+	void			Sync();
+	unsigned int	ReadUBitLongOverflow( int numbits );
+
+	bf_read			&m_Buf;
+	uint64			m_nWindow;		// Upcoming bits, next bit in bit 0
+	int				m_nWindowBits;
+	int				m_iNextDWord;	// Next dword to load into the window
+	int				m_nEndDWord;	// One past the last dword holding valid bits
+	int				m_iCurBit;
+};
+
+inline CBitReadAccumulator::CBitReadAccumulator( bf_read &buf ) : m_Buf( buf )
+{
+	Sync();
+}
+
+inline void CBitReadAccumulator::Sync()
+{
+	m_iCurBit = m_Buf.m_iCurBit;
+	m_nEndDWord = ( m_Buf.m_nDataBits + 31 ) >> 5;
+
+	int iDWord = m_iCurBit >> 5;
+	if ( iDWord < m_nEndDWord )
+	{
+		m_nWindow = LoadLittleDWord( (const unsigned long*)m_Buf.m_pData, iDWord ) >> ( m_iCurBit & 31 );
+		m_nWindowBits = 32 - ( m_iCurBit & 31 );
+	}
+	else
+	{
+		m_nWindow = 0;
+		m_nWindowBits = 0;
+	}
+	m_iNextDWord = iDWord + 1;
+}
+
+BITBUF_INLINE unsigned int CBitReadAccumulator::ReadUBitLong( int numbits )
+{
+	Assert( numbits > 0 && numbits <= 32 );
+
+	if ( m_Buf.m_nDataBits - m_iCurBit < numbits )
+		return ReadUBitLongOverflow( numbits );
+
+	if ( m_nWindowBits < numbits )
+	{
+		// One dword is always enough since the window holds fewer than 32 bits here,
+		// and it exists since there are at least numbits left in the buffer
+		Assert( m_iNextDWord < m_nEndDWord );
+		m_nWindow |= (uint64)LoadLittleDWord( (const unsigned long*)m_Buf.m_pData, m_iNextDWord ) << m_nWindowBits;
+		m_nWindowBits += 32;
+		++m_iNextDWord;
+	}
+
+	unsigned int nResult = (unsigned int)m_nWindow & (unsigned int)( ( (uint64)1 << numbits ) - 1 );
+	m_nWindow >>= numbits;
+	m_nWindowBits -= numbits;
+	m_iCurBit += numbits;
+	return nResult;
+}
+
+
 #endif
 
 
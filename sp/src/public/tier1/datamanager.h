@@ -44,6 +44,7 @@ public:
 	unsigned int			TargetSize();
 	unsigned int			AvailableSize();
 	unsigned int			UsedSize();
+	int						ResourceCount() const { return m_memoryLists.Count( m_lruList ) + m_memoryLists.Count( m_lockList ); }
 
 	void					NotifySizeChanged( memhandle_t handle, unsigned int oldSize, unsigned int newSize );
 
@@ -247,6 +248,194 @@ private:
 	MUTEX_TYPE m_mutex;
 };
 
+//-----------------------------------------------------------------------------
+// A CDataManager split into independently locked shards, for caches that are
+// hit from several threads at once. Each shard has its own LRU and mutex; new
+// resources are dealt out to the shards round-robin. The target size covers
+// all shards and is enforced approximately: when it's exceeded the creating
+// shard's LRU is evicted first, then the LRUs of any other shards that aren't
+// busy.
+//
+// Handles carry their shard in the low bits of the index word, so a shard can
+// hold at most MAX_SHARD_RESOURCES (64K >> SHARD_BITS) resources at once. A
+// full shard evicts its LRU resource to make room; if everything in it is
+// locked the next shard is tried, and if all of them are full CreateResource
+// fails and returns INVALID_MEMHANDLE.
+//-----------------------------------------------------------------------------
+template< class STORAGE_TYPE, class CREATE_PARAMS, class LOCK_TYPE = STORAGE_TYPE *, class MUTEX_TYPE = CThreadFastMutex, int SHARD_BITS = 3 >
+class CShardedDataManager
+{
+public:
+	enum
+	{
+		NUM_SHARDS = 1 << SHARD_BITS,
+		MAX_SHARD_RESOURCES = 0x10000 >> SHARD_BITS,
+	};
+	typedef CDataManager<STORAGE_TYPE, CREATE_PARAMS, LOCK_TYPE, MUTEX_TYPE> Shard_t;
+
+	CShardedDataManager( unsigned int size = (unsigned)-1 ) : m_targetMemorySize( size ) {}
+
+	memhandle_t CreateResource( const CREATE_PARAMS &createParams, bool bCreateLocked = false )
+	{
+		int iFirstShard = (unsigned)( ++m_nNextShard ) & ( NUM_SHARDS - 1 );
+		for ( int i = 0; i < NUM_SHARDS; i++ )
+		{
+			int iShard = ( iFirstShard + i ) & ( NUM_SHARDS - 1 );
+			Shard_t &shard = m_Shards[iShard];
+
+			// Hold the shard so eviction and creation are atomic with respect to it
+			AUTO_LOCK_( MUTEX_TYPE, shard.AccessMutex() );
+			EnsureCapacity( iShard, STORAGE_TYPE::EstimatedSize( createParams ) );
+
+			// Freed handles are reused, so keeping the count under the limit
+			// keeps every index in this shard's bits
+			if ( shard.ResourceCount() >= MAX_SHARD_RESOURCES )
+			{
+				memhandle_t hLRU = shard.GetFirstUnlocked();
+				if ( hLRU == INVALID_MEMHANDLE )
+					continue;
+
+				shard.DestroyResource( hLRU );
+			}
+
+			return ToShardedHandle( shard.CreateResource( createParams, bCreateLocked ), iShard );
+		}
+
+		Warning( "CShardedDataManager: all %d shards hold %d locked resources, can't create another\n", NUM_SHARDS, MAX_SHARD_RESOURCES );
+		return INVALID_MEMHANDLE;
+	}
+
+	void DestroyResource( memhandle_t hMem )				{ GetShard( hMem ).DestroyResource( ToShardHandle( hMem ) ); }
+	LOCK_TYPE LockResource( memhandle_t hMem )				{ return GetShard( hMem ).LockResource( ToShardHandle( hMem ) ); }
+	int UnlockResource( memhandle_t hMem )					{ return GetShard( hMem ).UnlockResource( ToShardHandle( hMem ) ); }
+	LOCK_TYPE GetResource_NoLock( memhandle_t hMem )		{ return GetShard( hMem ).GetResource_NoLock( ToShardHandle( hMem ) ); }
+	LOCK_TYPE GetResource_NoLockNoLRUTouch( memhandle_t hMem ) { return GetShard( hMem ).GetResource_NoLockNoLRUTouch( ToShardHandle( hMem ) ); }
+	void TouchResource( memhandle_t hMem )					{ GetShard( hMem ).TouchResource( ToShardHandle( hMem ) ); }
+	void MarkAsStale( memhandle_t hMem )					{ GetShard( hMem ).MarkAsStale( ToShardHandle( hMem ) ); }
+	int LockCount( memhandle_t hMem )						{ return GetShard( hMem ).LockCount( ToShardHandle( hMem ) ); }
+	int BreakLock( memhandle_t hMem )						{ return GetShard( hMem ).BreakLock( ToShardHandle( hMem ) ); }
+
+	// The mutex guarding hMem's shard, for callers that need to keep a
+	// resource from being evicted while they use it
+	MUTEX_TYPE &AccessMutex( memhandle_t hMem )				{ return GetShard( hMem ).AccessMutex(); }
+
+	unsigned int TargetSize() const { return m_targetMemorySize; }
+	void SetTargetSize( unsigned int targetSize ) { m_targetMemorySize = targetSize; }
+
+	// Sums the shards without locking them, so it's only approximate while
+	// other threads are creating or destroying resources
+	unsigned int UsedSize()
+	{
+		unsigned int nUsed = 0;
+		for ( int i = 0; i < NUM_SHARDS; i++ )
+		{
+			nUsed += m_Shards[i].UsedSize();
+		}
+		return nUsed;
+	}
+
+	unsigned int AvailableSize()
+	{
+		unsigned int nUsed = UsedSize();
+		return ( nUsed < m_targetMemorySize ) ? m_targetMemorySize - nUsed : 0;
+	}
+
+	int BreakAllLocks()
+	{
+		int nBroken = 0;
+		for ( int i = 0; i < NUM_SHARDS; i++ )
+		{
+			nBroken += m_Shards[i].BreakAllLocks();
+		}
+		return nBroken;
+	}
+
+	unsigned int FlushAllUnlocked()
+	{
+		unsigned int nFlushed = 0;
+		for ( int i = 0; i < NUM_SHARDS; i++ )
+		{
+			nFlushed += m_Shards[i].FlushAllUnlocked();
+		}
+		return nFlushed;
+	}
+
+	unsigned int FlushAll()
+	{
+		unsigned int nFlushed = 0;
+		for ( int i = 0; i < NUM_SHARDS; i++ )
+		{
+			nFlushed += m_Shards[i].FlushAll();
+		}
+		return nFlushed;
+	}
+
+	unsigned int FlushToTargetSize()
+	{
+		AUTO_LOCK_( MUTEX_TYPE, m_Shards[0].AccessMutex() );
+		return EnsureCapacity( 0, 0 );
+	}
+
+	Shard_t &GetShard( int iShard ) { return m_Shards[iShard]; }
+	Shard_t &GetShard( memhandle_t hMem ) { return m_Shards[(unsigned int)(uintp)hMem & ( NUM_SHARDS - 1 )]; }
+
+private:
+	bool IsOverBudget( unsigned int nSize )
+	{
+		unsigned int nUsed = UsedSize();
+		return nUsed > m_targetMemorySize || m_targetMemorySize - nUsed < nSize;
+	}
+
+	// Evicts unlocked resources until nSize more bytes fit. The caller must hold
+	// iShard's mutex; other shards are only touched if they can be locked
+	// without waiting, which also keeps two creating threads from deadlocking.
+	unsigned int EnsureCapacity( int iShard, unsigned int nSize )
+	{
+		unsigned int nFreed = 0;
+		for ( int i = 0; i < NUM_SHARDS && IsOverBudget( nSize ); i++ )
+		{
+			Shard_t &shard = m_Shards[( iShard + i ) & ( NUM_SHARDS - 1 )];
+			if ( i != 0 && !shard.TryLock() )
+				continue;
+
+			while ( IsOverBudget( nSize ) )
+			{
+				memhandle_t hLRU = shard.GetFirstUnlocked();
+				if ( hLRU == INVALID_MEMHANDLE )
+					break;
+
+				unsigned int nUsed = shard.UsedSize();
+				shard.DestroyResource( hLRU );
+				nFreed += nUsed - shard.UsedSize();
+			}
+
+			if ( i != 0 )
+			{
+				shard.Unlock();
+			}
+		}
+		return nFreed;
+	}
+
+	static memhandle_t ToShardedHandle( memhandle_t hMem, int iShard )
+	{
+		unsigned int fullWord = (unsigned int)(uintp)hMem;
+		unsigned int index = fullWord & 0xFFFF;
+		Assert( index < MAX_SHARD_RESOURCES );
+		return (memhandle_t)(uintp)( ( fullWord & 0xFFFF0000 ) | ( index << SHARD_BITS ) | iShard );
+	}
+
+	static memhandle_t ToShardHandle( memhandle_t hMem )
+	{
+		unsigned int fullWord = (unsigned int)(uintp)hMem;
+		return (memhandle_t)(uintp)( ( fullWord & 0xFFFF0000 ) | ( ( fullWord & 0xFFFF ) >> SHARD_BITS ) );
+	}
+
+	Shard_t m_Shards[NUM_SHARDS];
+	unsigned int m_targetMemorySize;
+	CInterlockedInt m_nNextShard;
+};
+
 //-----------------------------------------------------------------------------
 
 inline unsigned short CDataManagerBase::FromHandle( memhandle_t handle )
@@ -0,0 +1,216 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compiled, read-only KeyValues images.
+//
+//			A KeyValues image is a flat, position independent blob made of a
+//			header, an array of fixed size nodes linked by child/peer indices
+//			and a string table. Images can be memory mapped straight from disk
+//			and queried through KeyValuesView without allocating anything, or
+//			inflated back into a regular KeyValues tree without tokenizing.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef KVBINARYIMAGE_H
+#define KVBINARYIMAGE_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/platform.h"
+#include "utlmemory.h"
+#include "utlvector.h"
+#include "utlstring.h"
+#include "Color.h"
+
+class KeyValues;
+class CUtlBuffer;
+class IBaseFileSystem;
+class CKeyValuesImage;
+
+#define KVIMAGE_MAGIC			MAKEID( 'K', 'V', 'B', 'I' )
+#define KVIMAGE_VERSION			3
+#define KVIMAGE_INVALID_NODE	-1
+
+// File extension used for images compiled next to (or cached for) a text file
+#define KVIMAGE_EXTENSION		".kvb"
+
+//-----------------------------------------------------------------------------
+// On-disk layout. Everything is little endian and 4 byte aligned; offsets are
+// relative to the start of the image.
+//-----------------------------------------------------------------------------
+struct KVImageHeader_t
+{
+	int		m_nMagic;
+	int		m_nVersion;
+	int		m_nImageSize;		// Total size, header included
+	int		m_nNodeCount;
+	int		m_nNodeOffset;
+	int		m_nDependencyCount;
+	int		m_nDependencyOffset;	// Directly after the nodes
+	int		m_nStringOffset;		// Directly after the dependencies
+	int		m_nStringSize;
+	int		m_nRootNode;		// First top level key; later top level keys are its peers
+};
+
+struct KVImageNode_t
+{
+	int		m_nName;			// String table offset
+	unsigned int m_nNameHash;	// HashStringCaseless of the name, for quick rejects in FindKey
+	int		m_nFirstChild;		// KVIMAGE_INVALID_NODE if none
+	int		m_nNextPeer;		// KVIMAGE_INVALID_NODE if none
+	int		m_nValue[2];		// int / float / color, or both halves of a uint64
+	int		m_nText;			// String table offset of the value as GetString would return it
+	unsigned char m_nType;		// KeyValues::types_t
+	unsigned char m_pad[3];
+};
+
+// A file the image was compiled from (the text itself, #include and #base
+// files) and its timestamp at the time
+struct KVImageDependency_t
+{
+	int		m_nFile;			// String table offset
+	int		m_nFileTime;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Lightweight handle to one node of a KeyValues image. Views are two
+//			words, are passed by value and never allocate. They are only valid
+//			while the owning CKeyValuesImage is loaded.
+//-----------------------------------------------------------------------------
+class KeyValuesView
+{
+public:
+	KeyValuesView() : m_pImage( NULL ), m_nNode( KVIMAGE_INVALID_NODE ) {}
+	KeyValuesView( const CKeyValuesImage *pImage, int nNode ) : m_pImage( pImage ), m_nNode( nNode ) {}
+
+	bool IsValid() const { return m_pImage != NULL && m_nNode != KVIMAGE_INVALID_NODE; }
+	operator bool() const { return IsValid(); }
+
+	const char *GetName() const;
+	int GetDataType() const;
+	int GetNodeIndex() const { return m_nNode; }
+
+	// Same semantics as the KeyValues functions of the same name. Key names may
+	// be paths ("a/b/c"); matching is case insensitive.
+	KeyValuesView FindKey( const char *pKeyName ) const;
+	KeyValuesView GetFirstSubKey() const;
+	KeyValuesView GetNextKey() const;
+	KeyValuesView GetFirstTrueSubKey() const;
+	KeyValuesView GetNextTrueSubKey() const;
+	KeyValuesView GetFirstValue() const;
+	KeyValuesView GetNextValue() const;
+
+	int GetInt( const char *pKeyName = NULL, int nDefaultValue = 0 ) const;
+	uint64 GetUint64( const char *pKeyName = NULL, uint64 nDefaultValue = 0 ) const;
+	float GetFloat( const char *pKeyName = NULL, float flDefaultValue = 0.0f ) const;
+	bool GetBool( const char *pKeyName = NULL, bool bDefaultValue = false ) const { return GetInt( pKeyName, bDefaultValue ? 1 : 0 ) ? true : false; }
+	Color GetColor( const char *pKeyName = NULL ) const;
+
+	// Always returns a pointer into the image; numeric values are stored in
+	// the string table pre-formatted, colors as "r g b a" and TYPE_WSTRING
+	// values as UTF-8.
+	const char *GetString( const char *pKeyName = NULL, const char *pDefaultValue = "" ) const;
+
+	bool IsEmpty( const char *pKeyName = NULL ) const;
+
+	// Builds a regular KeyValues tree from this node and its children (not its peers)
+	KeyValues *MakeKeyValues() const;
+
+private:
+	const KVImageNode_t *GetNode() const;
+
+	const CKeyValuesImage *m_pImage;
+	int m_nNode;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Owns a KeyValues image, either memory mapped from a loose file,
+//			read into memory (files inside packs) or referenced in place.
+//-----------------------------------------------------------------------------
+class CKeyValuesImage
+{
+public:
+	CKeyValuesImage();
+	~CKeyValuesImage();
+
+	// Serializes pKeyValues and all of its peers (as LoadFromBuffer produces
+	// them for files with several top level keys) into buf. pDependencies
+	// lists the files it was parsed from; their current timestamps in pPathID
+	// are stored so LoadOrCompile can tell when the image is stale.
+	static bool Compile( KeyValues *pKeyValues, CUtlBuffer &buf, IBaseFileSystem *pFileSystem = NULL, const char *pPathID = NULL, const CUtlVector< CUtlString > *pDependencies = NULL );
+
+	// Returns true if the memory looks like an image (checks the header only)
+	static bool IsImage( const void *pData, int nSize );
+
+	// Inflates an image into pDest the same way KeyValues::LoadFromBuffer
+	// would have: pDest becomes the first top level key and further top level
+	// keys are chained as its peers.
+	static bool ReadInto( KeyValues *pDest, const void *pData, int nSize );
+
+	// Same as ReadInto, from a loaded image
+	bool CopyInto( KeyValues *pDest ) const;
+
+	// References memory owned by the caller; it must outlive this object
+	bool InitFromMemory( const void *pData, int nSize );
+
+	// Takes a copy of the buffer contents
+	bool InitFromBuffer( const CUtlBuffer &buf );
+
+	// Maps a file read-only. Files that are not on disk (pack files) are read
+	// into memory instead.
+	bool InitFromFile( IBaseFileSystem *pFileSystem, const char *pFileName, const char *pPathID = NULL );
+
+	// Loads pTextFile's compiled image from pCachePathID if none of the files
+	// it was compiled from changed since; otherwise parses the text with the
+	// given settings, writes a fresh image there and uses that. pCachePathID
+	// may be NULL to compile in memory only.
+	bool LoadOrCompile( IBaseFileSystem *pFileSystem, const char *pTextFile, const char *pPathID = NULL, 
+		bool bEscapeSequences = false, bool bEvaluateConditionals = true, const char *pCachePathID = "DEFAULT_WRITE_PATH" );
+
+	// Called by KeyValues for every #include and #base file it loads, so
+	// images compiled on this thread record them as dependencies
+	static void NoteIncludedFile( const char *pFileName );
+
+	void Shutdown();
+
+	bool IsLoaded() const { return m_pHeader != NULL; }
+	bool IsMapped() const { return m_pMappedView != NULL; }
+	int GetImageSize() const { return m_pHeader ? m_pHeader->m_nImageSize : 0; }
+	int GetNodeCount() const { return m_pHeader ? m_pHeader->m_nNodeCount : 0; }
+	int GetDependencyCount() const { return m_pHeader ? m_pHeader->m_nDependencyCount : 0; }
+	const KVImageDependency_t *GetDependency( int i ) const { return &m_pDependencies[i]; }
+
+	KeyValuesView GetRoot() const { return KeyValuesView( this, m_pHeader ? m_pHeader->m_nRootNode : KVIMAGE_INVALID_NODE ); }
+
+	const KVImageNode_t *GetNode( int nNode ) const { return &m_pNodes[nNode]; }
+	const char *GetString( int nOffset ) const { return m_pStrings + nOffset; }
+
+	// Builds the name of the image that caches pTextFile as loaded from
+	// pPathID with the given parse settings
+	static void GetImageFileName( const char *pTextFile, const char *pPathID, bool bEscapeSequences, bool bEvaluateConditionals, char *pImageFile, int nMaxLen );
+
+private:
+	bool Bind( const void *pData, int nSize );
+	static bool Validate( const void *pData, int nSize );
+
+	bool IsUpToDate( IBaseFileSystem *pFileSystem, const char *pPathID ) const;
+	void NoteDependencies() const;
+
+	const KVImageHeader_t *m_pHeader;
+	const KVImageNode_t *m_pNodes;
+	const KVImageDependency_t *m_pDependencies;
+	const char *m_pStrings;
+
+	CUtlMemory<unsigned char> m_OwnedData;
+	void *m_pMappedView;
+	int m_nMappedSize;
+};
+
+inline const KVImageNode_t *KeyValuesView::GetNode() const
+{
+	return m_pImage->GetNode( m_nNode );
+}
+
+#endif // KVBINARYIMAGE_H
@@ -106,24 +106,85 @@ protected:
 
 
 //-----------------------------------------------------------------------------
-// 
+// Thread-safe pool. Threads allocate from and free to magazines: small stacks
+// of free blocks that only exchange blocks with the shared pool, in batches,
+// when they run empty or fill up. Threads are spread over the magazines by
+// thread id, so each magazine's lock is normally only taken by one thread and
+// the pool mutex is only taken once per batch.
 //-----------------------------------------------------------------------------
 class CMemoryPoolMT : public CUtlMemoryPool
 {
 public:
-	CMemoryPoolMT(int blockSize, int numElements, int growMode = UTLMEMORYPOOL_GROW_FAST, const char *pszAllocOwner = NULL) : CUtlMemoryPool( blockSize, numElements, growMode, pszAllocOwner) {}
+	CMemoryPoolMT(int blockSize, int numElements, int growMode = UTLMEMORYPOOL_GROW_FAST, const char *pszAllocOwner = NULL);
+	~CMemoryPoolMT();
 
-
-	void*		Alloc()	{ AUTO_LOCK( m_mutex ); return CUtlMemoryPool::Alloc(); }
-	void*		Alloc( size_t amount )	{ AUTO_LOCK( m_mutex ); return CUtlMemoryPool::Alloc( amount ); }
-	void*		AllocZero()	{ AUTO_LOCK( m_mutex ); return CUtlMemoryPool::AllocZero(); }	
-	void*		AllocZero( size_t amount )	{ AUTO_LOCK( m_mutex ); return CUtlMemoryPool::AllocZero( amount ); }
-	void		Free(void *pMem) { AUTO_LOCK( m_mutex ); CUtlMemoryPool::Free( pMem ); }
+	void*		Alloc()	{ return Alloc( m_BlockSize ); }
+	void*		Alloc( size_t amount );
+	void*		AllocZero()	{ return AllocZero( m_BlockSize ); }
+	void*		AllocZero( size_t amount );
+	void		Free(void *pMem);
 
 	// Frees everything
-	void		Clear() { AUTO_LOCK( m_mutex ); return CUtlMemoryPool::Clear(); }
+	void		Clear();
+
+	// Returns the blocks cached in the magazines to the shared pool
+	void		FlushMagazines();
+
+	// Number of blocks handed out; unlike the base class this doesn't count
+	// free blocks cached in magazines
+	int			Count();
+
+	struct Stats_t
+	{
+		const char	*m_pszAllocOwner;
+		int			m_nBlockSize;
+		int			m_nInUse;			// Blocks currently handed out
+		int			m_nCached;			// Free blocks sitting in magazines
+		int			m_nPeakFromPool;	// High-water mark of blocks out of the shared pool (in use + cached)
+		int			m_nBlobs;
+		uint64		m_nAllocs;			// Totals since the pool was created
+		uint64		m_nFrees;
+		int			m_nBatches;			// Refills and drains of magazines
+		int			m_nContention;		// Magazine or pool locks that had to wait
+	};
+
+	void		GetStats( Stats_t &stats );
+
+	// Stats for every CMemoryPoolMT alive in this module
+	static void	GetAllStats( CUtlVector<Stats_t> &stats );
+
 private:
-	CThreadFastMutex m_mutex; // @TODO: Rework to use tslist (toml 7/6/2007)
+	enum
+	{
+		MAGAZINE_BITS = 3,
+		MAGAZINE_COUNT = 1 << MAGAZINE_BITS,
+		MAGAZINE_SIZE = 16,
+		MAGAZINE_BATCH = MAGAZINE_SIZE / 2,
+	};
+
+	struct Magazine_t
+	{
+		CThreadFastMutex	m_mutex;
+		int					m_nCount;
+		void				*m_pBlocks[MAGAZINE_SIZE];
+		uint64				m_nAllocs;
+		uint64				m_nFrees;
+		int					m_nContention;
+	};
+
+	Magazine_t	&LockMagazine();
+	void		LockPool();
+	void		RefillMagazine( Magazine_t &magazine );
+	void		DrainMagazine( Magazine_t &magazine, int nBlocks );
+
+	Magazine_t	m_Magazines[MAGAZINE_COUNT];
+	CThreadFastMutex m_mutex;
+	int			m_nBatches;
+	int			m_nPoolContention;
+
+	// Registry of live pools for GetAllStats
+	CMemoryPoolMT *m_pNextPool;
+	CMemoryPoolMT *m_pPrevPool;
 };
 
 
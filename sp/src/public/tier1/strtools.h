@@ -138,6 +138,21 @@ char*		V_stristr( char* pStr, const char* pSearch );
 const char*	V_stristr( const char* pStr, const char* pSearch );
 const char*	V_strnistr( const char* pStr, const char* pSearch, int n );
 const char*	V_strnchr( const char* pStr, char c, int n );
+
+// Scanning helpers, vectorized where the platform allows. Case folding is
+// ASCII only and whitespace is the C locale set, as the tokenizers expect.
+
+// Number of leading characters pA and pB share ignoring ASCII case, up to
+// the first NUL or nMax
+int			V_StrCaselessMatchLength( const char *pA, const char *pB, int nMax = 0x7fffffff );
+// Index of the first of nLen bytes that is one of pChars (at most 8, NUL
+// allowed) or, with bStopAtSpace, whitespace. nLen if there is none.
+int			V_FindFirstOf( const char *pBuf, int nLen, const char *pChars, int nChars, bool bStopAtSpace = false );
+// Number of leading whitespace bytes
+int			V_SkipWhitespace( const char *pBuf, int nLen );
+// True if the string (nLen bytes, or up to the NUL if nLen < 0) is well
+// formed UTF-8: no overlong forms, surrogates or code points past U+10FFFF
+bool		V_IsValidUTF8( const char *pStr, int nLen = -1 );
 inline int V_strcasecmp (const char *s1, const char *s2) { return V_stricmp(s1, s2); }
 inline int V_strncasecmp (const char *s1, const char *s2, int n) { return V_strnicmp(s1, s2, n); }
 void		V_qsort_s( void *base, size_t num, size_t width, int ( __cdecl *compare )(void *, const void *,
@@ -23,6 +23,9 @@
 // Forward declarations
 //-----------------------------------------------------------------------------
 struct characterset_t;
+class IBaseFileSystem;
+class IFileSystem;
+typedef void * FileHandle_t;
 
 	
 //-----------------------------------------------------------------------------
@@ -287,6 +290,10 @@ public:
 	const void* PeekGet( int offset = 0 ) const;
 	const void* PeekGet( int nMaxSize, int nOffset );
 
+	// Up to nMaxSize contiguous bytes at the get position, for scanning
+	// without advancing it. Returns NULL with *pSize 0 when nothing is left.
+	const char* PeekGetSpan( int nMaxSize, int *pSize );
+
 	// Where am I writing (put)/reading (get)?
 	int TellPut( ) const;
 	int TellGet( ) const;
@@ -553,6 +560,69 @@ public:
 };
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Read-only buffer over a memory mapped file. Gets read straight out
+//			of the mapping, so loading never copies the file and the OS only
+//			pages in what is actually parsed.
+//-----------------------------------------------------------------------------
+class CUtlMappedBuffer : public CUtlBuffer
+{
+public:
+	CUtlMappedBuffer();
+	~CUtlMappedBuffer();
+
+	// Maps a file by full path. nFlags may add TEXT_BUFFER and CONTAINS_CRLF;
+	// the buffer is always READ_ONLY. With bCopyOnWrite, Base() may be written
+	// to in place; the changes stay private to this process.
+	bool MapFile( const char *pFullPath, int nFlags = 0, bool bCopyOnWrite = false );
+
+	// Maps pFileName if it is a loose file. Files inside pack files, or that
+	// can't be mapped, are read into memory instead.
+	bool Open( IFileSystem *pFileSystem, const char *pFileName, const char *pPathID = NULL, int nFlags = 0 );
+
+	void Close();
+
+	bool IsMapped() const { return m_pMappedView != NULL; }
+
+	// Raw mapping, for callers that don't want a buffer. Returns NULL for
+	// empty files or on failure.
+	static void *MapFileView( const char *pFullPath, int *pSize, bool bCopyOnWrite = false );
+	static void UnmapFileView( void *pView, int nSize );
+
+private:
+	void *m_pMappedView;
+	int m_nMappedSize;
+};
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Read-only buffer that streams a file through a fixed size window,
+//			refilling it from the file handle as gets run past its end.
+//			TellMaxPut() is the file size, but Base() and PeekGet() only see
+//			the current window, so this suits parsers that read front to back.
+//-----------------------------------------------------------------------------
+class CUtlStreamReadBuffer : public CUtlBuffer
+{
+public:
+	CUtlStreamReadBuffer( int nWindowSize = 64 * 1024 );
+	~CUtlStreamReadBuffer();
+
+	// nFlags may add TEXT_BUFFER and CONTAINS_CRLF; the file is always read as binary
+	bool Open( IBaseFileSystem *pFileSystem, const char *pFileName, const char *pPathID = NULL, int nFlags = 0 );
+	void Close();
+
+	bool IsOpen() const { return m_hFile != NULL; }
+
+private:
+	bool StreamGetOverflow( int nSize );
+
+	IBaseFileSystem *m_pFileSystem;
+	FileHandle_t m_hFile;
+	int m_nWindowSize;
+	int m_nFilePos;
+};
+
+
 //-----------------------------------------------------------------------------
 // Where am I reading?
 //-----------------------------------------------------------------------------
@@ -0,0 +1,601 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: a cache-friendly open addressing hash map.
+//
+// CUtlFlatHashMap keeps keys and values in one flat array, with a parallel
+// array of stored hashes and a byte of control data per slot. Lookups hash
+// once, then compare 16 control bytes at a time (SSE2 where available) and
+// only touch the entries whose 7-bit hash fragment matches, so a typical
+// hit costs one or two cache lines instead of a walk down a red-black tree.
+//
+// Usage notes:
+// - handles are NOT STABLE across insertion or removal; don't hold on to
+//   them, and use RemoveIf() to remove elements based on a predicate rather
+//   than removing while iterating with FirstHandle()/NextHandle().
+// - Insert() first searches for an existing match and returns it if found
+// - like CUtlHashtable, keys with an AltArgumentType_t (CUtlString) can be
+//   looked up with the alternate type (const char *) without constructing
+//   a temporary key; the hash and equality functors must accept both.
+// - keys and values must be copy constructible; they are moved by copy
+//   construction when the table grows or an entry is shifted on removal.
+// - Serialize()/Unserialize() write the count followed by key/value pairs
+//   using the utlbufferutil overloads for the key and value types.
+//
+// CUtlFlatHashMap< int, float >  mapFromIntsToFloats;
+// CUtlFlatHashMap< CUtlString, int, CaselessStringHashFunctor, CaselessStringEqualFunctor >  dict;
+//
+// Implementation notes:
+// - linear probing with a power of two capacity, load kept under 7/8
+// - control bytes are 0x80 for an empty slot or the top 7 bits of the hash
+//   for a full one; the first GROUP_SIZE control bytes are mirrored past the
+//   end of the array so a group can be loaded at any slot without wrapping
+// - deletion shifts later members of the cluster back into the hole
+//   (Knuth's algorithm R), so there are no tombstones and probe sequences
+//   never degrade after many removals
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef UTLFLATHASHMAP_H
+#define UTLFLATHASHMAP_H
+#pragma once
+
+#include "strtools.h"
+#include "utlcommon.h"
+#include "utlmemory.h"
+#include "utlbufferutil.h"
+#include "mathlib/mathlib.h"
+
+#if defined( _WIN32 ) && !defined( _X360 )
+#include <intrin.h>
+#endif
+
+#if ( defined( _WIN32 ) && !defined( _X360 ) ) || defined( __SSE2__ )
+#include <emmintrin.h>
+#define UTLFLATHASH_SSE2 1
+#endif
+
+#define FOR_EACH_FLATHASHMAP( map, iter ) \
+	for ( UtlFlatHashHandle_t iter = (map).FirstHandle(); iter != (map).InvalidHandle(); iter = (map).NextHandle( iter ) )
+
+typedef int UtlFlatHashHandle_t;
+
+//-----------------------------------------------------------------------------
+// 16 control bytes compared at once. Bit n of a mask refers to slot (pos + n).
+//-----------------------------------------------------------------------------
+class CUtlFlatHashGroup
+{
+public:
+	enum { GROUP_SIZE = 16 };
+	enum { CTRL_EMPTY = 0x80 };
+
+	explicit CUtlFlatHashGroup( const uint8 *pCtrl )
+	{
+#ifdef UTLFLATHASH_SSE2
+		m_ctrl = _mm_loadu_si128( (const __m128i *)pCtrl );
+#else
+		m_pCtrl = pCtrl;
+#endif
+	}
+
+	// Slots whose control byte equals tag
+	uint32 Match( uint8 tag ) const
+	{
+#ifdef UTLFLATHASH_SSE2
+		return (uint32)_mm_movemask_epi8( _mm_cmpeq_epi8( m_ctrl, _mm_set1_epi8( (char)tag ) ) );
+#else
+		uint32 mask = 0;
+		for ( int i = 0; i < GROUP_SIZE; ++i )
+			mask |= (uint32)( m_pCtrl[i] == tag ) << i;
+		return mask;
+#endif
+	}
+
+	// Empty slots; only empty slots have the high bit set
+	uint32 MatchEmpty() const
+	{
+#ifdef UTLFLATHASH_SSE2
+		return (uint32)_mm_movemask_epi8( m_ctrl );
+#else
+		uint32 mask = 0;
+		for ( int i = 0; i < GROUP_SIZE; ++i )
+			mask |= (uint32)( m_pCtrl[i] >> 7 ) << i;
+		return mask;
+#endif
+	}
+
+	static int LowestBit( uint32 mask )
+	{
+		Assert( mask );
+#if defined( _WIN32 ) && !defined( _X360 )
+		unsigned long out;
+		_BitScanForward( &out, mask );
+		return (int)out;
+#elif defined( __GNUC__ )
+		return __builtin_ctz( mask );
+#else
+		int n = 0;
+		while ( !( mask & 1 ) ) { mask >>= 1; ++n; }
+		return n;
+#endif
+	}
+
+private:
+#ifdef UTLFLATHASH_SSE2
+	__m128i m_ctrl;
+#else
+	const uint8 *m_pCtrl;
+#endif
+};
+
+template <typename KeyT, typename ValueT = empty_t, typename KeyHashT = DefaultHashFunctor<KeyT>, typename KeyIsEqualT = DefaultEqualFunctor<KeyT>, typename AlternateKeyT = typename ArgumentTypeInfo<KeyT>::Alt_t >
+class CUtlFlatHashMap
+{
+public:
+	typedef UtlFlatHashHandle_t handle_t;
+	typedef CUtlKeyValuePair<KeyT, ValueT> KVPair;
+
+protected:
+	typedef typename ArgumentTypeInfo<KeyT>::Arg_t KeyArg_t;
+	typedef typename ArgumentTypeInfo<ValueT>::Arg_t ValueArg_t;
+	typedef typename ArgumentTypeInfo<AlternateKeyT>::Arg_t KeyAlt_t;
+
+	enum { GROUP_SIZE = CUtlFlatHashGroup::GROUP_SIZE };
+	enum { CTRL_EMPTY = CUtlFlatHashGroup::CTRL_EMPTY };
+
+	static uint8 HashTag( uint32 h ) { return (uint8)( h >> 25 ); }
+
+	// Empty table, all control bytes cleared
+	void DoAlloc( int nCapacity );
+
+	// Allocate a larger table and re-insert all existing entries
+	void DoRealloc( int nCapacity );
+
+	void SetCtrl( int idx, uint8 ctrl )
+	{
+		m_ctrl[idx] = ctrl;
+		if ( idx < GROUP_SIZE - 1 )
+			m_ctrl[m_nCapacity + idx] = ctrl;
+	}
+
+	// First empty slot in the probe sequence for hash h
+	int FindEmptySlot( uint32 h ) const;
+
+	template <typename KeyParamT> handle_t DoLookup( KeyParamT k, uint32 h ) const;
+	template <typename KeyParamT> handle_t DoInsert( KeyParamT k, uint32 h, bool *pDidInsert );
+	template <typename KeyParamT> handle_t DoInsert( KeyParamT k, ValueArg_t v, uint32 h, bool *pDidInsert );
+
+	// Destroys the entry at idx and closes the gap; returns the slot left empty
+	int DoRemoveAt( int idx );
+
+	CUtlMemory< uint8 > m_ctrl;
+	CUtlMemory< uint32 > m_hashes;
+	CUtlMemory< KVPair > m_entries;
+	int m_nCapacity;
+	int m_nUsed;
+	KeyIsEqualT m_eq;
+	KeyHashT m_hash;
+
+public:
+	explicit CUtlFlatHashMap( int nExpected = 0 )
+		: m_nCapacity( 0 ), m_nUsed( 0 ), m_eq(), m_hash() { if ( nExpected > 0 ) Reserve( nExpected ); }
+
+	CUtlFlatHashMap( int nExpected, const KeyHashT &hash, const KeyIsEqualT &eq = KeyIsEqualT() )
+		: m_nCapacity( 0 ), m_nUsed( 0 ), m_eq( eq ), m_hash( hash ) { if ( nExpected > 0 ) Reserve( nExpected ); }
+
+	~CUtlFlatHashMap() { RemoveAll(); }
+
+	// Functor access
+	KeyHashT &GetHashRef() { return m_hash; }
+	KeyIsEqualT &GetEqualRef() { return m_eq; }
+	const KeyHashT &GetHashRef() const { return m_hash; }
+	const KeyIsEqualT &GetEqualRef() const { return m_eq; }
+
+	// Handle validation
+	bool IsValidHandle( handle_t idx ) const { return (unsigned)idx < (unsigned)m_nCapacity && !( m_ctrl[idx] & CTRL_EMPTY ); }
+	static handle_t InvalidHandle() { return (handle_t)-1; }
+
+	// Iteration, in slot order
+	handle_t FirstHandle() const { return NextHandle( (handle_t)-1 ); }
+	handle_t NextHandle( handle_t idx ) const;
+
+	int Count() const { return m_nUsed; }
+	int Capacity() const { return m_nCapacity; }
+
+	// Key lookup, returns InvalidHandle() if not found
+	handle_t Find( KeyArg_t k ) const { return DoLookup<KeyArg_t>( k, m_hash( k ) ); }
+	handle_t Find( KeyArg_t k, unsigned int hash ) const { Assert( hash == m_hash( k ) ); return DoLookup<KeyArg_t>( k, hash ); }
+	// Alternate-type key lookup, returns InvalidHandle() if not found
+	handle_t Find( KeyAlt_t k ) const { return DoLookup<KeyAlt_t>( k, m_hash( k ) ); }
+	handle_t Find( KeyAlt_t k, unsigned int hash ) const { Assert( hash == m_hash( k ) ); return DoLookup<KeyAlt_t>( k, hash ); }
+
+	bool HasElement( KeyArg_t k ) const { return InvalidHandle() != Find( k ); }
+	bool HasElement( KeyAlt_t k ) const { return InvalidHandle() != Find( k ); }
+
+	// Key insertion or lookup, always returns a valid handle
+	handle_t Insert( KeyArg_t k ) { return DoInsert<KeyArg_t>( k, m_hash( k ), NULL ); }
+	handle_t Insert( KeyArg_t k, ValueArg_t v, bool *pDidInsert = NULL ) { return DoInsert<KeyArg_t>( k, v, m_hash( k ), pDidInsert ); }
+	handle_t Insert( KeyAlt_t k ) { return DoInsert<KeyAlt_t>( k, m_hash( k ), NULL ); }
+	handle_t Insert( KeyAlt_t k, ValueArg_t v, bool *pDidInsert = NULL ) { return DoInsert<KeyAlt_t>( k, v, m_hash( k ), pDidInsert ); }
+
+	// Key removal, returns false if not found
+	bool Remove( KeyArg_t k ) { handle_t h = Find( k ); if ( h == InvalidHandle() ) return false; DoRemoveAt( h ); return true; }
+	bool Remove( KeyAlt_t k ) { handle_t h = Find( k ); if ( h == InvalidHandle() ) return false; DoRemoveAt( h ); return true; }
+	void RemoveAt( handle_t idx ) { Assert( IsValidHandle( idx ) ); DoRemoveAt( idx ); }
+
+	// Removes every element for which pred( key, value ) returns true.
+	// Returns the number of elements removed.
+	template < typename PredicateT > int RemoveIf( PredicateT pred );
+
+	// Destroy contents, keep memory
+	void RemoveAll();
+
+	// Destroy contents and release memory
+	void Purge() { RemoveAll(); m_ctrl.Purge(); m_hashes.Purge(); m_entries.Purge(); m_nCapacity = 0; }
+
+	// Grow so that nExpected elements fit without reallocating
+	void Reserve( int nExpected );
+
+	// Access functions. Note: if ValueT is empty_t, all functions return const keys.
+	typedef typename KVPair::ValueReturn_t Element_t;
+	const KeyT &Key( handle_t idx ) const { Assert( IsValidHandle( idx ) ); return m_entries[idx].m_key; }
+	const Element_t &Element( handle_t idx ) const { Assert( IsValidHandle( idx ) ); return m_entries[idx].GetValue(); }
+	Element_t &Element( handle_t idx ) { Assert( IsValidHandle( idx ) ); return m_entries[idx].GetValue(); }
+	const Element_t &operator[]( handle_t idx ) const { return Element( idx ); }
+	Element_t &operator[]( handle_t idx ) { return Element( idx ); }
+
+	const Element_t &Get( KeyArg_t k, const Element_t &defaultValue ) const { handle_t h = Find( k ); return h != InvalidHandle() ? Element( h ) : defaultValue; }
+	const Element_t &Get( KeyAlt_t k, const Element_t &defaultValue ) const { handle_t h = Find( k ); return h != InvalidHandle() ? Element( h ) : defaultValue; }
+
+	const Element_t *GetPtr( KeyArg_t k ) const { handle_t h = Find( k ); return h != InvalidHandle() ? &Element( h ) : NULL; }
+	const Element_t *GetPtr( KeyAlt_t k ) const { handle_t h = Find( k ); return h != InvalidHandle() ? &Element( h ) : NULL; }
+	Element_t *GetPtr( KeyArg_t k ) { handle_t h = Find( k ); return h != InvalidHandle() ? &Element( h ) : NULL; }
+	Element_t *GetPtr( KeyAlt_t k ) { handle_t h = Find( k ); return h != InvalidHandle() ? &Element( h ) : NULL; }
+
+	// Swap memory and contents with another identical map
+	void Swap( CUtlFlatHashMap &other )
+	{
+		m_ctrl.Swap( other.m_ctrl );
+		m_hashes.Swap( other.m_hashes );
+		m_entries.Swap( other.m_entries );
+		::V_swap( m_nCapacity, other.m_nCapacity );
+		::V_swap( m_nUsed, other.m_nUsed );
+	}
+
+	// Average number of slots examined past the ideal slot, for tuning
+	float AverageProbeLength() const;
+
+#ifdef _DEBUG
+	void DbgCheckIntegrity() const;
+#endif
+
+private:
+	CUtlFlatHashMap( const CUtlFlatHashMap &copyConstructorIsNotImplemented );
+	CUtlFlatHashMap &operator=( const CUtlFlatHashMap &assignmentIsNotImplemented );
+};
+
+
+template <typename KeyT, typename ValueT, typename KeyHashT, typename KeyIsEqualT, typename AltKeyT>
+void CUtlFlatHashMap<KeyT, ValueT, KeyHashT, KeyIsEqualT, AltKeyT>::DoAlloc( int nCapacity )
+{
+	Assert( IsPowerOfTwo( nCapacity ) && nCapacity >= GROUP_SIZE );
+	m_nCapacity = nCapacity;
+	m_ctrl.EnsureCapacity( nCapacity + GROUP_SIZE );
+	m_hashes.EnsureCapacity( nCapacity );
+	m_entries.EnsureCapacity( nCapacity );
+	memset( m_ctrl.Base(), CTRL_EMPTY, nCapacity + GROUP_SIZE );
+}
+
+template <typename KeyT, typename ValueT, typename KeyHashT, typename KeyIsEqualT, typename AltKeyT>
+void CUtlFlatHashMap<KeyT, ValueT, KeyHashT, KeyIsEqualT, AltKeyT>::DoRealloc( int nCapacity )
+{
+	nCapacity = SmallestPowerOfTwoGreaterOrEqual( MAX( (int)GROUP_SIZE, nCapacity ) );
+	Assert( nCapacity > m_nUsed );
+
+	CUtlMemory< uint8 > oldCtrl;
+	CUtlMemory< uint32 > oldHashes;
+	CUtlMemory< KVPair > oldEntries;
+	oldCtrl.Swap( m_ctrl );
+	oldHashes.Swap( m_hashes );
+	oldEntries.Swap( m_entries );
+	int nOldCapacity = m_nCapacity;
+
+	DoAlloc( nCapacity );
+
+	for ( int i = 0; i < nOldCapacity; ++i )
+	{
+		if ( oldCtrl[i] & CTRL_EMPTY )
+			continue;
+
+		uint32 h = oldHashes[i];
+		int idx = FindEmptySlot( h );
+		SetCtrl( idx, HashTag( h ) );
+		m_hashes[idx] = h;
+		CopyConstruct( &m_entries[idx], oldEntries[i] );
+		Destruct( &oldEntries[i] );
+	}
+}
+
+template <typename KeyT, typename ValueT, typename KeyHashT, typename KeyIsEqualT, typename AltKeyT>
+void CUtlFlatHashMap<KeyT, ValueT, KeyHashT, KeyIsEqualT, AltKeyT>::Reserve( int nExpected )
+{
+	// Keep the load factor at or under 7/8
+	int nNeeded = nExpected + ( nExpected + 6 ) / 7;
+	if ( nNeeded > m_nCapacity )
+	{
+		DoRealloc( nNeeded );
+	}
+}
+
+template <typename KeyT, typename ValueT, typename KeyHashT, typename KeyIsEqualT, typename AltKeyT>
+int CUtlFlatHashMap<KeyT, ValueT, KeyHashT, KeyIsEqualT, AltKeyT>::FindEmptySlot( uint32 h ) const
+{
+	const uint32 mask = m_nCapacity - 1;
+	for ( uint32 pos = h & mask; ; pos = ( pos + GROUP_SIZE ) & mask )
+	{
+		uint32 empty = CUtlFlatHashGroup( m_ctrl.Base() + pos ).MatchEmpty();
+		if ( empty )
+			return ( pos + CUtlFlatHashGroup::LowestBit( empty ) ) & mask;
+	}
+}
+
+template <typename KeyT, typename ValueT, typename KeyHashT, typename KeyIsEqualT, typename AltKeyT>
+template <typename KeyParamT>
+UtlFlatHashHandle_t CUtlFlatHashMap<KeyT, ValueT, KeyHashT, KeyIsEqualT, AltKeyT>::DoLookup( KeyParamT k, uint32 h ) const
+{
+	if ( !m_nUsed )
+		return InvalidHandle();
+
+	const uint32 mask = m_nCapacity - 1;
+	const uint8 tag = HashTag( h );
+	const uint8 *pCtrl = m_ctrl.Base();
+	const uint32 *pHashes = m_hashes.Base();
+	const KVPair *pEntries = m_entries.Base();
+
+	// An element always sits in the first empty-free run starting at its
+	// ideal slot, so the first group containing an empty slot ends the search.
+	for ( uint32 pos = h & mask; ; pos = ( pos + GROUP_SIZE ) & mask )
+	{
+		CUtlFlatHashGroup group( pCtrl + pos );
+		for ( uint32 match = group.Match( tag ); match; match &= match - 1 )
+		{
+			uint32 idx = ( pos + CUtlFlatHashGroup::LowestBit( match ) ) & mask;
+			if ( pHashes[idx] == h && m_eq( pEntries[idx].m_key, k ) )
+				return (handle_t)idx;
+		}
+
+		if ( group.MatchEmpty() )
+			return InvalidHandle();
+	}
+}
+
+template <typename KeyT, typename ValueT, typename KeyHashT, typename KeyIsEqualT, typename AltKeyT>
+template <typename KeyParamT>
+UtlFlatHashHandle_t CUtlFlatHashMap<KeyT, ValueT, KeyHashT, KeyIsEqualT, AltKeyT>::DoInsert( KeyParamT k, uint32 h, bool *pDidInsert )
+{
+	handle_t idx = DoLookup<KeyParamT>( k, h );
+	if ( pDidInsert )
+		*pDidInsert = ( idx == InvalidHandle() );
+	if ( idx != InvalidHandle() )
+		return idx;
+
+	Reserve( m_nUsed + 1 );
+	idx = FindEmptySlot( h );
+	SetCtrl( idx, HashTag( h ) );
+	m_hashes[idx] = h;
+	::new ( &m_entries[idx] ) KVPair( k );
+	++m_nUsed;
+	return idx;
+}
+
+template <typename KeyT, typename ValueT, typename KeyHashT, typename KeyIsEqualT, typename AltKeyT>
+template <typename KeyParamT>
+UtlFlatHashHandle_t CUtlFlatHashMap<KeyT, ValueT, KeyHashT, KeyIsEqualT, AltKeyT>::DoInsert( KeyParamT k, ValueArg_t v, uint32 h, bool *pDidInsert )
+{
+	handle_t idx = DoLookup<KeyParamT>( k, h );
+	if ( pDidInsert )
+		*pDidInsert = ( idx == InvalidHandle() );
+	if ( idx != InvalidHandle() )
+		return idx;
+
+	Reserve( m_nUsed + 1 );
+	idx = FindEmptySlot( h );
+	SetCtrl( idx, HashTag( h ) );
+	m_hashes[idx] = h;
+	::new ( &m_entries[idx] ) KVPair( k, v );
+	++m_nUsed;
+	return idx;
+}
+
+template <typename KeyT, typename ValueT, typename KeyHashT, typename KeyIsEqualT, typename AltKeyT>
+int CUtlFlatHashMap<KeyT, ValueT, KeyHashT, KeyIsEqualT, AltKeyT>::DoRemoveAt( int idx )
+{
+	Assert( IsValidHandle( idx ) );
+	const uint32 mask = m_nCapacity - 1;
+
+	Destruct( &m_entries[idx] );
+	--m_nUsed;
+
+	// Walk the rest of the cluster and pull back every element whose ideal
+	// slot is at or before the hole, so lookups never need a tombstone.
+	uint32 hole = idx;
+	for ( uint32 next = ( hole + 1 ) & mask; !( m_ctrl[next] & CTRL_EMPTY ); next = ( next + 1 ) & mask )
+	{
+		uint32 ideal = m_hashes[next] & mask;
+		if ( ( ( next - ideal ) & mask ) < ( ( next - hole ) & mask ) )
+			continue;
+
+		SetCtrl( hole, m_ctrl[next] );
+		m_hashes[hole] = m_hashes[next];
+		CopyConstruct( &m_entries[hole], m_entries[next] );
+		Destruct( &m_entries[next] );
+		hole = next;
+	}
+
+	SetCtrl( hole, CTRL_EMPTY );
+	return hole;
+}
+
+template <typename KeyT, typename ValueT, typename KeyHashT, typename KeyIsEqualT, typename AltKeyT>
+template <typename PredicateT>
+int CUtlFlatHashMap<KeyT, ValueT, KeyHashT, KeyIsEqualT, AltKeyT>::RemoveIf( PredicateT pred )
+{
+	if ( !m_nUsed )
+		return 0;
+
+	// Start just past an empty slot: shifts never cross an empty slot, so
+	// walking once around the table from there only ever pulls unvisited
+	// elements back into the slot being examined.
+	const uint32 mask = m_nCapacity - 1;
+	uint32 start = FindEmptySlot( 0 );
+	int nRemoved = 0;
+	for ( uint32 n = 1; n <= mask; )
+	{
+		uint32 idx = ( start + n ) & mask;
+		if ( !( m_ctrl[idx] & CTRL_EMPTY ) && pred( m_entries[idx].m_key, m_entries[idx].GetValue() ) )
+		{
+			DoRemoveAt( idx );
+			++nRemoved;
+			continue;
+		}
+		++n;
+	}
+	return nRemoved;
+}
+
+template <typename KeyT, typename ValueT, typename KeyHashT, typename KeyIsEqualT, typename AltKeyT>
+UtlFlatHashHandle_t CUtlFlatHashMap<KeyT, ValueT, KeyHashT, KeyIsEqualT, AltKeyT>::NextHandle( handle_t idx ) const
+{
+	for ( ++idx; idx < m_nCapacity; ++idx )
+	{
+		if ( !( m_ctrl[idx] & CTRL_EMPTY ) )
+			return idx;
+	}
+	return InvalidHandle();
+}
+
+template <typename KeyT, typename ValueT, typename KeyHashT, typename KeyIsEqualT, typename AltKeyT>
+void CUtlFlatHashMap<KeyT, ValueT, KeyHashT, KeyIsEqualT, AltKeyT>::RemoveAll()
+{
+	if ( !m_nCapacity )
+		return;
+
+	if ( m_nUsed )
+	{
+		for ( int i = 0; i < m_nCapacity; ++i )
+		{
+			if ( !( m_ctrl[i] & CTRL_EMPTY ) )
+				Destruct( &m_entries[i] );
+		}
+		memset( m_ctrl.Base(), CTRL_EMPTY, m_nCapacity + GROUP_SIZE );
+		m_nUsed = 0;
+	}
+}
+
+template <typename KeyT, typename ValueT, typename KeyHashT, typename KeyIsEqualT, typename AltKeyT>
+float CUtlFlatHashMap<KeyT, ValueT, KeyHashT, KeyIsEqualT, AltKeyT>::AverageProbeLength() const
+{
+	if ( !m_nUsed )
+		return 0.0f;
+
+	const uint32 mask = m_nCapacity - 1;
+	uint32 nTotal = 0;
+	for ( int i = 0; i < m_nCapacity; ++i )
+	{
+		if ( !( m_ctrl[i] & CTRL_EMPTY ) )
+			nTotal += ( i - m_hashes[i] ) & mask;
+	}
+	return (float)nTotal / (float)m_nUsed;
+}
+
+#ifdef _DEBUG
+template <typename KeyT, typename ValueT, typename KeyHashT, typename KeyIsEqualT, typename AltKeyT>
+void CUtlFlatHashMap<KeyT, ValueT, KeyHashT, KeyIsEqualT, AltKeyT>::DbgCheckIntegrity() const
+{
+	const uint32 mask = m_nCapacity - 1;
+	int nUsed = 0;
+	for ( int i = 0; i < m_nCapacity; ++i )
+	{
+		if ( i < GROUP_SIZE - 1 )
+			Assert( m_ctrl[m_nCapacity + i] == m_ctrl[i] );
+		if ( m_ctrl[i] & CTRL_EMPTY )
+			continue;
+
+		++nUsed;
+		Assert( m_ctrl[i] == HashTag( m_hashes[i] ) );
+		Assert( m_hash( m_entries[i].m_key ) == m_hashes[i] );
+
+		// No empty slot between the ideal slot and the element
+		for ( uint32 j = m_hashes[i] & mask; j != (uint32)i; j = ( j + 1 ) & mask )
+			Assert( !( m_ctrl[j] & CTRL_EMPTY ) );
+	}
+	Assert( nUsed == m_nUsed );
+}
+#endif
+
+
+//-----------------------------------------------------------------------------
+// Serialization, using the utlbufferutil overloads for KeyT and ValueT
+//-----------------------------------------------------------------------------
+template <typename KeyT, typename ValueT, typename KeyHashT, typename KeyIsEqualT, typename AltKeyT>
+bool Serialize( CUtlBuffer &buf, const CUtlFlatHashMap<KeyT, ValueT, KeyHashT, KeyIsEqualT, AltKeyT> &src )
+{
+	if ( !buf.IsText() )
+	{
+		buf.PutInt( src.Count() );
+	}
+
+	FOR_EACH_FLATHASHMAP( src, i )
+	{
+		::Serialize( buf, src.Key( i ) );
+		if ( buf.IsText() )
+		{
+			buf.PutChar( ' ' );
+		}
+		::Serialize( buf, src.Element( i ) );
+		if ( buf.IsText() )
+		{
+			buf.PutChar( '\n' );
+		}
+	}
+
+	return buf.IsValid();
+}
+
+template <typename KeyT, typename ValueT, typename KeyHashT, typename KeyIsEqualT, typename AltKeyT>
+bool Unserialize( CUtlBuffer &buf, CUtlFlatHashMap<KeyT, ValueT, KeyHashT, KeyIsEqualT, AltKeyT> &dest )
+{
+	dest.RemoveAll();
+
+	MEM_ALLOC_CREDIT_FUNCTION();
+
+	int nCount = 0;
+	if ( !buf.IsText() )
+	{
+		nCount = buf.GetInt();
+		if ( nCount < 0 || !buf.IsValid() )
+			return false;
+		dest.Reserve( nCount );
+	}
+
+	for ( int i = 0; buf.IsText() || i < nCount; ++i )
+	{
+		if ( buf.IsText() )
+		{
+			buf.EatWhiteSpace();
+			if ( !buf.IsValid() )
+				break;
+		}
+
+		KeyT key;
+		ValueT value;
+		if ( !::Unserialize( buf, key ) || !::Unserialize( buf, value ) )
+			return false;
+
+		dest.Element( dest.Insert( key ) ) = value;
+	}
+
+	return buf.IsValid() || buf.IsText();
+}
+
+#endif // UTLFLATHASHMAP_H
@@ -0,0 +1,116 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Thread safe string interning.
+//
+//			CUtlInternTable keeps one pointer-stable copy of every distinct
+//			string it is given. Lookups never lock: each shard publishes its
+//			hash table through a single pointer and fills a slot's hash before
+//			its string pointer, so readers only ever see complete entries.
+//			Insertions lock the one shard the string hashes to. Tables that
+//			are outgrown are retired rather than freed, since readers may
+//			still be probing them, and go away with RemoveAll(). Nothing but
+//			the table object itself is allocated until the first insertion,
+//			and the number of shards follows the expected size, so small
+//			tables cost one shard and a small string block.
+//
+//			Numbered tables also give every string a dense id, starting at 0
+//			in insertion order, that String() maps back without locking.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef UTLINTERNTABLE_H
+#define UTLINTERNTABLE_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/threadtools.h"
+#include "tier1/utlvector.h"
+
+class CUtlInternTable
+{
+public:
+	enum { INVALID_ID = -1 };
+
+	// Ids go up to MAX_IDS - 1
+	enum
+	{
+		ID_PAGE_BITS = 10,
+		ID_PAGE_SIZE = 1 << ID_PAGE_BITS,
+		ID_PAGE_COUNT = 1024,
+		MAX_IDS = ID_PAGE_SIZE * ID_PAGE_COUNT,
+	};
+
+	// nExpected picks the shard count and initial table size
+	CUtlInternTable( bool bCaseInsensitive = false, bool bNumbered = false, int nExpected = 0 );
+	~CUtlInternTable();
+
+	// Returns the interned copy of pString, adding it if necessary. Safe to
+	// call from any thread. Returns NULL for NULL, or if a numbered table is
+	// full.
+	const char *Intern( const char *pString, int *pId = NULL );
+
+	// Returns the interned copy of pString or NULL. Lock free; a string
+	// being added by another thread at the same time may or may not be found.
+	const char *Find( const char *pString, int *pId = NULL ) const;
+
+	// Numbered tables only. Lock free.
+	const char *String( int nId ) const;
+
+	// Number of strings interned. While other threads are inserting, ids up
+	// to Count() - 1 may still be on their way in.
+	int Count() const { return m_nCount; }
+
+	bool IsCaseInsensitive() const { return m_bCaseInsensitive; }
+
+	// Copies out every interned string, in no particular order
+	void GetStrings( CUtlVector< const char * > &strings ) const;
+
+	// Bytes allocated for strings and lookup tables, retired ones included
+	int GetMemoryUsage() const;
+
+	// Frees all strings. Not thread safe: nothing else may use the table, or
+	// any string it returned, while or after this runs.
+	void RemoveAll();
+
+private:
+	struct Table_t
+	{
+		unsigned int m_nMask;
+		unsigned int *m_pHashes;
+		const char * volatile *m_pStrings;
+	};
+
+	struct Shard_t;
+
+	unsigned int HashString( const char *pString ) const;
+	bool StringsEqual( const char *pA, const char *pB ) const;
+	Shard_t *ShardForHash( unsigned int nHash ) const;
+	Shard_t *CreateShards();
+	const char *FindHashed( const char *pString, unsigned int nHash, int *pId ) const;
+
+	// Probes one table; returns the slot holding pString or the empty slot
+	// that ends its probe sequence
+	int Probe( const Table_t *pTable, const char *pString, unsigned int nHash, const char **ppFound ) const;
+
+	Table_t *AllocTable( Shard_t &shard, int nSize );
+	char *AllocString( Shard_t &shard, int nLen );
+	void SetId( int nId, const char *pString );
+
+	Shard_t * volatile m_pShards;
+	int m_nShardCount;
+	const char ** volatile *m_ppIdPages;
+	CInterlockedInt m_nCount;		// strings readers can see
+	CInterlockedInt m_nNextId;		// ids handed out, some maybe not yet published
+	int m_nExpected;
+	bool m_bCaseInsensitive;
+	bool m_bNumbered;
+
+private:
+	CUtlInternTable( const CUtlInternTable &copyConstructorIsNotImplemented );
+	CUtlInternTable &operator=( const CUtlInternTable &assignmentIsNotImplemented );
+};
+
+#endif // UTLINTERNTABLE_H
@@ -19,6 +19,7 @@
 #include "tier1/utlbuffer.h"
 #include "tier1/utllinkedlist.h"
 #include "tier1/stringpool.h"
+#include "tier1/utlinterntable.h"
 
 
 //-----------------------------------------------------------------------------
@@ -222,6 +223,51 @@ private:
 };
 
 
+//-----------------------------------------------------------------------------
+// CUtlInternSymbolTable:
+// description:
+//    A symbol table with CUtlSymbolTable's interface that keeps its strings
+//    in a numbered CUtlInternTable. Find() and String() never lock and
+//    AddString() only locks one shard, so it suits tables filled during
+//    map spawn or from worker threads. RemoveAll() must not race with
+//    anything. CUtlSymbolTable itself is left alone, since prebuilt
+//    libraries inline its members.
+//-----------------------------------------------------------------------------
+
+class CUtlInternSymbolTable
+{
+public:
+	// nExpected sizes the table for about that many strings up front
+	CUtlInternSymbolTable( bool caseInsensitive = false, int nExpected = 0 )
+		: m_Strings( caseInsensitive, true, nExpected )
+	{
+	}
+
+	// Finds and/or creates a symbol based on the string
+	CUtlSymbol AddString( const char* pString );
+
+	// Finds the symbol for pString
+	CUtlSymbol Find( const char* pString ) const;
+
+	// Look up the string associated with a particular symbol
+	const char* String( CUtlSymbol id ) const;
+
+	// Remove all symbols in the table.
+	void RemoveAll()
+	{
+		m_Strings.RemoveAll();
+	}
+
+	int GetNumStrings( void ) const
+	{
+		return m_Strings.Count();
+	}
+
+private:
+	CUtlInternTable m_Strings;
+};
+
+
 
 //-----------------------------------------------------------------------------
 // CUtlFilenameSymbolTable:
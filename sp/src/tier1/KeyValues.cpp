@@ -16,6 +16,7 @@
 #endif
 
 #include <KeyValues.h>
+#include "kvbinaryimage.h"
 #include "filesystem.h"
 #include <vstdlib/IKeyValuesSystem.h>
 
@@ -23,9 +24,11 @@
 #include <stdlib.h>
 #include "tier0/dbg.h"
 #include "tier0/mem.h"
+#include "tier0/threadtools.h"
 #include "utlvector.h"
 #include "utlbuffer.h"
 #include "utlhash.h"
+#include "utlmap.h"
 #include "UtlSortVector.h"
 #include "convar.h"
 #ifdef MAPBASE
@@ -433,6 +436,240 @@ KeyValues::KeyValues( const char *setName, const char *firstKey, int firstValue,
 	SetInt( secondKey, secondValue );
 }
 
+//-----------------------------------------------------------------------------
+// Arena allocation. An arena is a list of blocks handed out by bumping a
+// pointer; keys and value strings allocated from it are never freed one by
+// one, the whole arena goes when the key that owns it is destroyed. The owner
+// keeps its arena in the value union (KeyValues can't grow, the engine
+// allocates it by size), so only TYPE_NONE keys get one; the owner's child
+// index moves into the arena. If an owner is given an int, float, pointer or
+// color value later, its arena moves out to s_SpilledArenas (m_bArenaSpilled)
+// so the value can have the union. The arena being filled on the current
+// thread is the one of the innermost CKeyValuesArenaScope.
+//-----------------------------------------------------------------------------
+class CKeyValuesArena
+{
+public:
+	enum
+	{
+		MIN_BLOCK_SIZE = 16 * 1024,
+		MAX_BLOCK_SIZE = 1024 * 1024,
+	};
+
+	CKeyValuesArena() : m_pOwnerChildIndex( NULL ), m_pCur( NULL ), m_pEnd( NULL ), m_nNextBlockSize( MIN_BLOCK_SIZE ), m_pLastKey( NULL ) {}
+
+	~CKeyValuesArena()
+	{
+		for ( int i = 0; i < m_Blocks.Count(); i++ )
+		{
+			free( m_Blocks[i] );
+		}
+	}
+
+	void *Alloc( int nSize )
+	{
+		nSize = ( nSize + 7 ) & ~7;
+		if ( m_pCur + nSize > m_pEnd )
+		{
+			int nBlockSize = MAX( nSize, m_nNextBlockSize );
+			m_nNextBlockSize = MIN( m_nNextBlockSize * 2, (int)MAX_BLOCK_SIZE );
+
+			MEM_ALLOC_CREDIT_( "KeyValues arena" );
+			m_pCur = (char *)malloc( nBlockSize );
+			m_pEnd = m_pCur + nBlockSize;
+			m_Blocks.AddToTail( m_pCur );
+		}
+
+		void *p = m_pCur;
+		m_pCur += nSize;
+		return p;
+	}
+
+	void *AllocKey( int nSize )
+	{
+		m_pLastKey = Alloc( nSize );
+		return m_pLastKey;
+	}
+
+	// Lets Init() tell whether the key being constructed came from here
+	bool IsLastKey( const void *p ) const { return p == m_pLastKey; }
+
+	static CThreadLocalPtr< CKeyValuesArena > s_pActive;
+
+	CKeyValuesChildIndex *m_pOwnerChildIndex;
+
+private:
+	CUtlVector< char * > m_Blocks;
+	char *m_pCur;
+	char *m_pEnd;
+	int m_nNextBlockSize;
+	void *m_pLastKey;
+};
+
+CThreadLocalPtr< CKeyValuesArena > CKeyValuesArena::s_pActive;
+
+static CUtlMap< const KeyValues *, CKeyValuesArena * > s_SpilledArenas( DefLessFunc( const KeyValues * ) );
+static CThreadFastMutex s_SpilledArenasMutex;
+
+//-----------------------------------------------------------------------------
+// Makes pOwner's arena (created on demand) the active one for the lifetime of
+// the scope. A NULL owner, or one holding a value, leaves the active arena
+// alone.
+//-----------------------------------------------------------------------------
+class CKeyValuesArenaScope
+{
+public:
+	CKeyValuesArenaScope( KeyValues *pOwner )
+	{
+		m_pPrevious = CKeyValuesArena::s_pActive;
+		if ( !pOwner || pOwner->m_iDataType != KeyValues::TYPE_NONE )
+			return;
+
+		if ( !pOwner->m_bOwnsArena )
+		{
+			CKeyValuesArena *pArena = new CKeyValuesArena;
+			if ( pOwner->m_bHasChildIndex )
+			{
+				pArena->m_pOwnerChildIndex = pOwner->m_pChildIndex;
+			}
+			pOwner->m_pArena = pArena;
+			pOwner->m_bOwnsArena = true;
+		}
+		CKeyValuesArena::s_pActive = pOwner->GetArena();
+	}
+
+	~CKeyValuesArenaScope()
+	{
+		CKeyValuesArena::s_pActive = m_pPrevious;
+	}
+
+private:
+	CKeyValuesArena *m_pPrevious;
+};
+
+void KeyValues::UseArena( bool bState )
+{
+	m_bUseArena = bState;
+}
+
+void KeyValues::ReleaseArena()
+{
+	if ( !m_bOwnsArena )
+		return;
+
+	CKeyValuesArena *pArena = GetArena();
+	Assert( CKeyValuesArena::s_pActive != pArena );
+	Assert( !m_bHasChildIndex );
+	if ( m_bArenaSpilled )
+	{
+		AUTO_LOCK( s_SpilledArenasMutex );
+		s_SpilledArenas.Remove( this );
+	}
+	else
+	{
+		m_pArena = NULL;
+	}
+
+	delete pArena;
+	m_bOwnsArena = false;
+	m_bArenaSpilled = false;
+}
+
+CKeyValuesArena *KeyValues::GetArena() const
+{
+	if ( !m_bOwnsArena )
+		return NULL;
+
+	if ( !m_bArenaSpilled )
+		return m_pArena;
+
+	AUTO_LOCK( s_SpilledArenasMutex );
+	unsigned short i = s_SpilledArenas.Find( this );
+	return s_SpilledArenas.IsValidIndex( i ) ? s_SpilledArenas[i] : NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The child index is in the value union, or in the arena for keys
+//			that keep their arena there
+//-----------------------------------------------------------------------------
+CKeyValuesChildIndex *KeyValues::GetChildIndex() const
+{
+	return IsArenaInUnion() ? m_pArena->m_pOwnerChildIndex : m_pChildIndex;
+}
+
+void KeyValues::SetChildIndex( CKeyValuesChildIndex *pIndex )
+{
+	if ( IsArenaInUnion() )
+	{
+		m_pArena->m_pOwnerChildIndex = pIndex;
+	}
+	else
+	{
+		m_pChildIndex = pIndex;
+	}
+	m_bHasChildIndex = ( pIndex != NULL );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Clears the value union for a setter that is about to store into it.
+//			An arena owner's arena moves out to the side table.
+//-----------------------------------------------------------------------------
+void KeyValues::PrepareUnionValue()
+{
+	ReleaseChildIndex();
+
+	if ( IsArenaInUnion() )
+	{
+		AUTO_LOCK( s_SpilledArenasMutex );
+		s_SpilledArenas.Insert( this, m_pArena );
+		m_bArenaSpilled = true;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Destroys a key, returning its memory unless it belongs to an arena
+//-----------------------------------------------------------------------------
+void KeyValues::DestroyKey( KeyValues *pKey )
+{
+	if ( pKey->m_bArenaNode )
+	{
+		pKey->~KeyValues();
+	}
+	else
+	{
+		delete pKey;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Allocates m_sValue, from the active arena if there is one
+//-----------------------------------------------------------------------------
+char *KeyValues::AllocValueString( int nSize )
+{
+	CKeyValuesArena *pArena = CKeyValuesArena::s_pActive;
+	if ( pArena )
+	{
+		m_sValue = (char *)pArena->Alloc( nSize );
+		m_bArenaValue = true;
+	}
+	else
+	{
+		m_sValue = new char[nSize];
+		m_bArenaValue = false;
+	}
+	return m_sValue;
+}
+
+void KeyValues::FreeValueString()
+{
+	if ( !m_bArenaValue )
+	{
+		delete [] m_sValue;
+	}
+	m_sValue = NULL;
+	m_bArenaValue = false;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Initialize member variables
 //-----------------------------------------------------------------------------
@@ -452,8 +689,15 @@ void KeyValues::Init()
 	m_bHasEscapeSequences = false;
 	m_bEvaluateConditionals = true;
 
-	// for future proof
-	memset( unused, 0, sizeof(unused) );
+	m_bHasChildIndex = false;
+	m_bIndexedChild = false;
+	m_bUseArena = false;
+	m_bOwnsArena = false;
+	m_bArenaSpilled = false;
+	m_bArenaValue = false;
+
+	CKeyValuesArena *pArena = CKeyValuesArena::s_pActive;
+	m_bArenaNode = ( pArena && pArena->IsLastKey( this ) );
 }
 
 //-----------------------------------------------------------------------------
@@ -471,26 +715,30 @@ KeyValues::~KeyValues()
 //-----------------------------------------------------------------------------
 void KeyValues::RemoveEverything()
 {
+	ReleaseChildIndex();
+
 	KeyValues *dat;
 	KeyValues *datNext = NULL;
 	for ( dat = m_pSub; dat != NULL; dat = datNext )
 	{
 		datNext = dat->m_pPeer;
 		dat->m_pPeer = NULL;
-		delete dat;
+		DestroyKey( dat );
 	}
 
 	for ( dat = m_pPeer; dat && dat != this; dat = datNext )
 	{
 		datNext = dat->m_pPeer;
 		dat->m_pPeer = NULL;
-		delete dat;
+		DestroyKey( dat );
 	}
 
-	delete [] m_sValue;
-	m_sValue = NULL;
+	FreeValueString();
 	delete [] m_wsValue;
 	m_wsValue = NULL;
+
+	// everything that lived in the arena is gone now
+	ReleaseArena();
 }
 
 //-----------------------------------------------------------------------------
@@ -567,43 +815,45 @@ const char *KeyValues::ReadToken( CUtlBuffer &buf, bool &wasQuoted, bool &wasCon
 		return s_pTokenBuf;
 	}
 
-	// read in the token until we hit a whitespace or a control character
+	// read in the token until we hit a whitespace or a control character,
+	// a span of the buffer at a time
+	static const char s_TokenStops[] = { 0, '"', '{', '}' };
 	bool bReportedError = false;
 	bool bConditionalStart = false;
 	int nCount = 0;
-	while ( ( c = (const char*)buf.PeekGet( sizeof(char), 0 ) ) )
+	int nSize;
+	while ( ( c = buf.PeekGetSpan( KEYVALUES_TOKEN_SIZE, &nSize ) ) )
 	{
-		// end of file
-		if ( *c == 0 )
-			break;
+		// end of file, control characters and whitespace end the token
+		int nLen = V_FindFirstOf( c, nSize, s_TokenStops, ARRAYSIZE( s_TokenStops ), true );
 
-		// break if any control character appears in non quoted tokens
-		if ( *c == '"' || *c == '{' || *c == '}' )
-			break;
-
-		if ( *c == '[' )
-			bConditionalStart = true;
-
-		if ( *c == ']' && bConditionalStart )
+		// a ']' anywhere after a '[' makes the token a conditional
+		const char *pOpen = bConditionalStart ? c : (const char *)memchr( c, '[', nLen );
+		if ( pOpen )
 		{
-			wasConditional = true;
+			bConditionalStart = true;
+			if ( memchr( pOpen, ']', nLen - ( pOpen - c ) ) )
+			{
+				wasConditional = true;
+			}
 		}
 
-		// break on whitespace
-		if ( isspace(*c) )
-			break;
-
-		if (nCount < (KEYVALUES_TOKEN_SIZE-1) )
+		int nCopy = MIN( nLen, KEYVALUES_TOKEN_SIZE - 1 - nCount );
+		if ( nCopy > 0 )
 		{
-			s_pTokenBuf[nCount++] = *c;	// add char to buffer
+			memcpy( s_pTokenBuf + nCount, c, nCopy );	// add chars to buffer
+			nCount += nCopy;
 		}
-		else if ( !bReportedError )
+
+		if ( nCopy < nLen && !bReportedError )
 		{
 			bReportedError = true;
 			g_KeyValuesErrorStack.ReportError(" ReadToken overflow" );
 		}
 
-		buf.SeekGet( CUtlBuffer::SEEK_CURRENT, 1 );
+		buf.SeekGet( CUtlBuffer::SEEK_CURRENT, nLen );
+		if ( nLen < nSize )
+			break;
 	}
 	s_pTokenBuf[ nCount ] = 0;
 	return s_pTokenBuf;
@@ -636,9 +886,29 @@ void KeyValues::UsesConditionals(bool state)
 bool KeyValues::LoadFromFile( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID )
 {
 	Assert(filesystem);
+
+	CKeyValuesArenaScope arenaScope( m_bUseArena ? this : NULL );
 #ifdef WIN32
 	Assert( IsX360() || ( IsPC() && _heapchk() == _HEAPOK ) );
 #endif
+#ifdef MAPBASE
+	// -kvimagecache keeps a compiled image of every file loaded through here
+	// and inflates that instead of tokenizing the text again
+	static int s_nUseImageCache = -1;
+	if ( s_nUseImageCache == -1 )
+		s_nUseImageCache = CommandLine()->CheckParm( "-kvimagecache" ) ? 1 : 0;
+
+	if ( s_nUseImageCache )
+	{
+		CKeyValuesImage image;
+		if ( image.LoadOrCompile( filesystem, resourceName, pathID, m_bHasEscapeSequences != 0, m_bEvaluateConditionals != 0 ) )
+		{
+			s_LastFileLoadingFrom = (char*)resourceName;
+			return image.CopyInto( this );
+		}
+	}
+#endif
+
 	FileHandle_t f = filesystem->Open(resourceName, "rb", pathID);
 	if ( !f )
 		return false;
@@ -657,7 +927,12 @@ bool KeyValues::LoadFromFile( IBaseFileSystem *filesystem, const char *resourceN
 
 	filesystem->Close( f );	// close file after reading
 
-	if ( bRetOK )
+	if ( bRetOK && CKeyValuesImage::IsImage( buffer, fileSize ) )
+	{
+		// compiled image, no tokenizing required
+		bRetOK = CKeyValuesImage::ReadInto( this, buffer, fileSize );
+	}
+	else if ( bRetOK )
 	{
 		buffer[fileSize] = 0; // null terminate file as EOF
 		buffer[fileSize+1] = 0; // double NULL terminating in case this is a unicode file
@@ -894,11 +1169,358 @@ void KeyValues::SaveKeyToFile( KeyValues *dat, IBaseFileSystem *filesystem, File
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Child index for nodes with many subkeys. Maps key symbols to the first child
+// with that name using open addressing; each slot keeps the symbol it was
+// filed under, so probing never depends on names that may have changed since.
+// The index hangs off the parent through m_pChildIndex, which shares the
+// value union: only TYPE_NONE nodes are indexed and the value setters drop
+// the index before overwriting it. It is only ever built by the code that
+// adds children (FindKey( name, true ), AddSubKey, CreateKey, the loaders and
+// MakeCopy), so lookups never modify the tree and a finished tree can be read
+// from several threads.
+//
+// KeyValues has no parent pointer, so SetName on an indexed child can't fix
+// its parent's slots up. Instead it stamps the old and the new name's bucket
+// in s_ChildIndexRenameEpochs, and indices built before that stamp look
+// names from those buckets up in the list. Other names keep using the index.
+//
+// The layout of KeyValues is shared with the engine and the other prebuilt
+// modules, which were compiled against the version of this code without the
+// index. Their nodes always have the index bits clear, so they never look
+// like indexed nodes; their reads of our trees walk the list; an append made
+// by them is noticed because m_pLastChild gains a peer; and deleting an
+// indexed node there only leaks the index. Only nodes with more than
+// s_nChildIndexThreshold children are ever indexed.
+//-----------------------------------------------------------------------------
+COMPILE_TIME_ASSERT( sizeof( KeyValues ) == 8 * sizeof( void * ) );
+
+int KeyValues::s_nChildIndexThreshold = 32;
+
+#define KEYVALUES_RENAME_BUCKET_BITS	8
+
+static int s_ChildIndexRenameEpochs[ 1 << KEYVALUES_RENAME_BUCKET_BITS ];
+static CInterlockedInt s_nChildIndexRenameEpoch;
+
+class CKeyValuesChildIndex
+{
+public:
+	CKeyValuesChildIndex() : m_pLastChild( NULL ), m_nCount( 0 ), m_nBits( 0 ), m_nEpoch( 0 ) {}
+
+	void Build( KeyValues *pFirstChild )
+	{
+		m_nEpoch = s_nChildIndexRenameEpoch;
+		m_nCount = 0;
+		m_pLastChild = NULL;
+		for ( KeyValues *dat = pFirstChild; dat; dat = dat->m_pPeer )
+		{
+			m_nCount++;
+			m_pLastChild = dat;
+			dat->m_bIndexedChild = true;
+		}
+
+		Resize( m_nCount );
+		for ( KeyValues *dat = pFirstChild; dat; dat = dat->m_pPeer )
+		{
+			Insert( dat->m_iKeyName, dat );
+		}
+	}
+
+	// False if a child with this name may have been renamed since Build, or
+	// children were appended by code that doesn't know about the index
+	bool IsCurrent( int iKeySymbol, const KeyValues *pFirstChild ) const
+	{
+		if ( m_pLastChild ? ( m_pLastChild->m_pPeer != NULL ) : ( pFirstChild != NULL ) )
+			return false;
+
+		return s_ChildIndexRenameEpochs[ RenameBucket( iKeySymbol ) ] <= m_nEpoch;
+	}
+
+	KeyValues *Find( int iKeySymbol ) const
+	{
+		int nMask = m_Slots.Count() - 1;
+		for ( int i = Slot( iKeySymbol ); m_Slots[i].m_pChild; i = ( i + 1 ) & nMask )
+		{
+			if ( m_Slots[i].m_iKeySymbol == iKeySymbol )
+				return m_Slots[i].m_pChild;
+		}
+		return NULL;
+	}
+
+	// pChild has just been linked in at the end of the list. Returns false if
+	// it didn't follow m_pLastChild, in which case the index must be rebuilt.
+	bool Append( KeyValues *pChild, const KeyValues *pFirstChild )
+	{
+		if ( m_pLastChild ? ( m_pLastChild->m_pPeer != pChild ) : ( pFirstChild != pChild ) )
+			return false;
+
+		m_nCount++;
+		m_pLastChild = pChild;
+		pChild->m_bIndexedChild = true;
+		if ( m_nCount * 2 > m_Slots.Count() )
+		{
+			Rehash();
+		}
+		Insert( pChild->m_iKeyName, pChild );
+		return true;
+	}
+
+	// pChild is about to be unlinked; pPrev is the child before it, if any
+	void Remove( KeyValues *pChild, KeyValues *pPrev )
+	{
+		m_nCount--;
+		if ( m_pLastChild == pChild )
+		{
+			m_pLastChild = pPrev;
+		}
+
+		int nMask = m_Slots.Count() - 1;
+		int i = Slot( pChild->m_iKeyName );
+		while ( m_Slots[i].m_pChild && m_Slots[i].m_pChild != pChild )
+		{
+			i = ( i + 1 ) & nMask;
+		}
+
+		if ( !m_Slots[i].m_pChild )
+		{
+			// Normally a later duplicate of an indexed name, but it may also
+			// have been renamed since it was filed
+			for ( i = 0; i < m_Slots.Count(); i++ )
+			{
+				if ( m_Slots[i].m_pChild == pChild )
+					break;
+			}
+
+			if ( i == m_Slots.Count() )
+				return;
+		}
+
+		// Hand the slot to the next child of the same name, if there is one
+		int iKeySymbol = m_Slots[i].m_iKeySymbol;
+		for ( KeyValues *dat = pChild->m_pPeer; dat; dat = dat->m_pPeer )
+		{
+			if ( dat->m_iKeyName == iKeySymbol )
+			{
+				m_Slots[i].m_pChild = dat;
+				return;
+			}
+		}
+
+		// Otherwise delete with backward shifting so probe chains stay intact
+		m_Slots[i].m_pChild = NULL;
+		for ( int j = ( i + 1 ) & nMask; m_Slots[j].m_pChild; j = ( j + 1 ) & nMask )
+		{
+			int nHome = Slot( m_Slots[j].m_iKeySymbol );
+			if ( ( ( j - nHome ) & nMask ) >= ( ( j - i ) & nMask ) )
+			{
+				m_Slots[i] = m_Slots[j];
+				m_Slots[j].m_pChild = NULL;
+				i = j;
+			}
+		}
+	}
+
+	// Called when an indexed child is renamed from iOldKeySymbol to iNewKeySymbol
+	static void NoteRename( int iOldKeySymbol, int iNewKeySymbol )
+	{
+		int nEpoch = ++s_nChildIndexRenameEpoch;
+		s_ChildIndexRenameEpochs[ RenameBucket( iOldKeySymbol ) ] = nEpoch;
+		s_ChildIndexRenameEpochs[ RenameBucket( iNewKeySymbol ) ] = nEpoch;
+	}
+
+	KeyValues *m_pLastChild;
+	int m_nCount;
+
+private:
+	struct Slot_t
+	{
+		int m_iKeySymbol;
+		KeyValues *m_pChild;
+	};
+
+	static int RenameBucket( int iKeySymbol )
+	{
+		return (int)( ( (unsigned int)iKeySymbol * 2654435761u ) >> ( 32 - KEYVALUES_RENAME_BUCKET_BITS ) );
+	}
+
+	int Slot( int iKeySymbol ) const
+	{
+		return (int)( ( (unsigned int)iKeySymbol * 2654435761u ) >> ( 32 - m_nBits ) );
+	}
+
+	void Resize( int nCount )
+	{
+		m_nBits = 4;
+		while ( ( 1 << m_nBits ) < nCount * 2 )
+		{
+			m_nBits++;
+		}
+		m_Slots.SetCount( 1 << m_nBits );
+		memset( m_Slots.Base(), 0, m_Slots.Count() * sizeof( Slot_t ) );
+	}
+
+	void Rehash()
+	{
+		CUtlVector< Slot_t > oldSlots;
+		oldSlots.Swap( m_Slots );
+		Resize( m_nCount );
+
+		// Reinserting in slot order could reorder duplicates, but only the
+		// first child of each name is ever in the table
+		for ( int i = 0; i < oldSlots.Count(); i++ )
+		{
+			if ( oldSlots[i].m_pChild )
+			{
+				Insert( oldSlots[i].m_iKeySymbol, oldSlots[i].m_pChild );
+			}
+		}
+	}
+
+	// Keeps the first child of each name
+	void Insert( int iKeySymbol, KeyValues *pChild )
+	{
+		int nMask = m_Slots.Count() - 1;
+		int i = Slot( iKeySymbol );
+		for ( ; m_Slots[i].m_pChild; i = ( i + 1 ) & nMask )
+		{
+			if ( m_Slots[i].m_iKeySymbol == iKeySymbol )
+				return;
+		}
+		m_Slots[i].m_iKeySymbol = iKeySymbol;
+		m_Slots[i].m_pChild = pChild;
+	}
+
+	CUtlVector< Slot_t > m_Slots;
+	int m_nBits;
+	int m_nEpoch;
+};
+
+void KeyValues::SetChildIndexThreshold( int nThreshold )
+{
+	s_nChildIndexThreshold = nThreshold;
+}
+
+int KeyValues::GetChildIndexThreshold()
+{
+	return s_nChildIndexThreshold;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Builds (or rebuilds) the child index of this node
+//-----------------------------------------------------------------------------
+void KeyValues::BuildChildIndex( bool bRecursive )
+{
+	// Keys holding a value keep it in the union the index would use
+	if ( m_pSub && m_iDataType == TYPE_NONE )
+	{
+		if ( !m_bHasChildIndex )
+		{
+			SetChildIndex( new CKeyValuesChildIndex );
+		}
+		GetChildIndex()->Build( m_pSub );
+	}
+
+	if ( bRecursive )
+	{
+		for ( KeyValues *dat = m_pSub; dat; dat = dat->m_pPeer )
+		{
+			if ( dat->m_pSub )
+			{
+				dat->BuildChildIndex( true );
+			}
+		}
+	}
+}
+
+void KeyValues::ReleaseChildIndex()
+{
+	if ( !m_bHasChildIndex )
+		return;
+
+	delete GetChildIndex();
+	SetChildIndex( NULL );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Builds the child index if this node has more than the threshold
+//			number of children. Called by the code that adds children, never
+//			by lookups.
+//-----------------------------------------------------------------------------
+void KeyValues::IndexChildrenIfWide()
+{
+	if ( m_bHasChildIndex || m_iDataType != TYPE_NONE || s_nChildIndexThreshold <= 0 )
+		return;
+
+	int nChildren = 0;
+	for ( KeyValues *dat = m_pSub; dat; dat = dat->m_pPeer )
+	{
+		if ( ++nChildren > s_nChildIndexThreshold )
+		{
+			BuildChildIndex();
+			return;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Looks a child up through the index. Also returns the last child so
+//			FindKey can append without walking the list.
+//-----------------------------------------------------------------------------
+KeyValues *KeyValues::FindIndexedChild( int iKeySymbol, KeyValues **ppLastChild ) const
+{
+	const CKeyValuesChildIndex *pIndex = GetChildIndex();
+	if ( pIndex->IsCurrent( iKeySymbol, m_pSub ) )
+	{
+		KeyValues *dat = pIndex->Find( iKeySymbol );
+		if ( !dat || dat->m_iKeyName == iKeySymbol )
+		{
+			*ppLastChild = pIndex->m_pLastChild;
+			return dat;
+		}
+	}
+
+	// The index may be out of date for this name; the list is still right
+	KeyValues *dat;
+	*ppLastChild = NULL;
+	for ( dat = m_pSub; dat; dat = dat->m_pPeer )
+	{
+		*ppLastChild = dat;
+		if ( dat->m_iKeyName == iKeySymbol )
+			break;
+	}
+	return dat;
+}
+
+void KeyValues::AddToChildIndex( KeyValues *pChild )
+{
+	if ( m_bHasChildIndex && !GetChildIndex()->Append( pChild, m_pSub ) )
+	{
+		// children were linked in behind the index's back
+		BuildChildIndex();
+	}
+}
+
+void KeyValues::RemoveFromChildIndex( KeyValues *pChild, KeyValues *pPrev )
+{
+	pChild->m_bIndexedChild = false;
+
+	if ( m_bHasChildIndex )
+	{
+		GetChildIndex()->Remove( pChild, pPrev );
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: looks up a key by symbol name
 //-----------------------------------------------------------------------------
 KeyValues *KeyValues::FindKey(int keySymbol) const
 {
+	if ( m_bHasChildIndex )
+	{
+		KeyValues *pLastChild;
+		return FindIndexedChild( keySymbol, &pLastChild );
+	}
+
 	for (KeyValues *dat = m_pSub; dat != NULL; dat = dat->m_pPeer)
 	{
 		if (dat->m_iKeyName == keySymbol)
@@ -944,15 +1566,24 @@ KeyValues *KeyValues::FindKey(const char *keyName, bool bCreate)
 
 	KeyValues *lastItem = NULL;
 	KeyValues *dat;
-	// find the searchStr in the current peer list
-	for (dat = m_pSub; dat != NULL; dat = dat->m_pPeer)
+	int nWalked = 0;
+	if ( m_bHasChildIndex )
 	{
-		lastItem = dat;	// record the last item looked at (for if we need to append to the end of the list)
-
-		// symbol compare
-		if (dat->m_iKeyName == iSearchStr)
+		dat = FindIndexedChild( iSearchStr, &lastItem );
+	}
+	else
+	{
+		// find the searchStr in the current peer list
+		for (dat = m_pSub; dat != NULL; dat = dat->m_pPeer)
 		{
-			break;
+			lastItem = dat;	// record the last item looked at (for if we need to append to the end of the list)
+			nWalked++;
+
+			// symbol compare
+			if (dat->m_iKeyName == iSearchStr)
+			{
+				break;
+			}
 		}
 	}
 
@@ -983,10 +1614,16 @@ KeyValues *KeyValues::FindKey(const char *keyName, bool bCreate)
 				m_pSub = dat;
 			}
 			dat->m_pPeer = NULL;
+			AddToChildIndex( dat );
 
 			// a key graduates to be a submsg as soon as it's m_pSub is set
 			// this should be the only place m_pSub is set
 			m_iDataType = TYPE_NONE;
+
+			if ( nWalked >= s_nChildIndexThreshold )
+			{
+				IndexChildrenIfWide();
+			}
 		}
 		else
 		{
@@ -1030,7 +1667,9 @@ KeyValues *KeyValues::CreateNewKey()
 	char buf[12];
 	Q_snprintf( buf, sizeof(buf), "%d", newID );
 
-	return CreateKeyUsingKnownLastChild( buf, pLastChild );
+	KeyValues *dat = CreateKeyUsingKnownLastChild( buf, pLastChild );
+	IndexChildrenIfWide();
+	return dat;
 }
 
 
@@ -1040,7 +1679,9 @@ KeyValues *KeyValues::CreateNewKey()
 KeyValues* KeyValues::CreateKey( const char *keyName )
 {
 	KeyValues *pLastChild = FindLastSubKey();
-	return CreateKeyUsingKnownLastChild( keyName, pLastChild );
+	KeyValues *dat = CreateKeyUsingKnownLastChild( keyName, pLastChild );
+	IndexChildrenIfWide();
+	return dat;
 }
 
 //-----------------------------------------------------------------------------
@@ -1088,6 +1729,8 @@ void KeyValues::AddSubkeyUsingKnownLastChild( KeyValues *pSubkey, KeyValues *pLa
 
 		pLastChild->SetNextKey( pSubkey );
 	}
+
+	AddToChildIndex( pSubkey );
 }
 
 
@@ -1107,14 +1750,30 @@ void KeyValues::AddSubKey( KeyValues *pSubkey )
 	}
 	else
 	{
-		KeyValues *pTempDat = m_pSub;
+		// the index knows (roughly) where the tail is
+		KeyValues *pTempDat = m_bHasChildIndex ? GetChildIndex()->m_pLastChild : NULL;
+		if ( !pTempDat )
+		{
+			pTempDat = m_pSub;
+		}
+
+		int nWalked = 1;
 		while ( pTempDat->GetNextKey() != NULL )
 		{
 			pTempDat = pTempDat->GetNextKey();
+			nWalked++;
 		}
 
 		pTempDat->SetNextKey( pSubkey );
+
+		if ( !m_bHasChildIndex && nWalked >= s_nChildIndexThreshold )
+		{
+			IndexChildrenIfWide();
+			return;
+		}
 	}
+
+	AddToChildIndex( pSubkey );
 }
 
 
@@ -1130,6 +1789,7 @@ void KeyValues::RemoveSubKey(KeyValues *subKey)
 	// check the list pointer
 	if (m_pSub == subKey)
 	{
+		RemoveFromChildIndex( subKey, NULL );
 		m_pSub = subKey->m_pPeer;
 	}
 	else
@@ -1140,6 +1800,7 @@ void KeyValues::RemoveSubKey(KeyValues *subKey)
 		{
 			if (kv->m_pPeer == subKey)
 			{
+				RemoveFromChildIndex( subKey, kv );
 				kv->m_pPeer = subKey->m_pPeer;
 				break;
 			}
@@ -1237,6 +1898,9 @@ int KeyValues::GetInt( const char *keyName, int defaultValue )
 			// can't convert, since it would lose data
 			Assert(0);
 			return 0;
+		case TYPE_NONE:
+			// the union may hold the child index or the arena
+			return ( dat->m_bHasChildIndex || dat->IsArenaInUnion() ) ? 0 : dat->m_iValue;
 		case TYPE_INT:
 		case TYPE_PTR:
 		default:
@@ -1265,6 +1929,8 @@ uint64 KeyValues::GetUint64( const char *keyName, uint64 defaultValue )
 			return (int)dat->m_flValue;
 		case TYPE_UINT64:
 			return *((uint64 *)dat->m_sValue);
+		case TYPE_NONE:
+			return ( dat->m_bHasChildIndex || dat->IsArenaInUnion() ) ? 0 : dat->m_iValue;
 		case TYPE_INT:
 		case TYPE_PTR:
 		default:
@@ -1360,6 +2026,10 @@ const char *KeyValues::GetString( const char *keyName, const char *defaultValue
 			Q_snprintf( buf, sizeof( buf ), "%lld", *((uint64 *)(dat->m_sValue)) );
 			SetString( keyName, buf );
 			break;
+		case TYPE_COLOR:
+			Q_snprintf( buf, sizeof( buf ), "%d %d %d %d", dat->m_Color[0], dat->m_Color[1], dat->m_Color[2], dat->m_Color[3] );
+			SetString( keyName, buf );
+			break;
 
 		case TYPE_WSTRING:
 		{
@@ -1499,6 +2169,8 @@ void KeyValues::SetColor( const char *keyName, Color value)
 
 	if ( dat )
 	{
+		dat->PrepareUnionValue();
+
 		dat->m_iDataType = TYPE_COLOR;
 		dat->m_Color[0] = value[0];
 		dat->m_Color[1] = value[1];
@@ -1510,7 +2182,7 @@ void KeyValues::SetColor( const char *keyName, Color value)
 void KeyValues::SetStringValue( char const *strValue )
 {
 	// delete the old value
-	delete [] m_sValue;
+	FreeValueString();
 	// make sure we're not storing the WSTRING  - as we're converting over to STRING
 	delete [] m_wsValue;
 	m_wsValue = NULL;
@@ -1523,7 +2195,7 @@ void KeyValues::SetStringValue( char const *strValue )
 
 	// allocate memory for the new value and copy it in
 	int len = Q_strlen( strValue );
-	m_sValue = new char[len + 1];
+	AllocValueString( len + 1 );
 	Q_memcpy( m_sValue, strValue, len+1 );
 
 	m_iDataType = TYPE_STRING;
@@ -1544,7 +2216,7 @@ void KeyValues::SetString( const char *keyName, const char *value )
 		}
 
 		// delete the old value
-		delete [] dat->m_sValue;
+		dat->FreeValueString();
 		// make sure we're not storing the WSTRING  - as we're converting over to STRING
 		delete [] dat->m_wsValue;
 		dat->m_wsValue = NULL;
@@ -1557,7 +2229,7 @@ void KeyValues::SetString( const char *keyName, const char *value )
 
 		// allocate memory for the new value and copy it in
 		int len = Q_strlen( value );
-		dat->m_sValue = new char[len + 1];
+		dat->AllocValueString( len + 1 );
 		Q_memcpy( dat->m_sValue, value, len+1 );
 
 		dat->m_iDataType = TYPE_STRING;
@@ -1575,8 +2247,7 @@ void KeyValues::SetWString( const char *keyName, const wchar_t *value )
 		// delete the old value
 		delete [] dat->m_wsValue;
 		// make sure we're not storing the STRING  - as we're converting over to WSTRING
-		delete [] dat->m_sValue;
-		dat->m_sValue = NULL;
+		dat->FreeValueString();
 
 		if (!value)
 		{
@@ -1602,6 +2273,8 @@ void KeyValues::SetInt( const char *keyName, int value )
 
 	if ( dat )
 	{
+		dat->PrepareUnionValue();
+
 		dat->m_iValue = value;
 		dat->m_iDataType = TYPE_INT;
 	}
@@ -1617,12 +2290,12 @@ void KeyValues::SetUint64( const char *keyName, uint64 value )
 	if ( dat )
 	{
 		// delete the old value
-		delete [] dat->m_sValue;
+		dat->FreeValueString();
 		// make sure we're not storing the WSTRING  - as we're converting over to STRING
 		delete [] dat->m_wsValue;
 		dat->m_wsValue = NULL;
 
-		dat->m_sValue = new char[sizeof(uint64)];
+		dat->AllocValueString( sizeof(uint64) );
 		*((uint64 *)dat->m_sValue) = value;
 		dat->m_iDataType = TYPE_UINT64;
 	}
@@ -1637,6 +2310,8 @@ void KeyValues::SetFloat( const char *keyName, float value )
 
 	if ( dat )
 	{
+		dat->PrepareUnionValue();
+
 		dat->m_flValue = value;
 		dat->m_iDataType = TYPE_FLOAT;
 	}
@@ -1644,7 +2319,14 @@ void KeyValues::SetFloat( const char *keyName, float value )
 
 void KeyValues::SetName( const char * setName )
 {
+	int iOldKeyName = m_iKeyName;
 	m_iKeyName = s_pfGetSymbolForString( setName, true );
+
+	// the parent's index (if it has one) still files us under the old name
+	if ( m_bIndexedChild && iOldKeyName != m_iKeyName )
+	{
+		CKeyValuesChildIndex::NoteRename( iOldKeyName, m_iKeyName );
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -1656,6 +2338,8 @@ void KeyValues::SetPtr( const char *keyName, void *value )
 
 	if ( dat )
 	{
+		dat->PrepareUnionValue();
+
 		dat->m_pValue = value;
 		dat->m_iDataType = TYPE_PTR;
 	}
@@ -1679,7 +2363,7 @@ void KeyValues::RecursiveCopyKeyValues( KeyValues& src )
 			if( src.m_sValue )
 			{
 				int len = Q_strlen(src.m_sValue) + 1;
-				m_sValue = new char[len];
+				AllocValueString( len );
 				Q_strncpy( m_sValue, src.m_sValue, len );
 			}
 			break;
@@ -1688,7 +2372,7 @@ void KeyValues::RecursiveCopyKeyValues( KeyValues& src )
 				m_iValue = src.m_iValue;
 				Q_snprintf( buf,sizeof(buf), "%d", m_iValue );
 				int len = Q_strlen(buf) + 1;
-				m_sValue = new char[len];
+				AllocValueString( len );
 				Q_strncpy( m_sValue, buf, len  );
 			}
 			break;
@@ -1697,7 +2381,7 @@ void KeyValues::RecursiveCopyKeyValues( KeyValues& src )
 				m_flValue = src.m_flValue;
 				Q_snprintf( buf,sizeof(buf), "%f", m_flValue );
 				int len = Q_strlen(buf) + 1;
-				m_sValue = new char[len];
+				AllocValueString( len );
 				Q_strncpy( m_sValue, buf, len );
 			}
 			break;
@@ -1708,7 +2392,7 @@ void KeyValues::RecursiveCopyKeyValues( KeyValues& src )
 			break;
 		case TYPE_UINT64:
 			{
-				m_sValue = new char[sizeof(uint64)];
+				AllocValueString( sizeof(uint64) );
 				Q_memcpy( m_sValue, src.m_sValue, sizeof(uint64) );
 			}
 			break;
@@ -1768,7 +2452,12 @@ void KeyValues::RecursiveCopyKeyValues( KeyValues& src )
 KeyValues& KeyValues::operator=( KeyValues& src )
 {
 	RemoveEverything();
+
+	// our own memory doesn't move
+	bool bArenaNode = m_bArenaNode;
 	Init();	// reset all values
+	m_bArenaNode = bArenaNode;
+
 	RecursiveCopyKeyValues( src );
 	return *this;
 }
@@ -1779,6 +2468,8 @@ KeyValues& KeyValues::operator=( KeyValues& src )
 //-----------------------------------------------------------------------------
 void KeyValues::CopySubkeys( KeyValues *pParent ) const
 {
+	pParent->ReleaseChildIndex();
+
 	// recursively copy subkeys
 	// Also maintain ordering....
 	KeyValues *pPrev = NULL;
@@ -1799,6 +2490,8 @@ void KeyValues::CopySubkeys( KeyValues *pParent ) const
 		dat->m_pPeer = NULL;
 		pPrev = dat;
 	}
+
+	pParent->IndexChildrenIfWide();
 }
 
 
@@ -1806,9 +2499,18 @@ void KeyValues::CopySubkeys( KeyValues *pParent ) const
 // Purpose: Makes a copy of the whole key-value pair set
 //-----------------------------------------------------------------------------
 KeyValues *KeyValues::MakeCopy( void ) const
+{
+	return MakeCopy( false );
+}
+
+KeyValues *KeyValues::MakeCopy( bool bUseArena ) const
 {
 	KeyValues *newKeyValue = new KeyValues(GetName());
 
+	// everything below the new key comes out of its arena, unless the key
+	// needs the value union for its own value
+	CKeyValuesArenaScope arenaScope( ( bUseArena && m_iDataType == TYPE_NONE ) ? newKeyValue : NULL );
+
 	newKeyValue->UsesEscapeSequences( m_bHasEscapeSequences != 0 );
 	newKeyValue->UsesConditionals( m_bEvaluateConditionals != 0 );
 
@@ -1822,7 +2524,7 @@ KeyValues *KeyValues::MakeCopy( void ) const
 			{
 				int len = Q_strlen( m_sValue );
 				Assert( !newKeyValue->m_sValue );
-				newKeyValue->m_sValue = new char[len + 1];
+				newKeyValue->AllocValueString( len + 1 );
 				Q_memcpy( newKeyValue->m_sValue, m_sValue, len+1 );
 			}
 		}
@@ -1858,7 +2560,7 @@ KeyValues *KeyValues::MakeCopy( void ) const
 		break;
 
 	case TYPE_UINT64:
-		newKeyValue->m_sValue = new char[sizeof(uint64)];
+		newKeyValue->AllocValueString( sizeof(uint64) );
 		Q_memcpy( newKeyValue->m_sValue, m_sValue, sizeof(uint64) );
 		break;
 	};
@@ -1889,7 +2591,11 @@ bool KeyValues::IsEmpty(const char *keyName)
 //-----------------------------------------------------------------------------
 void KeyValues::Clear( void )
 {
-	delete m_pSub;
+	ReleaseChildIndex();
+	if ( m_pSub )
+	{
+		DestroyKey( m_pSub );
+	}
 	m_pSub = NULL;
 	m_iDataType = TYPE_NONE;
 }
@@ -1911,7 +2617,7 @@ KeyValues::types_t KeyValues::GetDataType(const char *keyName)
 //-----------------------------------------------------------------------------
 void KeyValues::deleteThis()
 {
-	delete this;
+	DestroyKey( this );
 }
 
 //-----------------------------------------------------------------------------
@@ -1984,6 +2690,11 @@ void KeyValues::ParseIncludedKeys( char const *resourceName, const char *filetoi
 	newKV->UsesEscapeSequences( m_bHasEscapeSequences != 0 );	// use same format as parent
 	newKV->UsesConditionals( m_bEvaluateConditionals != 0 );
 
+#ifdef MAPBASE
+	// Compiled images must go stale when an included file changes
+	CKeyValuesImage::NoteIncludedFile( fullpath );
+#endif
+
 	if ( newKV->LoadFromFile( pFileSystem, fullpath, pPathID ) )
 	{
 		includedKeys.AddToTail( newKV );
@@ -2121,12 +2832,25 @@ bool EvaluateConditional( const char *str )
 //-----------------------------------------------------------------------------
 bool KeyValues::LoadFromBuffer( char const *resourceName, CUtlBuffer &buf, IBaseFileSystem* pFileSystem, const char *pPathID )
 {
+	CKeyValuesArenaScope arenaScope( m_bUseArena ? this : NULL );
+
 	KeyValues *pPreviousKey = NULL;
 	KeyValues *pCurrentKey = this;
 	CUtlVector< KeyValues * > includedKeys;
 	CUtlVector< KeyValues * > baseKeys;
 	bool wasQuoted;
 	bool wasConditional;
+
+	if ( CKeyValuesImage::IsImage( buf.PeekGet(), buf.GetBytesRemaining() ) )
+	{
+		KVImageHeader_t header;
+		Q_memcpy( &header, buf.PeekGet(), sizeof( header ) );
+		int nImageSize = header.m_nImageSize;
+		bool bRetOK = CKeyValuesImage::ReadInto( this, buf.PeekGet(), nImageSize );
+		buf.SeekGet( CUtlBuffer::SEEK_CURRENT, nImageSize );
+		return bRetOK;
+	}
+
 	g_KeyValuesErrorStack.SetFilename( resourceName );	
 	do 
 	{
@@ -2286,6 +3010,9 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 	// keep this out of the stack until a key is parsed
 	CKeyErrorContext errorKey( INVALID_KEY_SYMBOL );
 
+	// children get appended and (for rejected conditionals) unlinked by hand below
+	ReleaseChildIndex();
+
 	// Locate the last child.  (Almost always, we will not have any children.)
 	// We maintain the pointer to the last child here, so we don't have to re-locate
 	// it each time we append the next subkey, which causes O(N^2) time
@@ -2358,11 +3085,7 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 				break;
 			}
 			
-			if (dat->m_sValue)
-			{
-				delete[] dat->m_sValue;
-				dat->m_sValue = NULL;
-			}
+			dat->FreeValueString();
 
 			int len = Q_strlen( value );
 
@@ -2402,7 +3125,7 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 							digit -= 'A' - ( '9' + 1 );
 					retVal = ( retVal * 16 ) + ( digit - '0' );
 				}
-				dat->m_sValue = new char[sizeof(uint64)];
+				dat->AllocValueString( sizeof(uint64) );
 				*((uint64 *)dat->m_sValue) = retVal;
 				dat->m_iDataType = TYPE_UINT64;
 			}
@@ -2424,7 +3147,7 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 			if (dat->m_iDataType == TYPE_STRING)
 			{
 				// copy in the string information
-				dat->m_sValue = new char[len+1];
+				dat->AllocValueString( len+1 );
 				Q_memcpy( dat->m_sValue, value, len+1 );
 			}
 
@@ -2465,6 +3188,8 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 			dat = NULL;
 		}
 	}
+
+	IndexChildrenIfWide();
 }
 
 
@@ -2598,6 +3323,7 @@ bool KeyValues::ReadAsBinary( CUtlBuffer &buffer, int nStackDepth )
 			{
 				dat->m_pSub = new KeyValues("");
 				dat->m_pSub->ReadAsBinary( buffer, nStackDepth + 1 );
+				dat->IndexChildrenIfWide();
 				break;
 			}
 		case TYPE_STRING:
@@ -2607,7 +3333,7 @@ bool KeyValues::ReadAsBinary( CUtlBuffer &buffer, int nStackDepth )
 				token[KEYVALUES_TOKEN_SIZE-1] = 0;
 
 				int len = Q_strlen( token );
-				dat->m_sValue = new char[len + 1];
+				dat->AllocValueString( len + 1 );
 				Q_memcpy( dat->m_sValue, token, len+1 );
 								
 				break;
@@ -2626,7 +3352,7 @@ bool KeyValues::ReadAsBinary( CUtlBuffer &buffer, int nStackDepth )
 
 		case TYPE_UINT64:
 			{
-				dat->m_sValue = new char[sizeof(uint64)];
+				dat->AllocValueString( sizeof(uint64) );
 				*((uint64 *)dat->m_sValue) = buffer.GetInt64();
 				break;
 			}
@@ -2676,12 +3402,20 @@ bool KeyValues::ReadAsBinary( CUtlBuffer &buffer, int nStackDepth )
 //-----------------------------------------------------------------------------
 void *KeyValues::operator new( size_t iAllocSize )
 {
+	CKeyValuesArena *pArena = CKeyValuesArena::s_pActive;
+	if ( pArena )
+		return pArena->AllocKey( iAllocSize );
+
 	MEM_ALLOC_CREDIT();
 	return KeyValuesSystem()->AllocKeyValuesMemory(iAllocSize);
 }
 
 void *KeyValues::operator new( size_t iAllocSize, int nBlockUse, const char *pFileName, int nLine )
 {
+	CKeyValuesArena *pArena = CKeyValuesArena::s_pActive;
+	if ( pArena )
+		return pArena->AllocKey( iAllocSize );
+
 	MemAlloc_PushAllocDbgInfo( pFileName, nLine );
 	void *p = KeyValuesSystem()->AllocKeyValuesMemory(iAllocSize);
 	MemAlloc_PopAllocDbgInfo();
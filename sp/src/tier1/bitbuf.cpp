@@ -716,6 +716,61 @@ void bf_write::WriteBitAngles( const QAngle& fa )
 	WriteBitVec3Coord( tmp );
 }
 
+void bf_write::WriteBitAngleArray( const float *pAngles, int nCount, int numbits )
+{
+	CBitWriteAccumulator acc( *this );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		acc.WriteBitAngle( pAngles[i], numbits );
+	}
+}
+
+void bf_write::WriteBitCoordArray( const float *pValues, int nCount )
+{
+	CBitWriteAccumulator acc( *this );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		acc.WriteBitCoord( pValues[i] );
+	}
+}
+
+void bf_write::WriteBitVec3CoordArray( const Vector *pVectors, int nCount )
+{
+	CBitWriteAccumulator acc( *this );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		acc.WriteBitVec3Coord( pVectors[i] );
+	}
+}
+
+void bf_write::WriteBitNormalArray( const float *pValues, int nCount )
+{
+	CBitWriteAccumulator acc( *this );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		acc.WriteBitNormal( pValues[i] );
+	}
+}
+
+void bf_write::WriteBitVec3NormalArray( const Vector *pVectors, int nCount )
+{
+	CBitWriteAccumulator acc( *this );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		acc.WriteBitVec3Normal( pVectors[i] );
+	}
+}
+
+void bf_write::WriteBitAnglesArray( const QAngle *pAngles, int nCount )
+{
+	CBitWriteAccumulator acc( *this );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		Vector tmp( pAngles[i].x, pAngles[i].y, pAngles[i].z );
+		acc.WriteBitVec3Coord( tmp );
+	}
+}
+
 void bf_write::WriteChar(int val)
 {
 	WriteSBitLong(val, sizeof(char) << 3);
@@ -1341,6 +1396,62 @@ void bf_read::ReadBitAngles( QAngle& fa )
 	fa.Init( tmp.x, tmp.y, tmp.z );
 }
 
+void bf_read::ReadBitAngleArray( float *pAngles, int nCount, int numbits )
+{
+	CBitReadAccumulator acc( *this );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		pAngles[i] = acc.ReadBitAngle( numbits );
+	}
+}
+
+void bf_read::ReadBitCoordArray( float *pValues, int nCount )
+{
+	CBitReadAccumulator acc( *this );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		pValues[i] = acc.ReadBitCoord();
+	}
+}
+
+void bf_read::ReadBitVec3CoordArray( Vector *pVectors, int nCount )
+{
+	CBitReadAccumulator acc( *this );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		acc.ReadBitVec3Coord( pVectors[i] );
+	}
+}
+
+void bf_read::ReadBitNormalArray( float *pValues, int nCount )
+{
+	CBitReadAccumulator acc( *this );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		pValues[i] = acc.ReadBitNormal();
+	}
+}
+
+void bf_read::ReadBitVec3NormalArray( Vector *pVectors, int nCount )
+{
+	CBitReadAccumulator acc( *this );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		acc.ReadBitVec3Normal( pVectors[i] );
+	}
+}
+
+void bf_read::ReadBitAnglesArray( QAngle *pAngles, int nCount )
+{
+	CBitReadAccumulator acc( *this );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		Vector tmp;
+		acc.ReadBitVec3Coord( tmp );
+		pAngles[i].Init( tmp.x, tmp.y, tmp.z );
+	}
+}
+
 int64 bf_read::ReadLongLong()
 {
 	int64 retval;
@@ -1488,3 +1599,279 @@ int bf_read::CompareBitsAt( int offset, bf_read * RESTRICT other, int otherOffse
 	x ^= LoadLittleDWord( (unsigned long*)pData2End, 0 ) << (32 - iStartBit2);
 	return x & g_ExtraMasks[ numbits ];
 }
+
+
+// ---------------------------------------------------------------------------------------- //
+// CBitWriteAccumulator
+// ---------------------------------------------------------------------------------------- //
+
+// The codecs below must produce exactly the bits of their bf_write
+// counterparts; they differ only in packing a whole field into one write.
+
+void CBitWriteAccumulator::WriteUBitLongOverflow( unsigned int data, int numbits )
+{
+	// Let bf_write do the overflow handling so the flag, error handler and
+	// position all match
+	Flush();
+	m_Buf.WriteUBitLong( data, numbits, false );
+	Sync();
+}
+
+void CBitWriteAccumulator::WriteSBitLong( int data, int numbits )
+{
+	// Force the sign-extension bit to be correct even in the case of overflow.
+	int nValue = data;
+	int nPreserveBits = ( 0x7FFFFFFF >> ( 32 - numbits ) );
+	int nSignExtension = ( nValue >> 31 ) & ~nPreserveBits;
+	nValue &= nPreserveBits;
+	nValue |= nSignExtension;
+
+	AssertMsg2( nValue == data, "WriteSBitLong: 0x%08x does not fit in %d bits", data, numbits );
+
+	WriteUBitLong( nValue, numbits );
+}
+
+void CBitWriteAccumulator::WriteFloat( float val )
+{
+	if ( m_Buf.m_nDataBits - m_iCurBit < 32 )
+	{
+		Flush();
+		m_Buf.WriteFloat( val );
+		Sync();
+		return;
+	}
+
+	// bf_write::WriteFloat writes the little endian bytes of the float, which is
+	// the same as writing its bits as a 32 bit value
+	union { float f; uint32 u; } c;
+	c.f = val;
+	WriteUBitLong( c.u, 32 );
+}
+
+void CBitWriteAccumulator::WriteBitAngle( float fAngle, int numbits )
+{
+	unsigned int shift = BitForBitnum(numbits);
+	unsigned int mask = shift - 1;
+
+	int d = (int)( (fAngle / 360.0) * shift );
+	d &= mask;
+
+	WriteUBitLong( (unsigned int)d, numbits );
+}
+
+void CBitWriteAccumulator::WriteBitCoord( const float f )
+{
+	int		signbit = (f <= -COORD_RESOLUTION);
+	int		intval = (int)abs(f);
+	int		fractval = abs((int)(f*COORD_DENOMINATOR)) & (COORD_DENOMINATOR-1);
+
+	// Integer flag, fraction flag, sign, integer - 1, fraction
+	unsigned int bits = ( intval ? 1 : 0 ) | ( fractval ? 2 : 0 );
+	int numbits = 2;
+
+	if ( intval || fractval )
+	{
+		bits |= signbit << 2;
+		numbits = 3;
+
+		if ( intval )
+		{
+			bits |= ( (unsigned int)( intval - 1 ) & ( ( 1 << COORD_INTEGER_BITS ) - 1 ) ) << numbits;
+			numbits += COORD_INTEGER_BITS;
+		}
+
+		if ( fractval )
+		{
+			bits |= (unsigned int)fractval << numbits;
+			numbits += COORD_FRACTIONAL_BITS;
+		}
+	}
+
+	WriteUBitLong( bits, numbits );
+}
+
+void CBitWriteAccumulator::WriteBitVec3Coord( const Vector& fa )
+{
+	int		xflag, yflag, zflag;
+
+	xflag = (fa[0] >= COORD_RESOLUTION) || (fa[0] <= -COORD_RESOLUTION);
+	yflag = (fa[1] >= COORD_RESOLUTION) || (fa[1] <= -COORD_RESOLUTION);
+	zflag = (fa[2] >= COORD_RESOLUTION) || (fa[2] <= -COORD_RESOLUTION);
+
+	WriteUBitLong( xflag | ( yflag << 1 ) | ( zflag << 2 ), 3 );
+
+	if ( xflag )
+		WriteBitCoord( fa[0] );
+	if ( yflag )
+		WriteBitCoord( fa[1] );
+	if ( zflag )
+		WriteBitCoord( fa[2] );
+}
+
+// Sign bit followed by the clamped fraction
+static inline unsigned int EncodeBitNormal( float f )
+{
+	int	signbit = (f <= -NORMAL_RESOLUTION);
+
+	unsigned int fractval = abs( (int)(f*NORMAL_DENOMINATOR) );
+	if (fractval > NORMAL_DENOMINATOR)
+		fractval = NORMAL_DENOMINATOR;
+
+	return signbit | ( fractval << 1 );
+}
+
+void CBitWriteAccumulator::WriteBitNormal( float f )
+{
+	WriteUBitLong( EncodeBitNormal( f ), 1 + NORMAL_FRACTIONAL_BITS );
+}
+
+void CBitWriteAccumulator::WriteBitVec3Normal( const Vector& fa )
+{
+	int		xflag, yflag;
+
+	xflag = (fa[0] >= NORMAL_RESOLUTION) || (fa[0] <= -NORMAL_RESOLUTION);
+	yflag = (fa[1] >= NORMAL_RESOLUTION) || (fa[1] <= -NORMAL_RESOLUTION);
+
+	// Both flags, up to two normals and the z sign fit in a single write
+	unsigned int bits = xflag | ( yflag << 1 );
+	int numbits = 2;
+
+	if ( xflag )
+	{
+		bits |= EncodeBitNormal( fa[0] ) << numbits;
+		numbits += 1 + NORMAL_FRACTIONAL_BITS;
+	}
+	if ( yflag )
+	{
+		bits |= EncodeBitNormal( fa[1] ) << numbits;
+		numbits += 1 + NORMAL_FRACTIONAL_BITS;
+	}
+
+	int	signbit = (fa[2] <= -NORMAL_RESOLUTION);
+	bits |= signbit << numbits;
+	numbits++;
+
+	WriteUBitLong( bits, numbits );
+}
+
+// ---------------------------------------------------------------------------------------- //
+// CBitReadAccumulator
+// ---------------------------------------------------------------------------------------- //
+
+unsigned int CBitReadAccumulator::ReadUBitLongOverflow( int numbits )
+{
+	Flush();
+	unsigned int nResult = m_Buf.ReadUBitLong( numbits );
+	Sync();
+	return nResult;
+}
+
+float CBitReadAccumulator::ReadFloat()
+{
+	if ( m_Buf.m_nDataBits - m_iCurBit < 32 )
+	{
+		Flush();
+		float flResult = m_Buf.ReadFloat();
+		Sync();
+		return flResult;
+	}
+
+	union { uint32 u; float f; } c = { ReadUBitLong( 32 ) };
+	return c.f;
+}
+
+float CBitReadAccumulator::ReadBitAngle( int numbits )
+{
+	float shift = (float)( BitForBitnum(numbits) );
+
+	int i = ReadUBitLong( numbits );
+	return (float)i * (360.0 / shift);
+}
+
+float CBitReadAccumulator::ReadBitCoord()
+{
+	int		intval=0,fractval=0,signbit=0;
+	float	value = 0.0;
+
+	unsigned int flags = ReadUBitLong( 2 );
+	intval = flags & 1;
+	fractval = flags >> 1;
+
+	if ( intval || fractval )
+	{
+		signbit = ReadOneBit();
+
+		if ( intval )
+		{
+			// Adjust the integers from [0..MAX_COORD_VALUE-1] to [1..MAX_COORD_VALUE]
+			intval = ReadUBitLong( COORD_INTEGER_BITS ) + 1;
+		}
+
+		if ( fractval )
+		{
+			fractval = ReadUBitLong( COORD_FRACTIONAL_BITS );
+		}
+
+		value = intval + ((float)fractval * COORD_RESOLUTION);
+
+		if ( signbit )
+			value = -value;
+	}
+
+	return value;
+}
+
+void CBitReadAccumulator::ReadBitVec3Coord( Vector& fa )
+{
+	fa.Init( 0, 0, 0 );
+
+	unsigned int flags = ReadUBitLong( 3 );
+
+	if ( flags & 1 )
+		fa[0] = ReadBitCoord();
+	if ( flags & 2 )
+		fa[1] = ReadBitCoord();
+	if ( flags & 4 )
+		fa[2] = ReadBitCoord();
+}
+
+float CBitReadAccumulator::ReadBitNormal()
+{
+	unsigned int bits = ReadUBitLong( 1 + NORMAL_FRACTIONAL_BITS );
+	int	signbit = bits & 1;
+	unsigned int fractval = bits >> 1;
+
+	float value = (float)fractval * NORMAL_RESOLUTION;
+
+	if ( signbit )
+		value = -value;
+
+	return value;
+}
+
+void CBitReadAccumulator::ReadBitVec3Normal( Vector& fa )
+{
+	unsigned int flags = ReadUBitLong( 2 );
+
+	if ( flags & 1 )
+		fa[0] = ReadBitNormal();
+	else
+		fa[0] = 0.0f;
+
+	if ( flags & 2 )
+		fa[1] = ReadBitNormal();
+	else
+		fa[1] = 0.0f;
+
+	// The first two imply the third (but not its sign)
+	int znegative = ReadOneBit();
+
+	float fafafbfb = fa[0] * fa[0] + fa[1] * fa[1];
+	if (fafafbfb < 1.0f)
+		fa[2] = sqrt( 1.0f - fafafbfb );
+	else
+		fa[2] = 0.0f;
+
+	if (znegative)
+		fa[2] = -fa[2];
+}
@@ -0,0 +1,907 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compiled, read-only KeyValues images. See kvbinaryimage.h.
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+#include <KeyValues.h>
+#include "kvbinaryimage.h"
+#include "filesystem.h"
+
+#include "tier0/dbg.h"
+#include "tier0/threadtools.h"
+#include "utlbuffer.h"
+#include "utlvector.h"
+#include "utldict.h"
+#include "strtools.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include <tier0/memdbgon.h>
+
+#define KVIMAGE_CACHE_DIR		"kvcache"
+#define KVIMAGE_NO_TEXT			-1
+
+//-----------------------------------------------------------------------------
+// Case insensitive hash of a key name that doesn't need a terminator, so path
+// segments can be hashed in place
+//-----------------------------------------------------------------------------
+static inline unsigned int HashKeyName( const char *pName, int nLen )
+{
+	unsigned int nHash = 2166136261u;
+	for ( int i = 0; i < nLen; i++ )
+	{
+		unsigned char c = (unsigned char)pName[i];
+		if ( c >= 'A' && c <= 'Z' )
+			c += 'a' - 'A';
+		nHash = ( nHash ^ c ) * 16777619u;
+	}
+	return nHash;
+}
+
+
+//-----------------------------------------------------------------------------
+// Flattens a KeyValues tree into the image layout
+//-----------------------------------------------------------------------------
+class CKeyValuesImageBuilder
+{
+public:
+	CKeyValuesImageBuilder() : m_StringLookup( k_eDictCompareTypeCaseSensitive )
+	{
+		// Offset 0 is always the empty string
+		AddString( "" );
+	}
+
+	int AddPeers( KeyValues *pFirst )
+	{
+		int nFirst = KVIMAGE_INVALID_NODE;
+		int nPrev = KVIMAGE_INVALID_NODE;
+		for ( KeyValues *pKey = pFirst; pKey; pKey = pKey->GetNextKey() )
+		{
+			int nNode = AddNode( pKey );
+			if ( nPrev == KVIMAGE_INVALID_NODE )
+			{
+				nFirst = nNode;
+			}
+			else
+			{
+				m_Nodes[nPrev].m_nNextPeer = nNode;
+			}
+			nPrev = nNode;
+		}
+		return nFirst;
+	}
+
+	bool Write( int nRootNode, CUtlBuffer &buf )
+	{
+		// Pad the string table so the image size stays a multiple of 4
+		while ( m_Strings.TellPut() & 3 )
+		{
+			m_Strings.PutChar( 0 );
+		}
+
+		KVImageHeader_t header;
+		header.m_nMagic = KVIMAGE_MAGIC;
+		header.m_nVersion = KVIMAGE_VERSION;
+		header.m_nNodeCount = m_Nodes.Count();
+		header.m_nNodeOffset = sizeof( KVImageHeader_t );
+		header.m_nDependencyCount = m_Dependencies.Count();
+		header.m_nDependencyOffset = header.m_nNodeOffset + m_Nodes.Count() * sizeof( KVImageNode_t );
+		header.m_nStringOffset = header.m_nDependencyOffset + m_Dependencies.Count() * sizeof( KVImageDependency_t );
+		header.m_nStringSize = m_Strings.TellPut();
+		header.m_nImageSize = header.m_nStringOffset + header.m_nStringSize;
+		header.m_nRootNode = nRootNode;
+
+		buf.Put( &header, sizeof( header ) );
+		buf.Put( m_Nodes.Base(), m_Nodes.Count() * sizeof( KVImageNode_t ) );
+		buf.Put( m_Dependencies.Base(), m_Dependencies.Count() * sizeof( KVImageDependency_t ) );
+		buf.Put( m_Strings.Base(), m_Strings.TellPut() );
+		return buf.IsValid();
+	}
+
+	void AddDependency( const char *pFileName, long nFileTime )
+	{
+		KVImageDependency_t &dependency = m_Dependencies[ m_Dependencies.AddToTail() ];
+		dependency.m_nFile = AddString( pFileName );
+		dependency.m_nFileTime = (int)nFileTime;
+	}
+
+private:
+	int AddString( const char *pString )
+	{
+		int i = m_StringLookup.Find( pString );
+		if ( i != m_StringLookup.InvalidIndex() )
+			return m_StringLookup[i];
+
+		int nOffset = m_Strings.TellPut();
+		m_Strings.PutString( pString );
+		m_StringLookup.Insert( pString, nOffset );
+		return nOffset;
+	}
+
+	int AddFormatted( const char *pFormat, ... )
+	{
+		char buf[64];
+		va_list marker;
+		va_start( marker, pFormat );
+		Q_vsnprintf( buf, sizeof( buf ), pFormat, marker );
+		va_end( marker );
+		return AddString( buf );
+	}
+
+	int AddNode( KeyValues *pKey )
+	{
+		// Reserve our slot first so a node always precedes its children
+		int nNode = m_Nodes.AddToTail();
+		{
+			KVImageNode_t &node = m_Nodes[nNode];
+			memset( &node, 0, sizeof( node ) );
+
+			const char *pName = pKey->GetName();
+			node.m_nName = AddString( pName );
+			node.m_nNameHash = HashKeyName( pName, Q_strlen( pName ) );
+			node.m_nFirstChild = KVIMAGE_INVALID_NODE;
+			node.m_nNextPeer = KVIMAGE_INVALID_NODE;
+			node.m_nText = KVIMAGE_NO_TEXT;
+		}
+
+		// Only the typed getters are used here; GetString() would convert
+		// numeric keys of the source tree to strings.
+		int nType = pKey->GetDataType();
+		int nValue[2] = { 0, 0 };
+		int nText = KVIMAGE_NO_TEXT;
+		switch ( nType )
+		{
+		case KeyValues::TYPE_STRING:
+			{
+				const char *pValue = pKey->GetString();
+				nText = AddString( pValue ? pValue : "" );
+			}
+			break;
+
+		case KeyValues::TYPE_WSTRING:
+			{
+				char szUTF8[2048];
+				Q_UnicodeToUTF8( pKey->GetWString(), szUTF8, sizeof( szUTF8 ) );
+				nText = AddString( szUTF8 );
+			}
+			break;
+
+		case KeyValues::TYPE_INT:
+			nValue[0] = pKey->GetInt();
+			nText = AddFormatted( "%d", nValue[0] );
+			break;
+
+		case KeyValues::TYPE_FLOAT:
+			{
+				float flValue = pKey->GetFloat();
+				memcpy( &nValue[0], &flValue, sizeof( flValue ) );
+				nText = AddFormatted( "%f", flValue );
+			}
+			break;
+
+		case KeyValues::TYPE_UINT64:
+			{
+				uint64 nValue64 = pKey->GetUint64();
+				memcpy( nValue, &nValue64, sizeof( nValue64 ) );
+				nText = AddFormatted( "%lld", nValue64 );
+			}
+			break;
+
+		case KeyValues::TYPE_COLOR:
+			{
+				Color color = pKey->GetColor();
+				unsigned char rgba[4] = { (unsigned char)color.r(), (unsigned char)color.g(), (unsigned char)color.b(), (unsigned char)color.a() };
+				memcpy( &nValue[0], rgba, sizeof( rgba ) );
+				nText = AddFormatted( "%d %d %d %d", rgba[0], rgba[1], rgba[2], rgba[3] );
+			}
+			break;
+
+		case KeyValues::TYPE_PTR:
+			// Pointers mean nothing outside of this process
+			nType = KeyValues::TYPE_NONE;
+			break;
+
+		default:
+			nType = KeyValues::TYPE_NONE;
+			break;
+		}
+
+		int nFirstChild = AddPeers( pKey->GetFirstSubKey() );
+
+		// m_Nodes may have grown while adding the children
+		KVImageNode_t &node = m_Nodes[nNode];
+		node.m_nType = (unsigned char)nType;
+		node.m_nValue[0] = nValue[0];
+		node.m_nValue[1] = nValue[1];
+		node.m_nText = nText;
+		node.m_nFirstChild = nFirstChild;
+		return nNode;
+	}
+
+	CUtlVector< KVImageNode_t > m_Nodes;
+	CUtlVector< KVImageDependency_t > m_Dependencies;
+	CUtlBuffer m_Strings;
+	CUtlDict< int, int > m_StringLookup;
+};
+
+
+//-----------------------------------------------------------------------------
+// KeyValuesView
+//-----------------------------------------------------------------------------
+const char *KeyValuesView::GetName() const
+{
+	return IsValid() ? m_pImage->GetString( GetNode()->m_nName ) : "";
+}
+
+int KeyValuesView::GetDataType() const
+{
+	return IsValid() ? GetNode()->m_nType : KeyValues::TYPE_NONE;
+}
+
+KeyValuesView KeyValuesView::FindKey( const char *pKeyName ) const
+{
+	if ( !IsValid() )
+		return KeyValuesView();
+
+	// return the current key if a NULL subkey is asked for
+	if ( !pKeyName || !pKeyName[0] )
+		return *this;
+
+	int nNode = m_nNode;
+	const char *pSegment = pKeyName;
+	for ( ;; )
+	{
+		// Walk one '/' delimited segment at a time without copying it
+		const char *pEnd = strchr( pSegment, '/' );
+		int nLen = pEnd ? pEnd - pSegment : Q_strlen( pSegment );
+		unsigned int nHash = HashKeyName( pSegment, nLen );
+
+		int nChild = m_pImage->GetNode( nNode )->m_nFirstChild;
+		while ( nChild != KVIMAGE_INVALID_NODE )
+		{
+			const KVImageNode_t *pChild = m_pImage->GetNode( nChild );
+			if ( pChild->m_nNameHash == nHash )
+			{
+				const char *pName = m_pImage->GetString( pChild->m_nName );
+				if ( !Q_strnicmp( pName, pSegment, nLen ) && pName[nLen] == 0 )
+					break;
+			}
+			nChild = pChild->m_nNextPeer;
+		}
+
+		if ( nChild == KVIMAGE_INVALID_NODE )
+			return KeyValuesView();
+
+		if ( !pEnd )
+			return KeyValuesView( m_pImage, nChild );
+
+		nNode = nChild;
+		pSegment = pEnd + 1;
+	}
+}
+
+KeyValuesView KeyValuesView::GetFirstSubKey() const
+{
+	return IsValid() ? KeyValuesView( m_pImage, GetNode()->m_nFirstChild ) : KeyValuesView();
+}
+
+KeyValuesView KeyValuesView::GetNextKey() const
+{
+	return IsValid() ? KeyValuesView( m_pImage, GetNode()->m_nNextPeer ) : KeyValuesView();
+}
+
+KeyValuesView KeyValuesView::GetFirstTrueSubKey() const
+{
+	KeyValuesView view = GetFirstSubKey();
+	while ( view && view.GetDataType() != KeyValues::TYPE_NONE )
+	{
+		view = view.GetNextKey();
+	}
+	return view;
+}
+
+KeyValuesView KeyValuesView::GetNextTrueSubKey() const
+{
+	KeyValuesView view = GetNextKey();
+	while ( view && view.GetDataType() != KeyValues::TYPE_NONE )
+	{
+		view = view.GetNextKey();
+	}
+	return view;
+}
+
+KeyValuesView KeyValuesView::GetFirstValue() const
+{
+	KeyValuesView view = GetFirstSubKey();
+	while ( view && view.GetDataType() == KeyValues::TYPE_NONE )
+	{
+		view = view.GetNextKey();
+	}
+	return view;
+}
+
+KeyValuesView KeyValuesView::GetNextValue() const
+{
+	KeyValuesView view = GetNextKey();
+	while ( view && view.GetDataType() == KeyValues::TYPE_NONE )
+	{
+		view = view.GetNextKey();
+	}
+	return view;
+}
+
+//-----------------------------------------------------------------------------
+// The getters convert between types exactly like their KeyValues counterparts
+//-----------------------------------------------------------------------------
+int KeyValuesView::GetInt( const char *pKeyName, int nDefaultValue ) const
+{
+	KeyValuesView view = FindKey( pKeyName );
+	if ( !view )
+		return nDefaultValue;
+
+	const KVImageNode_t *pNode = view.GetNode();
+	switch ( pNode->m_nType )
+	{
+	case KeyValues::TYPE_STRING:
+	case KeyValues::TYPE_WSTRING:
+		return atoi( m_pImage->GetString( pNode->m_nText ) );
+	case KeyValues::TYPE_FLOAT:
+		return (int)*(const float *)&pNode->m_nValue[0];
+	case KeyValues::TYPE_UINT64:
+		// can't convert, since it would lose data
+		Assert( 0 );
+		return 0;
+	case KeyValues::TYPE_INT:
+	default:
+		return pNode->m_nValue[0];
+	}
+}
+
+uint64 KeyValuesView::GetUint64( const char *pKeyName, uint64 nDefaultValue ) const
+{
+	KeyValuesView view = FindKey( pKeyName );
+	if ( !view )
+		return nDefaultValue;
+
+	const KVImageNode_t *pNode = view.GetNode();
+	switch ( pNode->m_nType )
+	{
+	case KeyValues::TYPE_STRING:
+	case KeyValues::TYPE_WSTRING:
+		return (uint64)Q_atoi64( m_pImage->GetString( pNode->m_nText ) );
+	case KeyValues::TYPE_FLOAT:
+		return (int)*(const float *)&pNode->m_nValue[0];
+	case KeyValues::TYPE_UINT64:
+		{
+			uint64 nValue;
+			memcpy( &nValue, pNode->m_nValue, sizeof( nValue ) );
+			return nValue;
+		}
+	case KeyValues::TYPE_INT:
+	default:
+		return pNode->m_nValue[0];
+	}
+}
+
+float KeyValuesView::GetFloat( const char *pKeyName, float flDefaultValue ) const
+{
+	KeyValuesView view = FindKey( pKeyName );
+	if ( !view )
+		return flDefaultValue;
+
+	const KVImageNode_t *pNode = view.GetNode();
+	switch ( pNode->m_nType )
+	{
+	case KeyValues::TYPE_STRING:
+	case KeyValues::TYPE_WSTRING:
+		return (float)atof( m_pImage->GetString( pNode->m_nText ) );
+	case KeyValues::TYPE_FLOAT:
+		return *(const float *)&pNode->m_nValue[0];
+	case KeyValues::TYPE_INT:
+		return (float)pNode->m_nValue[0];
+	case KeyValues::TYPE_UINT64:
+		return (float)view.GetUint64();
+	default:
+		return 0.0f;
+	}
+}
+
+Color KeyValuesView::GetColor( const char *pKeyName ) const
+{
+	Color color( 0, 0, 0, 0 );
+	KeyValuesView view = FindKey( pKeyName );
+	if ( !view )
+		return color;
+
+	const KVImageNode_t *pNode = view.GetNode();
+	switch ( pNode->m_nType )
+	{
+	case KeyValues::TYPE_COLOR:
+		{
+			const unsigned char *rgba = (const unsigned char *)&pNode->m_nValue[0];
+			color.SetColor( rgba[0], rgba[1], rgba[2], rgba[3] );
+		}
+		break;
+	case KeyValues::TYPE_FLOAT:
+		color[0] = *(const float *)&pNode->m_nValue[0];
+		break;
+	case KeyValues::TYPE_INT:
+		color[0] = pNode->m_nValue[0];
+		break;
+	case KeyValues::TYPE_STRING:
+		{
+			// parse the colors out of the string
+			float a = 0.0f, b = 0.0f, c = 0.0f, d = 0.0f;
+			sscanf( m_pImage->GetString( pNode->m_nText ), "%f %f %f %f", &a, &b, &c, &d );
+			color.SetColor( (unsigned char)a, (unsigned char)b, (unsigned char)c, (unsigned char)d );
+		}
+		break;
+	}
+	return color;
+}
+
+const char *KeyValuesView::GetString( const char *pKeyName, const char *pDefaultValue ) const
+{
+	KeyValuesView view = FindKey( pKeyName );
+	if ( !view )
+		return pDefaultValue;
+
+	const KVImageNode_t *pNode = view.GetNode();
+	if ( pNode->m_nText == KVIMAGE_NO_TEXT )
+		return pDefaultValue;
+
+	return m_pImage->GetString( pNode->m_nText );
+}
+
+bool KeyValuesView::IsEmpty( const char *pKeyName ) const
+{
+	KeyValuesView view = FindKey( pKeyName );
+	if ( !view )
+		return true;
+
+	const KVImageNode_t *pNode = view.GetNode();
+	return ( pNode->m_nType == KeyValues::TYPE_NONE && pNode->m_nFirstChild == KVIMAGE_INVALID_NODE );
+}
+
+//-----------------------------------------------------------------------------
+// Copies one image node (value and children) into an existing KeyValues
+//-----------------------------------------------------------------------------
+static void InflateNode( const CKeyValuesImage *pImage, int nNode, KeyValues *pDest )
+{
+	const KVImageNode_t *pNode = pImage->GetNode( nNode );
+	switch ( pNode->m_nType )
+	{
+	case KeyValues::TYPE_STRING:
+		pDest->SetStringValue( pImage->GetString( pNode->m_nText ) );
+		break;
+
+	case KeyValues::TYPE_WSTRING:
+		{
+			wchar_t wszValue[2048];
+			Q_UTF8ToUnicode( pImage->GetString( pNode->m_nText ), wszValue, sizeof( wszValue ) );
+			pDest->SetWString( NULL, wszValue );
+		}
+		break;
+
+	case KeyValues::TYPE_INT:
+		pDest->SetInt( NULL, pNode->m_nValue[0] );
+		break;
+
+	case KeyValues::TYPE_FLOAT:
+		pDest->SetFloat( NULL, *(const float *)&pNode->m_nValue[0] );
+		break;
+
+	case KeyValues::TYPE_UINT64:
+		{
+			uint64 nValue;
+			memcpy( &nValue, pNode->m_nValue, sizeof( nValue ) );
+			pDest->SetUint64( NULL, nValue );
+		}
+		break;
+
+	case KeyValues::TYPE_COLOR:
+		{
+			const unsigned char *rgba = (const unsigned char *)&pNode->m_nValue[0];
+			pDest->SetColor( NULL, Color( rgba[0], rgba[1], rgba[2], rgba[3] ) );
+		}
+		break;
+	}
+
+	// Append after any existing children, keeping track of the tail so this
+	// stays linear. Relinking by hand means any child index has to go.
+	pDest->ReleaseChildIndex();
+	KeyValues *pLastChild = pDest->FindLastSubKey();
+	for ( int nChild = pNode->m_nFirstChild; nChild != KVIMAGE_INVALID_NODE; nChild = pImage->GetNode( nChild )->m_nNextPeer )
+	{
+		KeyValues *pChild = new KeyValues( pImage->GetString( pImage->GetNode( nChild )->m_nName ) );
+		InflateNode( pImage, nChild, pChild );
+
+		if ( pLastChild )
+		{
+			pLastChild->SetNextKey( pChild );
+		}
+		else
+		{
+			pDest->AddSubKey( pChild );
+		}
+		pLastChild = pChild;
+	}
+}
+
+KeyValues *KeyValuesView::MakeKeyValues() const
+{
+	if ( !IsValid() )
+		return NULL;
+
+	KeyValues *pKeyValues = new KeyValues( GetName() );
+	InflateNode( m_pImage, m_nNode, pKeyValues );
+	return pKeyValues;
+}
+
+
+//-----------------------------------------------------------------------------
+// CKeyValuesImage
+//-----------------------------------------------------------------------------
+CKeyValuesImage::CKeyValuesImage() :
+	m_pHeader( NULL ),
+	m_pNodes( NULL ),
+	m_pDependencies( NULL ),
+	m_pStrings( NULL ),
+	m_pMappedView( NULL ),
+	m_nMappedSize( 0 )
+{
+}
+
+CKeyValuesImage::~CKeyValuesImage()
+{
+	Shutdown();
+}
+
+void CKeyValuesImage::Shutdown()
+{
+	if ( m_pMappedView )
+	{
+		CUtlMappedBuffer::UnmapFileView( m_pMappedView, m_nMappedSize );
+		m_pMappedView = NULL;
+		m_nMappedSize = 0;
+	}
+
+	m_OwnedData.Purge();
+	m_pHeader = NULL;
+	m_pNodes = NULL;
+	m_pDependencies = NULL;
+	m_pStrings = NULL;
+}
+
+bool CKeyValuesImage::Compile( KeyValues *pKeyValues, CUtlBuffer &buf, IBaseFileSystem *pFileSystem, const char *pPathID, const CUtlVector< CUtlString > *pDependencies )
+{
+	if ( !pKeyValues || buf.IsText() )
+		return false;
+
+	CKeyValuesImageBuilder builder;
+	if ( pFileSystem && pDependencies )
+	{
+		for ( int i = 0; i < pDependencies->Count(); i++ )
+		{
+			const char *pFileName = (*pDependencies)[i].Get();
+			builder.AddDependency( pFileName, pFileSystem->GetFileTime( pFileName, pPathID ) );
+		}
+	}
+
+	int nRoot = builder.AddPeers( pKeyValues );
+	return builder.Write( nRoot, buf );
+}
+
+bool CKeyValuesImage::IsImage( const void *pData, int nSize )
+{
+	if ( !pData || nSize < (int)sizeof( KVImageHeader_t ) )
+		return false;
+
+	KVImageHeader_t header;
+	memcpy( &header, pData, sizeof( header ) );
+	return header.m_nMagic == KVIMAGE_MAGIC && header.m_nVersion == KVIMAGE_VERSION && header.m_nImageSize <= nSize;
+}
+
+//-----------------------------------------------------------------------------
+// Checks every offset and index once up front so the accessors (and mapped
+// files that were truncated or tampered with) never need bounds checks
+//-----------------------------------------------------------------------------
+bool CKeyValuesImage::Validate( const void *pData, int nSize )
+{
+	if ( !IsImage( pData, nSize ) )
+		return false;
+
+	const KVImageHeader_t *pHeader = (const KVImageHeader_t *)pData;
+	if ( pHeader->m_nNodeCount < 0 || pHeader->m_nNodeCount > nSize / (int)sizeof( KVImageNode_t ) || pHeader->m_nStringSize <= 0 ||
+		pHeader->m_nNodeOffset != sizeof( KVImageHeader_t ) ||
+		pHeader->m_nDependencyCount < 0 || pHeader->m_nDependencyCount > nSize / (int)sizeof( KVImageDependency_t ) ||
+		pHeader->m_nDependencyOffset != pHeader->m_nNodeOffset + pHeader->m_nNodeCount * (int)sizeof( KVImageNode_t ) ||
+		pHeader->m_nStringOffset != pHeader->m_nDependencyOffset + pHeader->m_nDependencyCount * (int)sizeof( KVImageDependency_t ) ||
+		pHeader->m_nImageSize != pHeader->m_nStringOffset + pHeader->m_nStringSize )
+	{
+		return false;
+	}
+
+	const char *pStrings = (const char *)pData + pHeader->m_nStringOffset;
+	if ( pStrings[pHeader->m_nStringSize - 1] != 0 )
+		return false;
+
+	int nNodes = pHeader->m_nNodeCount;
+	if ( pHeader->m_nRootNode < KVIMAGE_INVALID_NODE || pHeader->m_nRootNode >= nNodes )
+		return false;
+
+	const KVImageNode_t *pNodes = (const KVImageNode_t *)( (const char *)pData + pHeader->m_nNodeOffset );
+	for ( int i = 0; i < nNodes; i++ )
+	{
+		const KVImageNode_t &node = pNodes[i];
+
+		// Links only ever point forward, which also rules out cycles
+		if ( ( node.m_nFirstChild != KVIMAGE_INVALID_NODE && ( node.m_nFirstChild <= i || node.m_nFirstChild >= nNodes ) ) ||
+			( node.m_nNextPeer != KVIMAGE_INVALID_NODE && ( node.m_nNextPeer <= i || node.m_nNextPeer >= nNodes ) ) )
+		{
+			return false;
+		}
+
+		if ( node.m_nName < 0 || node.m_nName >= pHeader->m_nStringSize ||
+			node.m_nText < KVIMAGE_NO_TEXT || node.m_nText >= pHeader->m_nStringSize ||
+			node.m_nType >= KeyValues::TYPE_NUMTYPES )
+		{
+			return false;
+		}
+
+		// String values are read through m_nText without checking it
+		if ( node.m_nText == KVIMAGE_NO_TEXT && 
+			( node.m_nType == KeyValues::TYPE_STRING || node.m_nType == KeyValues::TYPE_WSTRING ) )
+		{
+			return false;
+		}
+	}
+
+	const KVImageDependency_t *pDependencies = (const KVImageDependency_t *)( (const char *)pData + pHeader->m_nDependencyOffset );
+	for ( int i = 0; i < pHeader->m_nDependencyCount; i++ )
+	{
+		if ( pDependencies[i].m_nFile < 0 || pDependencies[i].m_nFile >= pHeader->m_nStringSize )
+			return false;
+	}
+
+	return true;
+}
+
+bool CKeyValuesImage::Bind( const void *pData, int nSize )
+{
+	if ( !Validate( pData, nSize ) )
+		return false;
+
+	m_pHeader = (const KVImageHeader_t *)pData;
+	m_pNodes = (const KVImageNode_t *)( (const char *)pData + m_pHeader->m_nNodeOffset );
+	m_pDependencies = (const KVImageDependency_t *)( (const char *)pData + m_pHeader->m_nDependencyOffset );
+	m_pStrings = (const char *)pData + m_pHeader->m_nStringOffset;
+	return true;
+}
+
+bool CKeyValuesImage::InitFromMemory( const void *pData, int nSize )
+{
+	Shutdown();
+
+	// The node array is read in place, so it needs natural alignment
+	if ( (uintp)pData & 3 )
+	{
+		m_OwnedData.EnsureCapacity( nSize );
+		memcpy( m_OwnedData.Base(), pData, nSize );
+		pData = m_OwnedData.Base();
+	}
+
+	if ( !Bind( pData, nSize ) )
+	{
+		Shutdown();
+		return false;
+	}
+	return true;
+}
+
+bool CKeyValuesImage::InitFromBuffer( const CUtlBuffer &buf )
+{
+	Shutdown();
+
+	int nSize = buf.TellMaxPut();
+	m_OwnedData.EnsureCapacity( nSize );
+	memcpy( m_OwnedData.Base(), buf.Base(), nSize );
+
+	if ( !Bind( m_OwnedData.Base(), nSize ) )
+	{
+		Shutdown();
+		return false;
+	}
+	return true;
+}
+
+bool CKeyValuesImage::InitFromFile( IBaseFileSystem *pFileSystem, const char *pFileName, const char *pPathID )
+{
+	Shutdown();
+
+	// Loose files are mapped; the OS pages them in on demand and shares the
+	// pages between every process that loads the same image.
+	char szFullPath[MAX_PATH];
+	if ( ((IFileSystem *)pFileSystem)->RelativePathToFullPath( pFileName, pPathID, szFullPath, sizeof( szFullPath ), FILTER_CULLPACK ) )
+	{
+		m_pMappedView = CUtlMappedBuffer::MapFileView( szFullPath, &m_nMappedSize );
+		if ( m_pMappedView )
+		{
+			if ( Bind( m_pMappedView, m_nMappedSize ) )
+				return true;
+
+			Warning( "KeyValues image %s is invalid\n", pFileName );
+			Shutdown();
+			return false;
+		}
+	}
+
+	// Packed or otherwise unmappable; read it instead
+	CUtlBuffer buf;
+	if ( !pFileSystem->ReadFile( pFileName, pPathID, buf ) )
+		return false;
+
+	return InitFromBuffer( buf );
+}
+
+void CKeyValuesImage::GetImageFileName( const char *pTextFile, const char *pPathID, bool bEscapeSequences, bool bEvaluateConditionals, char *pImageFile, int nMaxLen )
+{
+	// The same file can resolve differently per path ID and parses differently
+	// per setting, so each combination gets its own image
+	Q_snprintf( pImageFile, nMaxLen, "%s%c%s%c%s.e%dc%d%s", KVIMAGE_CACHE_DIR, CORRECT_PATH_SEPARATOR, 
+		pPathID ? pPathID : "_all", CORRECT_PATH_SEPARATOR, pTextFile, 
+		bEscapeSequences ? 1 : 0, bEvaluateConditionals ? 1 : 0, KVIMAGE_EXTENSION );
+	Q_FixSlashes( pImageFile );
+}
+
+//-----------------------------------------------------------------------------
+// Files loaded through #include and #base while an image is being compiled
+// on this thread. NULL when nothing is recording.
+//-----------------------------------------------------------------------------
+static CThreadLocalPtr< CUtlVector< CUtlString > > s_pDependencyRecorder;
+
+void CKeyValuesImage::NoteIncludedFile( const char *pFileName )
+{
+	CUtlVector< CUtlString > *pDependencies = s_pDependencyRecorder;
+	if ( !pDependencies || !pFileName )
+		return;
+
+	for ( int i = 0; i < pDependencies->Count(); i++ )
+	{
+		if ( !Q_stricmp( (*pDependencies)[i].Get(), pFileName ) )
+			return;
+	}
+	pDependencies->AddToTail( CUtlString( pFileName ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Forwards this image's dependencies to an image being compiled
+//			further up the stack, which included this file
+//-----------------------------------------------------------------------------
+void CKeyValuesImage::NoteDependencies() const
+{
+	for ( int i = 0; i < GetDependencyCount(); i++ )
+	{
+		NoteIncludedFile( GetString( m_pDependencies[i].m_nFile ) );
+	}
+}
+
+bool CKeyValuesImage::IsUpToDate( IBaseFileSystem *pFileSystem, const char *pPathID ) const
+{
+	// Images without dependencies predate tracking them; never trust those
+	if ( GetDependencyCount() == 0 )
+		return false;
+
+	for ( int i = 0; i < GetDependencyCount(); i++ )
+	{
+		const KVImageDependency_t &dependency = m_pDependencies[i];
+		if ( (int)pFileSystem->GetFileTime( GetString( dependency.m_nFile ), pPathID ) != dependency.m_nFileTime )
+			return false;
+	}
+	return true;
+}
+
+bool CKeyValuesImage::LoadOrCompile( IBaseFileSystem *pFileSystem, const char *pTextFile, const char *pPathID, 
+	bool bEscapeSequences, bool bEvaluateConditionals, const char *pCachePathID )
+{
+	Shutdown();
+
+	char szImageFile[MAX_PATH];
+	GetImageFileName( pTextFile, pPathID, bEscapeSequences, bEvaluateConditionals, szImageFile, sizeof( szImageFile ) );
+
+	if ( pCachePathID && pFileSystem->FileExists( szImageFile, pCachePathID ) && 
+		InitFromFile( pFileSystem, szImageFile, pCachePathID ) )
+	{
+		if ( IsUpToDate( pFileSystem, pPathID ) )
+		{
+			NoteDependencies();
+			return true;
+		}
+		Shutdown();
+	}
+
+	// Parse the text directly rather than through KeyValues::LoadFromFile,
+	// which may itself be routed through the image cache
+	CUtlBuffer text;
+	if ( !pFileSystem->ReadFile( pTextFile, pPathID, text ) )
+		return false;
+	text.PutChar( 0 );
+	text.PutChar( 0 );
+
+	if ( IsImage( text.Base(), text.TellMaxPut() ) )
+	{
+		// Already compiled; nothing to cache
+		NoteIncludedFile( pTextFile );
+		return InitFromBuffer( text );
+	}
+
+	// Record every file the parse pulls in, keeping whatever an outer
+	// compile was recording
+	CUtlVector< CUtlString > dependencies;
+	dependencies.AddToTail( CUtlString( pTextFile ) );
+	CUtlVector< CUtlString > *pOuterDependencies = s_pDependencyRecorder;
+	s_pDependencyRecorder = &dependencies;
+
+	KeyValues *pKeyValues = new KeyValues( pTextFile );
+	pKeyValues->UsesEscapeSequences( bEscapeSequences );
+	pKeyValues->UsesConditionals( bEvaluateConditionals );
+	bool bOK = pKeyValues->LoadFromBuffer( pTextFile, (const char *)text.Base(), pFileSystem, pPathID );
+
+	s_pDependencyRecorder = pOuterDependencies;
+
+	CUtlBuffer image;
+	bOK = bOK && Compile( pKeyValues, image, pFileSystem, pPathID, &dependencies );
+	pKeyValues->deleteThis();
+
+	if ( !bOK )
+		return false;
+
+	if ( pCachePathID )
+	{
+		char szImageDir[MAX_PATH];
+		if ( Q_ExtractFilePath( szImageFile, szImageDir, sizeof( szImageDir ) ) )
+		{
+			((IFileSystem *)pFileSystem)->CreateDirHierarchy( szImageDir, pCachePathID );
+		}
+		pFileSystem->WriteFile( szImageFile, pCachePathID, image );
+	}
+
+	if ( !InitFromBuffer( image ) )
+		return false;
+
+	NoteDependencies();
+	return true;
+}
+
+bool CKeyValuesImage::ReadInto( KeyValues *pDest, const void *pData, int nSize )
+{
+	CKeyValuesImage image;
+	return image.InitFromMemory( pData, nSize ) && image.CopyInto( pDest );
+}
+
+bool CKeyValuesImage::CopyInto( KeyValues *pDest ) const
+{
+	if ( !IsLoaded() )
+		return false;
+
+	int nNode = m_pHeader->m_nRootNode;
+	if ( nNode == KVIMAGE_INVALID_NODE )
+		return true;
+
+	// The first top level key goes into pDest, the rest are chained after it
+	pDest->SetName( GetString( GetNode( nNode )->m_nName ) );
+	InflateNode( this, nNode, pDest );
+
+	KeyValues *pPrev = pDest;
+	for ( nNode = GetNode( nNode )->m_nNextPeer; nNode != KVIMAGE_INVALID_NODE; nNode = GetNode( nNode )->m_nNextPeer )
+	{
+		KeyValues *pKey = new KeyValues( GetString( GetNode( nNode )->m_nName ) );
+		InflateNode( this, nNode, pKey );
+		pPrev->SetNextKey( pKey );
+		pPrev = pKey;
+	}
+
+	return true;
+}
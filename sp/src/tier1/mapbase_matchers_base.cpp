@@ -35,6 +35,13 @@ bool Matcher_RunCharCompare(const char *pszQuery, const char *szValue)
 	// This matching model is based off of the ASW SDK
 	while ( *szValue && *pszQuery )
 	{
+		// Skip the run of characters that already match
+		int nSame = V_StrCaselessMatchLength( szValue, pszQuery );
+		szValue += nSame;
+		pszQuery += nSame;
+		if ( !*szValue || !*pszQuery )
+			break;
+
 		char cName = *szValue;
 		char cQuery = *pszQuery;
 		if ( cName != cQuery && tolower(cName) != tolower(cQuery) ) // people almost always use lowercase, so assume that first
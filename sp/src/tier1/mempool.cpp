@@ -310,3 +310,271 @@ void CUtlMemoryPool::Free( void *memBlock )
 }
 
 
+
+
+//-----------------------------------------------------------------------------
+// CMemoryPoolMT
+//-----------------------------------------------------------------------------
+
+// Live pools, for GetAllStats. Both are fine to use before static constructors
+// have run since they start out zeroed.
+static CMemoryPoolMT *s_pFirstPoolMT;
+static CThreadFastMutex s_PoolMTListMutex;
+
+CMemoryPoolMT::CMemoryPoolMT( int blockSize, int numElements, int growMode, const char *pszAllocOwner ) : 
+	CUtlMemoryPool( blockSize, numElements, growMode, pszAllocOwner )
+{
+	for ( int i = 0; i < MAGAZINE_COUNT; i++ )
+	{
+		m_Magazines[i].m_nCount = 0;
+		m_Magazines[i].m_nAllocs = 0;
+		m_Magazines[i].m_nFrees = 0;
+		m_Magazines[i].m_nContention = 0;
+	}
+	m_nBatches = 0;
+	m_nPoolContention = 0;
+
+	AUTO_LOCK( s_PoolMTListMutex );
+	m_pPrevPool = NULL;
+	m_pNextPool = s_pFirstPoolMT;
+	if ( s_pFirstPoolMT )
+	{
+		s_pFirstPoolMT->m_pPrevPool = this;
+	}
+	s_pFirstPoolMT = this;
+}
+
+CMemoryPoolMT::~CMemoryPoolMT()
+{
+	{
+		AUTO_LOCK( s_PoolMTListMutex );
+		if ( m_pPrevPool )
+		{
+			m_pPrevPool->m_pNextPool = m_pNextPool;
+		}
+		else
+		{
+			s_pFirstPoolMT = m_pNextPool;
+		}
+		if ( m_pNextPool )
+		{
+			m_pNextPool->m_pPrevPool = m_pPrevPool;
+		}
+	}
+
+	// So the base class doesn't report cached blocks as leaks
+	FlushMagazines();
+}
+
+//-----------------------------------------------------------------------------
+// Picks this thread's magazine and locks it
+//-----------------------------------------------------------------------------
+CMemoryPoolMT::Magazine_t &CMemoryPoolMT::LockMagazine()
+{
+	// Thread ids are often multiples of 4, so hash them rather than masking
+	unsigned int nSlot = ( (unsigned int)ThreadGetCurrentId() * 2654435761u ) >> ( 32 - MAGAZINE_BITS );
+	Magazine_t &magazine = m_Magazines[nSlot];
+
+	if ( !magazine.m_mutex.TryLock() )
+	{
+		magazine.m_mutex.Lock();
+		magazine.m_nContention++;
+	}
+	return magazine;
+}
+
+void CMemoryPoolMT::LockPool()
+{
+	if ( !m_mutex.TryLock() )
+	{
+		m_mutex.Lock();
+		m_nPoolContention++;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Moves a batch of blocks from the shared pool into an empty magazine
+//-----------------------------------------------------------------------------
+void CMemoryPoolMT::RefillMagazine( Magazine_t &magazine )
+{
+	LockPool();
+	while ( magazine.m_nCount < MAGAZINE_BATCH )
+	{
+		void *pBlock = CUtlMemoryPool::Alloc();
+		if ( !pBlock )
+			break;
+
+		magazine.m_pBlocks[magazine.m_nCount++] = pBlock;
+	}
+	m_nBatches++;
+	m_mutex.Unlock();
+}
+
+//-----------------------------------------------------------------------------
+// Returns the oldest nBlocks of a magazine to the shared pool
+//-----------------------------------------------------------------------------
+void CMemoryPoolMT::DrainMagazine( Magazine_t &magazine, int nBlocks )
+{
+	Assert( nBlocks <= magazine.m_nCount );
+
+	LockPool();
+	for ( int i = 0; i < nBlocks; i++ )
+	{
+		CUtlMemoryPool::Free( magazine.m_pBlocks[i] );
+	}
+	m_nBatches++;
+	m_mutex.Unlock();
+
+	magazine.m_nCount -= nBlocks;
+	memmove( magazine.m_pBlocks, magazine.m_pBlocks + nBlocks, magazine.m_nCount * sizeof( void * ) );
+}
+
+void *CMemoryPoolMT::Alloc( size_t amount )
+{
+	if ( amount > (unsigned int)m_BlockSize )
+		return NULL;
+
+	// Pools that can't grow keep every block in the shared pool, otherwise a
+	// thread could run dry while another's magazine holds the last blocks
+	if ( m_GrowMode == UTLMEMORYPOOL_GROW_NONE )
+	{
+		AUTO_LOCK( m_mutex );
+		void *pBlock = CUtlMemoryPool::Alloc( amount );
+		if ( pBlock )
+		{
+			m_Magazines[0].m_nAllocs++;
+		}
+		return pBlock;
+	}
+
+	Magazine_t &magazine = LockMagazine();
+	if ( !magazine.m_nCount )
+	{
+		RefillMagazine( magazine );
+	}
+
+	void *pBlock = NULL;
+	if ( magazine.m_nCount )
+	{
+		pBlock = magazine.m_pBlocks[--magazine.m_nCount];
+		magazine.m_nAllocs++;
+	}
+	magazine.m_mutex.Unlock();
+
+	return pBlock;
+}
+
+void *CMemoryPoolMT::AllocZero( size_t amount )
+{
+	void *mem = Alloc( amount );
+	if ( mem )
+	{
+		V_memset( mem, 0x00, amount );
+	}
+	return mem;
+}
+
+void CMemoryPoolMT::Free( void *pMem )
+{
+	if ( !pMem )
+		return;
+
+	if ( m_GrowMode == UTLMEMORYPOOL_GROW_NONE )
+	{
+		AUTO_LOCK( m_mutex );
+		CUtlMemoryPool::Free( pMem );
+		m_Magazines[0].m_nFrees++;
+		return;
+	}
+
+#ifdef _DEBUG	
+	// invalidate the memory; the shared pool checks the range when the block goes back to it
+	memset( pMem, 0xDD, m_BlockSize );
+#endif
+
+	Magazine_t &magazine = LockMagazine();
+	if ( magazine.m_nCount == MAGAZINE_SIZE )
+	{
+		DrainMagazine( magazine, MAGAZINE_BATCH );
+	}
+	magazine.m_pBlocks[magazine.m_nCount++] = pMem;
+	magazine.m_nFrees++;
+	magazine.m_mutex.Unlock();
+}
+
+void CMemoryPoolMT::FlushMagazines()
+{
+	for ( int i = 0; i < MAGAZINE_COUNT; i++ )
+	{
+		Magazine_t &magazine = m_Magazines[i];
+		AUTO_LOCK( magazine.m_mutex );
+		if ( magazine.m_nCount )
+		{
+			DrainMagazine( magazine, magazine.m_nCount );
+		}
+	}
+}
+
+void CMemoryPoolMT::Clear()
+{
+	// Same lock order as Alloc and Free: magazines, then the pool
+	for ( int i = 0; i < MAGAZINE_COUNT; i++ )
+	{
+		m_Magazines[i].m_mutex.Lock();
+		m_Magazines[i].m_nCount = 0;
+	}
+
+	m_mutex.Lock();
+	CUtlMemoryPool::Clear();
+	m_mutex.Unlock();
+
+	for ( int i = MAGAZINE_COUNT - 1; i >= 0; i-- )
+	{
+		m_Magazines[i].m_mutex.Unlock();
+	}
+}
+
+int CMemoryPoolMT::Count()
+{
+	int nCached = 0;
+	for ( int i = 0; i < MAGAZINE_COUNT; i++ )
+	{
+		nCached += m_Magazines[i].m_nCount;
+	}
+	return m_BlocksAllocated - nCached;
+}
+
+//-----------------------------------------------------------------------------
+// The counters are read without locking the magazines, so the numbers can be
+// slightly out of step with each other while the pool is in use
+//-----------------------------------------------------------------------------
+void CMemoryPoolMT::GetStats( Stats_t &stats )
+{
+	stats.m_pszAllocOwner = m_pszAllocOwner;
+	stats.m_nBlockSize = m_BlockSize;
+	stats.m_nCached = 0;
+	stats.m_nAllocs = 0;
+	stats.m_nFrees = 0;
+	stats.m_nContention = m_nPoolContention;
+	for ( int i = 0; i < MAGAZINE_COUNT; i++ )
+	{
+		stats.m_nCached += m_Magazines[i].m_nCount;
+		stats.m_nAllocs += m_Magazines[i].m_nAllocs;
+		stats.m_nFrees += m_Magazines[i].m_nFrees;
+		stats.m_nContention += m_Magazines[i].m_nContention;
+	}
+
+	stats.m_nInUse = m_BlocksAllocated - stats.m_nCached;
+	stats.m_nPeakFromPool = m_PeakAlloc;
+	stats.m_nBlobs = m_NumBlobs;
+	stats.m_nBatches = m_nBatches;
+}
+
+void CMemoryPoolMT::GetAllStats( CUtlVector<Stats_t> &stats )
+{
+	AUTO_LOCK( s_PoolMTListMutex );
+	for ( CMemoryPoolMT *pPool = s_pFirstPoolMT; pPool; pPool = pPool->m_pNextPool )
+	{
+		pPool->GetStats( stats[stats.AddToTail()] );
+	}
+}
@@ -75,6 +75,16 @@
 #if defined( _X360 )
 #include "xbox/xbox_win32stubs.h"
 #endif
+
+// The POSIX builds compile with -msse2; every Windows PC target has it
+#if ( defined( _WIN32 ) && !defined( _X360 ) ) || defined( __SSE2__ )
+#include <emmintrin.h>
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+#define STRTOOLS_SSE2 1
+#endif
+
 #include "tier0/memdbgon.h"
 
 static int FastToLower( char c )
@@ -92,6 +102,248 @@ static int FastToLower( char c )
 	return i;
 }
 
+
+//-----------------------------------------------------------------------------
+// Vectorized scanning. Loads are 16 bytes at a time and may run past the
+// end of a NUL terminated string, so they are only done when they can't
+// cross into the next (possibly unmapped) page.
+//-----------------------------------------------------------------------------
+#ifdef STRTOOLS_SSE2
+
+#define STRTOOLS_LOAD_IS_SAFE( p )	( ( (uintp)(p) & 4095 ) <= 4096 - 16 )
+
+static inline int LowestSetBit( uint32 nMask )
+{
+	Assert( nMask );
+#ifdef _WIN32
+	unsigned long nOut;
+	_BitScanForward( &nOut, nMask );
+	return (int)nOut;
+#else
+	return __builtin_ctz( nMask );
+#endif
+}
+
+// Adds 0x20 to the bytes in 'A'..'Z'
+static inline __m128i FoldASCIICase( __m128i v )
+{
+	__m128i t = _mm_sub_epi8( v, _mm_set1_epi8( 'A' ) );
+	__m128i upper = _mm_cmpeq_epi8( _mm_min_epu8( t, _mm_set1_epi8( 'Z' - 'A' ) ), t );
+	return _mm_or_si128( v, _mm_and_si128( upper, _mm_set1_epi8( 0x20 ) ) );
+}
+
+// ' ', or '\t' through '\r'
+static inline __m128i IsSpace( __m128i v )
+{
+	__m128i t = _mm_sub_epi8( v, _mm_set1_epi8( '\t' ) );
+	__m128i ctrl = _mm_cmpeq_epi8( _mm_min_epu8( t, _mm_set1_epi8( '\r' - '\t' ) ), t );
+	return _mm_or_si128( ctrl, _mm_cmpeq_epi8( v, _mm_set1_epi8( ' ' ) ) );
+}
+
+#endif
+
+static inline bool IsSpaceByte( unsigned char c )
+{
+	return c == ' ' || (unsigned char)( c - '\t' ) <= ( '\r' - '\t' );
+}
+
+static inline unsigned char FoldASCIICaseByte( unsigned char c )
+{
+	return ( (unsigned char)( c - 'A' ) <= ( 'Z' - 'A' ) ) ? ( c | 0x20 ) : c;
+}
+
+int V_StrCaselessMatchLength( const char *pA, const char *pB, int nMax )
+{
+	int n = 0;
+#ifdef STRTOOLS_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	while ( nMax - n >= 16 && STRTOOLS_LOAD_IS_SAFE( pA + n ) && STRTOOLS_LOAD_IS_SAFE( pB + n ) )
+	{
+		__m128i a = _mm_loadu_si128( (const __m128i *)( pA + n ) );
+		__m128i b = _mm_loadu_si128( (const __m128i *)( pB + n ) );
+		uint32 nSame = _mm_movemask_epi8( _mm_cmpeq_epi8( FoldASCIICase( a ), FoldASCIICase( b ) ) );
+		uint32 nEnd = _mm_movemask_epi8( _mm_cmpeq_epi8( a, zero ) );
+		uint32 nStop = ( nSame ^ 0xFFFF ) | nEnd;
+		if ( nStop )
+			return n + LowestSetBit( nStop );
+		n += 16;
+	}
+#endif
+
+	for ( ; n < nMax; ++n )
+	{
+		unsigned char a = pA[n];
+		if ( !a || FoldASCIICaseByte( a ) != FoldASCIICaseByte( pB[n] ) )
+			break;
+	}
+	return n;
+}
+
+// Offset of the first byte of pStr that matches c ignoring ASCII case, or of
+// the NUL. Non-ASCII bytes never fold onto ASCII ones, so for them this
+// agrees with FastToLower.
+static int StrFindCaselessChar( const char *pStr, char c )
+{
+	unsigned char cFolded = FoldASCIICaseByte( c );
+	int n = 0;
+#ifdef STRTOOLS_SSE2
+	if ( cFolded < 0x80 )
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i target = _mm_set1_epi8( cFolded );
+		while ( STRTOOLS_LOAD_IS_SAFE( pStr + n ) )
+		{
+			__m128i v = _mm_loadu_si128( (const __m128i *)( pStr + n ) );
+			uint32 nStop = _mm_movemask_epi8( _mm_or_si128( _mm_cmpeq_epi8( FoldASCIICase( v ), target ), _mm_cmpeq_epi8( v, zero ) ) );
+			if ( nStop )
+				return n + LowestSetBit( nStop );
+			n += 16;
+		}
+	}
+#endif
+
+	for ( ; pStr[n]; ++n )
+	{
+		if ( FastToLower( pStr[n] ) == FastToLower( c ) )
+			break;
+	}
+	return n;
+}
+
+int V_FindFirstOf( const char *pBuf, int nLen, const char *pChars, int nChars, bool bStopAtSpace )
+{
+	Assert( nChars >= 0 && nChars <= 8 );
+
+	int n = 0;
+#ifdef STRTOOLS_SSE2
+	__m128i targets[8];
+	for ( int i = 0; i < nChars; ++i )
+	{
+		targets[i] = _mm_set1_epi8( pChars[i] );
+	}
+
+	// Buffers have a known length, so no page checks are needed
+	for ( ; nLen - n >= 16; n += 16 )
+	{
+		__m128i v = _mm_loadu_si128( (const __m128i *)( pBuf + n ) );
+		__m128i hit = bStopAtSpace ? IsSpace( v ) : _mm_setzero_si128();
+		for ( int i = 0; i < nChars; ++i )
+		{
+			hit = _mm_or_si128( hit, _mm_cmpeq_epi8( v, targets[i] ) );
+		}
+
+		uint32 nHit = _mm_movemask_epi8( hit );
+		if ( nHit )
+			return n + LowestSetBit( nHit );
+	}
+#endif
+
+	for ( ; n < nLen; ++n )
+	{
+		unsigned char c = pBuf[n];
+		if ( bStopAtSpace && IsSpaceByte( c ) )
+			return n;
+
+		for ( int i = 0; i < nChars; ++i )
+		{
+			if ( c == (unsigned char)pChars[i] )
+				return n;
+		}
+	}
+	return nLen;
+}
+
+int V_SkipWhitespace( const char *pBuf, int nLen )
+{
+	int n = 0;
+#ifdef STRTOOLS_SSE2
+	for ( ; nLen - n >= 16; n += 16 )
+	{
+		__m128i v = _mm_loadu_si128( (const __m128i *)( pBuf + n ) );
+		uint32 nSpace = _mm_movemask_epi8( IsSpace( v ) );
+		if ( nSpace != 0xFFFF )
+			return n + LowestSetBit( nSpace ^ 0xFFFF );
+	}
+#endif
+
+	while ( n < nLen && IsSpaceByte( pBuf[n] ) )
+	{
+		++n;
+	}
+	return n;
+}
+
+bool V_IsValidUTF8( const char *pStr, int nLen )
+{
+	const unsigned char *p = (const unsigned char *)pStr;
+	if ( nLen < 0 )
+	{
+		nLen = V_strlen( pStr );
+	}
+
+	int n = 0;
+	while ( n < nLen )
+	{
+#ifdef STRTOOLS_SSE2
+		// Runs of ASCII go 16 bytes at a time
+		while ( nLen - n >= 16 && !_mm_movemask_epi8( _mm_loadu_si128( (const __m128i *)( p + n ) ) ) )
+		{
+			n += 16;
+		}
+		if ( n >= nLen )
+			break;
+#endif
+
+		unsigned char c = p[n];
+		if ( c < 0x80 )
+		{
+			++n;
+			continue;
+		}
+
+		int nExtra;
+		uint32 nCodePoint;
+		if ( ( c & 0xE0 ) == 0xC0 )
+		{
+			nExtra = 1;
+			nCodePoint = c & 0x1F;
+		}
+		else if ( ( c & 0xF0 ) == 0xE0 )
+		{
+			nExtra = 2;
+			nCodePoint = c & 0x0F;
+		}
+		else if ( ( c & 0xF8 ) == 0xF0 )
+		{
+			nExtra = 3;
+			nCodePoint = c & 0x07;
+		}
+		else
+		{
+			return false;
+		}
+
+		if ( nLen - n <= nExtra )
+			return false;
+
+		for ( int i = 1; i <= nExtra; ++i )
+		{
+			unsigned char cont = p[n + i];
+			if ( ( cont & 0xC0 ) != 0x80 )
+				return false;
+			nCodePoint = ( nCodePoint << 6 ) | ( cont & 0x3F );
+		}
+
+		// Overlong forms, UTF-16 surrogates and values past the Unicode range
+		static const uint32 s_nMinCodePoint[4] = { 0, 0x80, 0x800, 0x10000 };
+		if ( nCodePoint < s_nMinCodePoint[nExtra] || ( nCodePoint >= 0xD800 && nCodePoint <= 0xDFFF ) || nCodePoint > 0x10FFFF )
+			return false;
+
+		n += nExtra + 1;
+	}
+	return true;
+}
+
 void _V_memset (const char* file, int line, void *dest, int fill, int count)
 {
 	Assert( count >= 0 );
@@ -267,8 +519,11 @@ int V_stricmp( const char *str1, const char *str2 )
 	{
 		return 0;
 	}
-	const unsigned char *s1 = (const unsigned char*)str1;
-	const unsigned char *s2 = (const unsigned char*)str2;
+
+	// Skip the part that matches; the loop below sorts out the first difference
+	int nSame = V_StrCaselessMatchLength( str1, str2 );
+	const unsigned char *s1 = (const unsigned char*)str1 + nSame;
+	const unsigned char *s2 = (const unsigned char*)str2 + nSame;
 	for ( ; *s1; ++s1, ++s2 )
 	{
 		if ( *s1 != *s2 )
@@ -292,8 +547,10 @@ int V_stricmp( const char *str1, const char *str2 )
 
 int V_strnicmp( const char *str1, const char *str2, int n )
 {
-	const unsigned char *s1 = (const unsigned char*)str1;
-	const unsigned char *s2 = (const unsigned char*)str2;
+	int nSame = ( n > 0 ) ? V_StrCaselessMatchLength( str1, str2, n ) : 0;
+	const unsigned char *s1 = (const unsigned char*)str1 + nSame;
+	const unsigned char *s2 = (const unsigned char*)str2 + nSame;
+	n -= nSame;
 	for ( ; n > 0 && *s1; --n, ++s1, ++s2 )
 	{
 		if ( *s1 != *s2 )
@@ -627,6 +884,11 @@ char const* V_stristr( char const* pStr, char const* pSearch )
 	// Check the entire string
 	while (*pLetter != 0)
 	{
+		// Jump to the next place the first letter could match
+		pLetter += StrFindCaselessChar( pLetter, *pSearch );
+		if ( *pLetter == 0 )
+			break;
+
 		// Skip over non-matches
 		if (FastToLower((unsigned char)*pLetter) == FastToLower((unsigned char)*pSearch))
 		{
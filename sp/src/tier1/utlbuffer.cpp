@@ -19,6 +19,9 @@
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
+
+// How much text the scanning loops look at per step
+#define UTLBUFFER_SCAN_SIZE		256
 			    
 
 //-----------------------------------------------------------------------------
@@ -390,11 +393,21 @@ void CUtlBuffer::EatWhiteSpace()
 {
 	if ( IsText() && IsValid() )
 	{
-		while ( CheckGet( sizeof(char) ) )
+		while ( true )
 		{
-			if ( !isspace( *(const unsigned char*)PeekGet() ) )
+			int nSize;
+			const char *pSpan = PeekGetSpan( UTLBUFFER_SCAN_SIZE, &nSize );
+			if ( !pSpan )
+			{
+				// Ran out; this flags the overflow callers check for
+				CheckGet( sizeof(char) );
+				break;
+			}
+
+			int nSkip = V_SkipWhitespace( pSpan, nSize );
+			m_Get += nSkip;
+			if ( nSkip < nSize )
 				break;
-			m_Get += sizeof(char);
 		}
 	}
 }
@@ -416,10 +429,24 @@ bool CUtlBuffer::EatCPPComment()
 		m_Get += 2;
 
 		// read complete line
-		for ( char c = GetChar(); IsValid(); c = GetChar() )
+		while ( true )
 		{
-			if ( c == '\n' )
+			int nSize;
+			const char *pSpan = PeekGetSpan( UTLBUFFER_SCAN_SIZE, &nSize );
+			if ( !pSpan )
+			{
+				// Comment runs to the end of the buffer
+				CheckGet( sizeof(char) );
 				break;
+			}
+
+			int nLen = V_FindFirstOf( pSpan, nSize, "\n", 1 );
+			if ( nLen < nSize )
+			{
+				m_Get += nLen + 1;
+				break;
+			}
+			m_Get += nSize;
 		}
 		return true;
 	}
@@ -753,9 +780,31 @@ void CUtlBuffer::GetDelimitedString( CUtlCharConversion *pConv, char *pString, i
 	// Pull off the starting delimiter
 	SeekGet( SEEK_CURRENT, pConv->GetDelimiterLength() );
 
+	// Runs without the (single character) delimiter or an escape are copied whole
+	const char pStops[2] = { pConv->GetDelimiter()[0], pConv->GetEscapeChar() };
+	bool bScanRuns = ( pConv->GetDelimiterLength() == 1 );
+
 	int nRead = 0;
 	while ( IsValid() )
 	{
+		int nSize;
+		const char *pSpan = bScanRuns ? PeekGetSpan( UTLBUFFER_SCAN_SIZE, &nSize ) : NULL;
+		if ( pSpan )
+		{
+			int nRun = V_FindFirstOf( pSpan, nSize, pStops, 2 );
+			if ( nRun > 0 )
+			{
+				int nCopy = MIN( nRun, nMaxChars - nRead );
+				if ( nCopy > 0 )
+				{
+					memcpy( pString + nRead, pSpan, nCopy );
+					nRead += nCopy;
+				}
+				m_Get += nRun;
+				continue;
+			}
+		}
+
 		if ( PeekStringMatch( 0, pConv->GetDelimiter(), pConv->GetDelimiterLength() ) )
 		{
 			SeekGet( SEEK_CURRENT, pConv->GetDelimiterLength() );
@@ -865,6 +914,23 @@ const void* CUtlBuffer::PeekGet( int nMaxSize, int nOffset )
 }
 
 
+//-----------------------------------------------------------------------------
+// Peek a run of bytes to scan
+//-----------------------------------------------------------------------------
+const char* CUtlBuffer::PeekGetSpan( int nMaxSize, int *pSize )
+{
+	int nSize = MIN( nMaxSize, TellMaxPut() - TellGet() );
+	if ( nSize <= 0 || !CheckPeekGet( 0, nSize ) )
+	{
+		*pSize = 0;
+		return NULL;
+	}
+
+	*pSize = nSize;
+	return (const char *)&m_Memory[ m_Get - m_nOffset ];
+}
+
+
 //-----------------------------------------------------------------------------
 // Change where I'm reading
 //-----------------------------------------------------------------------------
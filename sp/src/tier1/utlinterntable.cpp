@@ -0,0 +1,442 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Thread safe string interning
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "tier1/utlinterntable.h"
+#include "tier1/strtools.h"
+#include "tier1/utlcommon.h"
+#include "mathlib/mathlib.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#define INTERN_MAX_SHARD_BITS	4
+#define INTERN_MAX_SHARDS		( 1 << INTERN_MAX_SHARD_BITS )
+#define INTERN_MIN_TABLE_SIZE	16
+#define INTERN_MIN_BLOCK_SIZE	256
+#define INTERN_BLOCK_SIZE		8192
+
+// Tables expected to hold fewer strings than this per shard get fewer shards
+#define INTERN_STRINGS_PER_SHARD	256
+
+// Strings longer than this get an allocation of their own
+#define INTERN_MAX_BLOCK_STRING	( INTERN_BLOCK_SIZE / 4 )
+
+struct CUtlInternTable::Shard_t
+{
+	Shard_t() : m_pTable( NULL ), m_nUsed( 0 ), m_pBlock( NULL ), m_nBlockFree( 0 ), m_nBlockSize( INTERN_MIN_BLOCK_SIZE ), m_nAllocated( 0 ) {}
+
+	Table_t * volatile m_pTable;
+	int m_nUsed;
+
+	// Current string block
+	char *m_pBlock;
+	int m_nBlockFree;
+	int m_nBlockSize;		// doubles up to INTERN_BLOCK_SIZE
+
+	// Everything this shard allocated: string blocks, current and retired tables
+	CUtlVector< void * > m_Allocations;
+	int m_nAllocated;
+
+	CThreadFastMutex m_Mutex;
+};
+
+//-----------------------------------------------------------------------------
+// Constructor, destructor
+//-----------------------------------------------------------------------------
+CUtlInternTable::CUtlInternTable( bool bCaseInsensitive, bool bNumbered, int nExpected ) :
+	m_pShards( NULL ), m_ppIdPages( NULL ), m_nExpected( nExpected ), m_bCaseInsensitive( bCaseInsensitive ), m_bNumbered( bNumbered )
+{
+	m_nShardCount = clamp( (int)SmallestPowerOfTwoGreaterOrEqual( MAX( nExpected / INTERN_STRINGS_PER_SHARD, 1 ) ), 1, INTERN_MAX_SHARDS );
+	m_nCount = 0;
+	m_nNextId = 0;
+}
+
+CUtlInternTable::~CUtlInternTable()
+{
+	RemoveAll();
+	delete [] m_pShards;
+}
+
+//-----------------------------------------------------------------------------
+// Hashing
+//-----------------------------------------------------------------------------
+inline unsigned int CUtlInternTable::HashString( const char *pString ) const
+{
+	return m_bCaseInsensitive ? CaselessStringHashFunctor()( pString ) : StringHashFunctor()( pString );
+}
+
+inline bool CUtlInternTable::StringsEqual( const char *pA, const char *pB ) const
+{
+	return m_bCaseInsensitive ? ( V_stricmp( pA, pB ) == 0 ) : ( V_strcmp( pA, pB ) == 0 );
+}
+
+// The top bits pick the shard, the bottom bits the slot within it. NULL
+// until the first insertion creates the shards.
+inline CUtlInternTable::Shard_t *CUtlInternTable::ShardForHash( unsigned int nHash ) const
+{
+	Shard_t *pShards = m_pShards;
+	return pShards ? &pShards[ ( nHash >> ( 32 - INTERN_MAX_SHARD_BITS ) ) & ( m_nShardCount - 1 ) ] : NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Many tables stay small or empty, so the shards are only allocated once
+// something is inserted
+//-----------------------------------------------------------------------------
+CUtlInternTable::Shard_t *CUtlInternTable::CreateShards()
+{
+	Shard_t *pShards = m_pShards;
+	if ( pShards )
+		return pShards;
+
+	pShards = new Shard_t[ m_nShardCount ];
+	if ( !ThreadInterlockedAssignPointerIf( (void * volatile *)&m_pShards, pShards, NULL ) )
+	{
+		// Another thread got there first
+		delete [] pShards;
+	}
+	return m_pShards;
+}
+
+//-----------------------------------------------------------------------------
+// Linear probe. Slots are filled hash first and string last, so once a
+// string pointer is visible its hash is too.
+//-----------------------------------------------------------------------------
+int CUtlInternTable::Probe( const Table_t *pTable, const char *pString, unsigned int nHash, const char **ppFound ) const
+{
+	for ( unsigned int i = nHash & pTable->m_nMask; ; i = ( i + 1 ) & pTable->m_nMask )
+	{
+		const char *pSlot = pTable->m_pStrings[i];
+		if ( !pSlot )
+		{
+			*ppFound = NULL;
+			return i;
+		}
+
+		ThreadMemoryBarrier();
+		if ( pTable->m_pHashes[i] == nHash && StringsEqual( pSlot, pString ) )
+		{
+			*ppFound = pSlot;
+			return i;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Lookup
+//-----------------------------------------------------------------------------
+const char *CUtlInternTable::Find( const char *pString, int *pId ) const
+{
+	if ( pId )
+	{
+		*pId = INVALID_ID;
+	}
+
+	if ( !pString )
+		return NULL;
+
+	return FindHashed( pString, HashString( pString ), pId );
+}
+
+const char *CUtlInternTable::FindHashed( const char *pString, unsigned int nHash, int *pId ) const
+{
+	const Shard_t *pShard = ShardForHash( nHash );
+	if ( !pShard )
+		return NULL;
+
+	const Table_t *pTable = pShard->m_pTable;
+	if ( !pTable )
+		return NULL;
+
+	ThreadMemoryBarrier();
+
+	const char *pFound;
+	Probe( pTable, pString, nHash, &pFound );
+	if ( pFound && pId && m_bNumbered )
+	{
+		*pId = ( (const int *)pFound )[-1];
+	}
+	return pFound;
+}
+
+const char *CUtlInternTable::String( int nId ) const
+{
+	Assert( m_bNumbered );
+	if ( nId < 0 || nId >= m_nNextId || !m_ppIdPages )
+		return NULL;
+
+	const char **pPage = m_ppIdPages[ nId >> ID_PAGE_BITS ];
+	return pPage ? pPage[ nId & ( ID_PAGE_SIZE - 1 ) ] : NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Allocation, all under the shard lock
+//-----------------------------------------------------------------------------
+CUtlInternTable::Table_t *CUtlInternTable::AllocTable( Shard_t &shard, int nSize )
+{
+	int nBytes = sizeof( Table_t ) + nSize * ( sizeof( unsigned int ) + sizeof( const char * ) );
+	Table_t *pTable = (Table_t *)malloc( nBytes );
+	pTable->m_nMask = nSize - 1;
+	pTable->m_pStrings = (const char **)( pTable + 1 );
+	pTable->m_pHashes = (unsigned int *)( pTable->m_pStrings + nSize );
+	memset( (void *)pTable->m_pStrings, 0, nSize * sizeof( const char * ) );
+
+	shard.m_Allocations.AddToTail( pTable );
+	shard.m_nAllocated += nBytes;
+	return pTable;
+}
+
+char *CUtlInternTable::AllocString( Shard_t &shard, int nLen )
+{
+	// Numbered tables keep the id in front of the string
+	int nHeader = m_bNumbered ? sizeof( int ) : 0;
+	int nBytes = AlignValue( nHeader + nLen, sizeof( int ) );
+
+	char *pMemory;
+	if ( nBytes > INTERN_MAX_BLOCK_STRING )
+	{
+		pMemory = (char *)malloc( nBytes );
+		shard.m_Allocations.AddToTail( pMemory );
+		shard.m_nAllocated += nBytes;
+	}
+	else
+	{
+		if ( nBytes > shard.m_nBlockFree )
+		{
+			// Blocks start small and grow with the shard
+			int nBlockSize = MAX( shard.m_nBlockSize, nBytes );
+			shard.m_pBlock = (char *)malloc( nBlockSize );
+			shard.m_nBlockFree = nBlockSize;
+			shard.m_Allocations.AddToTail( shard.m_pBlock );
+			shard.m_nAllocated += nBlockSize;
+			shard.m_nBlockSize = MIN( shard.m_nBlockSize * 2, INTERN_BLOCK_SIZE );
+		}
+
+		pMemory = shard.m_pBlock;
+		shard.m_pBlock += nBytes;
+		shard.m_nBlockFree -= nBytes;
+	}
+
+	return pMemory + nHeader;
+}
+
+void CUtlInternTable::SetId( int nId, const char *pString )
+{
+	if ( !m_ppIdPages )
+	{
+		const char ***ppPages = new const char **[ ID_PAGE_COUNT ];
+		memset( ppPages, 0, ID_PAGE_COUNT * sizeof( const char ** ) );
+		if ( !ThreadInterlockedAssignPointerIf( (void * volatile *)&m_ppIdPages, ppPages, NULL ) )
+		{
+			delete [] ppPages;
+		}
+	}
+
+	const char ** volatile &pPage = m_ppIdPages[ nId >> ID_PAGE_BITS ];
+	if ( !pPage )
+	{
+		const char **pNewPage = new const char *[ ID_PAGE_SIZE ];
+		memset( pNewPage, 0, ID_PAGE_SIZE * sizeof( const char * ) );
+		if ( !ThreadInterlockedAssignPointerIf( (void * volatile *)&pPage, pNewPage, NULL ) )
+		{
+			delete [] pNewPage;
+		}
+	}
+
+	( (int *)pString )[-1] = nId;
+	pPage[ nId & ( ID_PAGE_SIZE - 1 ) ] = pString;
+}
+
+//-----------------------------------------------------------------------------
+// Finds or adds a string
+//-----------------------------------------------------------------------------
+const char *CUtlInternTable::Intern( const char *pString, int *pId )
+{
+	if ( pId )
+	{
+		*pId = INVALID_ID;
+	}
+
+	if ( !pString )
+		return NULL;
+
+	// Most calls are for strings that are already in
+	unsigned int nHash = HashString( pString );
+	const char *pFound = FindHashed( pString, nHash, pId );
+	if ( pFound )
+		return pFound;
+
+	CreateShards();
+	Shard_t &shard = *ShardForHash( nHash );
+
+	AUTO_LOCK( shard.m_Mutex );
+
+	MEM_ALLOC_CREDIT();
+
+	// Another thread may have added it, or grown the table, since we looked
+	Table_t *pTable = shard.m_pTable;
+	int nSlot = -1;
+	if ( pTable )
+	{
+		nSlot = Probe( pTable, pString, nHash, &pFound );
+		if ( pFound )
+		{
+			if ( pId && m_bNumbered )
+			{
+				*pId = ( (const int *)pFound )[-1];
+			}
+			return pFound;
+		}
+	}
+
+	int nId = INVALID_ID;
+	if ( m_bNumbered && m_nNextId >= MAX_IDS )
+	{
+		AssertMsg( false, "CUtlInternTable: too many strings\n" );
+		return NULL;
+	}
+
+	// Keep the load under 1/2
+	if ( !pTable || ( shard.m_nUsed + 1 ) * 2 > (int)( pTable->m_nMask + 1 ) )
+	{
+		int nSize = pTable ? ( pTable->m_nMask + 1 ) * 2 : SmallestPowerOfTwoGreaterOrEqual( MAX( INTERN_MIN_TABLE_SIZE, m_nExpected * 2 / m_nShardCount ) );
+		Table_t *pNewTable = AllocTable( shard, nSize );
+		if ( pTable )
+		{
+			for ( unsigned int i = 0; i <= pTable->m_nMask; i++ )
+			{
+				const char *pOld = pTable->m_pStrings[i];
+				if ( !pOld )
+					continue;
+
+				unsigned int j = pTable->m_pHashes[i] & pNewTable->m_nMask;
+				while ( pNewTable->m_pStrings[j] )
+				{
+					j = ( j + 1 ) & pNewTable->m_nMask;
+				}
+				pNewTable->m_pHashes[j] = pTable->m_pHashes[i];
+				pNewTable->m_pStrings[j] = pOld;
+			}
+		}
+
+		// Publish the filled table; readers still in the old one finish there
+		ThreadMemoryBarrier();
+		shard.m_pTable = pNewTable;
+		pTable = pNewTable;
+
+		nSlot = Probe( pTable, pString, nHash, &pFound );
+		Assert( !pFound );
+	}
+
+	int nLen = V_strlen( pString ) + 1;
+	char *pCopy = AllocString( shard, nLen );
+	memcpy( pCopy, pString, nLen );
+
+	if ( m_bNumbered )
+	{
+		// Ids are handed out across shards, so they need the interlocked bump
+		nId = ++m_nNextId - 1;
+		SetId( nId, pCopy );
+	}
+
+	pTable->m_pHashes[nSlot] = nHash;
+	ThreadMemoryBarrier();
+	pTable->m_pStrings[nSlot] = pCopy;
+	shard.m_nUsed++;
+
+	// Only count the string once its id and slot are visible
+	ThreadMemoryBarrier();
+	++m_nCount;
+
+	if ( pId )
+	{
+		*pId = nId;
+	}
+	return pCopy;
+}
+
+//-----------------------------------------------------------------------------
+// Iteration and diagnostics
+//-----------------------------------------------------------------------------
+void CUtlInternTable::GetStrings( CUtlVector< const char * > &strings ) const
+{
+	if ( !m_pShards )
+		return;
+
+	strings.EnsureCapacity( strings.Count() + m_nCount );
+	for ( int i = 0; i < m_nShardCount; i++ )
+	{
+		const Table_t *pTable = m_pShards[i].m_pTable;
+		if ( !pTable )
+			continue;
+
+		for ( unsigned int j = 0; j <= pTable->m_nMask; j++ )
+		{
+			const char *pString = pTable->m_pStrings[j];
+			if ( pString )
+			{
+				strings.AddToTail( pString );
+			}
+		}
+	}
+}
+
+int CUtlInternTable::GetMemoryUsage() const
+{
+	int nTotal = m_pShards ? m_nShardCount * sizeof( Shard_t ) : 0;
+	if ( m_ppIdPages )
+	{
+		nTotal += ID_PAGE_COUNT * sizeof( const char ** );
+		for ( int i = 0; i < ID_PAGE_COUNT; i++ )
+		{
+			if ( m_ppIdPages[i] )
+			{
+				nTotal += ID_PAGE_SIZE * sizeof( const char * );
+			}
+		}
+	}
+
+	for ( int i = 0; m_pShards && i < m_nShardCount; i++ )
+	{
+		nTotal += m_pShards[i].m_nAllocated;
+	}
+	return nTotal;
+}
+
+//-----------------------------------------------------------------------------
+// Frees everything
+//-----------------------------------------------------------------------------
+void CUtlInternTable::RemoveAll()
+{
+	for ( int i = 0; m_pShards && i < m_nShardCount; i++ )
+	{
+		Shard_t &shard = m_pShards[i];
+		for ( int j = 0; j < shard.m_Allocations.Count(); j++ )
+		{
+			free( shard.m_Allocations[j] );
+		}
+		shard.m_Allocations.Purge();
+		shard.m_pTable = NULL;
+		shard.m_nUsed = 0;
+		shard.m_pBlock = NULL;
+		shard.m_nBlockFree = 0;
+		shard.m_nBlockSize = INTERN_MIN_BLOCK_SIZE;
+		shard.m_nAllocated = 0;
+	}
+
+	if ( m_ppIdPages )
+	{
+		for ( int i = 0; i < ID_PAGE_COUNT; i++ )
+		{
+			delete [] m_ppIdPages[i];
+		}
+		delete [] m_ppIdPages;
+		m_ppIdPages = NULL;
+	}
+
+	m_nCount = 0;
+	m_nNextId = 0;
+}
@@ -0,0 +1,262 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: File backed read-only buffers: CUtlMappedBuffer and
+//			CUtlStreamReadBuffer. See utlbuffer.h.
+//
+// $NoKeywords: $
+//===========================================================================//
+
+#if defined( _WIN32 ) && !defined( _X360 )
+#include <windows.h>
+#elif defined( POSIX )
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <limits.h>
+#include "utlbuffer.h"
+#include "filesystem.h"
+#include "tier0/dbg.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+//-----------------------------------------------------------------------------
+// Platform mapping
+//-----------------------------------------------------------------------------
+void *CUtlMappedBuffer::MapFileView( const char *pFullPath, int *pSize, bool bCopyOnWrite )
+{
+	void *pView = NULL;
+	*pSize = 0;
+
+#if defined( _WIN32 ) && !defined( _X360 )
+	HANDLE hFile = CreateFileA( pFullPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( hFile == INVALID_HANDLE_VALUE )
+		return NULL;
+
+	DWORD nSizeHigh = 0;
+	DWORD nSize = GetFileSize( hFile, &nSizeHigh );
+	if ( nSize != INVALID_FILE_SIZE && nSize > 0 && nSize <= INT_MAX && nSizeHigh == 0 )
+	{
+		HANDLE hMapping = CreateFileMappingA( hFile, NULL, bCopyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL );
+		if ( hMapping )
+		{
+			// The view keeps the mapping alive once the handles are closed
+			pView = MapViewOfFile( hMapping, bCopyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0 );
+			if ( pView )
+			{
+				*pSize = (int)nSize;
+			}
+			CloseHandle( hMapping );
+		}
+	}
+	CloseHandle( hFile );
+#elif defined( POSIX )
+	int fd = open( pFullPath, O_RDONLY );
+	if ( fd < 0 )
+		return NULL;
+
+	struct stat st;
+	if ( fstat( fd, &st ) == 0 && st.st_size > 0 && st.st_size <= INT_MAX )
+	{
+		pView = mmap( NULL, st.st_size, bCopyOnWrite ? ( PROT_READ | PROT_WRITE ) : PROT_READ, MAP_PRIVATE, fd, 0 );
+		if ( pView == MAP_FAILED )
+		{
+			pView = NULL;
+		}
+		else
+		{
+			*pSize = (int)st.st_size;
+		}
+	}
+	close( fd );
+#endif
+
+	return pView;
+}
+
+void CUtlMappedBuffer::UnmapFileView( void *pView, int nSize )
+{
+	if ( !pView )
+		return;
+
+#if defined( _WIN32 ) && !defined( _X360 )
+	UnmapViewOfFile( pView );
+#elif defined( POSIX )
+	munmap( pView, nSize );
+#endif
+}
+
+
+//-----------------------------------------------------------------------------
+// CUtlMappedBuffer
+//-----------------------------------------------------------------------------
+CUtlMappedBuffer::CUtlMappedBuffer() : CUtlBuffer( 0, 0, READ_ONLY ), m_pMappedView( NULL ), m_nMappedSize( 0 )
+{
+}
+
+CUtlMappedBuffer::~CUtlMappedBuffer()
+{
+	Close();
+}
+
+bool CUtlMappedBuffer::MapFile( const char *pFullPath, int nFlags, bool bCopyOnWrite )
+{
+	Close();
+
+	int nSize;
+	void *pView = MapFileView( pFullPath, &nSize, bCopyOnWrite );
+	if ( !pView )
+		return false;
+
+	m_pMappedView = pView;
+	m_nMappedSize = nSize;
+	SetExternalBuffer( pView, nSize, nSize, nFlags | READ_ONLY );
+	return true;
+}
+
+bool CUtlMappedBuffer::Open( IFileSystem *pFileSystem, const char *pFileName, const char *pPathID, int nFlags )
+{
+	Close();
+
+	char szFullPath[MAX_PATH];
+	if ( pFileSystem->RelativePathToFullPath( pFileName, pPathID, szFullPath, sizeof( szFullPath ), FILTER_CULLPACK ) && MapFile( szFullPath, nFlags ) )
+		return true;
+
+	// Packed, empty or otherwise unmappable; read it instead
+	CUtlBuffer buf( 0, 0, nFlags & ~READ_ONLY );
+	if ( !pFileSystem->ReadFile( pFileName, pPathID, buf ) )
+		return false;
+
+	Swap( buf );
+	m_Flags = nFlags | READ_ONLY;
+	return true;
+}
+
+void CUtlMappedBuffer::Close()
+{
+	// Detach from the view (or free the fallback copy) before unmapping
+	CUtlMemory<unsigned char> empty;
+	m_Memory.Swap( empty );
+	Purge();
+
+	UnmapFileView( m_pMappedView, m_nMappedSize );
+	m_pMappedView = NULL;
+	m_nMappedSize = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// CUtlStreamReadBuffer
+//
+// The window holds file bytes [m_nOffset, m_nOffset + NumAllocated()), cut
+// short at the end of the file; that is the range CheckGet assumes is loaded.
+//-----------------------------------------------------------------------------
+CUtlStreamReadBuffer::CUtlStreamReadBuffer( int nWindowSize ) : CUtlBuffer( 0, 0, READ_ONLY ),
+	m_pFileSystem( NULL ), m_hFile( FILESYSTEM_INVALID_HANDLE ), m_nWindowSize( MAX( nWindowSize, 1024 ) ), m_nFilePos( 0 )
+{
+	SetOverflowFuncs( static_cast< UtlBufferOverflowFunc_t >( &CUtlStreamReadBuffer::StreamGetOverflow ), &CUtlStreamReadBuffer::PutOverflow );
+}
+
+CUtlStreamReadBuffer::~CUtlStreamReadBuffer()
+{
+	Close();
+}
+
+bool CUtlStreamReadBuffer::Open( IBaseFileSystem *pFileSystem, const char *pFileName, const char *pPathID, int nFlags )
+{
+	Close();
+
+	FileHandle_t hFile = pFileSystem->Open( pFileName, "rb", pPathID );
+	if ( hFile == FILESYSTEM_INVALID_HANDLE )
+		return false;
+
+	unsigned int nFileSize = pFileSystem->Size( hFile );
+	if ( nFileSize > INT_MAX )
+	{
+		pFileSystem->Close( hFile );
+		return false;
+	}
+
+	m_pFileSystem = pFileSystem;
+	m_hFile = hFile;
+	m_nFilePos = 0;
+
+	m_Flags = nFlags | READ_ONLY;
+	m_Error = 0;
+	m_Get = 0;
+	m_Put = m_nMaxPut = (int)nFileSize;
+
+	// Start from an empty window past the end, then load the first one
+	m_nOffset = m_nMaxPut;
+	m_Memory.EnsureCapacity( m_nWindowSize );
+	if ( !StreamGetOverflow( 0 ) )
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void CUtlStreamReadBuffer::Close()
+{
+	if ( m_hFile != FILESYSTEM_INVALID_HANDLE )
+	{
+		m_pFileSystem->Close( m_hFile );
+		m_hFile = FILESYSTEM_INVALID_HANDLE;
+	}
+	m_pFileSystem = NULL;
+	Purge();
+}
+
+//-----------------------------------------------------------------------------
+// Moves the window to start at the get position, holding at least nSize
+// bytes. SeekGet passes -1 when the get leaves the window.
+//-----------------------------------------------------------------------------
+bool CUtlStreamReadBuffer::StreamGetOverflow( int nSize )
+{
+	if ( m_hFile == FILESYSTEM_INVALID_HANDLE )
+		return false;
+
+	nSize = MAX( nSize, 0 );
+
+	// Bytes of the old window that are still ahead of the get can be kept
+	int nKeep = 0;
+	int nValid = MIN( m_Memory.NumAllocated(), m_nMaxPut - m_nOffset );
+	if ( m_Get >= m_nOffset && m_Get < m_nOffset + nValid )
+	{
+		nKeep = m_nOffset + nValid - m_Get;
+		memmove( m_Memory.Base(), m_Memory.Base() + ( m_Get - m_nOffset ), nKeep );
+	}
+	m_nOffset = m_Get;
+
+	if ( m_Memory.NumAllocated() < nSize )
+	{
+		m_Memory.Grow( nSize - m_Memory.NumAllocated() );
+	}
+
+	int nRead = MIN( m_Memory.NumAllocated(), m_nMaxPut - m_Get ) - nKeep;
+	if ( nRead <= 0 )
+		return true;
+
+	int nFilePos = m_Get + nKeep;
+	if ( m_nFilePos != nFilePos )
+	{
+		m_pFileSystem->Seek( m_hFile, nFilePos, FILESYSTEM_SEEK_HEAD );
+		m_nFilePos = nFilePos;
+	}
+
+	int nBytesRead = m_pFileSystem->Read( m_Memory.Base() + nKeep, nRead, m_hFile );
+	m_nFilePos += MAX( nBytesRead, 0 );
+	if ( nBytesRead != nRead )
+	{
+		// The file got shorter under us; end it where the data did
+		m_nMaxPut = m_Put = m_nFilePos;
+		return m_Get + nSize <= m_nMaxPut;
+	}
+
+	return true;
+}
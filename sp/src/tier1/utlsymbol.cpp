@@ -288,6 +288,42 @@ void CUtlSymbolTable::RemoveAll()
 }
 
 
+//-----------------------------------------------------------------------------
+// CUtlInternSymbolTable. Symbols are the intern table's ids, which only
+// reach UTL_INVAL_SYMBOL after 65535 strings.
+//-----------------------------------------------------------------------------
+
+CUtlSymbol CUtlInternSymbolTable::AddString( const char* pString )
+{
+	int nId;
+	if ( !m_Strings.Intern( pString, &nId ) || nId >= UTL_INVAL_SYMBOL )
+	{
+		AssertMsg( !pString, "CUtlInternSymbolTable: more than 65535 symbols\n" );
+		return CUtlSymbol( UTL_INVAL_SYMBOL );
+	}
+
+	return CUtlSymbol( (UtlSymId_t)nId );
+}
+
+CUtlSymbol CUtlInternSymbolTable::Find( const char* pString ) const
+{
+	int nId;
+	if ( !m_Strings.Find( pString, &nId ) || nId >= UTL_INVAL_SYMBOL )
+		return CUtlSymbol( UTL_INVAL_SYMBOL );
+
+	return CUtlSymbol( (UtlSymId_t)nId );
+}
+
+const char* CUtlInternSymbolTable::String( CUtlSymbol id ) const
+{
+	if ( !id.IsValid() )
+		return "";
+
+	const char *pString = m_Strings.String( (UtlSymId_t)id );
+	return pString ? pString : "";
+}
+
+
 
 class CUtlFilenameSymbolTable::HashTable : public CUtlStableHashtable<CUtlConstString>
 {
@@ -703,6 +703,10 @@ template< class T > static void AddLump( int lumpnum, CUtlVector<T> &data, int v
 dheader_t		*g_pBSPHeader;
 FileHandle_t	g_hBSPFile;
 
+// .bsp files on disk are mapped rather than read, so their lumps are copied
+// out of the page cache instead of out of a heap copy of the whole file
+static CUtlMappedBuffer s_BSPFileMapping;
+
 struct Lump_t
 {
 	void	*pLumps[HEADER_LUMPS];
@@ -2117,6 +2121,34 @@ void ValidateHeader( const char *filename, const dheader_t *pHeader )
 	}
 }
 
+//-----------------------------------------------------------------------------
+//	Points g_pBSPHeader at the whole file. The mapping is copy-on-write since
+//	the header may be byte swapped in place.
+//-----------------------------------------------------------------------------
+static void LoadBSPHeader( const char *filename )
+{
+	if ( V_IsAbsolutePath( filename ) && s_BSPFileMapping.MapFile( filename, 0, true ) )
+	{
+		g_pBSPHeader = (dheader_t *)s_BSPFileMapping.Base();
+		return;
+	}
+
+	LoadFile( filename, (void **)&g_pBSPHeader );
+}
+
+static void FreeBSPHeader()
+{
+	if ( s_BSPFileMapping.IsMapped() )
+	{
+		s_BSPFileMapping.Close();
+	}
+	else
+	{
+		free( g_pBSPHeader );
+	}
+	g_pBSPHeader = NULL;
+}
+
 //-----------------------------------------------------------------------------
 //	Low level BSP opener for external parsing. Parses headers, but nothing else.
 //	You must close the BSP, via CloseBSPFile().
@@ -2126,7 +2158,7 @@ void OpenBSPFile( const char *filename )
 	Lumps_Init();
 
 	// load the file header
-	LoadFile( filename, (void **)&g_pBSPHeader );
+	LoadBSPHeader( filename );
 
 	if ( g_bSwapOnLoad )
 	{
@@ -2144,8 +2176,7 @@ void OpenBSPFile( const char *filename )
 //-----------------------------------------------------------------------------
 void CloseBSPFile( void )
 {
-	free( g_pBSPHeader );
-	g_pBSPHeader = NULL;
+	FreeBSPHeader();
 }
 
 //-----------------------------------------------------------------------------
@@ -2386,7 +2417,7 @@ void LoadBSPFile_FileSystemOnly( const char *filename )
 	//
 	// load the file header
 	//
-	LoadFile( filename, (void **)&g_pBSPHeader );
+	LoadBSPHeader( filename );
 
 	ValidateHeader( filename, g_pBSPHeader );
 
@@ -2405,8 +2436,7 @@ void LoadBSPFile_FileSystemOnly( const char *filename )
 	free( pakbuffer );
 
 	// everything has been copied out
-	free( g_pBSPHeader );
-	g_pBSPHeader = NULL;
+	FreeBSPHeader();
 }
 
 void ExtractZipFileFromBSP( char *pBSPFileName, char *pZipFileName )